@@ -195,16 +195,17 @@ void FormatValue<double>::formatHelper(
       } else if (arg.precision > DoubleToStringConverter::kMaxPrecisionDigits) {
         arg.precision = DoubleToStringConverter::kMaxPrecisionDigits;
       }
-      DoubleToStringConverter conv(
-          flags,
-          infinitySymbol,
-          nanSymbol,
-          exponentSymbol,
-          -4,
-          arg.precision,
-          0,
-          0);
-      arg.enforce(conv.ToShortest(val, &builder));
+      ShortestDoubleFormat format;
+      format.flags = flags;
+      format.infinitySymbol = infinitySymbol;
+      format.nanSymbol = nanSymbol;
+      format.exponentCharacter = exponentSymbol;
+      format.decimalInShortestLow = -4;
+      format.decimalInShortestHigh = arg.precision;
+      char shortest[bufLen];
+      assert(format.maxLength() <= sizeof(shortest));
+      builder.AddSubstring(
+          shortest, int(formatShortestDouble(val, shortest, format)));
       break;
     }
     default:
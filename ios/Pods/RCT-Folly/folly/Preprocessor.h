@@ -112,6 +112,23 @@
 
 #define FOLLY_PP_DETAIL_NARGS_1( \
     dummy,                       \
+    _32,                         \
+    _31,                         \
+    _30,                         \
+    _29,                         \
+    _28,                         \
+    _27,                         \
+    _26,                         \
+    _25,                         \
+    _24,                         \
+    _23,                         \
+    _22,                         \
+    _21,                         \
+    _20,                         \
+    _19,                         \
+    _18,                         \
+    _17,                         \
+    _16,                         \
     _15,                         \
     _14,                         \
     _13,                         \
@@ -134,6 +151,23 @@
   FOLLY_PP_DETAIL_NARGS_1(         \
       dummy,                       \
       ##__VA_ARGS__,               \
+      32,                          \
+      31,                          \
+      30,                          \
+      29,                          \
+      28,                          \
+      27,                          \
+      26,                          \
+      25,                          \
+      24,                          \
+      23,                          \
+      22,                          \
+      21,                          \
+      20,                          \
+      19,                          \
+      18,                          \
+      17,                          \
+      16,                          \
       15,                          \
       14,                          \
       13,                          \
@@ -182,6 +216,40 @@
   fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_13(fn, __VA_ARGS__)
 #define FOLLY_PP_DETAIL_FOR_EACH_REC_15(fn, a, ...) \
   fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_14(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_16(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_15(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_17(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_16(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_18(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_17(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_19(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_18(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_20(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_19(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_21(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_20(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_22(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_21(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_23(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_22(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_24(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_23(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_25(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_24(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_26(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_25(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_27(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_26(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_28(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_27(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_29(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_28(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_30(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_29(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_31(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_30(fn, __VA_ARGS__)
+#define FOLLY_PP_DETAIL_FOR_EACH_REC_32(fn, a, ...) \
+  fn(a) FOLLY_PP_DETAIL_FOR_EACH_REC_31(fn, __VA_ARGS__)
 
 #define FOLLY_PP_DETAIL_FOR_EACH_2(fn, n, ...) \
   FOLLY_PP_DETAIL_FOR_EACH_REC_##n(fn, __VA_ARGS__)
@@ -194,7 +262,7 @@
  *  Used to invoke a preprocessor macro, the name of which is passed as the
  *  first argument, once for each subsequent variadic argument.
  *
- *  At present, supports [0, 16) arguments.
+ *  At present, supports [0, 33) arguments.
  *
  *  This input:
  *
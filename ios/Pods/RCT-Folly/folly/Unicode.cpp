@@ -16,9 +16,20 @@
 
 #include <folly/Unicode.h>
 
+#include <cstring>
 #include <initializer_list>
 
 #include <folly/Conv.h>
+#include <folly/Portability.h>
+#include <folly/lang/Bits.h>
+
+#if FOLLY_X64
+#include <immintrin.h>
+#endif
+
+#if FOLLY_AARCH64
+#include <arm_neon.h>
+#endif
 
 namespace folly {
 
@@ -198,4 +209,580 @@ char32_t utf8ToCodePoint(
   throw std::runtime_error("folly::utf8ToCodePoint encoding length maxed out");
 }
 
+namespace {
+
+// Decodes the code point at p into cp, with the same checks as
+// utf8ToCodePoint. Returns false, leaving p alone, if it is invalid.
+FOLLY_ALWAYS_INLINE bool decodeUtf8(
+    const unsigned char*& p, const unsigned char* e, char32_t& cp) {
+  const unsigned char b0 = p[0];
+  if (b0 < 0x80) {
+    cp = b0;
+    p += 1;
+    return true;
+  }
+  auto cont = [&](size_t i) { return (p[i] & 0xc0) == 0x80; };
+  if (b0 < 0xc2) {
+    // continuation byte, or the overlong 0xc0 and 0xc1
+    return false;
+  }
+  if (b0 < 0xe0) {
+    if (e - p < 2 || !cont(1)) {
+      return false;
+    }
+    cp = (char32_t(b0 & 0x1f) << 6) | (p[1] & 0x3f);
+    p += 2;
+    return true;
+  }
+  if (b0 < 0xf0) {
+    if (e - p < 3 || !cont(1) || !cont(2)) {
+      return false;
+    }
+    cp = (char32_t(b0 & 0x0f) << 12) | (char32_t(p[1] & 0x3f) << 6) |
+        (p[2] & 0x3f);
+    if (cp < 0x800 || (cp >= 0xd800 && cp < 0xe000)) {
+      return false;
+    }
+    p += 3;
+    return true;
+  }
+  if (b0 < 0xf5) {
+    if (e - p < 4 || !cont(1) || !cont(2) || !cont(3)) {
+      return false;
+    }
+    cp = (char32_t(b0 & 0x07) << 18) | (char32_t(p[1] & 0x3f) << 12) |
+        (char32_t(p[2] & 0x3f) << 6) | (p[3] & 0x3f);
+    if (cp < 0x10000 || cp > 0x10ffff) {
+      return false;
+    }
+    p += 4;
+    return true;
+  }
+  return false;
+}
+
+FOLLY_ALWAYS_INLINE bool isAsciiWord(const unsigned char* p) {
+  uint64_t w;
+  std::memcpy(&w, p, sizeof(w));
+  return !(w & 0x8080808080808080ULL);
+}
+
+bool utf8ValidateScalar(const unsigned char* p, const unsigned char* e) {
+  char32_t cp;
+  while (p < e) {
+    if (e - p >= 8 && isAsciiWord(p)) {
+      p += 8;
+    } else if (!decodeUtf8(p, e, cp)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+FOLLY_NOINLINE void throwInvalidUtf8(const unsigned char* p) {
+  throw_exception<unicode_error>(
+      to<std::string>("folly::utf8ToUtf16 invalid byte ", uint32_t(*p)));
+}
+
+// Writes cp, a valid code point, as one or two code units.
+FOLLY_ALWAYS_INLINE char16_t* appendUtf16(char32_t cp, char16_t* out) {
+  if (cp < 0x10000) {
+    *out++ = char16_t(cp);
+  } else {
+    *out++ = char16_t(0xd800 + ((cp - 0x10000) >> 10));
+    *out++ = char16_t(0xdc00 + ((cp - 0x10000) & 0x3ff));
+  }
+  return out;
+}
+
+// Transcodes [p, e) up to `stop`, or to the end of the code point that
+// straddles it.
+FOLLY_ALWAYS_INLINE char16_t* utf8ToUtf16Scalar(
+    const unsigned char*& p,
+    const unsigned char* stop,
+    const unsigned char* e,
+    char16_t* out) {
+  char32_t cp;
+  while (p < stop) {
+    if (*p < 0x80) {
+      *out++ = *p++;
+    } else if (decodeUtf8(p, e, cp)) {
+      out = appendUtf16(cp, out);
+    } else {
+      throwInvalidUtf8(p);
+    }
+  }
+  return out;
+}
+
+// Transcodes [p, e) up to `stop`, or past the surrogate pair that
+// straddles it.
+FOLLY_ALWAYS_INLINE char* utf16ToUtf8Scalar(
+    const char16_t*& p, const char16_t* stop, const char16_t* e, char* out) {
+  while (p < stop) {
+    char32_t c = *p;
+    if (c < 0x80) {
+      *out++ = char(c);
+      p += 1;
+      continue;
+    }
+    if (c < 0x800) {
+      *out++ = char(0xc0 | (c >> 6));
+      *out++ = char(0x80 | (c & 0x3f));
+      p += 1;
+      continue;
+    }
+    if (utf16_code_unit_is_bmp(char16_t(c))) {
+      *out++ = char(0xe0 | (c >> 12));
+      *out++ = char(0x80 | ((c >> 6) & 0x3f));
+      *out++ = char(0x80 | (c & 0x3f));
+      p += 1;
+      continue;
+    }
+    if (e - p < 2 || !utf16_code_unit_is_high_surrogate(char16_t(c)) ||
+        !utf16_code_unit_is_low_surrogate(p[1])) {
+      throw_exception<unicode_error>(
+          to<std::string>("folly::utf16ToUtf8 unpaired surrogate ", c));
+    }
+    c = unicode_code_point_from_utf16_surrogate_pair(char16_t(c), p[1]);
+    *out++ = char(0xf0 | (c >> 18));
+    *out++ = char(0x80 | ((c >> 12) & 0x3f));
+    *out++ = char(0x80 | ((c >> 6) & 0x3f));
+    *out++ = char(0x80 | (c & 0x3f));
+    p += 2;
+  }
+  return out;
+}
+
+#if FOLLY_SSE_PREREQ(2, 0) && FOLLY_X64
+
+// 16 bytes at a time; all of these only need SSE2.
+struct Utf8Ascii {
+  static constexpr size_t kSize = 16;
+
+  // Widens 16 ascii bytes to code units if they are all ascii.
+  FOLLY_ALWAYS_INLINE static bool widen(
+      const unsigned char* p, char16_t* out) {
+    __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    if (_mm_movemask_epi8(r)) {
+      return false;
+    }
+    __m128i z = _mm_setzero_si128();
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(r, z));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(out + 8), _mm_unpackhi_epi8(r, z));
+    return true;
+  }
+
+  // Narrows 16 code units to bytes if they are all ascii.
+  FOLLY_ALWAYS_INLINE static bool narrow(const char16_t* p, char* out) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8));
+    __m128i high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16(-0x80));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) !=
+        0xffff) {
+      return false;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(a, b));
+    return true;
+  }
+
+  // Bytes that are not continuation bytes, i.e. > 0xbf as signed chars.
+  FOLLY_ALWAYS_INLINE static size_t countLeads(const unsigned char* p) {
+    __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return size_t(popcount(uint32_t(
+        _mm_movemask_epi8(_mm_cmpgt_epi8(r, _mm_set1_epi8(-65))))));
+  }
+};
+
+#elif FOLLY_AARCH64
+
+struct Utf8Ascii {
+  static constexpr size_t kSize = 16;
+
+  FOLLY_ALWAYS_INLINE static bool widen(
+      const unsigned char* p, char16_t* out) {
+    uint8x16_t r = vld1q_u8(p);
+    if (vmaxvq_u8(r) >= 0x80) {
+      return false;
+    }
+    auto o = reinterpret_cast<uint16_t*>(out);
+    vst1q_u16(o, vmovl_u8(vget_low_u8(r)));
+    vst1q_u16(o + 8, vmovl_high_u8(r));
+    return true;
+  }
+
+  FOLLY_ALWAYS_INLINE static bool narrow(const char16_t* p, char* out) {
+    auto i = reinterpret_cast<const uint16_t*>(p);
+    uint16x8_t a = vld1q_u16(i);
+    uint16x8_t b = vld1q_u16(i + 8);
+    if (vmaxvq_u16(vorrq_u16(a, b)) >= 0x80) {
+      return false;
+    }
+    vst1q_u8(
+        reinterpret_cast<uint8_t*>(out),
+        vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+    return true;
+  }
+
+  FOLLY_ALWAYS_INLINE static size_t countLeads(const unsigned char* p) {
+    uint8x16_t leads =
+        vcgtq_s8(vreinterpretq_s8_u8(vld1q_u8(p)), vdupq_n_s8(-65));
+    return vaddvq_u8(vandq_u8(leads, vdupq_n_u8(1)));
+  }
+};
+
+#else
+
+struct Utf8Ascii {
+  static constexpr size_t kSize = 8;
+
+  FOLLY_ALWAYS_INLINE static bool widen(
+      const unsigned char* p, char16_t* out) {
+    if (!isAsciiWord(p)) {
+      return false;
+    }
+    for (size_t i = 0; i < kSize; ++i) {
+      out[i] = p[i];
+    }
+    return true;
+  }
+
+  FOLLY_ALWAYS_INLINE static bool narrow(const char16_t* p, char* out) {
+    char16_t all = 0;
+    for (size_t i = 0; i < kSize; ++i) {
+      all |= p[i];
+    }
+    if (all >= 0x80) {
+      return false;
+    }
+    for (size_t i = 0; i < kSize; ++i) {
+      out[i] = char(p[i]);
+    }
+    return true;
+  }
+
+  FOLLY_ALWAYS_INLINE static size_t countLeads(const unsigned char* p) {
+    size_t n = 0;
+    for (size_t i = 0; i < kSize; ++i) {
+      n += (p[i] & 0xc0) != 0x80;
+    }
+    return n;
+  }
+};
+
+#endif
+
+// The lookup-table validator: every byte is classified by a 16-entry table
+// lookup on each nibble of its predecessor and on its own high nibble, and
+// the three results are and'ed. What is left is a bit per kind of error,
+// except for the continuation bytes of 3 and 4 byte sequences, which are
+// checked by looking 2 and 3 bytes back.
+//
+// clang-format off
+constexpr uint8_t kTooShort = 1 << 0; // lead not followed by continuation
+constexpr uint8_t kTooLong = 1 << 1; // ascii followed by continuation
+constexpr uint8_t kOverlong3 = 1 << 2;
+constexpr uint8_t kTooLarge = 1 << 3;
+constexpr uint8_t kSurrogate = 1 << 4;
+constexpr uint8_t kOverlong2 = 1 << 5;
+constexpr uint8_t kTooLarge1000 = 1 << 6;
+constexpr uint8_t kOverlong4 = 1 << 6;
+constexpr uint8_t kTwoConts = 1 << 7;
+constexpr uint8_t kCarry = kTooShort | kTooLong | kTwoConts;
+
+// by the high nibble of the previous byte
+alignas(16) constexpr uint8_t kByte1High[16] = {
+  // 0_______ ascii
+  kTooLong, kTooLong, kTooLong, kTooLong,
+  kTooLong, kTooLong, kTooLong, kTooLong,
+  // 10______ continuation
+  kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+  // 1100____ two byte lead
+  kTooShort | kOverlong2,
+  // 1101____ two byte lead
+  kTooShort,
+  // 1110____ three byte lead
+  kTooShort | kOverlong3 | kSurrogate,
+  // 1111____ four+ byte lead
+  kTooShort | kTooLarge | kTooLarge1000 | kOverlong4,
+};
+
+// by the low nibble of the previous byte
+alignas(16) constexpr uint8_t kByte1Low[16] = {
+  // ____0000
+  kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+  // ____0001
+  kCarry | kOverlong2,
+  // ____001_
+  kCarry,
+  kCarry,
+  // ____0100
+  kCarry | kTooLarge,
+  // ____0101
+  kCarry | kTooLarge | kTooLarge1000,
+  // ____011_
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+  // ____1___
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+  // ____1101
+  kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+  kCarry | kTooLarge | kTooLarge1000,
+  kCarry | kTooLarge | kTooLarge1000,
+};
+
+// by the high nibble of the byte itself
+alignas(16) constexpr uint8_t kByte2High[16] = {
+  // 0_______ ascii
+  kTooShort, kTooShort, kTooShort, kTooShort,
+  kTooShort, kTooShort, kTooShort, kTooShort,
+  // 1000____
+  kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4,
+  // 1001____
+  kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge,
+  // 101_____
+  kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+  kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+  // 11______ lead
+  kTooShort, kTooShort, kTooShort, kTooShort,
+};
+// clang-format on
+
+template <class Simd>
+struct Utf8Checker {
+  using reg_t = typename Simd::reg_t;
+
+  reg_t error = Simd::zero();
+  reg_t prevInput = Simd::zero();
+  reg_t prevIncomplete = Simd::zero();
+
+  FOLLY_ALWAYS_INLINE void push(reg_t in) {
+    if (Simd::isAscii(in)) {
+      error = Simd::or_(error, prevIncomplete);
+      prevIncomplete = Simd::zero();
+      prevInput = in;
+      return;
+    }
+    reg_t prev1 = Simd::template prev<1>(in, prevInput);
+    reg_t special = Simd::and_(
+        Simd::and_(
+            Simd::lookup(kByte1High, Simd::shr4(prev1)),
+            Simd::lookup(kByte1Low, Simd::low4(prev1))),
+        Simd::lookup(kByte2High, Simd::shr4(in)));
+    // Only bytes >= 0xe0 (0xf0) have their msb set after the subtraction:
+    // they are the leads that must be followed by 2 (3) continuations.
+    reg_t third =
+        Simd::subs(Simd::template prev<2>(in, prevInput), Simd::splat(0x60));
+    reg_t fourth =
+        Simd::subs(Simd::template prev<3>(in, prevInput), Simd::splat(0x70));
+    reg_t must23 = Simd::and_(Simd::or_(third, fourth), Simd::splat(0x80));
+    error = Simd::or_(error, Simd::xor_(must23, special));
+    prevIncomplete = Simd::subs(in, Simd::incompleteMax());
+    prevInput = in;
+  }
+
+  FOLLY_ALWAYS_INLINE bool finish() {
+    return !Simd::any(Simd::or_(error, prevIncomplete));
+  }
+};
+
+#if FOLLY_X64 && defined(__AVX2__)
+
+struct Utf8Simd {
+  using reg_t = __m256i;
+  static constexpr size_t kSize = 32;
+
+  static reg_t load(const unsigned char* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const reg_t*>(p));
+  }
+  static reg_t zero() { return _mm256_setzero_si256(); }
+  static reg_t splat(uint8_t c) { return _mm256_set1_epi8(char(c)); }
+  static reg_t and_(reg_t a, reg_t b) { return _mm256_and_si256(a, b); }
+  static reg_t or_(reg_t a, reg_t b) { return _mm256_or_si256(a, b); }
+  static reg_t xor_(reg_t a, reg_t b) { return _mm256_xor_si256(a, b); }
+  static reg_t subs(reg_t a, reg_t b) { return _mm256_subs_epu8(a, b); }
+  static reg_t low4(reg_t r) { return and_(r, splat(0x0f)); }
+  static reg_t shr4(reg_t r) { return low4(_mm256_srli_epi16(r, 4)); }
+  static reg_t lookup(const uint8_t (&table)[16], reg_t index) {
+    return _mm256_shuffle_epi8(
+        _mm256_broadcastsi128_si256(
+            _mm_load_si128(reinterpret_cast<const __m128i*>(table))),
+        index);
+  }
+  template <int N>
+  static reg_t prev(reg_t in, reg_t prevIn) {
+    return _mm256_alignr_epi8(
+        in, _mm256_permute2x128_si256(prevIn, in, 0x21), 16 - N);
+  }
+  static reg_t incompleteMax() {
+    return _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        char(0xf0 - 1), char(0xe0 - 1), char(0xc0 - 1));
+  }
+  static bool isAscii(reg_t r) { return !_mm256_movemask_epi8(r); }
+  static bool any(reg_t r) { return !_mm256_testz_si256(r, r); }
+};
+
+#elif FOLLY_X64 && FOLLY_SSSE
+
+struct Utf8Simd {
+  using reg_t = __m128i;
+  static constexpr size_t kSize = 16;
+
+  static reg_t load(const unsigned char* p) {
+    return _mm_loadu_si128(reinterpret_cast<const reg_t*>(p));
+  }
+  static reg_t zero() { return _mm_setzero_si128(); }
+  static reg_t splat(uint8_t c) { return _mm_set1_epi8(char(c)); }
+  static reg_t and_(reg_t a, reg_t b) { return _mm_and_si128(a, b); }
+  static reg_t or_(reg_t a, reg_t b) { return _mm_or_si128(a, b); }
+  static reg_t xor_(reg_t a, reg_t b) { return _mm_xor_si128(a, b); }
+  static reg_t subs(reg_t a, reg_t b) { return _mm_subs_epu8(a, b); }
+  static reg_t low4(reg_t r) { return and_(r, splat(0x0f)); }
+  static reg_t shr4(reg_t r) { return low4(_mm_srli_epi16(r, 4)); }
+  static reg_t lookup(const uint8_t (&table)[16], reg_t index) {
+    return _mm_shuffle_epi8(
+        _mm_load_si128(reinterpret_cast<const reg_t*>(table)), index);
+  }
+  template <int N>
+  static reg_t prev(reg_t in, reg_t prevIn) {
+    return _mm_alignr_epi8(in, prevIn, 16 - N);
+  }
+  static reg_t incompleteMax() {
+    return _mm_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        char(0xf0 - 1), char(0xe0 - 1), char(0xc0 - 1));
+  }
+  static bool isAscii(reg_t r) { return !_mm_movemask_epi8(r); }
+  static bool any(reg_t r) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(r, zero())) != 0xffff;
+  }
+};
+
+#elif FOLLY_AARCH64
+
+struct Utf8Simd {
+  using reg_t = uint8x16_t;
+  static constexpr size_t kSize = 16;
+
+  static reg_t load(const unsigned char* p) { return vld1q_u8(p); }
+  static reg_t zero() { return vdupq_n_u8(0); }
+  static reg_t splat(uint8_t c) { return vdupq_n_u8(c); }
+  static reg_t and_(reg_t a, reg_t b) { return vandq_u8(a, b); }
+  static reg_t or_(reg_t a, reg_t b) { return vorrq_u8(a, b); }
+  static reg_t xor_(reg_t a, reg_t b) { return veorq_u8(a, b); }
+  static reg_t subs(reg_t a, reg_t b) { return vqsubq_u8(a, b); }
+  static reg_t low4(reg_t r) { return vandq_u8(r, vdupq_n_u8(0x0f)); }
+  static reg_t shr4(reg_t r) { return vshrq_n_u8(r, 4); }
+  static reg_t lookup(const uint8_t (&table)[16], reg_t index) {
+    return vqtbl1q_u8(vld1q_u8(table), index);
+  }
+  template <int N>
+  static reg_t prev(reg_t in, reg_t prevIn) {
+    return vextq_u8(prevIn, in, 16 - N);
+  }
+  static reg_t incompleteMax() {
+    alignas(16) static constexpr uint8_t kMax[16] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1};
+    return vld1q_u8(kMax);
+  }
+  static bool isAscii(reg_t r) { return vmaxvq_u8(r) < 0x80; }
+  static bool any(reg_t r) { return vmaxvq_u8(r) != 0; }
+};
+
+#else
+
+#define FOLLY_DETAIL_UTF8_SCALAR_ONLY 1
+
+#endif
+
+} // namespace
+
+bool utf8Validate(StringPiece s) {
+  auto p = reinterpret_cast<const unsigned char*>(s.begin());
+  auto e = reinterpret_cast<const unsigned char*>(s.end());
+#ifdef FOLLY_DETAIL_UTF8_SCALAR_ONLY
+  return utf8ValidateScalar(p, e);
+#else
+  constexpr size_t kSize = Utf8Simd::kSize;
+  Utf8Checker<Utf8Simd> checker;
+  for (; size_t(e - p) >= kSize; p += kSize) {
+    checker.push(Utf8Simd::load(p));
+  }
+  if (p < e) {
+    // nul bytes are valid ascii
+    unsigned char tail[kSize] = {};
+    std::memcpy(tail, p, size_t(e - p));
+    checker.push(Utf8Simd::load(tail));
+  }
+  return checker.finish();
+#endif
+}
+
+size_t utf8CountCodePoints(StringPiece s) {
+  auto p = reinterpret_cast<const unsigned char*>(s.begin());
+  auto e = reinterpret_cast<const unsigned char*>(s.end());
+  size_t n = 0;
+  for (; size_t(e - p) >= Utf8Ascii::kSize; p += Utf8Ascii::kSize) {
+    n += Utf8Ascii::countLeads(p);
+  }
+  for (; p < e; ++p) {
+    n += (*p & 0xc0) != 0x80;
+  }
+  return n;
+}
+
+size_t utf8ToUtf16(StringPiece in, char16_t* out) {
+  auto p = reinterpret_cast<const unsigned char*>(in.begin());
+  auto e = reinterpret_cast<const unsigned char*>(in.end());
+  char16_t* o = out;
+  constexpr size_t kSize = Utf8Ascii::kSize;
+  while (size_t(e - p) >= kSize) {
+    if (Utf8Ascii::widen(p, o)) {
+      p += kSize;
+      o += kSize;
+    } else {
+      o = utf8ToUtf16Scalar(p, p + kSize, e, o);
+    }
+  }
+  o = utf8ToUtf16Scalar(p, e, e, o);
+  return size_t(o - out);
+}
+
+std::u16string utf8ToUtf16(StringPiece in) {
+  std::u16string out(in.size(), u'\0');
+  out.resize(utf8ToUtf16(in, &out[0]));
+  return out;
+}
+
+size_t utf16ToUtf8(std::u16string_view in, char* out) {
+  auto p = in.data();
+  auto e = in.data() + in.size();
+  char* o = out;
+  constexpr size_t kSize = Utf8Ascii::kSize;
+  while (size_t(e - p) >= kSize) {
+    if (Utf8Ascii::narrow(p, o)) {
+      p += kSize;
+      o += kSize;
+    } else {
+      o = utf16ToUtf8Scalar(p, p + kSize, e, o);
+    }
+  }
+  o = utf16ToUtf8Scalar(p, e, e, o);
+  return size_t(o - out);
+}
+
+std::string utf16ToUtf8(std::u16string_view in) {
+  std::string out(3 * in.size(), '\0');
+  out.resize(utf16ToUtf8(in, &out[0]));
+  return out;
+}
+
 } // namespace folly
@@ -18,10 +18,13 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 
+#include <folly/Range.h>
 #include <folly/lang/Exception.h>
 
 namespace folly {
@@ -91,4 +94,47 @@ char32_t utf8ToCodePoint(
 
 //////////////////////////////////////////////////////////////////////
 
+/*
+ * Bulk routines over whole strings.
+ *
+ * Valid UTF-8 is what utf8ToCodePoint accepts without skipOnError: the
+ * shortest encoding of a code point up to U+10FFFF that is not a surrogate.
+ *
+ * Validation uses the lookup-table algorithm of Keiser and Lemire
+ * (https://arxiv.org/abs/2010.03090) on SSSE3, AVX2 and NEON, and a scalar
+ * decoder elsewhere. All of them, as well as the transcoders, move through
+ * ASCII a register at a time.
+ */
+
+/*
+ * Returns whether `s` is valid UTF-8.
+ */
+bool utf8Validate(StringPiece s);
+
+/*
+ * Returns the number of code points in `s`, which is assumed to be valid
+ * UTF-8: every byte that is not a continuation byte counts as one.
+ */
+size_t utf8CountCodePoints(StringPiece s);
+
+/*
+ * Transcodes UTF-8 into UTF-16. `out` must have room for in.size() code
+ * units; the number written is returned.
+ *
+ * Throws unicode_error if `in` is not valid UTF-8.
+ */
+size_t utf8ToUtf16(StringPiece in, char16_t* out);
+std::u16string utf8ToUtf16(StringPiece in);
+
+/*
+ * Transcodes UTF-16 into UTF-8. `out` must have room for 3 * in.size()
+ * bytes; the number written is returned.
+ *
+ * Throws unicode_error on a surrogate that is not part of a pair.
+ */
+size_t utf16ToUtf8(std::u16string_view in, char* out);
+std::string utf16ToUtf8(std::u16string_view in);
+
+//////////////////////////////////////////////////////////////////////
+
 } // namespace folly
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <folly/Portability.h>
+#include <folly/lang/Bits.h>
+
+#if FOLLY_X64
+#include <immintrin.h>
+#endif
+
+#if FOLLY_AARCH64
+#include <arm_neon.h>
+#endif
+
+// This file is not supposed to be included by users.
+// It is the scanner behind json::escapeString and is included by json.cpp.
+// It is a header file to test different platforms.
+//
+// The set of bytes escapeString has to stop at is a 128-bit bitmap, laid
+// out as 16 bytes indexed by the low nibble of a character, whose bit h
+// stands for the character with high nibble h. With a byte shuffle the
+// bitmap is looked up for a whole register at once, so the characters in
+// extra_ascii_to_escape_bitmap cost the same as the ones always escaped,
+// however many there are.
+
+namespace folly {
+namespace detail {
+
+/**
+ * The bytes escapeString copies through only after looking at them.
+ *
+ * Bit h of `lo[c & 15]` is set when ascii character c, with c >> 4 == h,
+ * needs an escape: control characters, '"', '\\' and the extra escapes.
+ * Bytes >= 0x80 are stops when `nonAscii` is set, which is the case when
+ * they get encoded as \u escapes.
+ */
+struct JsonEscapeTable {
+  alignas(16) std::uint8_t lo[16];
+  bool hasExtra;
+  bool nonAscii;
+
+  FOLLY_ALWAYS_INLINE bool test(std::uint8_t c) const {
+    return c & 0x80 ? nonAscii : (lo[c & 15] >> (c >> 4)) & 1;
+  }
+};
+
+/**
+ * Builds the table for serialization_opts::extra_ascii_to_escape_bitmap,
+ * given as its two words. Characters below 0x20 in the bitmap are ignored
+ * since they are always escaped.
+ */
+inline JsonEscapeTable makeJsonEscapeTable(
+    std::uint64_t extraLo, std::uint64_t extraHi, bool nonAscii) {
+  JsonEscapeTable t;
+  // 0x00 - 0x1f, in every row
+  std::memset(t.lo, 0x03, sizeof(t.lo));
+  t.lo['"' & 15] |= 1 << ('"' >> 4);
+  t.lo['\\' & 15] |= 1 << ('\\' >> 4);
+  t.nonAscii = nonAscii;
+  extraLo &= ~std::uint64_t(0) << 32;
+  t.hasExtra = extraLo || extraHi;
+  auto add = [&](std::uint64_t bits, unsigned offset) {
+    while (bits) {
+      unsigned c = offset + unsigned(findFirstSet(bits) - 1);
+      t.lo[c & 15] |= std::uint8_t(1 << (c >> 4));
+      bits &= bits - 1;
+    }
+  };
+  add(extraLo, 0);
+  add(extraHi, 64);
+  return t;
+}
+
+struct JsonEscapeScannerScalar {
+  static constexpr std::size_t kBlock = 8;
+
+  // Index of the first byte of the block that needs an escape, or kBlock.
+  FOLLY_ALWAYS_INLINE static std::size_t first(
+      const std::uint8_t* p, const JsonEscapeTable& t) {
+    if (t.hasExtra) {
+      for (std::size_t i = 0; i < kBlock; ++i) {
+        if (t.test(p[i])) {
+          return i;
+        }
+      }
+      return kBlock;
+    }
+
+    using T = std::uint64_t;
+    constexpr T kOnes = ~T() / 255; // 0x...0101
+    constexpr T kMsbs = kOnes * 0x80; // 0x...8080
+
+    T s;
+    std::memcpy(&s, p, sizeof(s));
+
+    // Sets the MSB of bytes < b. Precondition: b < 128.
+    auto isLess = [](T w, std::uint8_t b) {
+      // A byte is < b iff subtracting b underflows, so we check that
+      // the MSB wasn't set before and it's set after the subtraction.
+      return (w - kOnes * b) & ~w & kMsbs;
+    };
+    auto isChar = [&](std::uint8_t c) {
+      // A byte is == c iff it is 0 if xor'd with c.
+      return isLess(s ^ (kOnes * c), 1);
+    };
+
+    // The MSB is set for each byte that needs an escape.
+    T needsEscape = isLess(s, 0x20) | isChar('\\') | isChar('"');
+    if (t.nonAscii) {
+      needsEscape |= s & kMsbs;
+    }
+    if (!needsEscape) {
+      return kBlock;
+    }
+    if (kIsLittleEndian) {
+      return std::size_t(findFirstSet(needsEscape) / 8 - 1);
+    } else {
+      return std::size_t(sizeof(T) - findLastSet(needsEscape) / 8);
+    }
+  }
+};
+
+#if FOLLY_X64
+
+#if defined(__AVX2__)
+
+struct JsonEscapeScannerAvx2 {
+  static constexpr std::size_t kBlock = 32;
+
+  FOLLY_ALWAYS_INLINE static std::size_t first(
+      const std::uint8_t* p, const JsonEscapeTable& t) {
+    const __m256i table = _mm256_broadcastsi128_si256(
+        _mm_load_si128(reinterpret_cast<const __m128i*>(t.lo)));
+    // bit h for high nibble h, nothing for bytes >= 0x80
+    const __m256i bits = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+        1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+    __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i row = _mm256_shuffle_epi8(table, _mm256_and_si256(r, nibble));
+    __m256i bit = _mm256_shuffle_epi8(
+        bits, _mm256_and_si256(_mm256_srli_epi16(r, 4), nibble));
+    __m256i clear = _mm256_cmpeq_epi8(
+        _mm256_and_si256(row, bit), _mm256_setzero_si256());
+    std::uint32_t mask = ~std::uint32_t(_mm256_movemask_epi8(clear));
+    if (t.nonAscii) {
+      mask |= std::uint32_t(_mm256_movemask_epi8(r));
+    }
+    return mask ? std::size_t(findFirstSet(mask) - 1) : kBlock;
+  }
+};
+
+using JsonEscapeScanner = JsonEscapeScannerAvx2;
+
+#elif defined(__SSSE3__)
+
+struct JsonEscapeScannerSsse3 {
+  static constexpr std::size_t kBlock = 16;
+
+  FOLLY_ALWAYS_INLINE static std::size_t first(
+      const std::uint8_t* p, const JsonEscapeTable& t) {
+    const __m128i table =
+        _mm_load_si128(reinterpret_cast<const __m128i*>(t.lo));
+    // bit h for high nibble h, nothing for bytes >= 0x80
+    const __m128i bits = _mm_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+
+    __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i row = _mm_shuffle_epi8(table, _mm_and_si128(r, nibble));
+    __m128i bit =
+        _mm_shuffle_epi8(bits, _mm_and_si128(_mm_srli_epi16(r, 4), nibble));
+    __m128i clear =
+        _mm_cmpeq_epi8(_mm_and_si128(row, bit), _mm_setzero_si128());
+    std::uint32_t mask = ~std::uint32_t(_mm_movemask_epi8(clear)) & 0xffff;
+    if (t.nonAscii) {
+      mask |= std::uint32_t(_mm_movemask_epi8(r));
+    }
+    return mask ? std::size_t(findFirstSet(mask) - 1) : kBlock;
+  }
+};
+
+using JsonEscapeScanner = JsonEscapeScannerSsse3;
+
+#else
+
+// Without a byte shuffle the fixed set is compared directly and the extra
+// escapes, if any, are looked up one byte at a time.
+struct JsonEscapeScannerSse2 {
+  static constexpr std::size_t kBlock = 16;
+
+  FOLLY_ALWAYS_INLINE static std::size_t first(
+      const std::uint8_t* p, const JsonEscapeTable& t) {
+    __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    // r < 0x20 as unsigned bytes, i.e. max(r, 0x1f) == 0x1f
+    __m128i ctl = _mm_cmpeq_epi8(
+        _mm_max_epu8(r, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f));
+    __m128i hit = _mm_or_si128(
+        ctl,
+        _mm_or_si128(
+            _mm_cmpeq_epi8(r, _mm_set1_epi8('"')),
+            _mm_cmpeq_epi8(r, _mm_set1_epi8('\\'))));
+    std::uint32_t mask = std::uint32_t(_mm_movemask_epi8(hit));
+    if (t.nonAscii) {
+      mask |= std::uint32_t(_mm_movemask_epi8(r));
+    }
+    std::size_t n = mask ? std::size_t(findFirstSet(mask) - 1) : kBlock;
+    if (t.hasExtra) {
+      for (std::size_t i = 0; i < n; ++i) {
+        if (t.test(p[i])) {
+          return i;
+        }
+      }
+    }
+    return n;
+  }
+};
+
+using JsonEscapeScanner = JsonEscapeScannerSse2;
+
+#endif
+
+#elif FOLLY_AARCH64
+
+struct JsonEscapeScannerNeon {
+  static constexpr std::size_t kBlock = 16;
+
+  FOLLY_ALWAYS_INLINE static std::size_t first(
+      const std::uint8_t* p, const JsonEscapeTable& t) {
+    const uint8x16_t table = vld1q_u8(t.lo);
+    // bit h for high nibble h, nothing for bytes >= 0x80
+    const uint8x16_t bits = {
+        1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    uint8x16_t r = vld1q_u8(p);
+    uint8x16_t row = vqtbl1q_u8(table, vandq_u8(r, vdupq_n_u8(0x0f)));
+    uint8x16_t bit = vqtbl1q_u8(bits, vshrq_n_u8(r, 4));
+    uint8x16_t hit = vtstq_u8(row, bit);
+    if (t.nonAscii) {
+      hit = vorrq_u8(hit, vcgeq_u8(r, vdupq_n_u8(0x80)));
+    }
+    // There is no movemask on neon: narrow every lane to a nibble.
+    std::uint64_t mask = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+    return mask ? std::size_t(findFirstSet(mask) - 1) / 4 : kBlock;
+  }
+};
+
+using JsonEscapeScanner = JsonEscapeScannerNeon;
+
+#else
+
+using JsonEscapeScanner = JsonEscapeScannerScalar;
+
+#endif
+
+/**
+ * Scans the block starting at p, of which only `avail` bytes are input.
+ * Loads that stay within the page of p are done in place, which is safe but
+ * has to hide from the sanitizers; the others go through a copy.
+ */
+template <typename Scanner>
+FOLLY_DISABLE_SANITIZERS std::size_t jsonFirstEscapableTail(
+    const std::uint8_t* p, std::size_t avail, const JsonEscapeTable& t) {
+  constexpr std::size_t kBlock = Scanner::kBlock;
+  constexpr std::uintptr_t kPage = 4096;
+  if ((reinterpret_cast<std::uintptr_t>(p) & (kPage - 1)) <= kPage - kBlock) {
+    return Scanner::first(p, t);
+  }
+  std::uint8_t tail[kBlock] = {};
+  std::memcpy(tail, p, avail);
+  return Scanner::first(tail, t);
+}
+
+/**
+ * Returns the first byte in [p, e) the table selects, or e.
+ */
+template <typename Scanner>
+FOLLY_ALWAYS_INLINE const std::uint8_t* jsonFirstEscapableImpl(
+    const std::uint8_t* p, const std::uint8_t* e, const JsonEscapeTable& t) {
+  constexpr std::size_t kBlock = Scanner::kBlock;
+  for (; std::size_t(e - p) >= kBlock; p += kBlock) {
+    std::size_t n = Scanner::first(p, t);
+    if (n < kBlock) {
+      return p + n;
+    }
+  }
+  if (p == e) {
+    return e;
+  }
+  // Whatever follows the tail, hits past its end are cut off.
+  std::size_t avail = std::size_t(e - p);
+  std::size_t n = jsonFirstEscapableTail<Scanner>(p, avail, t);
+  return p + (n < avail ? n : avail);
+}
+
+FOLLY_ALWAYS_INLINE const std::uint8_t* jsonFirstEscapable(
+    const std::uint8_t* p, const std::uint8_t* e, const JsonEscapeTable& t) {
+  return jsonFirstEscapableImpl<JsonEscapeScanner>(p, e, t);
+}
+
+} // namespace detail
+} // namespace folly
@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <folly/Portability.h>
+#include <folly/Range.h>
+#include <folly/lang/Bits.h>
+#include <folly/memory/UninitializedMemoryHacks.h>
+
+#if FOLLY_X64
+#include <immintrin.h>
+#endif
+
+#if FOLLY_AARCH64
+#include <arm_neon.h>
+#endif
+
+// This file is not supposed to be included by users.
+// It is the first stage of the indexed json parser and is included by
+// json.cpp. It is a header file to test different platforms.
+//
+// The approach follows simdjson (https://arxiv.org/abs/1902.08318): the
+// input is classified 64 bytes at a time into bitmasks, string regions are
+// computed from the quote and backslash masks without branching, and the
+// offsets of every structural character are collected into a flat index.
+// The second stage then walks the index instead of the raw bytes, so it
+// never has to look at whitespace or string contents one byte at a time.
+
+namespace folly {
+namespace detail {
+
+/**
+ * Bitmasks for one 64-byte block of input, bit i describing byte i.
+ *
+ * `op` holds the json operators: { } [ ] : ,
+ * `whitespace` holds the characters skipped by the parser: ' ' \t \n \r
+ */
+struct JsonBlockMasks {
+  std::uint64_t quote;
+  std::uint64_t backslash;
+  std::uint64_t op;
+  std::uint64_t whitespace;
+};
+
+struct JsonBlockClassifierScalar {
+  FOLLY_ALWAYS_INLINE static JsonBlockMasks classify(const char* p) {
+    JsonBlockMasks m{0, 0, 0, 0};
+    for (int i = 0; i < 64; ++i) {
+      auto bit = std::uint64_t(1) << i;
+      switch (p[i]) {
+        // clang-format off
+        case '"':  m.quote |= bit; break;
+        case '\\': m.backslash |= bit; break;
+        case '{': case '}': case '[': case ']': case ':': case ',':
+          m.op |= bit; break;
+        case ' ': case '\t': case '\n': case '\r':
+          m.whitespace |= bit; break;
+        // clang-format on
+        default:
+          break;
+      }
+    }
+    return m;
+  }
+};
+
+#if FOLLY_X64
+
+#if defined(__AVX2__)
+
+struct JsonBlockClassifierAvx2 {
+  using reg_t = __m256i;
+
+  FOLLY_ALWAYS_INLINE static std::uint64_t movemask(reg_t lo, reg_t hi) {
+    return std::uint64_t(std::uint32_t(_mm256_movemask_epi8(lo))) |
+        (std::uint64_t(std::uint32_t(_mm256_movemask_epi8(hi))) << 32);
+  }
+
+  FOLLY_ALWAYS_INLINE static reg_t eq(reg_t r, char c) {
+    return _mm256_cmpeq_epi8(r, _mm256_set1_epi8(c));
+  }
+
+  FOLLY_ALWAYS_INLINE static reg_t op(reg_t r) {
+    // '[' and ']' differ from '{' and '}' only in bit 0x20.
+    reg_t lower = _mm256_or_si256(r, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(
+        _mm256_or_si256(eq(lower, '{'), eq(lower, '}')),
+        _mm256_or_si256(eq(r, ':'), eq(r, ',')));
+  }
+
+  FOLLY_ALWAYS_INLINE static reg_t whitespace(reg_t r) {
+    return _mm256_or_si256(
+        _mm256_or_si256(eq(r, ' '), eq(r, '\t')),
+        _mm256_or_si256(eq(r, '\n'), eq(r, '\r')));
+  }
+
+  FOLLY_ALWAYS_INLINE static JsonBlockMasks classify(const char* p) {
+    reg_t lo = _mm256_loadu_si256(reinterpret_cast<const reg_t*>(p));
+    reg_t hi = _mm256_loadu_si256(reinterpret_cast<const reg_t*>(p + 32));
+    return JsonBlockMasks{
+        movemask(eq(lo, '"'), eq(hi, '"')),
+        movemask(eq(lo, '\\'), eq(hi, '\\')),
+        movemask(op(lo), op(hi)),
+        movemask(whitespace(lo), whitespace(hi))};
+  }
+};
+
+using JsonBlockClassifier = JsonBlockClassifierAvx2;
+
+#else
+
+struct JsonBlockClassifierSse2 {
+  using reg_t = __m128i;
+
+  FOLLY_ALWAYS_INLINE static std::uint64_t movemask(
+      reg_t a, reg_t b, reg_t c, reg_t d) {
+    return std::uint64_t(std::uint16_t(_mm_movemask_epi8(a))) |
+        (std::uint64_t(std::uint16_t(_mm_movemask_epi8(b))) << 16) |
+        (std::uint64_t(std::uint16_t(_mm_movemask_epi8(c))) << 32) |
+        (std::uint64_t(std::uint16_t(_mm_movemask_epi8(d))) << 48);
+  }
+
+  FOLLY_ALWAYS_INLINE static reg_t eq(reg_t r, char c) {
+    return _mm_cmpeq_epi8(r, _mm_set1_epi8(c));
+  }
+
+  FOLLY_ALWAYS_INLINE static reg_t op(reg_t r) {
+    // '[' and ']' differ from '{' and '}' only in bit 0x20.
+    reg_t lower = _mm_or_si128(r, _mm_set1_epi8(0x20));
+    return _mm_or_si128(
+        _mm_or_si128(eq(lower, '{'), eq(lower, '}')),
+        _mm_or_si128(eq(r, ':'), eq(r, ',')));
+  }
+
+  FOLLY_ALWAYS_INLINE static reg_t whitespace(reg_t r) {
+    return _mm_or_si128(
+        _mm_or_si128(eq(r, ' '), eq(r, '\t')),
+        _mm_or_si128(eq(r, '\n'), eq(r, '\r')));
+  }
+
+  FOLLY_ALWAYS_INLINE static JsonBlockMasks classify(const char* p) {
+    reg_t r0 = _mm_loadu_si128(reinterpret_cast<const reg_t*>(p));
+    reg_t r1 = _mm_loadu_si128(reinterpret_cast<const reg_t*>(p + 16));
+    reg_t r2 = _mm_loadu_si128(reinterpret_cast<const reg_t*>(p + 32));
+    reg_t r3 = _mm_loadu_si128(reinterpret_cast<const reg_t*>(p + 48));
+    return JsonBlockMasks{
+        movemask(eq(r0, '"'), eq(r1, '"'), eq(r2, '"'), eq(r3, '"')),
+        movemask(eq(r0, '\\'), eq(r1, '\\'), eq(r2, '\\'), eq(r3, '\\')),
+        movemask(op(r0), op(r1), op(r2), op(r3)),
+        movemask(
+            whitespace(r0), whitespace(r1), whitespace(r2), whitespace(r3))};
+  }
+};
+
+using JsonBlockClassifier = JsonBlockClassifierSse2;
+
+#endif
+
+#elif FOLLY_AARCH64
+
+struct JsonBlockClassifierNeon {
+  using reg_t = uint8x16_t;
+
+  // There is no movemask on neon: keep one distinct bit per lane and fold
+  // the four registers together with pairwise adds.
+  FOLLY_ALWAYS_INLINE static std::uint64_t movemask(
+      reg_t a, reg_t b, reg_t c, reg_t d) {
+    const uint8x16_t bits = {
+        0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+        0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+    uint8x16_t s0 = vpaddq_u8(vandq_u8(a, bits), vandq_u8(b, bits));
+    uint8x16_t s1 = vpaddq_u8(vandq_u8(c, bits), vandq_u8(d, bits));
+    s0 = vpaddq_u8(s0, s1);
+    s0 = vpaddq_u8(s0, s0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(s0), 0);
+  }
+
+  FOLLY_ALWAYS_INLINE static reg_t eq(reg_t r, char c) {
+    return vceqq_u8(r, vdupq_n_u8(static_cast<std::uint8_t>(c)));
+  }
+
+  FOLLY_ALWAYS_INLINE static reg_t op(reg_t r) {
+    // '[' and ']' differ from '{' and '}' only in bit 0x20.
+    reg_t lower = vorrq_u8(r, vdupq_n_u8(0x20));
+    return vorrq_u8(
+        vorrq_u8(eq(lower, '{'), eq(lower, '}')),
+        vorrq_u8(eq(r, ':'), eq(r, ',')));
+  }
+
+  FOLLY_ALWAYS_INLINE static reg_t whitespace(reg_t r) {
+    return vorrq_u8(
+        vorrq_u8(eq(r, ' '), eq(r, '\t')), vorrq_u8(eq(r, '\n'), eq(r, '\r')));
+  }
+
+  FOLLY_ALWAYS_INLINE static JsonBlockMasks classify(const char* p) {
+    auto u = reinterpret_cast<const std::uint8_t*>(p);
+    reg_t r0 = vld1q_u8(u);
+    reg_t r1 = vld1q_u8(u + 16);
+    reg_t r2 = vld1q_u8(u + 32);
+    reg_t r3 = vld1q_u8(u + 48);
+    return JsonBlockMasks{
+        movemask(eq(r0, '"'), eq(r1, '"'), eq(r2, '"'), eq(r3, '"')),
+        movemask(eq(r0, '\\'), eq(r1, '\\'), eq(r2, '\\'), eq(r3, '\\')),
+        movemask(op(r0), op(r1), op(r2), op(r3)),
+        movemask(
+            whitespace(r0), whitespace(r1), whitespace(r2), whitespace(r3))};
+  }
+};
+
+using JsonBlockClassifier = JsonBlockClassifierNeon;
+
+#else
+
+using JsonBlockClassifier = JsonBlockClassifierScalar;
+
+#endif
+
+/**
+ * Bit i of the result is the xor of bits [0, i] of x, i.e. it is set for
+ * every byte that follows an odd number of quotes.
+ */
+FOLLY_ALWAYS_INLINE std::uint64_t jsonPrefixXor(std::uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/**
+ * Returns the mask of characters escaped by a backslash, i.e. the ones
+ * preceded by an odd-length run of backslashes. `prevEscaped` carries the
+ * state across blocks: it is 1 when the next block starts escaped.
+ */
+FOLLY_ALWAYS_INLINE std::uint64_t jsonEscapedMask(
+    std::uint64_t backslash, std::uint64_t& prevEscaped) {
+  constexpr std::uint64_t kEvenBits = 0x5555555555555555ULL;
+  // An escaped backslash does not start a new escape.
+  backslash &= ~prevEscaped;
+  std::uint64_t followsEscape = (backslash << 1) | prevEscaped;
+  // Runs starting on odd bits are carried through by the addition, which
+  // flips the parity of every character that follows them.
+  std::uint64_t oddStarts = backslash & ~kEvenBits & ~followsEscape;
+  std::uint64_t evenSequences = oddStarts + backslash;
+  prevEscaped = evenSequences < oddStarts ? 1 : 0;
+  std::uint64_t invert = evenSequences << 1;
+  return (kEvenBits ^ invert) & followsEscape;
+}
+
+template <typename Classifier>
+struct JsonStructuralIndexer {
+  /**
+   * Fills `index` with the offsets of every operator outside of strings,
+   * every unescaped quote (so each string contributes its opening and
+   * closing quote) and the first byte of every other token (numbers and
+   * literals).
+   *
+   * Returns false if the input cannot be indexed: it is larger than what 32
+   * bit offsets can address, or it ends inside a string. The caller is
+   * expected to fall back to the byte-at-a-time parser, which reports the
+   * error.
+   */
+  static bool build(StringPiece input, std::vector<std::uint32_t>& index) {
+    if (input.size() >= std::numeric_limits<std::uint32_t>::max()) {
+      return false;
+    }
+
+    std::uint64_t prevEscaped = 0;
+    std::uint64_t prevInString = 0;
+    std::uint64_t prevScalar = 0;
+    std::size_t n = 0;
+    index.clear();
+
+    auto step = [&](const char* p, std::uint32_t offset) {
+      JsonBlockMasks m = Classifier::classify(p);
+
+      std::uint64_t escaped = jsonEscapedMask(m.backslash, prevEscaped);
+      std::uint64_t quote = m.quote & ~escaped;
+      // Set inside strings including the opening quote, but not the closing.
+      std::uint64_t inString = jsonPrefixXor(quote) ^ prevInString;
+      prevInString = std::uint64_t(std::int64_t(inString) >> 63);
+
+      std::uint64_t scalar = ~(m.op | m.whitespace | quote | inString);
+      std::uint64_t scalarStart = scalar & ~((scalar << 1) | prevScalar);
+      prevScalar = scalar >> 63;
+
+      std::uint64_t structural = (m.op & ~inString) | scalarStart | quote;
+
+      if (index.size() < n + 64) {
+        resizeWithoutInitialization(index, std::max(index.size() * 2, n + 64));
+      }
+      std::uint32_t* out = index.data() + n;
+      while (structural) {
+        *out++ = offset + std::uint32_t(findFirstSet(structural) - 1);
+        structural &= structural - 1;
+      }
+      n = std::size_t(out - index.data());
+    };
+
+    const char* data = input.data();
+    const std::size_t size = input.size();
+    std::size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+      step(data + i, std::uint32_t(i));
+    }
+    if (i < size) {
+      // Pad the tail with whitespace, which is never structural.
+      char tail[64];
+      std::memset(tail, ' ', sizeof(tail));
+      std::memcpy(tail, data + i, size - i);
+      step(tail, std::uint32_t(i));
+    }
+    index.resize(n);
+    return prevInString == 0;
+  }
+};
+
+/**
+ * Calls fn(offset) with the offset of every operator outside of strings,
+ * in order, until it returns false. A cheaper pass than the full index for
+ * callers that only need the nesting structure.
+ */
+template <typename Classifier, typename Fn>
+void jsonForEachOperatorImpl(StringPiece input, Fn fn) {
+  std::uint64_t prevEscaped = 0;
+  std::uint64_t prevInString = 0;
+
+  auto step = [&](const char* p, std::size_t offset) {
+    JsonBlockMasks m = Classifier::classify(p);
+
+    std::uint64_t escaped = jsonEscapedMask(m.backslash, prevEscaped);
+    std::uint64_t inString = jsonPrefixXor(m.quote & ~escaped) ^ prevInString;
+    prevInString = std::uint64_t(std::int64_t(inString) >> 63);
+
+    for (std::uint64_t op = m.op & ~inString; op; op &= op - 1) {
+      if (!fn(offset + findFirstSet(op) - 1)) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  const char* data = input.data();
+  const std::size_t size = input.size();
+  std::size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    if (!step(data + i, i)) {
+      return;
+    }
+  }
+  if (i < size) {
+    char tail[64];
+    std::memset(tail, ' ', sizeof(tail));
+    std::memcpy(tail, data + i, size - i);
+    step(tail, i);
+  }
+}
+
+template <typename Fn>
+FOLLY_ALWAYS_INLINE void jsonForEachOperator(StringPiece input, Fn fn) {
+  jsonForEachOperatorImpl<JsonBlockClassifier>(input, fn);
+}
+
+FOLLY_ALWAYS_INLINE bool jsonBuildStructuralIndex(
+    StringPiece input, std::vector<std::uint32_t>& index) {
+  return JsonStructuralIndexer<JsonBlockClassifier>::build(input, index);
+}
+
+} // namespace detail
+} // namespace folly
@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * frozen_dynamic is an immutable, hash-consed dynamic.
+ *
+ * Every distinct value lives in exactly one node, shared by all the
+ * frozen_dynamics (and all the enclosing arrays and objects) that hold
+ * it. Each node carries its hash, computed once from its children's when
+ * it is created, so hash() and operator== are O(1) whatever the size of
+ * the value; copies are a reference count increment. That makes
+ * frozen_dynamic a cheap key for caches of things computed from json:
+ *
+ *   F14FastMap<frozen_dynamic, Fragment> cache;
+ *
+ *   frozen_dynamic key(props); // O(size of props), once
+ *   auto it = cache.find(key); // O(1)
+ *
+ * Equality is identity of the interned nodes, which is stricter than
+ * dynamic's operator==: the int 1 and the double 1.0 are different
+ * values, and doubles compare by bit pattern (so NaN equals itself and
+ * -0.0 differs from 0.0). hash() returns the same value as dynamic::hash()
+ * on the thawed value.
+ *
+ * Interning goes through a process-wide table split in locked shards;
+ * frozen_dynamics may be created, copied and destroyed from any thread.
+ * Nodes are freed when the last frozen_dynamic referring to them goes.
+ * Object members are kept in an order of their own (by key hash), not in
+ * insertion order.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <folly/Indestructible.h>
+#include <folly/Range.h>
+#include <folly/dynamic.h>
+#include <folly/container/F14Set.h>
+#include <folly/hash/Hash.h>
+#include <folly/lang/Exception.h>
+
+namespace folly {
+
+class frozen_dynamic {
+ public:
+  using member = std::pair<frozen_dynamic, frozen_dynamic>;
+
+  // null
+  frozen_dynamic() noexcept = default;
+  /* implicit */ frozen_dynamic(std::nullptr_t) noexcept {}
+
+  // Interns value and, recursively, everything it contains.
+  explicit frozen_dynamic(dynamic const& value);
+
+  frozen_dynamic(frozen_dynamic const& other) noexcept : node_(other.node_) {
+    acquire();
+  }
+  frozen_dynamic(frozen_dynamic&& other) noexcept
+      : node_(std::exchange(other.node_, nullptr)) {}
+  frozen_dynamic& operator=(frozen_dynamic const& other) noexcept {
+    frozen_dynamic(other).swap(*this);
+    return *this;
+  }
+  frozen_dynamic& operator=(frozen_dynamic&& other) noexcept {
+    frozen_dynamic(std::move(other)).swap(*this);
+    return *this;
+  }
+  ~frozen_dynamic() { release(); }
+
+  void swap(frozen_dynamic& other) noexcept { std::swap(node_, other.node_); }
+
+  dynamic::Type type() const;
+  bool isNull() const { return node_ == nullptr; }
+  bool isBool() const { return type() == dynamic::BOOL; }
+  bool isInt() const { return type() == dynamic::INT64; }
+  bool isDouble() const { return type() == dynamic::DOUBLE; }
+  bool isNumber() const { return isInt() || isDouble(); }
+  bool isString() const { return type() == dynamic::STRING; }
+  bool isArray() const { return type() == dynamic::ARRAY; }
+  bool isObject() const { return type() == dynamic::OBJECT; }
+
+  // Same value as dynamic::hash() of the thawed value, without walking it.
+  size_t hash() const;
+
+  // Number of elements of an array or object, or length of a string.
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+
+  // Access without conversion; throw TypeError on a type mismatch.
+  StringPiece getString() const;
+  int64_t getInt() const;
+  double getDouble() const;
+  bool getBool() const;
+
+  // Array elements.
+  frozen_dynamic const* begin() const;
+  frozen_dynamic const* end() const;
+  frozen_dynamic const& at(size_t index) const;
+  frozen_dynamic const& operator[](size_t index) const { return at(index); }
+
+  // Object members. get_ptr returns nullptr if the key is missing, at and
+  // operator[] throw std::out_of_range.
+  Range<member const*> items() const;
+  frozen_dynamic const* get_ptr(StringPiece key) const;
+  frozen_dynamic const& at(StringPiece key) const;
+  frozen_dynamic const& operator[](StringPiece key) const { return at(key); }
+  size_t count(StringPiece key) const { return get_ptr(key) ? 1 : 0; }
+
+  dynamic toDynamic() const;
+
+  // Number of distinct non-null values interned process-wide, nested ones
+  // included. For monitoring caches keyed by frozen_dynamic.
+  static size_t internedCount();
+
+  friend bool operator==(frozen_dynamic const& a, frozen_dynamic const& b) {
+    return a.node_ == b.node_;
+  }
+  friend bool operator!=(frozen_dynamic const& a, frozen_dynamic const& b) {
+    return a.node_ != b.node_;
+  }
+
+ private:
+  struct node;
+  struct node_hash;
+  struct node_equal;
+  struct table;
+
+  static table& interned();
+  static frozen_dynamic intern(node&& candidate);
+
+  void acquire() const noexcept;
+  void release() noexcept;
+  node const& get(dynamic::Type expected, char const* name) const;
+
+  node* node_{nullptr};
+};
+
+struct frozen_dynamic::node {
+  node() = default;
+  node(node&& other) noexcept
+      : type(other.type),
+        hash(other.hash),
+        scalar(std::move(other.scalar)),
+        str(std::move(other.str)),
+        elements(std::move(other.elements)),
+        members(std::move(other.members)) {}
+
+  mutable std::atomic<uint32_t> refs{1};
+  dynamic::Type type;
+  size_t hash;
+  // The value of a scalar. Strings are in str, not here.
+  dynamic scalar;
+  std::string str;
+  std::vector<frozen_dynamic> elements;
+  // Sorted by key hash, then by key node, so equal objects have equal
+  // member lists.
+  std::vector<member> members;
+};
+
+// The table hashes and compares nodes by value. Since their children are
+// interned, the comparison is shallow.
+struct frozen_dynamic::node_hash {
+  using folly_is_avalanching = std::true_type;
+  size_t operator()(node const* n) const { return n->hash; }
+};
+
+struct frozen_dynamic::node_equal {
+  bool operator()(node const* a, node const* b) const {
+    if (a->type != b->type || a->hash != b->hash) {
+      return false;
+    }
+    switch (a->type) {
+      case dynamic::BOOL:
+        return a->scalar.getBool() == b->scalar.getBool();
+      case dynamic::INT64:
+        return a->scalar.getInt() == b->scalar.getInt();
+      case dynamic::DOUBLE: {
+        auto const x = a->scalar.getDouble();
+        auto const y = b->scalar.getDouble();
+        return std::memcmp(&x, &y, sizeof(double)) == 0;
+      }
+      case dynamic::STRING:
+        return a->str == b->str;
+      case dynamic::ARRAY:
+        return a->elements == b->elements;
+      case dynamic::OBJECT:
+        return a->members == b->members;
+      case dynamic::NULLT:
+      default:
+        return true;
+    }
+  }
+};
+
+struct frozen_dynamic::table {
+  struct shard {
+    std::mutex mutex;
+    F14FastSet<node*, node_hash, node_equal> nodes;
+  };
+
+  static constexpr size_t kShards = 16;
+
+  shard& shardFor(size_t hash) {
+    // Middle bits, away from those F14 uses for the chunk and the tag.
+    return shards[(hash >> (4 * sizeof(size_t))) % kShards];
+  }
+
+  shard shards[kShards];
+};
+
+inline frozen_dynamic::table& frozen_dynamic::interned() {
+  // Never destroyed, so that frozen_dynamics in other static objects can
+  // still be released at exit.
+  static Indestructible<table> instance;
+  return *instance;
+}
+
+inline size_t frozen_dynamic::internedCount() {
+  size_t count = 0;
+  for (auto& shard : interned().shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    count += shard.nodes.size();
+  }
+  return count;
+}
+
+inline frozen_dynamic frozen_dynamic::intern(node&& candidate) {
+  auto& shard = interned().shardFor(candidate.hash);
+  frozen_dynamic ret;
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  auto it = shard.nodes.find(&candidate);
+  if (it != shard.nodes.end()) {
+    // A node whose count already dropped to zero is being freed by
+    // release(); it must not come back, so replace it.
+    auto refs = (*it)->refs.load(std::memory_order_relaxed);
+    while (refs != 0) {
+      if ((*it)->refs.compare_exchange_weak(
+              refs, refs + 1, std::memory_order_relaxed)) {
+        ret.node_ = *it;
+        return ret;
+      }
+    }
+    shard.nodes.erase(it);
+  }
+  ret.node_ = new node(std::move(candidate));
+  shard.nodes.insert(ret.node_);
+  return ret;
+}
+
+inline void frozen_dynamic::acquire() const noexcept {
+  if (node_) {
+    node_->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+inline void frozen_dynamic::release() noexcept {
+  if (!node_ || node_->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  {
+    auto& shard = interned().shardFor(node_->hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // intern() may already have replaced this node by an equal one.
+    auto it = shard.nodes.find(node_);
+    if (it != shard.nodes.end() && *it == node_) {
+      shard.nodes.erase(it);
+    }
+  }
+  // Releases the children, which may take other shard locks.
+  delete node_;
+}
+
+inline frozen_dynamic::frozen_dynamic(dynamic const& value) {
+  node n;
+  n.type = value.type();
+  switch (value.type()) {
+    case dynamic::NULLT:
+      return;
+    case dynamic::BOOL:
+    case dynamic::INT64:
+    case dynamic::DOUBLE:
+      n.scalar = value;
+      n.hash = value.hash();
+      break;
+    case dynamic::STRING:
+      n.str = value.getString();
+      n.hash = value.hash();
+      break;
+    case dynamic::ARRAY: {
+      n.elements.reserve(value.size());
+      uint64_t h = 0;
+      for (auto const& element : value) {
+        n.elements.emplace_back(element);
+        h = hash::hash_128_to_64(h, n.elements.back().hash());
+      }
+      n.hash = static_cast<size_t>(h);
+      break;
+    }
+    case dynamic::OBJECT: {
+      n.members.reserve(value.size());
+      // As in dynamic::hash(), a sum so that the order does not matter.
+      size_t h = 0x0B1EC7;
+      for (auto const& item : value.items()) {
+        n.members.emplace_back(
+            frozen_dynamic(item.first), frozen_dynamic(item.second));
+        auto const& m = n.members.back();
+        if (sizeof(size_t) == sizeof(uint32_t)) {
+          h += hash::twang_32from64(
+              (uint64_t(m.first.hash()) << 32) | m.second.hash());
+        } else {
+          h += static_cast<size_t>(
+              hash::hash_128_to_64(m.first.hash(), m.second.hash()));
+        }
+      }
+      n.hash = h;
+      std::sort(
+          n.members.begin(),
+          n.members.end(),
+          [](member const& a, member const& b) {
+            auto const ha = a.first.hash();
+            auto const hb = b.first.hash();
+            return ha != hb ? ha < hb
+                            : std::less<node*>()(a.first.node_, b.first.node_);
+          });
+      break;
+    }
+  }
+  *this = intern(std::move(n));
+}
+
+inline dynamic::Type frozen_dynamic::type() const {
+  return node_ ? node_->type : dynamic::NULLT;
+}
+
+inline size_t frozen_dynamic::hash() const {
+  // dynamic::hash() of null.
+  return node_ ? node_->hash : 0xBAAAAAAD;
+}
+
+inline frozen_dynamic::node const& frozen_dynamic::get(
+    dynamic::Type expected, char const* name) const {
+  if (type() != expected) {
+    throw_exception<TypeError>(name, type());
+  }
+  return *node_;
+}
+
+inline size_t frozen_dynamic::size() const {
+  switch (type()) {
+    case dynamic::STRING:
+      return node_->str.size();
+    case dynamic::ARRAY:
+      return node_->elements.size();
+    case dynamic::OBJECT:
+      return node_->members.size();
+    default:
+      throw_exception<TypeError>("array/object/string", type());
+  }
+}
+
+inline StringPiece frozen_dynamic::getString() const {
+  return get(dynamic::STRING, "string").str;
+}
+
+inline int64_t frozen_dynamic::getInt() const {
+  return get(dynamic::INT64, "int64").scalar.getInt();
+}
+
+inline double frozen_dynamic::getDouble() const {
+  return get(dynamic::DOUBLE, "double").scalar.getDouble();
+}
+
+inline bool frozen_dynamic::getBool() const {
+  return get(dynamic::BOOL, "boolean").scalar.getBool();
+}
+
+inline frozen_dynamic const* frozen_dynamic::begin() const {
+  return get(dynamic::ARRAY, "array").elements.data();
+}
+
+inline frozen_dynamic const* frozen_dynamic::end() const {
+  auto const& n = get(dynamic::ARRAY, "array");
+  return n.elements.data() + n.elements.size();
+}
+
+inline frozen_dynamic const& frozen_dynamic::at(size_t index) const {
+  auto const& n = get(dynamic::ARRAY, "array");
+  if (index >= n.elements.size()) {
+    throw_exception<std::out_of_range>("out of range in dynamic array");
+  }
+  return n.elements[index];
+}
+
+inline Range<frozen_dynamic::member const*> frozen_dynamic::items() const {
+  auto const& n = get(dynamic::OBJECT, "object");
+  return Range<member const*>(
+      n.members.data(), n.members.data() + n.members.size());
+}
+
+inline frozen_dynamic const* frozen_dynamic::get_ptr(StringPiece key) const {
+  auto const& members = get(dynamic::OBJECT, "object").members;
+  // Same as dynamic::hash() of the key as a string.
+  auto const h = Hash()(key);
+  auto it = std::lower_bound(
+      members.begin(), members.end(), h, [](member const& m, size_t v) {
+        return m.first.hash() < v;
+      });
+  for (; it != members.end() && it->first.hash() == h; ++it) {
+    if (it->first.isString() && it->first.getString() == key) {
+      return &it->second;
+    }
+  }
+  return nullptr;
+}
+
+inline frozen_dynamic const& frozen_dynamic::at(StringPiece key) const {
+  auto ret = get_ptr(key);
+  if (!ret) {
+    throw_exception<std::out_of_range>(
+        to<std::string>("couldn't find key ", key, " in dynamic object"));
+  }
+  return *ret;
+}
+
+inline dynamic frozen_dynamic::toDynamic() const {
+  switch (type()) {
+    case dynamic::NULLT:
+      return nullptr;
+    case dynamic::BOOL:
+    case dynamic::INT64:
+    case dynamic::DOUBLE:
+      return node_->scalar;
+    case dynamic::STRING:
+      return node_->str;
+    case dynamic::ARRAY: {
+      dynamic ret = dynamic::array;
+      ret.reserve(node_->elements.size());
+      for (auto const& element : node_->elements) {
+        ret.push_back(element.toDynamic());
+      }
+      return ret;
+    }
+    case dynamic::OBJECT:
+    default: {
+      dynamic ret = dynamic::object;
+      ret.reserve(node_->members.size());
+      for (auto const& m : node_->members) {
+        ret.insert(m.first.toDynamic(), m.second.toDynamic());
+      }
+      return ret;
+    }
+  }
+}
+
+} // namespace folly
+
+namespace std {
+
+template <>
+struct hash<::folly::frozen_dynamic> {
+  using folly_is_avalanching = std::true_type;
+
+  size_t operator()(::folly::frozen_dynamic const& d) const { return d.hash(); }
+};
+
+} // namespace std
@@ -17,22 +17,36 @@
 #include <folly/json.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
 #include <functional>
 #include <iterator>
+#include <numeric>
 #include <sstream>
+#include <system_error>
+#include <thread>
 #include <type_traits>
 
 #include <boost/algorithm/string.hpp>
 #include <glog/logging.h>
 
 #include <folly/Conv.h>
+#include <folly/Exception.h>
+#include <folly/FileUtil.h>
 #include <folly/Portability.h>
 #include <folly/Range.h>
 #include <folly/Unicode.h>
 #include <folly/Utility.h>
+#include <folly/detail/JsonEscape.h>
+#include <folly/detail/JsonStructuralIndex.h>
+#include <folly/hash/SpookyHashV2.h>
+#include <folly/lang/Assume.h>
 #include <folly/lang/Bits.h>
 #include <folly/portability/Constexpr.h>
 
+FOLLY_DECLARE_VECTOR_RESIZE_WITHOUT_INIT(uint32_t)
+
 namespace folly {
 
 //////////////////////////////////////////////////////////////////////
@@ -95,8 +109,28 @@ struct Printer {
   };
 
   explicit Printer(
-      std::string& out, unsigned* indentLevel, serialization_opts const* opts)
-      : out_(out), indentLevel_(indentLevel), opts_(*opts) {}
+      std::string& out,
+      unsigned* indentLevel,
+      serialization_opts const* opts,
+      output_sink* sink = nullptr,
+      size_t flushSize = 0)
+      : out_(out),
+        indentLevel_(indentLevel),
+        opts_(*opts),
+        sink_(sink),
+        flushSize_(flushSize) {}
+
+  // Passes what is buffered in out to the sink.
+  void flush() const {
+    sink_->write(out_);
+    if (out_.capacity() > 2 * flushSize_) {
+      // Don't hold on to the space taken by a long string.
+      out_ = std::string();
+      out_.reserve(flushSize_);
+    } else {
+      out_.clear();
+    }
+  }
 
   void operator()(dynamic const& v, const Context& context) const {
     (*this)(v, &context);
@@ -151,6 +185,9 @@ struct Printer {
       default:
         CHECK(0) << "Bad type " << v.type();
     }
+    if (sink_ && out_.size() >= flushSize_) {
+      flush();
+    }
   }
 
  private:
@@ -295,14 +332,22 @@ struct Printer {
   std::string& out_;
   unsigned* const indentLevel_;
   serialization_opts const& opts_;
+  output_sink* const sink_;
+  size_t const flushSize_;
 };
 
 //////////////////////////////////////////////////////////////////////
 
 // Wraps our input buffer with some helper functions.
 struct Input {
-  explicit Input(StringPiece range, json::serialization_opts const* opts)
-      : range_(range), opts_(*opts), lineNum_(0) {
+  explicit Input(
+      StringPiece range,
+      json::serialization_opts const* opts,
+      unsigned lineNum = 0)
+      : range_(range),
+        opts_(*opts),
+        lineNum_(lineNum),
+        lineBegin_(range.begin()) {
     storeCurrent();
   }
 
@@ -313,6 +358,14 @@ struct Input {
 
   unsigned getLineNum() const { return lineNum_; }
 
+  // The position of the next character, for an input starting at `base`.
+  json::parse_location getLocation(char const* base) const {
+    return {
+        lineNum_,
+        static_cast<uint32_t>(range_.begin() - lineBegin_),
+        static_cast<uint32_t>(range_.begin() - base)};
+  }
+
   // Parse ahead for as long as the supplied predicate is satisfied,
   // returning a range of what was skipped.
   template <class Predicate>
@@ -324,6 +377,7 @@ struct Input {
       }
       if (range_[skipped] == '\n') {
         ++lineNum_;
+        lineBegin_ = range_.begin() + skipped + 1;
       }
     }
     auto ret = range_.subpiece(0, skipped);
@@ -355,6 +409,7 @@ struct Input {
         if (range_[index] == '\n') {
           index++;
           ++lineNum_;
+          lineBegin_ = range_.begin() + index;
           continue;
         }
         if (range_[index] == '\t' || range_[index] == '\r') {
@@ -429,6 +484,7 @@ struct Input {
   StringPiece range_;
   json::serialization_opts const& opts_;
   unsigned lineNum_;
+  char const* lineBegin_;
   int current_;
   unsigned int currentRecursionLevel_{0};
 };
@@ -445,7 +501,162 @@ class RecursionGuard {
   Input& in_;
 };
 
-dynamic parseValue(Input& in, json::metadata_map* map);
+} // namespace
+
+// Fills in a metadata_table for parseJsonWithMetadata. The parser adds an
+// entry as soon as it reaches a key or value, so entries are in parse
+// order, and sets its address once the value has its final place in the
+// tree: right away for object members, and when the array is complete for
+// array elements, since they move while the array grows.
+class metadata_recorder {
+ public:
+  metadata_recorder(metadata_table& table, StringPiece input)
+      : table_(table), base_(input.begin()) {
+    table_.clear();
+    // A guess that is on the high side for most documents; the vectors
+    // grow past it if needed.
+    table_.entries_.reserve(input.size() / 8);
+    table_.index_.reserve(input.size() / 8);
+  }
+
+  char const* base() const { return base_; }
+
+  uint32_t add(parse_location key, parse_location value) {
+    auto const i = static_cast<uint32_t>(table_.entries_.size());
+    table_.entries_.push_back(parse_metadata{{key}, {value}});
+    table_.index_.emplace_back(nullptr, i);
+    return i;
+  }
+
+  void setValueBegin(uint32_t i, parse_location value) {
+    table_.entries_[i].value_range.begin = value;
+  }
+
+  void setAddress(uint32_t i, dynamic const* value) {
+    table_.index_[i].first = value;
+  }
+
+  void addElement(parse_location value) {
+    pendingElements_.push_back(add({}, value));
+  }
+
+  // Sets the addresses of the elements of the array that was just parsed,
+  // which are the last array.size() added with addElement.
+  void setElementAddresses(dynamic const& array) {
+    auto const n = array.size();
+    auto const first = pendingElements_.end() - n;
+    for (size_t i = 0; i < n; ++i) {
+      setAddress(first[i], &array[i]);
+    }
+    pendingElements_.erase(first, pendingElements_.end());
+  }
+
+  // Keeps a value replaced by a duplicate key alive until the end of the
+  // parse, so that no other value can be allocated where its elements
+  // were while their entries are still in the index.
+  void retire(dynamic&& value) { retired_.push_back(std::move(value)); }
+
+  void finish() {
+    auto& index = table_.index_;
+    // The root has no address: it is moved out of the parser.
+    index.erase(index.begin());
+    if (!retired_.empty()) {
+      std::less<dynamic const*> less;
+      std::vector<dynamic const*> dead;
+      for (auto const& value : retired_) {
+        collectElements(value, dead);
+      }
+      std::sort(dead.begin(), dead.end(), less);
+      index.erase(
+          std::remove_if(
+              index.begin(),
+              index.end(),
+              [&](auto const& e) {
+                return std::binary_search(
+                    dead.begin(), dead.end(), e.first, less);
+              }),
+          index.end());
+    }
+    sortByAddress(index);
+    if (!retired_.empty()) {
+      // The entry of a replaced value has the address of the value that
+      // replaced it, which comes later in parse order.
+      auto out = index.begin();
+      for (auto it = index.begin(); it != index.end(); ++it) {
+        if (it + 1 == index.end() || it[1].first != it->first) {
+          *out++ = *it;
+        }
+      }
+      index.erase(out, index.end());
+    }
+  }
+
+ private:
+  using index_entry = std::pair<dynamic const*, uint32_t>;
+
+  // Values are often allocated in parse order, in which case there is
+  // nothing to do. Otherwise an LSD radix sort, a byte at a time over the
+  // bytes in which the addresses differ: the index interleaves the values
+  // of every open container, which std::sort handles poorly. Being stable,
+  // it keeps entries with the same address in parse order.
+  static void sortByAddress(std::vector<index_entry>& index) {
+    auto const bits = [](index_entry const& e) {
+      return reinterpret_cast<uintptr_t>(e.first);
+    };
+    if (std::is_sorted(index.begin(), index.end(), [&](auto& a, auto& b) {
+          return bits(a) < bits(b);
+        })) {
+      return;
+    }
+    uintptr_t differing = 0;
+    for (auto const& e : index) {
+      differing |= bits(e) ^ bits(index.front());
+    }
+    std::vector<index_entry> sorted(index.size());
+    for (unsigned shift = 0; shift < 8 * sizeof(uintptr_t); shift += 8) {
+      if (((differing >> shift) & 0xff) == 0) {
+        continue;
+      }
+      size_t offsets[256] = {};
+      for (auto const& e : index) {
+        ++offsets[(bits(e) >> shift) & 0xff];
+      }
+      size_t sum = 0;
+      for (auto& offset : offsets) {
+        sum += std::exchange(offset, sum);
+      }
+      for (auto const& e : index) {
+        sorted[offsets[(bits(e) >> shift) & 0xff]++] = e;
+      }
+      index.swap(sorted);
+    }
+  }
+
+  static void collectElements(
+      dynamic const& value, std::vector<dynamic const*>& out) {
+    if (value.isArray()) {
+      for (auto const& element : value) {
+        out.push_back(&element);
+        collectElements(element, out);
+      }
+    } else if (value.isObject()) {
+      for (auto const& member : value.items()) {
+        out.push_back(&member.second);
+        collectElements(member.second, out);
+      }
+    }
+  }
+
+  metadata_table& table_;
+  char const* const base_;
+  std::vector<uint32_t> pendingElements_;
+  std::vector<dynamic> retired_;
+};
+
+namespace {
+
+dynamic parseValue(
+    Input& in, json::metadata_map* map, metadata_recorder* table = nullptr);
 std::string parseString(Input& in);
 dynamic parseNumber(Input& in);
 
@@ -454,18 +665,26 @@ void parseObjectKeyValue(
     dynamic& ret,
     dynamic&& key,
     json::metadata_map* map,
+    metadata_recorder* table,
+    uint32_t entry,
     bool distinct) {
   auto keyLineNumber = in.getLineNum();
   in.skipWhitespace();
   in.expect(':');
   in.skipWhitespace();
   auto valueLineNumber = in.getLineNum();
-  auto value = parseValue(in, map);
+  if (table) {
+    table->setValueBegin(entry, in.getLocation(table->base()));
+  }
+  auto value = parseValue(in, map, table);
   auto [it, inserted] = ret.try_emplace(std::move(key), std::move(value));
   if (!inserted) {
     if (distinct) {
       in.error("duplicate key inserted");
     }
+    if (table) {
+      table->retire(std::move(it->second));
+    }
     it->second = std::move(value);
   }
   if (map) {
@@ -473,9 +692,13 @@ void parseObjectKeyValue(
         &it->second,
         json::parse_metadata{{{keyLineNumber}}, {{valueLineNumber}}});
   }
+  if (table) {
+    table->setAddress(entry, &it->second);
+  }
 }
 
-dynamic parseObject(Input& in, json::metadata_map* map) {
+dynamic parseObject(
+    Input& in, json::metadata_map* map, metadata_recorder* table) {
   DCHECK_EQ(*in, '{');
   ++in;
 
@@ -493,6 +716,12 @@ dynamic parseObject(Input& in, json::metadata_map* map) {
     if (opts.allow_trailing_comma && *in == '}') {
       break;
     }
+    uint32_t entry = 0;
+    if (table) {
+      entry = table->add(in.getLocation(table->base()), {});
+    }
+    // The table only has entries for values; the values inside a key that
+    // is itself an array or object are not recorded.
     dynamic key = parseValue(in, map);
     if (opts.convert_int_keys && key.isInt()) {
       key = key.asString();
@@ -501,7 +730,7 @@ dynamic parseObject(Input& in, json::metadata_map* map) {
           opts.convert_int_keys ? "expected string or integer for object key"
                                 : "expected string for object key");
     }
-    parseObjectKeyValue(in, ret, std::move(key), map, distinct);
+    parseObjectKeyValue(in, ret, std::move(key), map, table, entry, distinct);
 
     in.skipWhitespace();
     if (*in != ',') {
@@ -515,7 +744,8 @@ dynamic parseObject(Input& in, json::metadata_map* map) {
   return ret;
 }
 
-dynamic parseArray(Input& in, json::metadata_map* map) {
+dynamic parseArray(
+    Input& in, json::metadata_map* map, metadata_recorder* table) {
   DCHECK_EQ(*in, '[');
   ++in;
 
@@ -532,7 +762,10 @@ dynamic parseArray(Input& in, json::metadata_map* map) {
     if (in.getOpts().allow_trailing_comma && *in == ']') {
       break;
     }
-    ret.push_back(parseValue(in, map));
+    if (table) {
+      table->addElement(in.getLocation(table->base()));
+    }
+    ret.push_back(parseValue(in, map, table));
     if (map) {
       lineNumbers.push_back(in.getLineNum());
     }
@@ -548,6 +781,9 @@ dynamic parseArray(Input& in, json::metadata_map* map) {
       map->emplace(&ret[i], json::parse_metadata{{{0}}, {{lineNumbers[i]}}});
     }
   }
+  if (table) {
+    table->setElementAddresses(ret);
+  }
   in.expect(']');
 
   return ret;
@@ -716,14 +952,15 @@ std::string parseString(Input& in) {
   return ret;
 }
 
-dynamic parseValue(Input& in, json::metadata_map* map) {
+dynamic parseValue(
+    Input& in, json::metadata_map* map, metadata_recorder* table) {
   RecursionGuard guard(in);
 
   in.skipWhitespace();
   // clang-format off
   return
-      *in == '[' ? parseArray(in, map) :
-      *in == '{' ? parseObject(in, map) :
+      *in == '[' ? parseArray(in, map, table) :
+      *in == '{' ? parseObject(in, map, table) :
       *in == '\"' ? parseString(in) :
       (*in == '-' || (*in >= '0' && *in <= '9')) ? parseNumber(in) :
       in.consume("true") ? true :
@@ -739,6 +976,570 @@ dynamic parseValue(Input& in, json::metadata_map* map) {
   // clang-format on
 }
 
+//////////////////////////////////////////////////////////////////////
+
+// The indexed parser and lazy_document share a tape: a flat record of the
+// position and kind of every value, built by walking the offsets produced
+// by detail::jsonBuildStructuralIndex. The tape builder accepts exactly the
+// same documents as parseValue, but it does not report errors itself:
+// every method returns false on failure and the caller re-parses with the
+// byte-at-a-time parser, which throws the usual parse_error with the right
+// line and context.
+
+using tape_tag = lazy_document::tape_tag;
+using tape_entry = lazy_document::tape_entry;
+
+bool isContainerTag(tape_tag tag) {
+  return tag == tape_tag::array || tag == tape_tag::object;
+}
+
+bool isStringTag(tape_tag tag) {
+  return tag == tape_tag::string || tag == tape_tag::escaped_string ||
+      tag == tape_tag::raw_string;
+}
+
+// Short strings are cheaper to scan inline, long ones go through memchr.
+const char* findBackslash(const char* p, const char* e) {
+  if (e - p < 32) {
+    while (p != e && *p != '\\') {
+      ++p;
+    }
+    return p;
+  }
+  auto bs = static_cast<const char*>(std::memchr(p, '\\', size_t(e - p)));
+  return bs ? bs : e;
+}
+
+bool readHex(const char*& p, const char* e, uint16_t& out) {
+  if (e - p < 4) {
+    return false;
+  }
+  out = 0;
+  for (int i = 0; i < 4; ++i, ++p) {
+    char c = *p;
+    // clang-format off
+    uint16_t v =
+        c >= '0' && c <= '9' ? c - '0' :
+        c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+        c >= 'A' && c <= 'F' ? c - 'A' + 10 :
+        16;
+    // clang-format on
+    if (v == 16) {
+      return false;
+    }
+    out = uint16_t(out * 16 + v);
+  }
+  return true;
+}
+
+// See decodeUnicodeEscape(Input&, std::string&).
+bool decodeUnicodeEscape(const char*& p, const char* e, std::string& out) {
+  uint16_t prefix;
+  if (!readHex(p, e, prefix)) {
+    return false;
+  }
+  char32_t codePoint = prefix;
+  if (utf16_code_unit_is_high_surrogate(prefix)) {
+    uint16_t suffix;
+    if (e - p < 2 || p[0] != '\\' || p[1] != 'u') {
+      return false;
+    }
+    p += 2;
+    if (!readHex(p, e, suffix) || !utf16_code_unit_is_low_surrogate(suffix)) {
+      return false;
+    }
+    codePoint = unicode_code_point_from_utf16_surrogate_pair(prefix, suffix);
+  } else if (!utf16_code_unit_is_bmp(prefix)) {
+    return false;
+  }
+  appendCodePointToUtf8(codePoint, out);
+  return true;
+}
+
+// Appends the decoded contents of a string whose quotes are at p[-1] and
+// e[0]. Returns false on an invalid escape. See parseString(Input&), which
+// also lets NUL bytes through.
+bool unescapeString(const char* p, const char* e, std::string& out) {
+  for (;;) {
+    const char* bs = findBackslash(p, e);
+    out.append(p, bs);
+    if (bs == e) {
+      return true;
+    }
+    p = bs + 1;
+    // The closing quote cannot be escaped, so there is always a character
+    // after the backslash.
+    switch (*p++) {
+      // clang-format off
+      case '\"': out.push_back('\"'); break;
+      case '\\': out.push_back('\\'); break;
+      case '/':  out.push_back('/');  break;
+      case 'b':  out.push_back('\b'); break;
+      case 'f':  out.push_back('\f'); break;
+      case 'n':  out.push_back('\n'); break;
+      case 'r':  out.push_back('\r'); break;
+      case 't':  out.push_back('\t'); break;
+      case 'u':  if (!decodeUnicodeEscape(p, e, out)) { return false; } break;
+      // clang-format on
+      default:
+        return false;
+    }
+  }
+}
+
+class TapeBuilder {
+ public:
+  TapeBuilder(
+      StringPiece range,
+      std::vector<uint32_t> const& index,
+      serialization_opts const& opts,
+      std::vector<tape_entry>& tape)
+      : data_(range.data()),
+        size_(range.size()),
+        cur_(index.data()),
+        end_(index.data() + index.size()),
+        opts_(opts),
+        tape_(tape) {}
+
+  bool build() {
+    // Strings take two index entries and containers at least two, so this
+    // is usually close to the final size.
+    tape_.reserve(size_t(end_ - cur_) / 2 + 1);
+    if (!parseValue(0)) {
+      return false;
+    }
+    // Like parseJson, allow trailing whitespace and anything after a NUL.
+    auto pos = skipWhitespace(lastEnd_);
+    return pos == size_ || data_[pos] == '\0';
+  }
+
+ private:
+  int peek() const { return cur_ != end_ ? data_[*cur_] : EOF; }
+
+  int at(size_t pos) const { return pos < size_ ? data_[pos] : EOF; }
+
+  size_t skipWhitespace(size_t pos) const {
+    while (pos < size_ &&
+           (data_[pos] == ' ' || data_[pos] == '\n' || data_[pos] == '\t' ||
+            data_[pos] == '\r')) {
+      ++pos;
+    }
+    return pos;
+  }
+
+  size_t skipDigits(size_t pos) const {
+    while (pos < size_ && data_[pos] >= '0' && data_[pos] <= '9') {
+      ++pos;
+    }
+    return pos;
+  }
+
+  // Consumes the structural character c at the current offset.
+  bool expect(char c) {
+    if (peek() != c) {
+      return false;
+    }
+    lastEnd_ = *cur_++ + 1;
+    return true;
+  }
+
+  void push(tape_tag tag, size_t begin, size_t end) {
+    tape_.push_back(tape_entry{tag, 0, uint32_t(begin), uint32_t(end)});
+  }
+
+  bool parseValue(unsigned level) {
+    if (level > opts_.recursion_limit) {
+      return false;
+    }
+    switch (peek()) {
+      case '[':
+        return parseArray(level);
+      case '{':
+        return parseObject(level);
+      case '\"':
+        return parseString();
+      case EOF:
+        return false;
+      default:
+        return parseScalar();
+    }
+  }
+
+  bool parseObject(unsigned level) {
+    size_t const self = tape_.size();
+    push(tape_tag::object, *cur_, 0);
+    expect('{');
+
+    uint32_t count = 0;
+    if (!expect('}')) {
+      for (;;) {
+        if (opts_.allow_trailing_comma && peek() == '}') {
+          break;
+        }
+        size_t const key = tape_.size();
+        if (!parseValue(level + 1)) {
+          return false;
+        }
+        auto const tag = tape_[key].tag;
+        if (!(opts_.convert_int_keys && tag == tape_tag::int64_value) &&
+            !opts_.allow_non_string_keys && !isStringTag(tag)) {
+          return false;
+        }
+        if (!expect(':') || !parseValue(level + 1)) {
+          return false;
+        }
+        ++count;
+        if (!expect(',')) {
+          break;
+        }
+      }
+      if (!expect('}')) {
+        return false;
+      }
+    }
+
+    tape_[self].size = count;
+    tape_[self].end = uint32_t(tape_.size());
+    if ((opts_.validate_keys || opts_.convert_int_keys) && count > 1) {
+      return checkDistinctKeys(self);
+    }
+    return true;
+  }
+
+  bool checkDistinctKeys(size_t self) const;
+
+  bool parseArray(unsigned level) {
+    size_t const self = tape_.size();
+    push(tape_tag::array, *cur_, 0);
+    expect('[');
+
+    uint32_t count = 0;
+    if (!expect(']')) {
+      for (;;) {
+        if (opts_.allow_trailing_comma && peek() == ']') {
+          break;
+        }
+        if (!parseValue(level + 1)) {
+          return false;
+        }
+        ++count;
+        if (!expect(',')) {
+          break;
+        }
+      }
+      if (!expect(']')) {
+        return false;
+      }
+    }
+
+    tape_[self].size = count;
+    tape_[self].end = uint32_t(tape_.size());
+    return true;
+  }
+
+  // The index holds both quotes of every string, so the contents are known
+  // up front and only need a scan for escapes. Escaped strings are decoded
+  // once here to validate them.
+  bool parseString() {
+    if (end_ - cur_ < 2) {
+      return false;
+    }
+    const char* p = data_ + cur_[0] + 1;
+    const char* e = data_ + cur_[1];
+    auto tag = tape_tag::string;
+    const char* bs = findBackslash(p, e);
+    if (bs != e) {
+      scratch_.clear();
+      if (!unescapeString(bs, e, scratch_)) {
+        return false;
+      }
+      tag = tape_tag::escaped_string;
+    }
+    push(tag, cur_[0], cur_[1] + 1);
+    lastEnd_ = cur_[1] + 1;
+    cur_ += 2;
+    return true;
+  }
+
+  // Numbers and literals. Only their first byte is in the index, so after
+  // the token we check that nothing but whitespace separates it from the
+  // next structural character.
+  bool parseScalar() {
+    size_t pos = *cur_++;
+    size_t end;
+    tape_tag tag;
+    if (!scanScalar(pos, tag, end)) {
+      return false;
+    }
+    lastEnd_ = end;
+    if (cur_ != end_ && skipWhitespace(end) != *cur_) {
+      return false;
+    }
+    push(tag, pos, end);
+    return true;
+  }
+
+  bool consume(size_t pos, StringPiece literal) const {
+    return StringPiece(data_ + pos, size_ - pos).startsWith(literal);
+  }
+
+  // See parseValue(Input&, json::metadata_map*) and parseNumber(Input&).
+  // Numbers are converted when read, so this also rejects up front what
+  // the conversion would reject: integers out of range and exponents
+  // without digits.
+  bool scanScalar(size_t pos, tape_tag& tag, size_t& end) const {
+    auto const asStrings = opts_.parse_numbers_as_strings;
+    auto const infinity = tape_tag::infinity;
+    int c = at(pos);
+    if (c != '-' && !(c >= '0' && c <= '9')) {
+      auto literal = [&](StringPiece str, tape_tag t) {
+        if (!consume(pos, str)) {
+          return false;
+        }
+        tag = t;
+        end = pos + str.size();
+        return true;
+      };
+      return literal("true", tape_tag::true_value) ||
+          literal("false", tape_tag::false_value) ||
+          literal("null", tape_tag::null_value) ||
+          literal("Infinity", asStrings ? tape_tag::raw_string : infinity) ||
+          literal("NaN", asStrings ? tape_tag::raw_string : tape_tag::nan);
+    }
+
+    bool const negative = c == '-';
+    if (negative && consume(pos, "-Infinity")) {
+      tag = asStrings ? tape_tag::raw_string : tape_tag::negative_infinity;
+      end = pos + constexpr_strlen("-Infinity");
+      return true;
+    }
+
+    size_t integralEnd = skipDigits(negative ? pos + 1 : pos);
+    StringPiece integral(data_ + pos, data_ + integralEnd);
+    if (negative && integral.size() < 2) {
+      return false;
+    }
+
+    int next = at(integralEnd);
+    auto const wasE = next == 'e' || next == 'E';
+    if (next != '.' && !wasE) {
+      end = integralEnd;
+      if (asStrings) {
+        tag = tape_tag::raw_string;
+        return true;
+      }
+      constexpr const char* maxIntStr = "9223372036854775807";
+      constexpr const char* minIntStr = "-9223372036854775808";
+      constexpr auto maxIntLen = constexpr_strlen(maxIntStr);
+      constexpr auto minIntLen = constexpr_strlen(minIntStr);
+      auto extremaLen = negative ? minIntLen : maxIntLen;
+      auto extremaStr = negative ? minIntStr : maxIntStr;
+      if (FOLLY_LIKELY(
+              !opts_.double_fallback || integral.size() < extremaLen) ||
+          (integral.size() == extremaLen && integral <= extremaStr)) {
+        // Anything shorter than INT64_MAX fits.
+        if (integral.size() >= maxIntLen && !tryTo<int64_t>(integral)) {
+          return false;
+        }
+        tag = tape_tag::int64_value;
+      } else {
+        tag = tape_tag::double_value;
+      }
+      return true;
+    }
+
+    end = !wasE ? skipDigits(integralEnd + 1) : integralEnd;
+    if (at(end) == 'e' || at(end) == 'E') {
+      ++end;
+      if (at(end) == '+' || at(end) == '-') {
+        ++end;
+      }
+      auto digitsEnd = skipDigits(end);
+      if (digitsEnd == end && !asStrings) {
+        return false;
+      }
+      end = digitsEnd;
+    }
+    tag = asStrings ? tape_tag::raw_string : tape_tag::double_value;
+    return true;
+  }
+
+  const char* const data_;
+  const size_t size_;
+  const uint32_t* cur_;
+  const uint32_t* const end_;
+  serialization_opts const& opts_;
+  std::vector<tape_entry>& tape_;
+  // Offset one past the last token consumed.
+  size_t lastEnd_{0};
+  std::string scratch_;
+};
+
+// Builds dynamics out of a tape. The tape has been validated, so nothing
+// here can fail.
+class TapeDecoder {
+ public:
+  TapeDecoder(StringPiece data, tape_entry const* tape, bool convertIntKeys)
+      : data_(data.data()), tape_(tape), convertIntKeys_(convertIntKeys) {}
+
+  // Decodes the value at the given index, returns the index past it.
+  size_t decode(size_t index, dynamic& out) const {
+    auto const& e = tape_[index];
+    switch (e.tag) {
+      case tape_tag::array: {
+        out = dynamic::array;
+        out.resize(e.size);
+        size_t i = index + 1;
+        for (auto& element : out) {
+          i = decode(i, element);
+        }
+        return i;
+      }
+      case tape_tag::object: {
+        out = dynamic::object;
+        out.reserve(e.size);
+        size_t i = index + 1;
+        while (i != e.end) {
+          dynamic key;
+          i = decodeKey(i, key);
+          auto it = out.try_emplace(std::move(key), nullptr).first;
+          i = decode(i, it->second);
+        }
+        return i;
+      }
+      default:
+        out = decodeScalar(e);
+        return index + 1;
+    }
+  }
+
+  // Like decode(), applying convert_int_keys.
+  size_t decodeKey(size_t index, dynamic& out) const {
+    auto const& e = tape_[index];
+    if (convertIntKeys_ && e.tag == tape_tag::int64_value) {
+      out = to<std::string>(to<int64_t>(token(e)));
+      return index + 1;
+    }
+    return decode(index, out);
+  }
+
+  dynamic decodeScalar(tape_entry const& e) const {
+    switch (e.tag) {
+      case tape_tag::null_value:
+        return nullptr;
+      case tape_tag::true_value:
+        return true;
+      case tape_tag::false_value:
+        return false;
+      case tape_tag::int64_value:
+        return to<int64_t>(token(e));
+      case tape_tag::double_value:
+        return to<double>(token(e));
+      case tape_tag::infinity:
+        return std::numeric_limits<double>::infinity();
+      case tape_tag::negative_infinity:
+        return -std::numeric_limits<double>::infinity();
+      case tape_tag::nan:
+        return std::numeric_limits<double>::quiet_NaN();
+      case tape_tag::string:
+      case tape_tag::escaped_string:
+      case tape_tag::raw_string:
+        return decodeString(e);
+      case tape_tag::array:
+      case tape_tag::object:
+      default:
+        break;
+    }
+    assume_unreachable();
+  }
+
+  std::string decodeString(tape_entry const& e) const {
+    if (e.tag == tape_tag::raw_string) {
+      return token(e).str();
+    }
+    if (e.tag == tape_tag::string) {
+      return std::string(data_ + e.begin + 1, data_ + e.end - 1);
+    }
+    std::string out;
+    unescapeString(data_ + e.begin + 1, data_ + e.end - 1, out);
+    return out;
+  }
+
+  StringPiece token(tape_entry const& e) const {
+    return StringPiece(data_ + e.begin, data_ + e.end);
+  }
+
+ private:
+  const char* const data_;
+  tape_entry const* const tape_;
+  const bool convertIntKeys_;
+};
+
+bool TapeBuilder::checkDistinctKeys(size_t self) const {
+  TapeDecoder decoder(
+      StringPiece(data_, size_), tape_.data(), opts_.convert_int_keys);
+  dynamic seen = dynamic::object;
+  seen.reserve(tape_[self].size);
+  for (size_t i = self + 1; i != tape_[self].end;) {
+    dynamic key;
+    i = decoder.decodeKey(i, key);
+    if (!seen.try_emplace(std::move(key), nullptr).second) {
+      return false;
+    }
+    i = isContainerTag(tape_[i].tag) ? tape_[i].end : i + 1;
+  }
+  return true;
+}
+
+bool buildTape(
+    StringPiece range,
+    serialization_opts const& opts,
+    std::vector<tape_entry>& tape) {
+  std::vector<uint32_t> index;
+  if (!detail::jsonBuildStructuralIndex(range, index)) {
+    return false;
+  }
+  return TapeBuilder(range, index, opts, tape).build();
+}
+
+// Returns false if the input was not parsed, in which case the caller falls
+// back to the regular parser to produce the result or the error.
+bool parseWithStructuralIndex(
+    StringPiece range, serialization_opts const& opts, dynamic& out) {
+  std::vector<tape_entry> tape;
+  if (!buildTape(range, opts, tape)) {
+    return false;
+  }
+  TapeDecoder(range, tape.data(), opts.convert_int_keys).decode(0, out);
+  return true;
+}
+
+// Builds the tape of a document or throws the parse_error parseJson would.
+// Returns the part of the input the tape refers to.
+StringPiece buildTapeOrThrow(
+    StringPiece range,
+    serialization_opts const& opts,
+    std::vector<tape_entry>& tape) {
+  if (buildTape(range, opts, tape)) {
+    return range;
+  }
+  // Let the regular parser report the error. If there is none, the value
+  // was followed by a NUL byte and whatever came after it confused the
+  // structural index, so index only what the parser consumed.
+  Input in(range, &opts);
+  parseValue(in, nullptr);
+  in.skipWhitespace();
+  if (in.size() && *in != '\0') {
+    in.error("parsing didn't consume all input");
+  }
+  range = range.subpiece(0, range.size() - in.size());
+  tape.clear();
+  if (!buildTape(range, opts, tape)) {
+    throw_exception<parse_error>("json parse error: unsupported input");
+  }
+  return range;
+}
+
 } // namespace
 
 //////////////////////////////////////////////////////////////////////
@@ -755,68 +1556,50 @@ std::array<uint64_t, 2> buildExtraAsciiToEscapeBitmap(StringPiece chars) {
 
 std::string serialize(dynamic const& dyn, serialization_opts const& opts) {
   std::string ret;
+  if (opts.reserve_exact_size) {
+    ret.reserve(serializedSize(dyn, opts));
+  }
   unsigned indentLevel = 0;
   Printer p(ret, opts.pretty_formatting ? &indentLevel : nullptr, &opts);
   p(dyn, nullptr);
   return ret;
 }
 
-// Fast path to determine the longest prefix that can be left
-// unescaped in a string of sizeof(T) bytes packed in an integer of
-// type T.
-template <bool EnableExtraAsciiEscapes, class T>
-size_t firstEscapableInWord(T s, const serialization_opts& opts) {
-  static_assert(std::is_unsigned<T>::value, "Unsigned integer required");
-  static constexpr T kOnes = ~T() / 255; // 0x...0101
-  static constexpr T kMsbs = kOnes * 0x80; // 0x...8080
-
-  // Sets the MSB of bytes < b. Precondition: b < 128.
-  auto isLess = [](T w, uint8_t b) {
-    // A byte is < b iff subtracting b underflows, so we check that
-    // the MSB wasn't set before and it's set after the subtraction.
-    return (w - kOnes * b) & ~w & kMsbs;
-  };
-
-  auto isChar = [&](uint8_t c) {
-    // A byte is == c iff it is 0 if xor'd with c.
-    return isLess(s ^ (kOnes * c), 1);
-  };
+void fd_sink::write(StringPiece data) {
+  checkUnixError(writeFull(fd_, data.data(), data.size()), "write failed");
+}
 
-  // The following masks have the MSB set for each byte of the word
-  // that satisfies the corresponding condition.
-  auto isHigh = s & kMsbs; // >= 128
-  auto isLow = isLess(s, 0x20); // <= 0x1f
-  auto needsEscape = isHigh | isLow | isChar('\\') | isChar('"');
-
-  if /* constexpr */ (EnableExtraAsciiEscapes) {
-    // Deal with optional bitmap for unicode escapes. Escapes can optionally be
-    // set for ascii characters 32 - 127, so the inner loop may run up to 96
-    // times. However, for the case where 0 or a handful of bits are set,
-    // looping will be minimal through use of findFirstSet.
-    for (size_t i = 0, e = opts.extra_ascii_to_escape_bitmap.size(); i < e;
-         ++i) {
-      const auto offset = i * 64;
-      // Clear first 32 characters if this is the first index, since those are
-      // always escaped.
-      auto bitmap = opts.extra_ascii_to_escape_bitmap[i] &
-          (i == 0 ? uint64_t(-1) << 32 : ~0ULL);
-      while (bitmap) {
-        auto bit = folly::findFirstSet(bitmap);
-        needsEscape |= isChar(static_cast<uint8_t>(offset + bit - 1));
-        bitmap &= bitmap - 1;
-      }
-    }
-  }
+void ostream_sink::write(StringPiece data) {
+  out_.write(data.data(), std::streamsize(data.size()));
+}
 
-  if (!needsEscape) {
-    return sizeof(T);
+void serialize(
+    dynamic const& dyn,
+    serialization_opts const& opts,
+    output_sink& sink,
+    size_t buffer_size) {
+  std::string buffer;
+  buffer.reserve(buffer_size);
+  unsigned indentLevel = 0;
+  Printer p(
+      buffer,
+      opts.pretty_formatting ? &indentLevel : nullptr,
+      &opts,
+      &sink,
+      buffer_size);
+  p(dyn, nullptr);
+  if (!buffer.empty()) {
+    p.flush();
   }
+}
 
-  if (folly::kIsLittleEndian) {
-    return folly::findFirstSet(needsEscape) / 8 - 1;
-  } else {
-    return sizeof(T) - folly::findLastSet(needsEscape) / 8;
-  }
+size_t serializedSize(dynamic const& dyn, serialization_opts const& opts) {
+  struct counting_sink : output_sink {
+    void write(StringPiece data) override { size += data.size(); }
+    size_t size = 0;
+  } sink;
+  serialize(dyn, opts, sink, 1024 /* fits in L1 */);
+  return sink.size;
 }
 
 // Escape a string so that it is legal to print it in JSON text.
@@ -827,65 +1610,123 @@ void escapeStringImpl(
     return c < 10 ? c + '0' : c - 10 + 'a';
   };
 
+  auto writeHex = [&](char16_t v) {
+    char buf[] = "\\u\0\0\0\0";
+    buf[2] = hexDigit((v >> 12) & 0x0f);
+    buf[3] = hexDigit((v >> 8) & 0x0f);
+    buf[4] = hexDigit((v >> 4) & 0x0f);
+    buf[5] = hexDigit(v & 0x0f);
+    out.append(buf, 6);
+  };
+  auto writeCodePoint = [&](char32_t cp) {
+    // From the ECMA-404 The JSON Data Interchange Syntax 2nd Edition Dec 2017
+    if (cp < 0x10000u) {
+      // If the code point is in the Basic Multilingual Plane (U+0000 through
+      // U+FFFF), then it may be represented as a six-character sequence:
+      // a reverse solidus, followed by the lowercase letter u, followed by
+      // four hexadecimal digits that encode the code point.
+      writeHex(static_cast<char16_t>(cp));
+    } else {
+      // To escape a code point that is not in the Basic Multilingual Plane,
+      // the character may be represented as a twelve-character sequence,
+      // encoding the UTF-16 surrogate pair corresponding to the code point.
+      writeHex(static_cast<char16_t>(
+          0xd800u + (((cp - 0x10000u) >> 10) & 0x3ffu)));
+      writeHex(static_cast<char16_t>(0xdc00u + ((cp - 0x10000u) & 0x3ffu)));
+    }
+  };
+
+  // Since non-ascii encoding inherently does utf8 validation
+  // we explicitly validate utf8 only if non-ascii encoding is disabled.
+  const bool validate = (opts.validate_utf8 || opts.skip_invalid_utf8) &&
+      !opts.encode_non_ascii;
+  const auto table = detail::makeJsonEscapeTable(
+      EnableExtraAsciiEscapes ? opts.extra_ascii_to_escape_bitmap[0] : 0,
+      EnableExtraAsciiEscapes ? opts.extra_ascii_to_escape_bitmap[1] : 0,
+      opts.encode_non_ascii);
+
+  // Moves `end` back to the start of the code point it falls in, if any.
+  auto codePointStart = [](const unsigned char* begin, auto* end) {
+    for (int i = 0; i < 3 && end > begin && (*end & 0xc0) == 0x80; ++i) {
+      --end;
+    }
+    return end;
+  };
+
   out.push_back('\"');
 
   auto* p = reinterpret_cast<const unsigned char*>(input.begin());
-  auto* q = reinterpret_cast<const unsigned char*>(input.begin());
   auto* e = reinterpret_cast<const unsigned char*>(input.end());
 
   while (p < e) {
     // Find the longest prefix that does not need escaping, and copy
     // it literally into the output string.
-    auto firstEsc = p;
-    while (firstEsc < e) {
-      auto avail = to_unsigned(e - firstEsc);
-      uint64_t word = 0;
-      if (avail >= 8) {
-        word = folly::loadUnaligned<uint64_t>(firstEsc);
+    //
+    // To achieve better spatial and temporal coherence the prefix is
+    // validated right after it is found, while it is still in cache.
+    // For that, validated input is scanned a window at a time.
+    constexpr size_t kValidateWindow = 4096;
+    auto* end = e;
+    if (validate && size_t(e - p) > kValidateWindow) {
+      end = codePointStart(p, p + kValidateWindow);
+    }
+    auto firstEsc = detail::jsonFirstEscapable(p, end, table);
+    if (firstEsc > p) {
+      StringPiece prefix(
+          reinterpret_cast<const char*>(p),
+          reinterpret_cast<const char*>(firstEsc));
+      if (!validate || utf8Validate(prefix)) {
+        out.append(prefix.data(), prefix.size());
+        p = firstEsc;
       } else {
-        word = folly::partialLoadUnaligned<uint64_t>(firstEsc, avail);
-      }
-      auto prefix = firstEscapableInWord<EnableExtraAsciiEscapes>(word, opts);
-      DCHECK_LE(prefix, avail);
-      firstEsc += prefix;
-      if (prefix < 8) {
-        break;
+        // Redo the prefix one code point at a time, which throws or
+        // replaces invalid encodings.
+        while (p < firstEsc) {
+          auto* q = p;
+          char32_t v = utf8ToCodePoint(q, e, opts.skip_invalid_utf8);
+          if (opts.skip_invalid_utf8 && v == U'\ufffd') {
+            out.append(reinterpret_cast<const char*>(u8"\ufffd"));
+          } else {
+            out.append(reinterpret_cast<const char*>(p), q - p);
+          }
+          p = q;
+        }
       }
-    }
-    if (firstEsc > p) {
-      out.append(reinterpret_cast<const char*>(p), firstEsc - p);
-      p = firstEsc;
-      // We can't be in the middle of a multibyte sequence, so we can reset q.
-      q = p;
-      if (p == e) {
-        break;
+      if (p >= end) {
+        continue;
       }
     }
 
     // Handle the next byte that may need escaping.
 
-    // Since non-ascii encoding inherently does utf8 validation
-    // we explicitly validate utf8 only if non-ascii encoding is disabled.
-    if ((opts.validate_utf8 || opts.skip_invalid_utf8) &&
-        !opts.encode_non_ascii) {
-      // To achieve better spatial and temporal coherence
-      // we do utf8 validation progressively along with the
-      // string-escaping instead of two separate passes.
-
-      // As the encoding progresses, q will stay at or ahead of p.
-      CHECK_GE(q, p);
-
-      // As p catches up with q, move q forward.
-      if (q == p) {
-        // calling utf8_decode has the side effect of
-        // checking that utf8 encodings are valid
-        char32_t v = utf8ToCodePoint(q, e, opts.skip_invalid_utf8);
-        if (opts.skip_invalid_utf8 && v == U'\ufffd') {
-          out.append(reinterpret_cast<const char*>(u8"\ufffd"));
-          p = q;
-          continue;
+    if (opts.encode_non_ascii && (*p & 0x80)) {
+      // Encode a run of non-ascii characters at once. Runs long enough to
+      // pay for it are transcoded in bulk if they are valid; the others,
+      // as in mostly latin text, go one code point at a time.
+      constexpr size_t kMinRun = 16;
+      constexpr size_t kMaxRun = 64;
+      auto* run = p;
+      while (run < e && (*run & 0x80) && size_t(run - p) < kMaxRun) {
+        ++run;
+      }
+      if (run < e && (*run & 0x80)) {
+        run = codePointStart(p, run);
+      }
+      StringPiece text(
+          reinterpret_cast<const char*>(p), reinterpret_cast<const char*>(run));
+      if (text.size() >= kMinRun && utf8Validate(text)) {
+        char16_t units[kMaxRun];
+        auto n = utf8ToUtf16(text, units);
+        for (size_t i = 0; i < n; ++i) {
+          writeHex(units[i]);
         }
+        p = run;
+        continue;
+      }
+      while (p < run) {
+        writeCodePoint(utf8ToCodePoint(p, e, opts.skip_invalid_utf8));
       }
+      continue;
     }
 
     auto encodeUnicode = opts.encode_non_ascii && (*p & 0x80);
@@ -901,30 +1742,7 @@ void escapeStringImpl(
       // with value > 127, so size > 1 byte (or they are whitelisted for
       // Unicode encoding).
       // NOTE: char32_t / char16_t are both unsigned.
-      char32_t cp = utf8ToCodePoint(p, e, opts.skip_invalid_utf8);
-      auto writeHex = [&](char16_t v) {
-        char buf[] = "\\u\0\0\0\0";
-        buf[2] = hexDigit((v >> 12) & 0x0f);
-        buf[3] = hexDigit((v >> 8) & 0x0f);
-        buf[4] = hexDigit((v >> 4) & 0x0f);
-        buf[5] = hexDigit(v & 0x0f);
-        out.append(buf, 6);
-      };
-      // From the ECMA-404 The JSON Data Interchange Syntax 2nd Edition Dec 2017
-      if (cp < 0x10000u) {
-        // If the code point is in the Basic Multilingual Plane (U+0000 through
-        // U+FFFF), then it may be represented as a six-character sequence:
-        // a reverse solidus, followed by the lowercase letter u, followed by
-        // four hexadecimal digits that encode the code point.
-        writeHex(static_cast<char16_t>(cp));
-      } else {
-        // To escape a code point that is not in the Basic Multilingual Plane,
-        // the character may be represented as a twelve-character sequence,
-        // encoding the UTF-16 surrogate pair corresponding to the code point.
-        writeHex(static_cast<char16_t>(
-            0xd800u + (((cp - 0x10000u) >> 10) & 0x3ffu)));
-        writeHex(static_cast<char16_t>(0xdc00u + ((cp - 0x10000u) & 0x3ffu)));
-      }
+      writeCodePoint(utf8ToCodePoint(p, e, opts.skip_invalid_utf8));
     } else if (*p == '\\' || *p == '\"') {
       char buf[] = "\\\0";
       buf[1] = char(*p++);
@@ -1029,6 +1847,1302 @@ std::string stripComments(StringPiece jsonC) {
   return result;
 }
 
+//////////////////////////////////////////////////////////////////////
+
+lazy_document::lazy_document(StringPiece json)
+    : lazy_document(json, serialization_opts()) {}
+
+lazy_document::lazy_document(StringPiece json, serialization_opts const& opts)
+    : convertIntKeys_(opts.convert_int_keys) {
+  data_ = buildTapeOrThrow(json, opts, tape_);
+}
+
+dynamic lazy_document::toDynamic() const {
+  return root().toDynamic();
+}
+
+dynamic::Type lazy_document::cursor::type() const {
+  switch (entry().tag) {
+    case tape_tag::null_value:
+      return dynamic::NULLT;
+    case tape_tag::true_value:
+    case tape_tag::false_value:
+      return dynamic::BOOL;
+    case tape_tag::int64_value:
+      return dynamic::INT64;
+    case tape_tag::double_value:
+    case tape_tag::infinity:
+    case tape_tag::negative_infinity:
+    case tape_tag::nan:
+      return dynamic::DOUBLE;
+    case tape_tag::string:
+    case tape_tag::escaped_string:
+    case tape_tag::raw_string:
+      return dynamic::STRING;
+    case tape_tag::array:
+      return dynamic::ARRAY;
+    case tape_tag::object:
+    default:
+      return dynamic::OBJECT;
+  }
+}
+
+void lazy_document::cursor::enforce(dynamic::Type expected) const {
+  if (type() != expected) {
+    throw_exception<TypeError>(
+        expected == dynamic::ARRAY ? "array" : "object", type());
+  }
+}
+
+size_t lazy_document::cursor::size() const {
+  auto const& e = entry();
+  switch (e.tag) {
+    case tape_tag::array:
+    case tape_tag::object:
+      return e.size;
+    case tape_tag::string:
+      return e.end - e.begin - 2;
+    case tape_tag::raw_string:
+      return e.end - e.begin;
+    case tape_tag::escaped_string:
+      return asString().size();
+    default:
+      throw_exception<TypeError>("array/object/string", type());
+  }
+}
+
+bool lazy_document::cursor::keyEquals(uint32_t index, StringPiece key) const {
+  auto const& e = doc_->tape_[index];
+  auto const data = doc_->data_.data();
+  switch (e.tag) {
+    case tape_tag::string:
+      return StringPiece(data + e.begin + 1, data + e.end - 1) == key;
+    case tape_tag::raw_string:
+      return StringPiece(data + e.begin, data + e.end) == key;
+    case tape_tag::escaped_string:
+      return cursor(doc_, index).asString() == key;
+    case tape_tag::int64_value:
+      return doc_->convertIntKeys_ && cursor(doc_, index).asString() == key;
+    default:
+      return false;
+  }
+}
+
+Optional<lazy_document::cursor> lazy_document::cursor::find(
+    StringPiece key) const {
+  enforce(dynamic::OBJECT);
+  Optional<cursor> ret;
+  // Keep going after a match: with duplicate keys parseJson keeps the last.
+  for (size_t i = index_ + 1, end = entry().end; i != end;) {
+    size_t const value = doc_->next(i);
+    if (keyEquals(uint32_t(i), key)) {
+      ret = cursor(doc_, uint32_t(value));
+    }
+    i = doc_->next(value);
+  }
+  return ret;
+}
+
+lazy_document::cursor lazy_document::cursor::operator[](StringPiece key) const {
+  auto ret = find(key);
+  if (!ret) {
+    throw_exception<std::out_of_range>(
+        sformat("couldn't find key {} in dynamic object", key));
+  }
+  return *ret;
+}
+
+lazy_document::cursor lazy_document::cursor::operator[](size_t index) const {
+  enforce(dynamic::ARRAY);
+  if (index >= entry().size) {
+    throw_exception<std::out_of_range>("out of range in dynamic array");
+  }
+  size_t i = index_ + 1;
+  while (index--) {
+    i = doc_->next(i);
+  }
+  return cursor(doc_, uint32_t(i));
+}
+
+std::string lazy_document::cursor::asString() const {
+  auto const& e = entry();
+  if (isStringTag(e.tag)) {
+    return TapeDecoder(doc_->data_, nullptr, false).decodeString(e);
+  }
+  return toDynamic().asString();
+}
+
+int64_t lazy_document::cursor::asInt() const {
+  auto const& e = entry();
+  if (e.tag == tape_tag::int64_value) {
+    return to<int64_t>(raw());
+  }
+  return toDynamic().asInt();
+}
+
+double lazy_document::cursor::asDouble() const {
+  auto const& e = entry();
+  if (e.tag == tape_tag::double_value) {
+    return to<double>(raw());
+  }
+  return toDynamic().asDouble();
+}
+
+bool lazy_document::cursor::asBool() const {
+  auto const& e = entry();
+  if (e.tag == tape_tag::true_value || e.tag == tape_tag::false_value) {
+    return e.tag == tape_tag::true_value;
+  }
+  return toDynamic().asBool();
+}
+
+StringPiece lazy_document::cursor::raw() const {
+  auto const& tape = doc_->tape_;
+  auto const data = doc_->data_.data();
+  auto const& e = entry();
+  if (!isContainerTag(e.tag)) {
+    return StringPiece(data + e.begin, data + e.end);
+  }
+  // Containers do not record where they end in the input. Find the last
+  // leaf of this one; after it come only whitespace, trailing commas and
+  // the closing brackets of the containers around it, ours among them.
+  size_t leaf = index_;
+  size_t closes = 1;
+  while (isContainerTag(tape[leaf].tag) && tape[leaf].size != 0) {
+    auto n = tape[leaf].size * (tape[leaf].tag == tape_tag::object ? 2 : 1);
+    size_t child = leaf + 1;
+    while (--n) {
+      child = doc_->next(child);
+    }
+    leaf = child;
+    closes += isContainerTag(tape[leaf].tag);
+  }
+  size_t pos = isContainerTag(tape[leaf].tag) ? tape[leaf].begin + 1
+                                           : tape[leaf].end;
+  for (;; ++pos) {
+    if ((data[pos] == ']' || data[pos] == '}') && --closes == 0) {
+      break;
+    }
+  }
+  return StringPiece(data + e.begin, data + pos + 1);
+}
+
+dynamic lazy_document::cursor::toDynamic() const {
+  dynamic ret;
+  TapeDecoder(doc_->data_, doc_->tape_.data(), doc_->convertIntKeys_)
+      .decode(index_, ret);
+  return ret;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+namespace {
+
+uint64_t hashKey(StringPiece key) {
+  return hash::SpookyHashV2::Hash64(key.data(), key.size(), 0);
+}
+
+} // namespace
+
+// Copies a document from its tape into a single block of memory: the nodes
+// first, each container's elements (or members, preceded by their hash
+// index) contiguous, then the bytes of all strings.
+class arena_dynamic::builder {
+ public:
+  builder(
+      StringPiece data,
+      std::vector<tape_entry> const& tape,
+      serialization_opts const& opts)
+      : decoder_(data, tape.data(), opts.convert_int_keys),
+        tape_(tape),
+        convertIntKeys_(opts.convert_int_keys) {}
+
+  arena_dynamic const& build(FunctionRef<void*(size_t)> allocate) {
+    // One node per tape entry is enough: object members take two, one for
+    // the key and one for the value. Decoding never makes a string longer
+    // than its json, integer keys included.
+    size_t nodeBytes = tape_.size() * sizeof(arena_dynamic);
+    size_t stringBytes = 0;
+    for (auto const& e : tape_) {
+      if (e.tag == tape_tag::object && e.size > kMaxLinearMembers) {
+        nodeBytes += sizeof(uint32_t) << slotBits(e.size);
+      } else if (
+          isStringTag(e.tag) ||
+          (convertIntKeys_ && e.tag == tape_tag::int64_value)) {
+        stringBytes += e.end - e.begin;
+      }
+    }
+    nodes_ = static_cast<char*>(allocate(nodeBytes + stringBytes));
+    strings_ = nodes_ + nodeBytes;
+
+    auto root = static_cast<arena_dynamic*>(take(sizeof(arena_dynamic)));
+    decode(0, *root);
+    return *root;
+  }
+
+ private:
+  // Hash indexes have at least twice as many slots as members.
+  static uint8_t slotBits(uint32_t members) {
+    return uint8_t(findLastSet(2 * members - 1));
+  }
+
+  void* take(size_t bytes) {
+    auto ret = nodes_;
+    nodes_ += bytes;
+    return ret;
+  }
+
+  size_t decode(size_t index, arena_dynamic& out) {
+    auto const& e = tape_[index];
+    out.size_ = 0;
+    out.slotBits_ = 0;
+    switch (e.tag) {
+      case tape_tag::array: {
+        out.type_ = dynamic::ARRAY;
+        out.size_ = e.size;
+        auto elements =
+            static_cast<arena_dynamic*>(take(e.size * sizeof(arena_dynamic)));
+        out.u_.elements = elements;
+        size_t i = index + 1;
+        for (uint32_t k = 0; k < e.size; ++k) {
+          i = decode(i, elements[k]);
+        }
+        return i;
+      }
+      case tape_tag::object:
+        return decodeObject(index, out);
+      case tape_tag::null_value:
+        out.type_ = dynamic::NULLT;
+        out.u_.integer = 0;
+        break;
+      case tape_tag::true_value:
+      case tape_tag::false_value:
+        out.type_ = dynamic::BOOL;
+        out.u_.boolean = e.tag == tape_tag::true_value;
+        break;
+      case tape_tag::int64_value:
+        out.type_ = dynamic::INT64;
+        out.u_.integer = to<int64_t>(decoder_.token(e));
+        break;
+      case tape_tag::double_value:
+        out.type_ = dynamic::DOUBLE;
+        out.u_.dbl = to<double>(decoder_.token(e));
+        break;
+      case tape_tag::infinity:
+      case tape_tag::negative_infinity:
+      case tape_tag::nan:
+        out.type_ = dynamic::DOUBLE;
+        out.u_.dbl = decoder_.decodeScalar(e).getDouble();
+        break;
+      case tape_tag::string:
+        setString(out, decoder_.token(e).subpiece(1, e.end - e.begin - 2));
+        break;
+      case tape_tag::raw_string:
+        setString(out, decoder_.token(e));
+        break;
+      case tape_tag::escaped_string:
+      default:
+        setString(out, decoder_.decodeString(e));
+        break;
+    }
+    return index + 1;
+  }
+
+  void setString(arena_dynamic& out, StringPiece str) {
+    out.type_ = dynamic::STRING;
+    out.size_ = uint32_t(str.size());
+    out.u_.str = strings_;
+    std::memcpy(strings_, str.data(), str.size());
+    strings_ += str.size();
+  }
+
+  size_t decodeKey(size_t index, arena_dynamic& out) {
+    auto const& e = tape_[index];
+    if (convertIntKeys_ && e.tag == tape_tag::int64_value) {
+      setString(out, to<std::string>(to<int64_t>(decoder_.token(e))));
+      return index + 1;
+    }
+    return decode(index, out);
+  }
+
+  size_t decodeObject(size_t index, arena_dynamic& out) {
+    auto const& e = tape_[index];
+    out.type_ = dynamic::OBJECT;
+    uint32_t* slots = nullptr;
+    size_t mask = 0;
+    if (e.size > kMaxLinearMembers) {
+      out.slotBits_ = slotBits(e.size);
+      mask = (size_t(1) << out.slotBits_) - 1;
+      slots = static_cast<uint32_t*>(take(sizeof(uint32_t) * (mask + 1)));
+      std::fill(slots, slots + mask + 1, 0);
+    }
+    auto members = static_cast<member*>(take(e.size * sizeof(member)));
+    out.u_.members = members;
+
+    // Duplicate keys overwrite the earlier value in place, like the
+    // try_emplace in parseObjectKeyValue.
+    uint32_t n = 0;
+    for (size_t i = index + 1; i != e.end;) {
+      auto& key = members[n].first;
+      i = decodeKey(i, key);
+      member* dup = nullptr;
+      uint32_t* slot = nullptr;
+      if (key.isString() && slots) {
+        StringPiece str(key.u_.str, key.size_);
+        size_t h = hashKey(str) & mask;
+        for (; slots[h]; h = (h + 1) & mask) {
+          auto& m = members[slots[h] - 1];
+          if (StringPiece(m.first.u_.str, m.first.size_) == str) {
+            dup = &m;
+            break;
+          }
+        }
+        slot = &slots[h];
+      } else {
+        dup = findLinear(members, n, key);
+      }
+      if (dup) {
+        i = decode(i, dup->second);
+      } else {
+        i = decode(i, members[n].second);
+        if (slot) {
+          *slot = ++n;
+        } else {
+          ++n;
+        }
+      }
+    }
+    out.size_ = n;
+    return e.end;
+  }
+
+  // Non-string keys, allowed by allow_non_string_keys, compare as dynamic.
+  static member* findLinear(member* members, uint32_t n, arena_dynamic& key) {
+    if (key.isString()) {
+      StringPiece str(key.u_.str, key.size_);
+      for (uint32_t k = 0; k < n; ++k) {
+        auto& m = members[k].first;
+        if (m.isString() && StringPiece(m.u_.str, m.size_) == str) {
+          return &members[k];
+        }
+      }
+      return nullptr;
+    }
+    auto const d = key.toDynamic();
+    for (uint32_t k = 0; k < n; ++k) {
+      if (!members[k].first.isString() && members[k].first.toDynamic() == d) {
+        return &members[k];
+      }
+    }
+    return nullptr;
+  }
+
+  TapeDecoder decoder_;
+  std::vector<tape_entry> const& tape_;
+  bool const convertIntKeys_;
+  char* nodes_{nullptr};
+  char* strings_{nullptr};
+};
+
+arena_dynamic const& parseJsonToArena(
+    StringPiece range,
+    serialization_opts const& opts,
+    FunctionRef<void*(size_t)> allocate) {
+  std::vector<tape_entry> tape;
+  range = buildTapeOrThrow(range, opts, tape);
+  return arena_dynamic::builder(range, tape, opts).build(allocate);
+}
+
+size_t arena_dynamic::size() const {
+  if (isArray() || isObject() || isString()) {
+    return size_;
+  }
+  throw_exception<TypeError>("array/object/string", type());
+}
+
+arena_dynamic const* arena_dynamic::get_ptr(StringPiece key) const {
+  enforce(dynamic::OBJECT, "object");
+  auto const m = members();
+  if (slotBits_ == 0) {
+    for (uint32_t k = 0; k < size_; ++k) {
+      auto const& first = m[k].first;
+      if (first.isString() && StringPiece(first.u_.str, first.size_) == key) {
+        return &m[k].second;
+      }
+    }
+    return nullptr;
+  }
+  // Only string keys are in the index.
+  auto const s = slots();
+  size_t const mask = (size_t(1) << slotBits_) - 1;
+  for (size_t h = hashKey(key) & mask; s[h]; h = (h + 1) & mask) {
+    auto const& first = m[s[h] - 1].first;
+    if (StringPiece(first.u_.str, first.size_) == key) {
+      return &m[s[h] - 1].second;
+    }
+  }
+  return nullptr;
+}
+
+arena_dynamic const& arena_dynamic::at(StringPiece key) const {
+  auto ret = get_ptr(key);
+  if (!ret) {
+    throw_exception<std::out_of_range>(
+        sformat("couldn't find key {} in dynamic object", key));
+  }
+  return *ret;
+}
+
+std::string arena_dynamic::asString() const {
+  return isString() ? getString().str() : toDynamic().asString();
+}
+
+int64_t arena_dynamic::asInt() const {
+  return isInt() ? u_.integer : toDynamic().asInt();
+}
+
+double arena_dynamic::asDouble() const {
+  return isDouble() ? u_.dbl : toDynamic().asDouble();
+}
+
+bool arena_dynamic::asBool() const {
+  return isBool() ? u_.boolean : toDynamic().asBool();
+}
+
+dynamic arena_dynamic::toDynamic() const {
+  switch (type()) {
+    case dynamic::NULLT:
+      return nullptr;
+    case dynamic::BOOL:
+      return u_.boolean;
+    case dynamic::INT64:
+      return u_.integer;
+    case dynamic::DOUBLE:
+      return u_.dbl;
+    case dynamic::STRING:
+      return getString();
+    case dynamic::ARRAY: {
+      dynamic ret = dynamic::array;
+      ret.reserve(size_);
+      for (auto const& element : *this) {
+        ret.push_back(element.toDynamic());
+      }
+      return ret;
+    }
+    case dynamic::OBJECT:
+    default: {
+      dynamic ret = dynamic::object;
+      ret.reserve(size_);
+      for (auto const& m : items()) {
+        ret.insert(m.first.toDynamic(), m.second.toDynamic());
+      }
+      return ret;
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+class parse_handler::failure : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+void parse_handler::fail(char const* what) {
+  throw_exception<failure>(what);
+}
+
+void parse_handler::on_non_string_key(dynamic&&) {
+  fail("non-string object keys are not supported by this handler");
+}
+
+streaming_parser::streaming_parser(
+    parse_handler& handler, serialization_opts const& opts)
+    : handler_(handler),
+      recursionLimit_(opts.recursion_limit),
+      allowTrailingComma_(opts.allow_trailing_comma),
+      allowNonStringKeys_(opts.allow_non_string_keys),
+      convertIntKeys_(opts.convert_int_keys),
+      validateKeys_(opts.validate_keys),
+      doubleFallback_(opts.double_fallback),
+      numbersAsStrings_(opts.parse_numbers_as_strings) {}
+
+void streaming_parser::feed(StringPiece chunk) {
+  pos_ = chunk.begin();
+  end_ = chunk.end();
+  tokenBegin_ = pos_;
+  try {
+    run();
+  } catch (parse_handler::failure const& e) {
+    error(e.what());
+  }
+}
+
+void streaming_parser::finish() {
+  pos_ = end_ = tokenBegin_ = nullptr;
+  eof_ = true;
+  try {
+    run();
+  } catch (parse_handler::failure const& e) {
+    error(e.what());
+  }
+  DCHECK(state_ == state::done || state_ == state::ignore);
+}
+
+void streaming_parser::error(char const* what) const {
+  auto context = StringPiece(pos_, end_).subpiece(0, 16 /* arbitrary */);
+  throw make_parse_error(line_, context.str(), what);
+}
+
+// Returns false if the chunk ends first. At the end of input the caller
+// sees EOF, as Input would.
+bool streaming_parser::skipWhitespace() {
+  for (; pos_ != end_; ++pos_) {
+    char c = *pos_;
+    if (c == '\n') {
+      ++line_;
+    } else if (c != ' ' && c != '\t' && c != '\r') {
+      return true;
+    }
+  }
+  return eof_;
+}
+
+// The states mirror parseValue, parseObject and parseArray. The token
+// states return false when they need more input.
+void streaming_parser::run() {
+  for (;;) {
+    switch (state_) {
+      case state::value:
+        if (!skipWhitespace()) {
+          return;
+        }
+        startValue();
+        break;
+      case state::object_first:
+      case state::object_next:
+        if (!skipWhitespace()) {
+          return;
+        }
+        if (current() == '}' &&
+            (state_ == state::object_first || allowTrailingComma_)) {
+          ++pos_;
+          endContainer();
+          break;
+        }
+        inKey_ = true;
+        state_ = state::value;
+        break;
+      case state::colon:
+        if (!skipWhitespace()) {
+          return;
+        }
+        if (current() != ':') {
+          error("expected ':'");
+        }
+        ++pos_;
+        inKey_ = false;
+        state_ = state::value;
+        break;
+      case state::array_first:
+      case state::array_next:
+        if (!skipWhitespace()) {
+          return;
+        }
+        if (current() == ']' &&
+            (state_ == state::array_first || allowTrailingComma_)) {
+          ++pos_;
+          endContainer();
+          break;
+        }
+        state_ = state::value;
+        break;
+      case state::after_value: {
+        if (stack_.empty()) {
+          state_ = state::done;
+          break;
+        }
+        if (!skipWhitespace()) {
+          return;
+        }
+        bool const object = stack_.back() == '{';
+        if (current() == ',') {
+          ++pos_;
+          state_ = object ? state::object_next : state::array_next;
+          break;
+        }
+        if (current() != (object ? '}' : ']')) {
+          error(object ? "expected '}'" : "expected ']'");
+        }
+        ++pos_;
+        endContainer();
+        break;
+      }
+      case state::string:
+        if (!scanString()) {
+          return;
+        }
+        break;
+      case state::escape:
+        if (!scanEscape()) {
+          return;
+        }
+        break;
+      case state::hex:
+        if (!scanHex()) {
+          return;
+        }
+        break;
+      case state::surrogate:
+        if (!scanSurrogate()) {
+          return;
+        }
+        break;
+      case state::number:
+        if (!scanNumber()) {
+          return;
+        }
+        break;
+      case state::integer_end:
+        if (!skipWhitespace()) {
+          return;
+        }
+        emitScalar(std::move(integer_));
+        break;
+      case state::literal:
+        if (!scanLiteral()) {
+          return;
+        }
+        break;
+      case state::done:
+        if (!skipWhitespace() || pos_ == end_) {
+          return;
+        }
+        if (*pos_ != '\0') {
+          error("parsing didn't consume all input");
+        }
+        state_ = state::ignore;
+        break;
+      case state::ignore:
+      default:
+        pos_ = end_;
+        return;
+    }
+  }
+}
+
+void streaming_parser::startValue() {
+  if (stack_.size() > recursionLimit_) {
+    error("recursion limit exceeded");
+  }
+  int const c = current();
+  switch (c) {
+    case '[':
+    case '{':
+      if (inKey_) {
+        serialization_opts opts;
+        opts.validate_keys = validateKeys_;
+        opts.convert_int_keys = convertIntKeys_;
+        keys_.push_back(
+            {stack_.size(), std::make_unique<dynamic_builder>(opts)});
+        inKey_ = false;
+      }
+      ++pos_;
+      stack_.push_back(char(c));
+      if (c == '{') {
+        handler().on_begin_object();
+        state_ = state::object_first;
+      } else {
+        handler().on_begin_array();
+        state_ = state::array_first;
+      }
+      return;
+    case '\"':
+      ++pos_;
+      tokenBegin_ = pos_;
+      buffered_ = false;
+      buf_.clear();
+      state_ = state::string;
+      return;
+    case 't':
+      literal_ = "true";
+      break;
+    case 'f':
+      literal_ = "false";
+      break;
+    case 'n':
+      literal_ = "null";
+      break;
+    case 'I':
+      literal_ = "Infinity";
+      break;
+    case 'N':
+      literal_ = "NaN";
+      break;
+    default:
+      if (c == '-' || (c >= '0' && c <= '9')) {
+        tokenBegin_ = pos_;
+        buf_.clear();
+        numberPart_ = number_part::sign;
+        state_ = state::number;
+        return;
+      }
+      error("expected json value");
+  }
+  matched_ = 0;
+  state_ = state::literal;
+}
+
+void streaming_parser::endContainer() {
+  if (stack_.back() == '{') {
+    handler().on_end_object();
+  } else {
+    handler().on_end_array();
+  }
+  stack_.pop_back();
+  state_ = state::after_value;
+  if (!keys_.empty() && keys_.back().depth == stack_.size()) {
+    dynamic key = std::move(keys_.back().builder->result());
+    keys_.pop_back();
+    inKey_ = true;
+    emitScalar(std::move(key));
+  }
+}
+
+parse_handler& streaming_parser::handler() {
+  return keys_.empty() ? handler_ : *keys_.back().builder;
+}
+
+// See parseString(Input&). Strings that end in the chunk they started in
+// and have no escapes are passed to the handler without a copy.
+bool streaming_parser::scanString() {
+  char const* p = pos_;
+  for (; p != end_ && *p != '\"' && *p != '\\'; ++p) {
+    if (*p == '\n') {
+      ++line_;
+    }
+  }
+  if (p == end_) {
+    buf_.append(pos_, p);
+    buffered_ = true;
+    pos_ = p;
+    if (!eof_) {
+      return false;
+    }
+    error("unterminated string");
+  }
+  if (*p == '\"') {
+    if (buffered_) {
+      buf_.append(pos_, p);
+    }
+    pos_ = p + 1;
+    emitString(buffered_ ? StringPiece(buf_) : StringPiece(tokenBegin_, p));
+    return true;
+  }
+  buf_.append(pos_, p);
+  buffered_ = true;
+  pos_ = p + 1;
+  state_ = state::escape;
+  return true;
+}
+
+bool streaming_parser::scanEscape() {
+  if (pos_ == end_ && !eof_) {
+    return false;
+  }
+  int const c = current();
+  switch (c) {
+    // clang-format off
+    case '\"': buf_.push_back('\"'); break;
+    case '\\': buf_.push_back('\\'); break;
+    case '/':  buf_.push_back('/');  break;
+    case 'b':  buf_.push_back('\b'); break;
+    case 'f':  buf_.push_back('\f'); break;
+    case 'n':  buf_.push_back('\n'); break;
+    case 'r':  buf_.push_back('\r'); break;
+    case 't':  buf_.push_back('\t'); break;
+    case 'u':  break;
+    // clang-format on
+    default:
+      error(to<std::string>("unknown escape ", c, " in string").c_str());
+  }
+  ++pos_;
+  matched_ = 0;
+  highSurrogate_ = 0;
+  state_ = c == 'u' ? state::hex : state::string;
+  return true;
+}
+
+// See decodeUnicodeEscape(Input&, std::string&): the four characters are
+// all read before any is checked.
+bool streaming_parser::scanHex() {
+  while (matched_ < 4 && pos_ != end_) {
+    hex_[matched_++] = *pos_++;
+  }
+  if (matched_ < 4) {
+    if (!eof_) {
+      return false;
+    }
+    error("expected 4 hex digits");
+  }
+  uint16_t value = 0;
+  for (char c : hex_) {
+    // clang-format off
+    value = uint16_t(value * 16 + (
+        c >= '0' && c <= '9' ? c - '0' :
+        c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+        c >= 'A' && c <= 'F' ? c - 'A' + 10 :
+        (error("invalid hex digit"), 0)));
+    // clang-format on
+  }
+  char32_t codePoint = value;
+  if (highSurrogate_) {
+    if (!utf16_code_unit_is_low_surrogate(value)) {
+      error("second character in surrogate pair is invalid");
+    }
+    codePoint =
+        unicode_code_point_from_utf16_surrogate_pair(highSurrogate_, value);
+  } else if (utf16_code_unit_is_high_surrogate(value)) {
+    highSurrogate_ = value;
+    matched_ = 0;
+    state_ = state::surrogate;
+    return true;
+  } else if (!utf16_code_unit_is_bmp(value)) {
+    error("invalid unicode code point (in range [0xdc00,0xdfff])");
+  }
+  appendCodePointToUtf8(codePoint, buf_);
+  state_ = state::string;
+  return true;
+}
+
+bool streaming_parser::scanSurrogate() {
+  while (matched_ < 2 && pos_ != end_) {
+    if (*pos_ != "\\u"[matched_]) {
+      break;
+    }
+    ++matched_;
+    ++pos_;
+  }
+  if (matched_ < 2) {
+    if (pos_ == end_ && !eof_) {
+      return false;
+    }
+    error(
+        "expected another unicode escape for second half of "
+        "surrogate pair");
+  }
+  matched_ = 0;
+  state_ = state::hex;
+  return true;
+}
+
+// See parseNumber(Input&). The token is scanned with the same grammar and
+// converted once it is complete.
+bool streaming_parser::scanNumber() {
+  for (; pos_ != end_; ++pos_) {
+    char const c = *pos_;
+    bool const digit = c >= '0' && c <= '9';
+    switch (numberPart_) {
+      case number_part::sign:
+        numberPart_ = c == '-' ? number_part::minus : number_part::integral;
+        continue;
+      case number_part::minus:
+        if (c == 'I') {
+          literal_ = "-Infinity";
+          matched_ = 1;
+          state_ = state::literal;
+          return true;
+        }
+        if (digit) {
+          numberPart_ = number_part::integral;
+          continue;
+        }
+        break;
+      case number_part::integral:
+      case number_part::fraction:
+        if (digit) {
+          continue;
+        }
+        if (c == '.' && numberPart_ == number_part::integral) {
+          numberPart_ = number_part::fraction;
+          continue;
+        }
+        if (c == 'e' || c == 'E') {
+          numberPart_ = number_part::e;
+          continue;
+        }
+        break;
+      case number_part::e:
+        numberPart_ = number_part::exp;
+        if (c == '+' || c == '-') {
+          continue;
+        }
+        [[fallthrough]];
+      case number_part::exp:
+      default:
+        if (digit) {
+          continue;
+        }
+        break;
+    }
+    break;
+  }
+  if (pos_ == end_ && !eof_) {
+    buf_.append(tokenBegin_, pos_);
+    return false;
+  }
+  if (buf_.empty()) {
+    emitNumber(StringPiece(tokenBegin_, pos_));
+  } else {
+    buf_.append(tokenBegin_, pos_);
+    emitNumber(buf_);
+  }
+  return true;
+}
+
+bool streaming_parser::scanLiteral() {
+  for (; literal_[matched_] && pos_ != end_; ++matched_, ++pos_) {
+    if (*pos_ != literal_[matched_]) {
+      break;
+    }
+  }
+  if (!literal_[matched_]) {
+    emitLiteral();
+    return true;
+  }
+  if (pos_ == end_ && !eof_) {
+    return false;
+  }
+  error(
+      literal_[0] == '-' ? "expected digits after `-'"
+                         : "expected json value");
+}
+
+void streaming_parser::emitString(StringPiece str) {
+  if (inKey_) {
+    handler().on_key(str);
+    state_ = state::colon;
+  } else {
+    handler().on_string(str);
+    state_ = state::after_value;
+  }
+}
+
+void streaming_parser::emitNumber(StringPiece token) {
+  bool const negative = token.front() == '-';
+  size_t integralSize = negative ? 1 : 0;
+  while (integralSize < token.size() && token[integralSize] >= '0' &&
+         token[integralSize] <= '9') {
+    ++integralSize;
+  }
+  auto integral = token.subpiece(0, integralSize);
+  if (negative && integral.size() < 2) {
+    error("expected digits after `-'");
+  }
+
+  if (integral.size() != token.size()) {
+    return numbersAsStrings_ ? emitScalar(token)
+                             : emitScalar(to<double>(token));
+  }
+  if (numbersAsStrings_) {
+    return emitScalar(integral);
+  }
+  constexpr const char* maxIntStr = "9223372036854775807";
+  constexpr const char* minIntStr = "-9223372036854775808";
+  constexpr auto maxIntLen = constexpr_strlen(maxIntStr);
+  constexpr auto minIntLen = constexpr_strlen(minIntStr);
+  auto extremaLen = negative ? minIntLen : maxIntLen;
+  auto extremaStr = negative ? minIntStr : maxIntStr;
+  if (FOLLY_LIKELY(!doubleFallback_ || integral.size() < extremaLen) ||
+      (integral.size() == extremaLen && integral <= extremaStr)) {
+    integer_ = to<int64_t>(integral);
+  } else {
+    integer_ = to<double>(integral);
+  }
+  // parseNumber skips the whitespace after an integer before returning, so
+  // errors about it, such as a duplicate key, are reported past it.
+  state_ = state::integer_end;
+}
+
+void streaming_parser::emitLiteral() {
+  auto const inf = std::numeric_limits<double>::infinity();
+  auto const nan = std::numeric_limits<double>::quiet_NaN();
+  switch (literal_[0]) {
+    case 't':
+      return emitScalar(true);
+    case 'f':
+      return emitScalar(false);
+    case 'n':
+      return emitScalar(nullptr);
+    case 'N':
+      return emitScalar(numbersAsStrings_ ? dynamic(literal_) : dynamic(nan));
+    case 'I':
+      return emitScalar(numbersAsStrings_ ? dynamic(literal_) : dynamic(inf));
+    default:
+      return emitScalar(numbersAsStrings_ ? dynamic(literal_) : dynamic(-inf));
+  }
+}
+
+// Numbers, literals and container keys go through a dynamic, so that object
+// keys get the same treatment as in parseObject.
+void streaming_parser::emitScalar(dynamic&& value) {
+  if (!inKey_) {
+    state_ = state::after_value;
+    switch (value.type()) {
+      case dynamic::NULLT:
+        return handler().on_null();
+      case dynamic::BOOL:
+        return handler().on_bool(value.getBool());
+      case dynamic::INT64:
+        return handler().on_int(value.getInt());
+      case dynamic::DOUBLE:
+        return handler().on_double(value.getDouble());
+      case dynamic::STRING:
+      case dynamic::ARRAY:
+      case dynamic::OBJECT:
+      default:
+        return handler().on_string(value.getString());
+    }
+  }
+  state_ = state::colon;
+  if (value.isString()) {
+    handler().on_key(value.getString());
+  } else if (convertIntKeys_ && value.isInt()) {
+    handler().on_key(value.asString());
+  } else if (allowNonStringKeys_) {
+    handler().on_non_string_key(std::move(value));
+  } else {
+    error(
+        convertIntKeys_ ? "expected string or integer for object key"
+                        : "expected string for object key");
+  }
+}
+
+dynamic_builder::dynamic_builder(serialization_opts const& opts)
+    : distinct_(opts.validate_keys || opts.convert_int_keys) {}
+
+// See parseObjectKeyValue.
+dynamic& dynamic_builder::add(dynamic&& value) {
+  if (stack_.empty()) {
+    root_ = std::move(value);
+    return root_;
+  }
+  dynamic& top = *stack_.back();
+  if (top.isArray()) {
+    top.push_back(std::move(value));
+    return *std::prev(top.end());
+  }
+  auto [it, inserted] = top.try_emplace(std::move(key_), std::move(value));
+  if (!inserted) {
+    if (distinct_) {
+      if (!value.isObject() && !value.isArray()) {
+        fail("duplicate key inserted");
+      }
+      duplicateDepth_ = stack_.size() + 1;
+    }
+    it->second = std::move(value);
+  }
+  return it->second;
+}
+
+void dynamic_builder::pop() {
+  if (stack_.size() == duplicateDepth_) {
+    fail("duplicate key inserted");
+  }
+  stack_.pop_back();
+}
+
+void dynamic_builder::on_begin_object() {
+  stack_.push_back(&add(dynamic::object));
+}
+
+void dynamic_builder::on_end_object() {
+  pop();
+}
+
+void dynamic_builder::on_begin_array() {
+  stack_.push_back(&add(dynamic::array));
+}
+
+void dynamic_builder::on_end_array() {
+  pop();
+}
+
+void dynamic_builder::on_key(StringPiece key) {
+  key_ = key;
+}
+
+void dynamic_builder::on_non_string_key(dynamic&& key) {
+  key_ = std::move(key);
+}
+
+void dynamic_builder::on_null() {
+  add(nullptr);
+}
+
+void dynamic_builder::on_bool(bool value) {
+  add(value);
+}
+
+void dynamic_builder::on_int(int64_t value) {
+  add(value);
+}
+
+void dynamic_builder::on_double(double value) {
+  add(value);
+}
+
+void dynamic_builder::on_string(StringPiece value) {
+  add(value);
+}
+
+namespace {
+
+// Inputs smaller than this are not worth handing to another thread.
+constexpr size_t kMinParallelSpan = 64 << 10;
+
+// Runs work on the calling thread and on up to threads - 1 others.
+void runConcurrently(size_t threads, FunctionRef<void()> work) {
+  std::vector<std::thread> workers;
+  try {
+    workers.reserve(threads);
+    for (size_t i = 1; i < threads; ++i) {
+      workers.emplace_back([&] { work(); });
+    }
+  } catch (...) {
+    // Out of threads or memory. Make do with the threads we got, which
+    // must be joined in any case; work() takes its share from a queue, so
+    // fewer threads only make it slower.
+  }
+  work();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+// Offsets of the commas that split the elements of the top-level array
+// opening at `open` into at most `count` spans of similar size, followed
+// by the offset of the closing bracket. Empty if the array doesn't close.
+std::vector<size_t> splitArray(StringPiece range, size_t open, size_t count) {
+  std::vector<size_t> splits;
+  size_t const span = (range.size() - open) / count;
+  size_t next = open + span;
+  size_t depth = 0;
+  bool closed = false;
+  detail::jsonForEachOperator(range.subpiece(open), [&](size_t offset) {
+    offset += open;
+    switch (range[offset]) {
+      case '[':
+      case '{':
+        ++depth;
+        break;
+      case ']':
+      case '}':
+        if (--depth == 0) {
+          splits.push_back(offset);
+          closed = true;
+          return false;
+        }
+        break;
+      case ',':
+        if (depth == 1 && offset >= next) {
+          splits.push_back(offset);
+          next = offset + span;
+        }
+        break;
+      default:
+        break;
+    }
+    return true;
+  });
+  if (!closed) {
+    splits.clear();
+  }
+  return splits;
+}
+
+// Parses the array elements from the start of range up to `end`, which is
+// the comma after the last one or, for the last span, the closing bracket;
+// see parseArray. Returns false if they don't end exactly there.
+bool parseArraySpan(
+    StringPiece range,
+    char const* end,
+    bool last,
+    serialization_opts const& opts,
+    std::vector<dynamic>& out) {
+  Input in(range, &opts);
+  // The enclosing array.
+  RecursionGuard guard(in);
+  for (;;) {
+    out.push_back(parseValue(in, nullptr));
+    in.skipWhitespace();
+    if (in.begin() == end) {
+      return true;
+    }
+    if (*in != ',') {
+      return false;
+    }
+    ++in;
+    in.skipWhitespace();
+    if (last && opts.allow_trailing_comma && in.begin() == end) {
+      return true;
+    }
+  }
+}
+
+// Parses one line of newline-delimited json, unless it is blank.
+void parseLine(
+    StringPiece line,
+    serialization_opts const& opts,
+    unsigned lineNum,
+    std::vector<dynamic>& out) {
+  Input in(line, &opts, lineNum);
+  in.skipWhitespace();
+  if (!in.size()) {
+    return;
+  }
+  out.push_back(parseValue(in, nullptr));
+  in.skipWhitespace();
+  if (in.size() && *in != '\0') {
+    in.error("parsing didn't consume all input");
+  }
+}
+
+dynamic concat(std::vector<std::vector<dynamic>>& parts) {
+  size_t size = 0;
+  for (auto const& part : parts) {
+    size += part.size();
+  }
+  dynamic ret = dynamic::array;
+  ret.reserve(size);
+  for (auto& part : parts) {
+    for (auto& value : part) {
+      ret.push_back(std::move(value));
+    }
+    std::vector<dynamic>().swap(part);
+  }
+  return ret;
+}
+
+} // namespace
+
+parse_metadata const* metadata_table::find(dynamic const* value) const {
+  std::less<dynamic const*> less;
+  auto it = std::lower_bound(
+      index_.begin(), index_.end(), value, [&](auto const& e, auto v) {
+        return less(e.first, v);
+      });
+  if (it == index_.end() || it->first != value) {
+    return nullptr;
+  }
+  return &entries_[it->second];
+}
+
+void metadata_table::clear() {
+  entries_.clear();
+  index_.clear();
+}
+
 } // namespace json
 
 //////////////////////////////////////////////////////////////////////
@@ -1056,11 +3170,41 @@ dynamic parseJsonWithMetadata(
   return ret;
 }
 
+dynamic parseJsonWithMetadata(StringPiece range, json::metadata_table& table) {
+  return parseJsonWithMetadata(range, json::serialization_opts(), table);
+}
+
+dynamic parseJsonWithMetadata(
+    StringPiece range,
+    json::serialization_opts const& opts,
+    json::metadata_table& table) {
+  json::Input in(range, &opts);
+  json::metadata_recorder recorder(table, range);
+
+  in.skipWhitespace();
+  recorder.add({}, in.getLocation(range.begin()));
+  auto ret = parseValue(in, nullptr, &recorder);
+
+  in.skipWhitespace();
+  if (in.size() && *in != '\0') {
+    in.error("parsing didn't consume all input");
+  }
+  recorder.finish();
+  return ret;
+}
+
 dynamic parseJson(StringPiece range) {
   return parseJson(range, json::serialization_opts());
 }
 
 dynamic parseJson(StringPiece range, json::serialization_opts const& opts) {
+  if (opts.parse_with_structural_index) {
+    dynamic ret;
+    if (json::parseWithStructuralIndex(range, opts, ret)) {
+      return ret;
+    }
+  }
+
   json::Input in(range, &opts);
 
   auto ret = parseValue(in, nullptr);
@@ -1071,6 +3215,126 @@ dynamic parseJson(StringPiece range, json::serialization_opts const& opts) {
   return ret;
 }
 
+dynamic parseJsonParallel(
+    StringPiece range, json::serialization_opts const& opts, size_t threads) {
+  if (threads == 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+  size_t open = 0;
+  while (open < range.size() &&
+         (range[open] == ' ' || range[open] == '\n' || range[open] == '\t' ||
+          range[open] == '\r')) {
+    ++open;
+  }
+  size_t const spans =
+      std::min(threads * 4, range.size() / json::kMinParallelSpan);
+  if (threads < 2 || spans < 2 || open == range.size() || range[open] != '[') {
+    return parseJson(range, opts);
+  }
+  auto const splits = json::splitArray(range, open, spans);
+  if (splits.size() < 2) {
+    return parseJson(range, opts);
+  }
+
+  std::vector<std::vector<dynamic>> parts(splits.size());
+  std::atomic<size_t> nextPart{0};
+  std::atomic<bool> failed{false};
+  json::runConcurrently(std::min(threads, parts.size()), [&] {
+    size_t i;
+    while (!failed.load(std::memory_order_relaxed) &&
+           (i = nextPart.fetch_add(1)) < parts.size()) {
+      size_t const begin = i == 0 ? open + 1 : splits[i - 1] + 1;
+      try {
+        if (!json::parseArraySpan(
+                range.subpiece(begin),
+                range.begin() + splits[i],
+                i + 1 == parts.size(),
+                opts,
+                parts[i])) {
+          failed = true;
+        }
+      } catch (...) {
+        failed = true;
+      }
+    }
+  });
+  if (!failed) {
+    json::Input in(range.subpiece(splits.back() + 1), &opts);
+    in.skipWhitespace();
+    failed = in.size() && *in != '\0';
+  }
+  if (failed) {
+    // Throws the error that comes first in the input, with its line. Or,
+    // if the split itself was at fault (a trailing comma after the last
+    // split, say), parses the input after all.
+    return parseJson(range, opts);
+  }
+  return json::concat(parts);
+}
+
+dynamic parseNdjson(
+    StringPiece range, json::serialization_opts const& opts, size_t threads) {
+  if (threads == 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+  size_t const spans = threads < 2
+      ? 1
+      : std::min(threads * 4, range.size() / json::kMinParallelSpan + 1);
+  // Spans start at the beginning of a line.
+  std::vector<char const*> starts{range.begin()};
+  for (size_t i = 1; i < spans; ++i) {
+    auto target =
+        std::max(starts.back(), range.begin() + range.size() / spans * i);
+    auto nl = static_cast<char const*>(
+        std::memchr(target, '\n', size_t(range.end() - target)));
+    if (!nl || nl + 1 == range.end()) {
+      break;
+    }
+    starts.push_back(nl + 1);
+  }
+  starts.push_back(range.end());
+
+  size_t const count = starts.size() - 1;
+  std::vector<unsigned> lines(count);
+  std::atomic<size_t> next{0};
+  size_t const workers = std::min(threads, count);
+  // The number of the first line of each span, for errors.
+  json::runConcurrently(workers, [&] {
+    for (size_t i; (i = next.fetch_add(1)) < count;) {
+      lines[i] = unsigned(std::count(starts[i], starts[i + 1], '\n'));
+    }
+  });
+  std::partial_sum(lines.begin(), lines.end(), lines.begin());
+
+  std::vector<std::vector<dynamic>> parts(count);
+  std::vector<std::exception_ptr> errors(count);
+  std::atomic<size_t> firstError{count};
+  next = 0;
+  json::runConcurrently(workers, [&] {
+    for (size_t i; (i = next.fetch_add(1)) < firstError.load();) {
+      unsigned lineNum = i == 0 ? 0 : lines[i - 1];
+      try {
+        for (auto p = starts[i]; p != starts[i + 1]; ++lineNum) {
+          auto nl = static_cast<char const*>(
+              std::memchr(p, '\n', size_t(starts[i + 1] - p)));
+          auto const lineEnd = nl ? nl : starts[i + 1];
+          json::parseLine(StringPiece(p, lineEnd), opts, lineNum, parts[i]);
+          p = nl ? nl + 1 : lineEnd;
+        }
+      } catch (...) {
+        errors[i] = std::current_exception();
+        for (size_t j = firstError.load(); i < j;) {
+          firstError.compare_exchange_weak(j, i);
+        }
+      }
+    }
+  });
+  if (firstError < count) {
+    std::rethrow_exception(errors[firstError]);
+  }
+  return json::concat(parts);
+}
+
 std::string toJson(dynamic const& dyn) {
   return json::serialize(dyn, json::serialization_opts());
 }
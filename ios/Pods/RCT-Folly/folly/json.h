@@ -42,10 +42,17 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cstdio>
 #include <iosfwd>
+#include <iterator>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <folly/Function.h>
+#include <folly/Optional.h>
 #include <folly/Range.h>
 #include <folly/dynamic.h>
 
@@ -130,6 +137,18 @@ struct serialization_opts {
   // Recursion limit when parsing.
   unsigned int recursion_limit{100};
 
+  // If true, serialize() to a string first computes the exact size of the
+  // output (see serializedSize) and allocates it once, instead of growing
+  // the string as it goes. Worth it for large documents.
+  bool reserve_exact_size{false};
+
+  // If true, parse in two stages: first build an index of the structural
+  // characters of the whole input with SIMD, then build the dynamic by
+  // walking the index. Faster on large inputs; the result and any errors
+  // are the same as with the default parser. Ignored by
+  // parseJsonWithMetadata.
+  bool parse_with_structural_index{false};
+
   // Bitmap representing ASCII characters to escape with unicode
   // representations. The least significant bit of the first in the pair is
   // ASCII value 0; the most significant bit of the second in the pair is ASCII
@@ -156,6 +175,70 @@ std::array<uint64_t, 2> buildExtraAsciiToEscapeBitmap(StringPiece chars);
  */
 std::string serialize(dynamic const&, serialization_opts const&);
 
+/**
+ * Receives the output of serialize() in pieces, in order.
+ */
+class output_sink {
+ public:
+  virtual ~output_sink() = default;
+
+  virtual void write(StringPiece data) = 0;
+};
+
+// Passes each piece of output to a function.
+class callback_sink : public output_sink {
+ public:
+  explicit callback_sink(Function<void(StringPiece)> fn) : fn_(std::move(fn)) {}
+
+  void write(StringPiece data) override { fn_(data); }
+
+ private:
+  Function<void(StringPiece)> fn_;
+};
+
+// Writes to a file descriptor; throws std::system_error if a write fails.
+class fd_sink : public output_sink {
+ public:
+  explicit fd_sink(int fd) : fd_(fd) {}
+
+  void write(StringPiece data) override;
+
+ private:
+  int const fd_;
+};
+
+// Writes to a std::ostream, whose state the caller checks afterwards.
+class ostream_sink : public output_sink {
+ public:
+  explicit ostream_sink(std::ostream& out) : out_(out) {}
+
+  void write(StringPiece data) override;
+
+ private:
+  std::ostream& out_;
+};
+
+/**
+ * Serialize dynamic to a sink, with options.
+ *
+ * The output is the same as serialize()'s, but it is collected in a buffer
+ * of about buffer_size bytes that is passed to the sink whenever it is full
+ * and once at the end, so memory use does not grow with the document. A
+ * single string longer than the buffer is passed on whole. If this throws,
+ * the sink may already have received part of the output.
+ */
+void serialize(
+    dynamic const&,
+    serialization_opts const&,
+    output_sink& sink,
+    size_t buffer_size = 4096);
+
+/**
+ * The exact size in bytes of serialize()'s output, computed without
+ * storing it. Throws the same print_error as serialize() would.
+ */
+size_t serializedSize(dynamic const&, serialization_opts const&);
+
 /**
  * Escape a string so that it is legal to print it in JSON text.
  *
@@ -183,9 +266,12 @@ class FOLLY_EXPORT print_error : public std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
-// may be extened in future to include offset, col, etc.
+// column and offset are only filled in by the metadata_table overload of
+// parseJsonWithMetadata.
 struct parse_location {
   uint32_t line{}; // 0-indexed
+  uint32_t column{}; // 0-indexed, in bytes from the start of the line
+  uint32_t offset{}; // in bytes from the start of the input
 };
 
 // may be extended in future to include end location
@@ -200,6 +286,662 @@ struct parse_metadata {
 
 using metadata_map = std::unordered_map<dynamic const*, parse_metadata>;
 
+class metadata_recorder;
+
+/**
+ * The positions of the keys and values of a document parsed by
+ * parseJsonWithMetadata, as a flat table rather than a node per value:
+ * one parse_metadata per value in the order the parser met them, the root
+ * first, and an index sorted by address for looking up the entry of a
+ * dynamic in the parsed tree with a binary search.
+ *
+ * The root is entry 0 and cannot be looked up by address, since the
+ * returned dynamic is moved into place by the caller; every other value
+ * can, as long as the document is alive and its containers have not been
+ * modified. The key_range of the root and of array elements is zero. A
+ * table filled by a parse that threw is left in an unspecified state.
+ * Offsets are 32 bits, so inputs must be smaller than 4GB.
+ */
+class metadata_table {
+ public:
+  // Number of values recorded, including the root.
+  size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+
+  // The i-th value in parse order.
+  parse_metadata const& operator[](size_t i) const { return entries_[i]; }
+
+  // The entry of a value inside the parsed document, or nullptr if there
+  // is none.
+  parse_metadata const* find(dynamic const* value) const;
+
+  // Keeps the memory, so a table reused across parses does not allocate.
+  void clear();
+
+ private:
+  friend class metadata_recorder;
+
+  std::vector<parse_metadata> entries_;
+  // Before the parse finishes, (address, i) for the i-th value; then
+  // sorted by address.
+  std::vector<std::pair<dynamic const*, uint32_t>> index_;
+};
+
+/**
+ * A read-only json document that is validated eagerly and decoded lazily.
+ *
+ * Construction checks the whole input, accepting exactly what parseJson
+ * accepts with the same options and throwing the same parse_error
+ * otherwise, and records where every value lives in a flat tape of
+ * offsets. No per-value memory is allocated: strings are unescaped and
+ * numbers converted only when read. Picking a few fields out of a large
+ * document therefore costs little more than the validation pass.
+ *
+ * The document refers to the input, which must outlive it. Cursors and
+ * iterators refer to the document and are invalidated when it is moved or
+ * destroyed.
+ *
+ *   json::lazy_document doc(body);
+ *   auto offer = doc["offers"][3];
+ *   int64_t id = offer["id"].asInt();
+ *   dynamic card = offer["card"].toDynamic();
+ *
+ * Lookups and conversions follow the rules of the equivalent dynamic
+ * methods and throw TypeError or std::out_of_range the same way. When an
+ * object has duplicate keys, lookups see the last one, as parseJson would.
+ */
+class lazy_document {
+ public:
+  enum class tape_tag : uint8_t {
+    null_value,
+    true_value,
+    false_value,
+    int64_value,
+    double_value, // also integers that overflowed with double_fallback
+    infinity,
+    negative_infinity,
+    nan,
+    string, // quoted string without escapes
+    escaped_string, // quoted string with at least one escape
+    raw_string, // unquoted token kept as text by parse_numbers_as_strings
+    array,
+    object,
+  };
+
+  // Values appear on the tape in document order, each container followed
+  // by its elements (for objects: key, value, key, value...).
+  struct tape_entry {
+    tape_tag tag;
+    // For containers the number of elements (or key/value pairs).
+    uint32_t size;
+    // Offset in the input of the first byte of the value.
+    uint32_t begin;
+    // For containers the index in the tape past the last nested entry,
+    // otherwise the offset in the input past the last byte of the value.
+    uint32_t end;
+  };
+
+  class cursor;
+  class iterator;
+  class item_iterator;
+
+  explicit lazy_document(StringPiece json);
+  lazy_document(StringPiece json, serialization_opts const& opts);
+
+  lazy_document(lazy_document&&) noexcept = default;
+  lazy_document& operator=(lazy_document&&) noexcept = default;
+
+  cursor root() const;
+
+  // Shortcuts for the same operations on root().
+  cursor operator[](StringPiece key) const;
+  cursor operator[](size_t index) const;
+  dynamic toDynamic() const;
+
+ private:
+  friend class cursor;
+
+  size_t next(size_t index) const {
+    auto const& e = tape_[index];
+    return e.tag == tape_tag::array || e.tag == tape_tag::object ? e.end
+                                                                  : index + 1;
+  }
+
+  StringPiece data_;
+  std::vector<tape_entry> tape_;
+  bool convertIntKeys_{false};
+};
+
+/**
+ * A position in a lazy_document. Cheap to copy.
+ */
+class lazy_document::cursor {
+ public:
+  dynamic::Type type() const;
+  bool isNull() const { return type() == dynamic::NULLT; }
+  bool isBool() const { return type() == dynamic::BOOL; }
+  bool isInt() const { return type() == dynamic::INT64; }
+  bool isDouble() const { return type() == dynamic::DOUBLE; }
+  bool isString() const { return type() == dynamic::STRING; }
+  bool isArray() const { return type() == dynamic::ARRAY; }
+  bool isObject() const { return type() == dynamic::OBJECT; }
+
+  // Number of elements of an array or object, or length of a string. An
+  // object's duplicate keys are each counted.
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+
+  // Object member access. operator[] throws std::out_of_range if the key is
+  // missing; find returns none instead.
+  cursor operator[](StringPiece key) const;
+  Optional<cursor> find(StringPiece key) const;
+  size_t count(StringPiece key) const { return find(key) ? 1 : 0; }
+
+  // Array element access. Linear in the index.
+  cursor operator[](size_t index) const;
+
+  // Array elements.
+  iterator begin() const;
+  iterator end() const;
+
+  // Object members as (key, value) pairs.
+  struct item_range {
+    item_iterator begin() const;
+    item_iterator end() const;
+    lazy_document const* doc;
+    uint32_t first;
+    uint32_t last;
+  };
+  item_range items() const;
+
+  // Conversions with the semantics of dynamic::asString() etc.
+  std::string asString() const;
+  int64_t asInt() const;
+  double asDouble() const;
+  bool asBool() const;
+
+  // The json text of the value, as it appears in the input.
+  StringPiece raw() const;
+
+  dynamic toDynamic() const;
+
+ private:
+  friend class lazy_document;
+  friend class iterator;
+  friend class item_iterator;
+
+  cursor(lazy_document const* doc, uint32_t index) : doc_(doc), index_(index) {}
+
+  tape_entry const& entry() const { return doc_->tape_[index_]; }
+  void enforce(dynamic::Type expected) const;
+  bool keyEquals(uint32_t index, StringPiece key) const;
+
+  lazy_document const* doc_;
+  uint32_t index_;
+};
+
+class lazy_document::iterator {
+ public:
+  using value_type = cursor;
+  using reference = cursor;
+  using pointer = void;
+  using difference_type = std::ptrdiff_t;
+  using iterator_category = std::forward_iterator_tag;
+
+  cursor operator*() const { return cursor(doc_, index_); }
+  iterator& operator++() {
+    index_ = uint32_t(doc_->next(index_));
+    return *this;
+  }
+  iterator operator++(int) {
+    auto ret = *this;
+    ++*this;
+    return ret;
+  }
+  friend bool operator==(iterator const& a, iterator const& b) {
+    return a.index_ == b.index_;
+  }
+  friend bool operator!=(iterator const& a, iterator const& b) {
+    return !(a == b);
+  }
+
+ private:
+  friend class cursor;
+  iterator(lazy_document const* doc, uint32_t index)
+      : doc_(doc), index_(index) {}
+
+  lazy_document const* doc_;
+  uint32_t index_;
+};
+
+class lazy_document::item_iterator {
+ public:
+  using value_type = std::pair<cursor, cursor>;
+  using reference = value_type;
+  using pointer = void;
+  using difference_type = std::ptrdiff_t;
+  using iterator_category = std::forward_iterator_tag;
+
+  value_type operator*() const {
+    return {cursor(doc_, index_), cursor(doc_, uint32_t(doc_->next(index_)))};
+  }
+  item_iterator& operator++() {
+    index_ = uint32_t(doc_->next(doc_->next(index_)));
+    return *this;
+  }
+  item_iterator operator++(int) {
+    auto ret = *this;
+    ++*this;
+    return ret;
+  }
+  friend bool operator==(item_iterator const& a, item_iterator const& b) {
+    return a.index_ == b.index_;
+  }
+  friend bool operator!=(item_iterator const& a, item_iterator const& b) {
+    return !(a == b);
+  }
+
+ private:
+  friend class cursor;
+  item_iterator(lazy_document const* doc, uint32_t index)
+      : doc_(doc), index_(index) {}
+
+  lazy_document const* doc_;
+  uint32_t index_;
+};
+
+inline lazy_document::cursor lazy_document::root() const {
+  return cursor(this, 0);
+}
+
+inline lazy_document::cursor lazy_document::operator[](StringPiece key) const {
+  return root()[key];
+}
+
+inline lazy_document::cursor lazy_document::operator[](size_t index) const {
+  return root()[index];
+}
+
+inline lazy_document::iterator lazy_document::cursor::begin() const {
+  enforce(dynamic::ARRAY);
+  return iterator(doc_, index_ + 1);
+}
+
+inline lazy_document::iterator lazy_document::cursor::end() const {
+  enforce(dynamic::ARRAY);
+  return iterator(doc_, entry().end);
+}
+
+inline lazy_document::cursor::item_range lazy_document::cursor::items() const {
+  enforce(dynamic::OBJECT);
+  return item_range{doc_, index_ + 1, entry().end};
+}
+
+inline lazy_document::item_iterator
+lazy_document::cursor::item_range::begin() const {
+  return item_iterator(doc, first);
+}
+
+inline lazy_document::item_iterator
+lazy_document::cursor::item_range::end() const {
+  return item_iterator(doc, last);
+}
+
+/**
+ * An immutable json value whose whole tree lives in an arena.
+ *
+ * Returned by the parseJson overloads that take an arena. The tree is
+ * allocated as a single block from the arena, strings included, and does
+ * not refer to the input; it stays valid until the arena is destroyed, at
+ * which point it is gone without any per-node destruction. A document that
+ * fails to parse may still have consumed arena memory.
+ *
+ *   SysArena arena;
+ *   auto const& doc = parseJson(body, arena);
+ *   for (auto const& offer : doc["offers"]) {
+ *     total += offer["price"].getDouble();
+ *   }
+ *
+ * Accessors mirror the dynamic methods of the same name, including the
+ * exceptions they throw. Objects hold distinct keys, like parseJson's
+ * output: with duplicate keys the last value wins. Lookups by key are
+ * linear in small objects and hashed in larger ones.
+ */
+class arena_dynamic {
+ public:
+  struct member;
+
+  dynamic::Type type() const { return dynamic::Type(type_); }
+  bool isNull() const { return type_ == dynamic::NULLT; }
+  bool isBool() const { return type_ == dynamic::BOOL; }
+  bool isInt() const { return type_ == dynamic::INT64; }
+  bool isDouble() const { return type_ == dynamic::DOUBLE; }
+  bool isNumber() const { return isInt() || isDouble(); }
+  bool isString() const { return type_ == dynamic::STRING; }
+  bool isArray() const { return type_ == dynamic::ARRAY; }
+  bool isObject() const { return type_ == dynamic::OBJECT; }
+
+  // Number of elements of an array or object, or length of a string.
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+
+  // Access without conversion; throw TypeError on a type mismatch.
+  StringPiece getString() const;
+  int64_t getInt() const;
+  double getDouble() const;
+  bool getBool() const;
+
+  // Conversions with the semantics of dynamic::asString() etc.
+  std::string asString() const;
+  int64_t asInt() const;
+  double asDouble() const;
+  bool asBool() const;
+
+  // Object member access. get_ptr returns nullptr if the key is missing,
+  // at and operator[] throw std::out_of_range.
+  arena_dynamic const* get_ptr(StringPiece key) const;
+  arena_dynamic const& at(StringPiece key) const;
+  arena_dynamic const& operator[](StringPiece key) const { return at(key); }
+  size_t count(StringPiece key) const { return get_ptr(key) ? 1 : 0; }
+
+  // Array element access.
+  arena_dynamic const& at(size_t index) const;
+  arena_dynamic const& operator[](size_t index) const { return at(index); }
+
+  // Array elements.
+  arena_dynamic const* begin() const;
+  arena_dynamic const* end() const;
+
+  // Object members, in input order.
+  Range<member const*> items() const;
+
+  dynamic toDynamic() const;
+
+ private:
+  class builder;
+  friend arena_dynamic const& parseJsonToArena(
+      StringPiece, serialization_opts const&, FunctionRef<void*(size_t)>);
+
+  // Objects with more members than this get a hash index.
+  static constexpr uint32_t kMaxLinearMembers = 8;
+
+  void enforce(dynamic::Type expected, char const* name) const {
+    if (type_ != expected) {
+      throw_exception<TypeError>(name, type());
+    }
+  }
+
+  member const* members() const;
+  // The hash index of an object, stored in the block right before its
+  // members: 1 << slotBits_ slots, each 0 or one plus a member position.
+  uint32_t const* slots() const;
+
+  union {
+    int64_t integer;
+    double dbl;
+    bool boolean;
+    char const* str;
+    arena_dynamic const* elements;
+    void const* members;
+  } u_;
+  uint32_t size_;
+  uint8_t type_;
+  uint8_t slotBits_;
+};
+
+struct arena_dynamic::member {
+  arena_dynamic first;
+  arena_dynamic second;
+};
+
+inline arena_dynamic::member const* arena_dynamic::members() const {
+  return static_cast<member const*>(u_.members);
+}
+
+inline uint32_t const* arena_dynamic::slots() const {
+  return static_cast<uint32_t const*>(u_.members) - (uint32_t(1) << slotBits_);
+}
+
+inline arena_dynamic const* arena_dynamic::begin() const {
+  enforce(dynamic::ARRAY, "array");
+  return u_.elements;
+}
+
+inline arena_dynamic const* arena_dynamic::end() const {
+  enforce(dynamic::ARRAY, "array");
+  return u_.elements + size_;
+}
+
+inline Range<arena_dynamic::member const*> arena_dynamic::items() const {
+  enforce(dynamic::OBJECT, "object");
+  return Range<member const*>(members(), size_);
+}
+
+inline arena_dynamic const& arena_dynamic::at(size_t index) const {
+  enforce(dynamic::ARRAY, "array");
+  if (index >= size_) {
+    throw_exception<std::out_of_range>("out of range in dynamic array");
+  }
+  return u_.elements[index];
+}
+
+inline StringPiece arena_dynamic::getString() const {
+  enforce(dynamic::STRING, "string");
+  return StringPiece(u_.str, size_);
+}
+
+inline int64_t arena_dynamic::getInt() const {
+  enforce(dynamic::INT64, "int64");
+  return u_.integer;
+}
+
+inline double arena_dynamic::getDouble() const {
+  enforce(dynamic::DOUBLE, "double");
+  return u_.dbl;
+}
+
+inline bool arena_dynamic::getBool() const {
+  enforce(dynamic::BOOL, "boolean");
+  return u_.boolean;
+}
+
+/**
+ * Builds an arena_dynamic, getting its memory from allocate. Use the
+ * parseJson overloads that take an arena instead.
+ */
+arena_dynamic const& parseJsonToArena(
+    StringPiece range,
+    serialization_opts const& opts,
+    FunctionRef<void*(size_t)> allocate);
+
+/**
+ * Receives the events of a streaming_parser, in document order.
+ *
+ * Strings passed to the handler are only valid during the call. Numbers
+ * arrive already converted according to the parser's options (or as
+ * strings with parse_numbers_as_strings). Within an object, each value is
+ * preceded by its key.
+ */
+class parse_handler {
+ public:
+  virtual ~parse_handler() = default;
+
+  virtual void on_begin_object() = 0;
+  virtual void on_end_object() = 0;
+  virtual void on_begin_array() = 0;
+  virtual void on_end_array() = 0;
+
+  virtual void on_key(StringPiece key) = 0;
+  // Keys that are neither strings nor converted by convert_int_keys, when
+  // allow_non_string_keys is set. Rejects them by default.
+  virtual void on_non_string_key(dynamic&& key);
+
+  virtual void on_null() = 0;
+  virtual void on_bool(bool value) = 0;
+  virtual void on_int(int64_t value) = 0;
+  virtual void on_double(double value) = 0;
+  virtual void on_string(StringPiece value) = 0;
+
+ protected:
+  // Stops the parser, which throws a parse_error with this message and the
+  // current position.
+  [[noreturn]] static void fail(char const* what);
+
+ private:
+  friend class streaming_parser;
+  class failure;
+};
+
+/**
+ * A parse_handler that builds a dynamic, the same one parseJson would.
+ */
+class dynamic_builder : public parse_handler {
+ public:
+  explicit dynamic_builder(serialization_opts const& opts);
+
+  dynamic_builder(dynamic_builder const&) = delete;
+  dynamic_builder& operator=(dynamic_builder const&) = delete;
+
+  // The document, complete once the parser has finished.
+  dynamic& result() { return root_; }
+
+  void on_begin_object() override;
+  void on_end_object() override;
+  void on_begin_array() override;
+  void on_end_array() override;
+  void on_key(StringPiece key) override;
+  void on_non_string_key(dynamic&& key) override;
+  void on_null() override;
+  void on_bool(bool value) override;
+  void on_int(int64_t value) override;
+  void on_double(double value) override;
+  void on_string(StringPiece value) override;
+
+ private:
+  dynamic& add(dynamic&& value);
+  void pop();
+
+  dynamic root_;
+  std::vector<dynamic*> stack_;
+  dynamic key_;
+  // Depth of a container stored under a duplicate key; reported once the
+  // container is complete, as parseJson does.
+  size_t duplicateDepth_{0};
+  bool const distinct_;
+};
+
+/**
+ * An incremental json parser: input is pushed in chunks of any size and
+ * events are sent to a parse_handler as soon as they are complete, so a
+ * document never needs to be in memory as a whole.
+ *
+ * It accepts exactly what parseJson accepts with the same options, and
+ * throws parse_error with the same messages and line numbers; the context
+ * quoted in the message is limited to the current chunk. After an
+ * exception the parser must not be used again.
+ *
+ *   json::dynamic_builder builder(opts);
+ *   json::streaming_parser parser(builder, opts);
+ *   while (auto chunk = source.read()) {
+ *     parser.feed(chunk);
+ *   }
+ *   parser.finish();
+ *   dynamic doc = std::move(builder.result());
+ */
+class streaming_parser {
+ public:
+  streaming_parser(parse_handler& handler, serialization_opts const& opts);
+
+  streaming_parser(streaming_parser const&) = delete;
+  streaming_parser& operator=(streaming_parser const&) = delete;
+
+  // Parses the next chunk of input.
+  void feed(StringPiece chunk);
+
+  // Signals the end of input; throws if the document is incomplete.
+  void finish();
+
+ private:
+  enum class state : uint8_t {
+    value, // any value, an object key if inKey_
+    object_first, // after '{'
+    object_next, // after ',' in an object
+    colon,
+    array_first, // after '['
+    array_next, // after ',' in an array
+    after_value, // ',' or the end of the container
+    string,
+    escape, // after a backslash in a string
+    hex, // the four digits of \u
+    surrogate, // the \u of the second half of a surrogate pair
+    number,
+    integer_end, // whitespace after an integer, before it is passed on
+    literal,
+    done, // after the top-level value
+    ignore, // after a NUL byte following the top-level value
+  };
+
+  enum class number_part : uint8_t { sign, minus, integral, fraction, e, exp };
+
+  void run();
+  bool skipWhitespace();
+  int current() const { return pos_ != end_ ? *pos_ : EOF; }
+  void startValue();
+  void endContainer();
+  bool scanString();
+  bool scanEscape();
+  bool scanHex();
+  bool scanSurrogate();
+  bool scanNumber();
+  bool scanLiteral();
+  void emitString(StringPiece str);
+  void emitNumber(StringPiece token);
+  void emitLiteral();
+  void emitScalar(dynamic&& value);
+  parse_handler& handler();
+  [[noreturn]] void error(char const* what) const;
+
+  parse_handler& handler_;
+  unsigned const recursionLimit_;
+  bool const allowTrailingComma_;
+  bool const allowNonStringKeys_;
+  bool const convertIntKeys_;
+  bool const validateKeys_;
+  bool const doubleFallback_;
+  bool const numbersAsStrings_;
+
+  state state_{state::value};
+  bool inKey_{false};
+  // The opening bracket of each enclosing container.
+  std::vector<char> stack_;
+
+  // Arrays and objects in key position are built into a dynamic, as
+  // parseObject does, and passed on as a key once complete.
+  struct key_builder {
+    size_t depth;
+    std::unique_ptr<dynamic_builder> builder;
+  };
+  std::vector<key_builder> keys_;
+  unsigned line_{0};
+
+  // The chunk being parsed.
+  char const* pos_{nullptr};
+  char const* end_{nullptr};
+  bool eof_{false};
+
+  // Strings and numbers split across chunks, and unescaped strings.
+  std::string buf_;
+  bool buffered_{false};
+  char const* tokenBegin_{nullptr};
+  number_part numberPart_{number_part::sign};
+  char const* literal_{nullptr};
+  uint8_t matched_{0};
+  char hex_[4];
+  uint16_t highSurrogate_{0};
+  // An integer held back until the whitespace after it is skipped.
+  dynamic integer_;
+};
+
 } // namespace json
 
 //////////////////////////////////////////////////////////////////////
@@ -211,11 +953,59 @@ using metadata_map = std::unordered_map<dynamic const*, parse_metadata>;
 dynamic parseJson(StringPiece, json::serialization_opts const&);
 dynamic parseJson(StringPiece);
 
+/**
+ * Parse a json blob into a tree allocated from an arena, such as a
+ * SysArena or a ThreadCachedArena (see folly/memory/Arena.h). Freeing the
+ * arena frees the whole document. See json::arena_dynamic.
+ */
+template <
+    class Arena,
+    class = decltype(static_cast<void*>(
+        std::declval<Arena&>().allocate(std::size_t())))>
+json::arena_dynamic const& parseJson(
+    StringPiece range, Arena& arena, json::serialization_opts const& opts) {
+  return json::parseJsonToArena(
+      range, opts, [&](std::size_t size) { return arena.allocate(size); });
+}
+
+template <
+    class Arena,
+    class = decltype(static_cast<void*>(
+        std::declval<Arena&>().allocate(std::size_t())))>
+json::arena_dynamic const& parseJson(StringPiece range, Arena& arena) {
+  return parseJson(range, arena, json::serialization_opts());
+}
+
 dynamic parseJsonWithMetadata(StringPiece range, json::metadata_map* map);
 dynamic parseJsonWithMetadata(
     StringPiece range,
     json::serialization_opts const& opts,
     json::metadata_map* map);
+dynamic parseJsonWithMetadata(StringPiece range, json::metadata_table& table);
+dynamic parseJsonWithMetadata(
+    StringPiece range,
+    json::serialization_opts const& opts,
+    json::metadata_table& table);
+
+/**
+ * Parse a json blob whose top level is an array, with the elements spread
+ * over `threads` threads (0 for one per core). A quick scan of the bracket
+ * structure splits the array at commas into spans that are parsed
+ * concurrently and joined in order. The result, and the error thrown for
+ * invalid input, are the same as parseJson's; other and small inputs are
+ * simply passed to parseJson.
+ */
+dynamic parseJsonParallel(
+    StringPiece range, json::serialization_opts const& opts, size_t threads);
+
+/**
+ * Parse newline-delimited json: one value per line, blank lines skipped,
+ * into an array of the values. Lines are parsed as by parseJson, on
+ * `threads` threads (0 for one per core). Throws the error of the first
+ * line that fails, numbered within the whole input.
+ */
+dynamic parseNdjson(
+    StringPiece range, json::serialization_opts const& opts, size_t threads);
 
 /**
  * Serialize a dynamic into a json string.
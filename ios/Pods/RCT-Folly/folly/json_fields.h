@@ -0,0 +1,1046 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Direct conversion between json text and C++ structs, without building a
+ * folly::dynamic in between.
+ *
+ * Describe a struct's fields once, next to it (in the same namespace, so
+ * that lookup finds the description):
+ *
+ *   struct card {
+ *     std::string brand;
+ *     int64_t last4{};
+ *   };
+ *   FOLLY_JSON_FIELDS(card, brand, last4)
+ *
+ *   struct offer {
+ *     int64_t id{};
+ *     std::string title;
+ *     std::vector<std::string> tags;
+ *     folly::Optional<double> price;
+ *     std::map<std::string, int64_t> counts;
+ *     card payment;
+ *   };
+ *   FOLLY_JSON_FIELDS(offer, id, title, tags, price, counts, payment)
+ *
+ *   auto o = folly::json::decode<offer>(body);
+ *   std::string text = folly::json::encode(o);
+ *
+ * json keys are the member names. decode() reads each value straight into
+ * its member: object keys are dispatched through a perfect hash built at
+ * compile time, and keys the struct does not describe are skipped without
+ * being decoded. Members whose key is absent keep their prior value; with
+ * duplicate keys the last one wins, as with parseJson.
+ *
+ * Supported member types are bool, integers, enums (as their underlying
+ * integer), floating point, std::string and fbstring, folly::Optional and
+ * std::optional (null when empty), sequence containers, sets, maps with
+ * string keys, folly::dynamic, and other described structs. Other types
+ * can be supported by specializing json::codec.
+ *
+ * decode() accepts the text parseJson accepts and converts values as
+ * convertTo<T>(parseJson(text)) does, so bools and numbers convert into
+ * each other and an integer is read as an int64 before it is narrowed to
+ * its member. The one exception is that strings do not convert to or from
+ * numbers and bools: the mismatch throws TypeError, as other type
+ * mismatches do. Malformed json throws json::parse_error, and a number out
+ * of range for its member throws ConversionError. encode() writes what
+ * toJson(toDynamic(value)) does. Of serialization_opts, decode() honors
+ * allow_trailing_comma, double_fallback and recursion_limit, and encode()
+ * the options for strings and doubles and allow_nan_inf; pretty printing
+ * and key sorting are not supported.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <folly/Conv.h>
+#include <folly/Likely.h>
+#include <folly/Optional.h>
+#include <folly/Preprocessor.h>
+#include <folly/Range.h>
+#include <folly/Traits.h>
+#include <folly/Unicode.h>
+#include <folly/dynamic.h>
+#include <folly/json.h>
+#include <folly/lang/Exception.h>
+
+/**
+ * Describe the members of `Type` that are read from and written to json,
+ * in the order encode() writes them. Use at namespace scope, in the
+ * namespace of `Type`; the members must be accessible there. Supports up to
+ * 32 members.
+ */
+#define FOLLY_JSON_FIELDS(Type, ...)                                      \
+  [[maybe_unused]] constexpr auto follyJsonFields(Type const*) {         \
+    using folly_json_fields_type = Type;                                  \
+    return ::folly::json::detail::field_list<folly_json_fields_type>{}   \
+        FOLLY_PP_FOR_EACH(FOLLY_JSON_FIELDS_DETAIL_FIELD, __VA_ARGS__); \
+  }
+
+#define FOLLY_JSON_FIELDS_DETAIL_FIELD(name) \
+  .add(#name, &folly_json_fields_type::name)
+
+namespace folly {
+namespace json {
+
+class struct_reader;
+class struct_writer;
+
+/**
+ * How values of type T are read and written. Specialize with
+ *
+ *   static void read(struct_reader& in, T& out);
+ *   static void write(struct_writer& out, T const& value);
+ *
+ * to support more types.
+ */
+template <typename T, typename Enable = void>
+struct codec;
+
+/**
+ * A cursor over json text for codec::read. Whitespace is skipped before
+ * every token.
+ */
+class struct_reader {
+ public:
+  struct_reader(StringPiece text, serialization_opts const& opts)
+      : begin_(text.begin()),
+        pos_(text.begin()),
+        end_(text.end()),
+        opts_(opts) {}
+
+  serialization_opts const& opts() const { return opts_; }
+
+  // The type of the next value, from its first character.
+  dynamic::Type peekType() {
+    switch (peek()) {
+      case '{':
+        return dynamic::OBJECT;
+      case '[':
+        return dynamic::ARRAY;
+      case '"':
+        return dynamic::STRING;
+      case 't':
+      case 'f':
+        return dynamic::BOOL;
+      case 'n':
+        return dynamic::NULLT;
+      default:
+        return isIntegerAhead() ? dynamic::INT64 : dynamic::DOUBLE;
+    }
+  }
+
+  // Consumes a null if one comes next.
+  bool consumeNull() {
+    if (peek() == 'n') {
+      literal("null");
+      return true;
+    }
+    return false;
+  }
+
+  // Bools and numbers convert into each other as with convertTo<T>:
+  // parseJson makes an int64 or a double, which dynamic::asBool, asInt and
+  // asDouble pass through to<T>.
+
+  bool readBool() { return readScalar<bool>("bool"); }
+
+  template <typename T>
+  T readInteger() {
+    return to<T>(readScalar<int64_t>("int64"));
+  }
+
+  double readDouble() { return readScalar<double>("double"); }
+
+  // Reads a string. The result refers to the input when the string has no
+  // escapes, and to `scratch` otherwise.
+  StringPiece readString(std::string& scratch) {
+    if (peek() != '"') {
+      typeError("string");
+    }
+    ++pos_;
+    auto const start = pos_;
+    while (true) {
+      if (FOLLY_UNLIKELY(pos_ == end_)) {
+        error("unterminated string");
+      }
+      auto const c = *pos_;
+      if (c == '"') {
+        return StringPiece(start, pos_++);
+      }
+      if (c == '\\') {
+        scratch.assign(start, pos_);
+        return unescape(scratch);
+      }
+      ++pos_;
+    }
+  }
+
+  /**
+   * Reads an object, calling on_key(StringPiece key) with the reader
+   * positioned at each member's value; on_key must read or skip it. The key
+   * is only valid until the value is read.
+   */
+  template <typename OnKey>
+  void readObject(OnKey&& on_key) {
+    if (peek() != '{') {
+      typeError("object");
+    }
+    ++pos_;
+    enter();
+    if (peek() == '}') {
+      ++pos_;
+      leave();
+      return;
+    }
+    while (true) {
+      if (peek() != '"') {
+        error("expected json value");
+      }
+      auto const key = readString(keyScratch_);
+      expect(':');
+      on_key(key);
+      if (peek() == ',') {
+        ++pos_;
+        if (opts_.allow_trailing_comma && peek() == '}') {
+          ++pos_;
+          break;
+        }
+        continue;
+      }
+      expect('}');
+      break;
+    }
+    leave();
+  }
+
+  /**
+   * Reads an array, calling on_element() with the reader positioned at each
+   * element; on_element must read or skip it.
+   */
+  template <typename OnElement>
+  void readArray(OnElement&& on_element) {
+    if (peek() != '[') {
+      typeError("array");
+    }
+    ++pos_;
+    enter();
+    if (peek() == ']') {
+      ++pos_;
+      leave();
+      return;
+    }
+    while (true) {
+      on_element();
+      if (peek() == ',') {
+        ++pos_;
+        if (opts_.allow_trailing_comma && peek() == ']') {
+          ++pos_;
+          break;
+        }
+        continue;
+      }
+      expect(']');
+      break;
+    }
+    leave();
+  }
+
+  // Skips the next value, checking that it is well formed.
+  void skipValue() {
+    switch (peek()) {
+      case '{':
+        readObject([this](StringPiece) { skipValue(); });
+        break;
+      case '[':
+        readArray([this] { skipValue(); });
+        break;
+      case '"':
+        skipString();
+        break;
+      case 't':
+      case 'f':
+        readBool();
+        break;
+      case 'n':
+        literal("null");
+        break;
+      default: {
+        // converted for the errors parseNumber throws, like an exponent
+        // without digits or an integer out of range
+        bool integer = false;
+        auto const token = number(integer, "json value");
+        if (isInt64(token, integer)) {
+          to<int64_t>(token);
+        } else {
+          to<double>(token);
+        }
+        break;
+      }
+    }
+  }
+
+  // Skips the next value and returns its text.
+  StringPiece rawValue() {
+    peek();
+    auto const start = pos_;
+    skipValue();
+    return StringPiece(start, pos_);
+  }
+
+  // Checks that only whitespace is left.
+  void finish() {
+    if (peek() != '\0' || pos_ != end_) {
+      error("parsing didn't consume all input");
+    }
+  }
+
+  [[noreturn]] void error(char const* what) const {
+    auto const line = std::count(begin_, pos_, '\n');
+    auto const context =
+        StringPiece(pos_, end_).subpiece(0, 16 /* as parseJson */);
+    throw_exception<parse_error>(to<std::string>(
+        "json parse error on line ",
+        line,
+        !context.empty() ? to<std::string>(" near `", context, '\'') : "",
+        ": ",
+        what));
+  }
+
+  // Throws TypeError for the next value not being of the expected type.
+  [[noreturn]] void typeError(char const* expected) {
+    auto const c = peek();
+    if (!std::strchr("{[\"tfn-IN0123456789", c) || c == '\0') {
+      error("expected json value");
+    }
+    throw_exception<TypeError>(expected, peekType());
+  }
+
+ private:
+  char peek() {
+    while (pos_ != end_ &&
+           (*pos_ == ' ' || *pos_ == '\n' || *pos_ == '\t' || *pos_ == '\r')) {
+      ++pos_;
+    }
+    return pos_ == end_ ? '\0' : *pos_;
+  }
+
+  template <typename T>
+  T readScalar(char const* expected) {
+    switch (peek()) {
+      case 't':
+        literal("true");
+        return to<T>(true);
+      case 'f':
+        literal("false");
+        return to<T>(false);
+      default:
+        break;
+    }
+    bool integer = false;
+    auto const token = number(integer, expected);
+    if (FOLLY_LIKELY(isInt64(token, integer))) {
+      return to<T>(to<int64_t>(token));
+    }
+    return to<T>(to<double>(token));
+  }
+
+  // Whether parseNumber makes an int64 of `token` rather than a double:
+  // with double_fallback, integers out of the range of int64 are doubles.
+  bool isInt64(StringPiece token, bool integer) const {
+    if (!integer) {
+      return false;
+    }
+    constexpr StringPiece kMax = "9223372036854775807";
+    constexpr StringPiece kMin = "-9223372036854775808";
+    auto const extrema = token[0] == '-' ? kMin : kMax;
+    return FOLLY_LIKELY(
+               !opts_.double_fallback || token.size() < extrema.size()) ||
+        (token.size() == extrema.size() && token <= extrema);
+  }
+
+  void expect(char c) {
+    if (FOLLY_UNLIKELY(peek() != c)) {
+      error(c == ':'   ? "expected ':'"
+                : c == '}' ? "expected '}'"
+                : c == ']' ? "expected ']'"
+                           : "unexpected character");
+    }
+    ++pos_;
+  }
+
+  void literal(StringPiece word) {
+    if (FOLLY_UNLIKELY(!StringPiece(pos_, end_).startsWith(word))) {
+      error("expected json value");
+    }
+    pos_ += word.size();
+  }
+
+  void enter() {
+    if (FOLLY_UNLIKELY(++depth_ > opts_.recursion_limit)) {
+      error("recursion limit exceeded");
+    }
+  }
+  void leave() { --depth_; }
+
+  bool isIntegerAhead() const {
+    auto p = pos_;
+    p += p != end_ && *p == '-';
+    while (p != end_ && *p >= '0' && *p <= '9') {
+      ++p;
+    }
+    return p != pos_ && (p == end_ || (*p != '.' && *p != 'e' && *p != 'E')) &&
+        *pos_ != 'I' && *pos_ != 'N';
+  }
+
+  // Scans a number as parseNumber does, which is laxer than the json
+  // grammar: leading zeros are allowed, and the digits after a '.' or an
+  // exponent are left for to<double> to check. Also takes the Infinity,
+  // -Infinity and NaN that parseJson accepts. `integer` tells if it is
+  // just digits.
+  StringPiece number(bool& integer, char const* expected) {
+    auto const c = peek();
+    if (c != '-' && !(c >= '0' && c <= '9') && c != 'I' && c != 'N') {
+      typeError(expected);
+    }
+    auto const start = pos_;
+    auto p = pos_ + (c == '-');
+    integer = false;
+    for (auto const word : {StringPiece("Infinity"), StringPiece("NaN")}) {
+      if ((c != '-' || word[0] == 'I') &&
+          StringPiece(p, end_).startsWith(word)) {
+        pos_ = p + word.size();
+        return StringPiece(start, pos_);
+      }
+    }
+    if (c == 'I' || c == 'N') {
+      error("expected json value");
+    }
+    auto const digits = [&] {
+      while (p != end_ && *p >= '0' && *p <= '9') {
+        ++p;
+      }
+    };
+    digits();
+    if (p == pos_ + 1 && c == '-') {
+      pos_ = p;
+      error("expected digits after `-'");
+    }
+    integer = true;
+    if (p != end_ && *p == '.') {
+      ++p;
+      digits();
+      integer = false;
+    }
+    if (p != end_ && (*p == 'e' || *p == 'E')) {
+      ++p;
+      p += p != end_ && (*p == '+' || *p == '-');
+      digits();
+      integer = false;
+    }
+    pos_ = p;
+    return StringPiece(start, p);
+  }
+
+  // Checks a string as readString does, without decoding it.
+  void skipString() {
+    ++pos_;
+    while (true) {
+      if (FOLLY_UNLIKELY(pos_ == end_)) {
+        error("unterminated string");
+      }
+      auto const c = *pos_;
+      if (c == '"') {
+        ++pos_;
+        return;
+      }
+      if (c == '\\') {
+        ++pos_;
+        escape(nullptr);
+        continue;
+      }
+      ++pos_;
+    }
+  }
+
+  char16_t hex4() {
+    if (end_ - pos_ < 4) {
+      error("expected 4 hex digits");
+    }
+    char16_t ret = 0;
+    for (int i = 0; i < 4; ++i) {
+      auto const c = *pos_++;
+      ret <<= 4;
+      if (c >= '0' && c <= '9') {
+        ret |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        ret |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        ret |= c - 'A' + 10;
+      } else {
+        error("invalid hex digit");
+      }
+    }
+    return ret;
+  }
+
+  // The escape after a backslash, appended to out unless it is null.
+  void escape(std::string* out) {
+    if (pos_ == end_) {
+      error("unterminated string");
+    }
+    char c;
+    switch (*pos_++) {
+      // clang-format off
+      case '"': c = '"'; break;
+      case '\\': c = '\\'; break;
+      case '/': c = '/'; break;
+      case 'b': c = '\b'; break;
+      case 'f': c = '\f'; break;
+      case 'n': c = '\n'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+      // clang-format on
+      case 'u': {
+        char32_t cp = hex4();
+        if (utf16_code_unit_is_high_surrogate(cp)) {
+          if (end_ - pos_ < 2 || pos_[0] != '\\' || pos_[1] != 'u') {
+            error("expected another unicode escape for second half of "
+                  "surrogate pair");
+          }
+          pos_ += 2;
+          auto const low = hex4();
+          if (!utf16_code_unit_is_low_surrogate(low)) {
+            error("second character in surrogate pair is invalid");
+          }
+          cp = unicode_code_point_from_utf16_surrogate_pair(cp, low);
+        } else if (utf16_code_unit_is_low_surrogate(cp)) {
+          error("invalid unicode code point (in range [0xdc00,0xdfff])");
+        }
+        if (out) {
+          appendCodePointToUtf8(cp, *out);
+        }
+        return;
+      }
+      default:
+        error("unknown escape sequence in json");
+    }
+    if (out) {
+      out->push_back(c);
+    }
+  }
+
+  // The rest of a string whose escape-free prefix is already in out.
+  StringPiece unescape(std::string& out) {
+    while (true) {
+      if (FOLLY_UNLIKELY(pos_ == end_)) {
+        error("unterminated string");
+      }
+      auto const c = *pos_++;
+      if (c == '"') {
+        return out;
+      }
+      if (c == '\\') {
+        escape(&out);
+        continue;
+      }
+      out.push_back(c);
+    }
+  }
+
+  char const* begin_;
+  char const* pos_;
+  char const* end_;
+  serialization_opts const& opts_;
+  unsigned depth_{0};
+  std::string keyScratch_;
+};
+
+/**
+ * Appends json text for codec::write.
+ */
+class struct_writer {
+ public:
+  struct_writer(std::string& out, serialization_opts const& opts)
+      : out_(out), opts_(opts) {}
+
+  serialization_opts const& opts() const { return opts_; }
+  std::string& out() { return out_; }
+
+  void writeNull() { out_ += "null"; }
+  void writeBool(bool value) { out_ += value ? "true" : "false"; }
+
+  template <typename T>
+  void writeInteger(T value) {
+    if (opts_.javascript_safe) {
+      // as toJson: checks the integer is exact as a double
+      to<double>(value);
+    }
+    toAppend(value, &out_);
+  }
+
+  void writeDouble(double value) {
+    if (!opts_.allow_nan_inf && !std::isfinite(value)) {
+      throw_exception<print_error>(
+          std::isnan(value)
+              ? "folly::json::encode: value was a NaN"
+              : "folly::json::encode: value was an INF");
+    }
+    toAppend(
+        value,
+        &out_,
+        opts_.double_mode,
+        opts_.double_num_digits,
+        opts_.double_flags);
+  }
+
+  void writeString(StringPiece value) { escapeString(value, out_, opts_); }
+
+  // Writes `"key":`, preceded by a comma unless it is the first.
+  void writeKey(StringPiece key, bool first) {
+    if (!first) {
+      out_ += ',';
+    }
+    writeString(key);
+    out_ += ':';
+  }
+
+  // Same for a key known not to need escaping, like a member name.
+  void writePlainKey(std::string_view key, bool first) {
+    out_ += first ? "\"" : ",\"";
+    out_.append(key.data(), key.size());
+    out_ += "\":";
+  }
+
+ private:
+  std::string& out_;
+  serialization_opts const& opts_;
+};
+
+namespace detail {
+
+template <typename C, typename M>
+struct field {
+  std::string_view name;
+  M C::*member;
+};
+
+template <typename C, typename... M>
+struct field_list {
+  std::tuple<field<C, M>...> fields;
+
+  template <typename N>
+  constexpr field_list<C, M..., N> add(
+      std::string_view name, N C::*member) const {
+    return {std::tuple_cat(fields, std::make_tuple(field<C, N>{name, member}))};
+  }
+};
+
+template <typename T>
+using detect_json_fields =
+    decltype(follyJsonFields(static_cast<T const*>(nullptr)));
+
+template <typename T>
+constexpr bool has_json_fields_v = is_detected_v<detect_json_fields, T>;
+
+// FNV-1a, perturbed by a seed chosen so that a struct's field names land in
+// distinct slots.
+constexpr uint32_t fieldNameHash(std::string_view name, uint32_t seed) {
+  uint32_t h = 0x811c9dc5 ^ seed;
+  for (auto const c : name) {
+    h = (h ^ static_cast<uint8_t>(c)) * 0x01000193;
+  }
+  return h ^ (h >> 16);
+}
+
+constexpr size_t fieldTableSize(size_t fields) {
+  size_t size = 4;
+  while (size < 4 * fields) {
+    size *= 2;
+  }
+  return size;
+}
+
+template <size_t N>
+struct field_table {
+  static constexpr size_t kSize = fieldTableSize(N);
+  uint32_t seed{};
+  // field index + 1, or 0
+  std::array<uint8_t, kSize> slots{};
+};
+
+template <size_t N>
+constexpr field_table<N> makeFieldTable(
+    std::array<std::string_view, N> const& names) {
+  static_assert(N < 256, "too many fields");
+  field_table<N> table;
+  for (uint32_t seed = 0; seed < (1u << 16); ++seed) {
+    table.seed = seed;
+    table.slots = {};
+    bool ok = true;
+    for (size_t i = 0; ok && i < N; ++i) {
+      auto& slot = table.slots
+                       [fieldNameHash(names[i], seed) & (table.kSize - 1)];
+      ok = slot == 0;
+      slot = uint8_t(i + 1);
+    }
+    if (ok) {
+      return table;
+    }
+  }
+  // only reachable with duplicate names; not a constant expression
+  throw_exception<std::logic_error>("FOLLY_JSON_FIELDS: duplicate field");
+}
+
+template <typename T>
+struct struct_info {
+  static constexpr auto list = follyJsonFields(static_cast<T const*>(nullptr));
+  static constexpr size_t size = std::tuple_size_v<decltype(list.fields)>;
+
+  template <size_t... I>
+  static constexpr std::array<std::string_view, size> namesOf(
+      std::index_sequence<I...>) {
+    return {{std::get<I>(list.fields).name...}};
+  }
+  static constexpr std::array<std::string_view, size> names =
+      namesOf(std::make_index_sequence<size>{});
+  static constexpr field_table<size> table = makeFieldTable<size>(names);
+
+  // Index of the field named `key`, or size.
+  static size_t find(StringPiece key) {
+    auto const slot = table.slots[fieldNameHash(
+                          std::string_view(key.data(), key.size()),
+                          table.seed) &
+                      (table.kSize - 1)];
+    if (slot == 0) {
+      return size;
+    }
+    auto const& name = names[slot - 1];
+    return name.size() == key.size() &&
+            std::memcmp(name.data(), key.data(), key.size()) == 0
+        ? slot - 1
+        : size;
+  }
+};
+
+template <typename T>
+using detect_emplace_back =
+    decltype(std::declval<T&>().emplace_back(), void());
+template <typename T>
+using detect_mapped_type = typename T::mapped_type;
+template <typename T>
+using detect_key_type = typename T::key_type;
+template <typename T>
+using detect_value_type = typename T::value_type;
+
+template <typename T>
+constexpr bool is_string_v = IsSomeString<T>::value;
+
+template <typename T>
+constexpr bool is_container_candidate_v =
+    !has_json_fields_v<T> && !std::is_same_v<T, dynamic> && !is_string_v<T>;
+
+template <typename T>
+constexpr bool is_map_v = is_container_candidate_v<T> &&
+    is_detected_v<detect_mapped_type, T> && is_detected_v<detect_key_type, T>;
+
+template <typename T>
+constexpr bool is_set_v = is_container_candidate_v<T> && !is_map_v<T> &&
+    is_detected_v<detect_key_type, T> && is_detected_v<detect_value_type, T>;
+
+template <typename T>
+constexpr bool is_sequence_v = is_container_candidate_v<T> && !is_map_v<T> &&
+    !is_set_v<T> && is_detected_v<detect_value_type, T> &&
+    is_detected_v<detect_emplace_back, T>;
+
+} // namespace detail
+
+template <typename T>
+void read(struct_reader& in, T& out) {
+  codec<std::remove_cv_t<T>>::read(in, out);
+}
+
+template <typename T>
+void write(struct_writer& out, T const& value) {
+  codec<std::remove_cv_t<T>>::write(out, value);
+}
+
+template <>
+struct codec<bool> {
+  static void read(struct_reader& in, bool& out) { out = in.readBool(); }
+  static void write(struct_writer& out, bool value) { out.writeBool(value); }
+};
+
+template <typename T>
+struct codec<
+    T,
+    std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+  static void read(struct_reader& in, T& out) {
+    out = in.readInteger<T>();
+  }
+  static void write(struct_writer& out, T value) { out.writeInteger(value); }
+};
+
+template <typename T>
+struct codec<T, std::enable_if_t<std::is_enum_v<T>>> {
+  using underlying = std::underlying_type_t<T>;
+  static void read(struct_reader& in, T& out) {
+    out = static_cast<T>(in.readInteger<underlying>());
+  }
+  static void write(struct_writer& out, T value) {
+    out.writeInteger(static_cast<underlying>(value));
+  }
+};
+
+template <typename T>
+struct codec<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+  static void read(struct_reader& in, T& out) {
+    out = to<T>(in.readDouble());
+  }
+  static void write(struct_writer& out, T value) {
+    out.writeDouble(static_cast<double>(value));
+  }
+};
+
+template <typename T>
+struct codec<T, std::enable_if_t<detail::is_string_v<T>>> {
+  static void read(struct_reader& in, T& out) {
+    std::string scratch;
+    auto const value = in.readString(scratch);
+    out.assign(value.data(), value.size());
+  }
+  static void write(struct_writer& out, T const& value) {
+    out.writeString(StringPiece(value.data(), value.size()));
+  }
+};
+
+template <>
+struct codec<dynamic> {
+  static void read(struct_reader& in, dynamic& out) {
+    out = parseJson(in.rawValue(), in.opts());
+  }
+  static void write(struct_writer& out, dynamic const& value) {
+    out.out() += json::serialize(value, out.opts());
+  }
+};
+
+template <typename T>
+struct codec<Optional<T>> {
+  static void read(struct_reader& in, Optional<T>& out) {
+    if (in.consumeNull()) {
+      out.reset();
+      return;
+    }
+    json::read(in, out.emplace());
+  }
+  static void write(struct_writer& out, Optional<T> const& value) {
+    if (value) {
+      json::write(out, *value);
+    } else {
+      out.writeNull();
+    }
+  }
+};
+
+template <typename T>
+struct codec<std::optional<T>> {
+  static void read(struct_reader& in, std::optional<T>& out) {
+    if (in.consumeNull()) {
+      out.reset();
+      return;
+    }
+    json::read(in, out.emplace());
+  }
+  static void write(struct_writer& out, std::optional<T> const& value) {
+    if (value) {
+      json::write(out, *value);
+    } else {
+      out.writeNull();
+    }
+  }
+};
+
+template <typename C>
+struct codec<C, std::enable_if_t<detail::is_sequence_v<C>>> {
+  using value_type = typename C::value_type;
+  static void read(struct_reader& in, C& out) {
+    out.clear();
+    in.readArray([&] {
+      if constexpr (std::is_same_v<value_type, bool>) {
+        // std::vector<bool> has no references to read into
+        out.push_back(in.readBool());
+      } else {
+        json::read(in, out.emplace_back());
+      }
+    });
+  }
+  static void write(struct_writer& out, C const& value) {
+    out.out() += '[';
+    bool first = true;
+    for (auto const& element : value) {
+      if (!first) {
+        out.out() += ',';
+      }
+      first = false;
+      json::write(out, static_cast<value_type const&>(element));
+    }
+    out.out() += ']';
+  }
+};
+
+template <typename C>
+struct codec<C, std::enable_if_t<detail::is_set_v<C>>> {
+  static void read(struct_reader& in, C& out) {
+    out.clear();
+    in.readArray([&] {
+      typename C::value_type element{};
+      json::read(in, element);
+      out.insert(std::move(element));
+    });
+  }
+  static void write(struct_writer& out, C const& value) {
+    out.out() += '[';
+    bool first = true;
+    for (auto const& element : value) {
+      if (!first) {
+        out.out() += ',';
+      }
+      first = false;
+      json::write(out, element);
+    }
+    out.out() += ']';
+  }
+};
+
+template <typename C>
+struct codec<C, std::enable_if_t<detail::is_map_v<C>>> {
+  using key_type = typename C::key_type;
+  static_assert(
+      detail::is_string_v<key_type>, "json object keys must be strings");
+
+  static void read(struct_reader& in, C& out) {
+    out.clear();
+    in.readObject([&](StringPiece key) {
+      json::read(in, out[key_type(key.data(), key.size())]);
+    });
+  }
+  static void write(struct_writer& out, C const& value) {
+    out.out() += '{';
+    bool first = true;
+    for (auto const& [key, mapped] : value) {
+      out.writeKey(StringPiece(key.data(), key.size()), first);
+      first = false;
+      json::write(out, mapped);
+    }
+    out.out() += '}';
+  }
+};
+
+template <typename T>
+struct codec<T, std::enable_if_t<detail::has_json_fields_v<T>>> {
+  using info = detail::struct_info<T>;
+  using reader = void (*)(struct_reader&, T&);
+
+  template <size_t I>
+  static void readField(struct_reader& in, T& out) {
+    json::read(in, out.*(std::get<I>(info::list.fields).member));
+  }
+
+  template <size_t... I>
+  static constexpr std::array<reader, info::size> readersOf(
+      std::index_sequence<I...>) {
+    return {{&readField<I>...}};
+  }
+  static constexpr std::array<reader, info::size> readers =
+      readersOf(std::make_index_sequence<info::size>{});
+
+  static void read(struct_reader& in, T& out) {
+    in.readObject([&](StringPiece key) {
+      auto const index = info::find(key);
+      if (index < info::size) {
+        readers[index](in, out);
+      } else {
+        in.skipValue();
+      }
+    });
+  }
+
+  template <size_t... I>
+  static void writeFields(
+      struct_writer& out, T const& value, std::index_sequence<I...>) {
+    (...,
+     (out.writePlainKey(info::names[I], I == 0),
+      json::write(out, value.*(std::get<I>(info::list.fields).member))));
+  }
+
+  static void write(struct_writer& out, T const& value) {
+    out.out() += '{';
+    writeFields(out, value, std::make_index_sequence<info::size>{});
+    out.out() += '}';
+  }
+};
+
+/**
+ * Read json text into `out`, which must be supported by json::codec.
+ */
+template <typename T>
+void decode(
+    StringPiece text, T& out, serialization_opts const& opts = {}) {
+  struct_reader in(text, opts);
+  json::read(in, out);
+  in.finish();
+}
+
+template <typename T>
+T decode(StringPiece text, serialization_opts const& opts = {}) {
+  T out{};
+  decode(text, out, opts);
+  return out;
+}
+
+/**
+ * Append the json text of `value` to `out`.
+ */
+template <typename T>
+void encode(
+    T const& value, std::string& out, serialization_opts const& opts = {}) {
+  struct_writer writer(out, opts);
+  json::write(writer, value);
+}
+
+template <typename T>
+std::string encode(T const& value, serialization_opts const& opts = {}) {
+  std::string out;
+  encode(value, out, opts);
+  return out;
+}
+
+} // namespace json
+} // namespace folly
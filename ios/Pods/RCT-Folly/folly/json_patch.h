@@ -16,10 +16,19 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include <glog/logging.h>
+
+#include <folly/Conv.h>
 #include <folly/Expected.h>
 #include <folly/Optional.h>
+#include <folly/container/Enumerate.h>
+#include <folly/container/F14Map.h>
 #include <folly/dynamic.h>
 #include <folly/json_pointer.h>
 
@@ -30,8 +39,8 @@ namespace folly {
  *
  * As described in RFC 6902 "JSON Patch".
  *
- * Implements parsing. Application over data structures must be
- * implemented separately.
+ * Implements parsing, application over dynamic and structural diffing
+ * of two dynamic values into a patch.
  */
 class json_patch {
  public:
@@ -97,6 +106,20 @@ class json_patch {
 
   std::vector<patch_operation> const& ops() const;
 
+  /*
+   * Compute a patch that turns `from` into a value equal (per
+   * dynamic::operator==) to `to`.
+   *
+   * Objects are diffed by key set and recursed into on common keys. Arrays
+   * are trimmed of their common prefix and suffix, and the remainder is
+   * aligned with a longest common subsequence over element hashes. Elements
+   * removed at one place and re-added elsewhere within the same array or
+   * object are emitted as "move" operations, and leftover removals paired
+   * with insertions at the same position are diffed in place. The result
+   * is small, though not guaranteed to be minimal.
+   */
+  static json_patch diff(dynamic const& from, dynamic const& to);
+
   enum class patch_application_error_code : uint8_t {
     other,
     // "from" pointer did not resolve
@@ -116,6 +139,10 @@ class json_patch {
   /*
    * Mutate supplied object in accordance with patch operations. Leaves
    * object in partially modified state if one of the operations fails.
+   *
+   * Containers resolved for one operation's path are reused by the next
+   * operation sharing a prefix of it, so a patch touching one region of a
+   * large document does not walk it from the root for every operation.
    */
   Expected<Unit, patch_application_error> apply(dynamic& obj) const;
 
@@ -123,4 +150,845 @@ class json_patch {
   std::vector<patch_operation> ops_;
 };
 
+namespace json_patch_detail {
+inline const std::string kOpKey{"op"};
+inline const std::string kOpTest{"test"};
+inline const std::string kOpRemove{"remove"};
+inline const std::string kOpAdd{"add"};
+inline const std::string kOpReplace{"replace"};
+inline const std::string kOpMove{"move"};
+inline const std::string kOpCopy{"copy"};
+inline const std::string kPathKey{"path"};
+inline const std::string kFromKey{"from"};
+inline const std::string kValueKey{"value"};
+} // namespace json_patch_detail
+
+// static
+inline Expected<json_patch, json_patch::parse_error> json_patch::try_parse(
+    dynamic const& obj) noexcept {
+  using err_code = parse_error_code;
+  using namespace json_patch_detail;
+
+  json_patch patch;
+  if (!obj.isArray()) {
+    return makeUnexpected(parse_error{err_code::invalid_shape, &obj});
+  }
+  for (auto const& elem : obj) {
+    if (!elem.isObject()) {
+      return makeUnexpected(parse_error{err_code::invalid_shape, &elem});
+    }
+    auto const* op_ptr = elem.get_ptr(kOpKey);
+    if (!op_ptr) {
+      return makeUnexpected(parse_error{err_code::missing_op, &elem});
+    }
+    if (!op_ptr->isString()) {
+      return makeUnexpected(parse_error{err_code::malformed_op, &elem});
+    }
+    auto const& op_str = op_ptr->getString();
+    patch_operation op;
+
+    // extract 'from' attribute
+    if (auto const* from_ptr = elem.get_ptr(kFromKey)) {
+      if (!from_ptr->isString()) {
+        return makeUnexpected(parse_error{err_code::invalid_shape, &elem});
+      }
+      auto json_ptr = json_pointer::try_parse(from_ptr->getString());
+      if (!json_ptr.hasValue()) {
+        return makeUnexpected(
+            parse_error{err_code::malformed_from_attr, &elem});
+      }
+      op.from = std::move(json_ptr.value());
+    }
+
+    // extract 'path' attribute
+    {
+      auto const* path_ptr = elem.get_ptr(kPathKey);
+      if (!path_ptr) {
+        return makeUnexpected(parse_error{err_code::missing_path_attr, &elem});
+      }
+      if (!path_ptr->isString()) {
+        return makeUnexpected(
+            parse_error{err_code::malformed_path_attr, &elem});
+      }
+      auto json_ptr = json_pointer::try_parse(path_ptr->getString());
+      if (!json_ptr.hasValue()) {
+        return makeUnexpected(
+            parse_error{err_code::malformed_path_attr, &elem});
+      }
+      op.path = std::move(json_ptr.value());
+    }
+
+    // extract 'value' attribute
+    if (auto const* val_ptr = elem.get_ptr(kValueKey)) {
+      op.value = *val_ptr;
+    }
+
+    // check mandatory attributes - add to this list as needed
+    if (op_str == kOpTest) {
+      if (!op.value) {
+        return makeUnexpected(parse_error{err_code::missing_value_attr, &elem});
+      }
+      op.op_code = patch_operation_code::test;
+    } else if (op_str == kOpRemove) {
+      op.op_code = patch_operation_code::remove;
+    } else if (op_str == kOpAdd) {
+      if (!op.value) {
+        return makeUnexpected(parse_error{err_code::missing_value_attr, &elem});
+      }
+      op.op_code = patch_operation_code::add;
+    } else if (op_str == kOpReplace) {
+      if (!op.value) {
+        return makeUnexpected(parse_error{err_code::missing_value_attr, &elem});
+      }
+      op.op_code = patch_operation_code::replace;
+    } else if (op_str == kOpMove) {
+      if (!op.from) {
+        return makeUnexpected(parse_error{err_code::missing_from_attr, &elem});
+      }
+      // is from a proper prefix to path?
+      if (op.from->is_prefix_of(op.path) && *op.from != op.path) {
+        return makeUnexpected(
+            parse_error{err_code::overlapping_pointers, &elem});
+      }
+      op.op_code = patch_operation_code::move;
+    } else if (op_str == kOpCopy) {
+      if (!op.from) {
+        return makeUnexpected(parse_error{err_code::missing_from_attr, &elem});
+      }
+      op.op_code = patch_operation_code::copy;
+    } else {
+      return makeUnexpected(parse_error{err_code::unknown_op, &elem});
+    }
+    patch.ops_.emplace_back(std::move(op));
+  }
+  return patch;
+}
+
+inline std::vector<json_patch::patch_operation> const& json_patch::ops()
+    const {
+  return ops_;
+}
+
+namespace json_patch_detail {
+
+using app_err_code = json_patch::patch_application_error_code;
+using res_err_code = dynamic::json_pointer_resolution_error_code;
+using resolved_path = dynamic::resolved_json_pointer<dynamic>;
+using resolved_value = dynamic::json_pointer_resolved_value<dynamic>;
+using resolution_error = dynamic::json_pointer_resolution_error<dynamic>;
+
+/*
+ * Resolves the json_pointers of a patch with the same rules as
+ * dynamic::try_get_ptr, but keeps the chain of containers walked for the
+ * previous pointer. The next pointer only walks the tokens past the prefix
+ * it shares with the previous one, which for the output of diff() (runs of
+ * operations on siblings) is usually just the last token.
+ *
+ * Only the parent chain is kept. Every operation mutates at most the
+ * parent of its path (or the target value itself), so the cached ancestors
+ * stay valid across operations; the chain is cut back to the shared prefix
+ * before anything below it is touched.
+ */
+class pointer_resolver {
+ public:
+  explicit pointer_resolver(dynamic& root) : nodes_{&root} {}
+
+  resolved_path resolve(json_pointer const& ptr) {
+    auto const& tokens = ptr.tokens();
+    size_t depth = 0;
+    if (tokens_ && !tokens.empty()) {
+      auto const limit = std::min(nodes_.size() - 1, tokens.size() - 1);
+      while (depth < limit && (*tokens_)[depth] == tokens[depth]) {
+        ++depth;
+      }
+    }
+    nodes_.resize(depth + 1);
+    tokens_ = &tokens;
+    if (tokens.empty()) {
+      return resolved_value{nullptr, nodes_[0], {}, 0};
+    }
+
+    for (size_t i = depth; i + 1 < tokens.size(); ++i) {
+      auto* const node = nodes_.back();
+      size_t index = 0;
+      auto const child = lookup(*node, tokens[i], false, index);
+      if (!child.hasValue()) {
+        return makeUnexpected(resolution_error{child.error(), i, node});
+      }
+      nodes_.push_back(child.value());
+    }
+
+    auto* const parent = nodes_.back();
+    auto const last = tokens.size() - 1;
+    size_t index = 0;
+    auto const value = lookup(*parent, tokens[last], true, index);
+    if (!value.hasValue()) {
+      return makeUnexpected(resolution_error{value.error(), last, parent});
+    }
+    return resolved_value{parent, value.value(), tokens[last], index};
+  }
+
+ private:
+  static Expected<dynamic*, res_err_code> lookup(
+      dynamic& node, std::string const& token, bool last, size_t& index) {
+    if (node.isArray()) {
+      if (token.size() > 1 && token[0] == '0') {
+        return makeUnexpected(res_err_code::index_has_leading_zero);
+      }
+      if (token.size() == 1 && token[0] == '-') {
+        return makeUnexpected(
+            last ? res_err_code::append_requested
+                 : res_err_code::json_pointer_out_of_bounds);
+      }
+      auto const idx = tryTo<size_t>(token);
+      if (!idx.hasValue()) {
+        return makeUnexpected(res_err_code::index_not_numeric);
+      }
+      if (idx.value() >= node.size()) {
+        return makeUnexpected(res_err_code::index_out_of_bounds);
+      }
+      index = idx.value();
+      return &node[index];
+    }
+    if (node.isObject()) {
+      auto* const value = node.get_ptr(token);
+      if (!value) {
+        return makeUnexpected(res_err_code::key_not_found);
+      }
+      return value;
+    }
+    return makeUnexpected(res_err_code::element_not_object_or_array);
+  }
+
+  std::vector<dynamic*> nodes_;
+  std::vector<std::string> const* tokens_{nullptr};
+};
+
+inline Expected<Unit, app_err_code> do_remove(resolved_path& ptr) {
+  if (!ptr.hasValue()) {
+    return makeUnexpected(app_err_code::path_not_found);
+  }
+  auto* const parent = ptr->parent;
+  if (!parent) {
+    return makeUnexpected(app_err_code::other);
+  }
+  if (parent->isObject()) {
+    parent->erase(ptr->parent_key);
+    return unit;
+  }
+  if (parent->isArray()) {
+    parent->erase(parent->begin() + ptr->parent_index);
+    return unit;
+  }
+  return makeUnexpected(app_err_code::other);
+}
+
+inline Expected<Unit, app_err_code> do_add(
+    resolved_path& ptr,
+    dynamic value,
+    std::vector<std::string> const& tokens) {
+  // element found: see if parent is object or array
+  if (ptr.hasValue()) {
+    // root element, or key in object - replace (per spec, par. 4.1, pt. 3.)
+    if (ptr->parent == nullptr || ptr->parent->isObject()) {
+      *ptr->value = std::move(value);
+      return unit;
+    }
+    // valid index in array: insert at index and shift right
+    if (ptr->parent->isArray()) {
+      ptr->parent->insert(
+          ptr->parent->begin() + ptr->parent_index, std::move(value));
+      return unit;
+    }
+    return makeUnexpected(app_err_code::other);
+  }
+  // only the last token may be missing
+  auto const& err = ptr.error();
+  if (err.index + 1 != tokens.size()) {
+    return makeUnexpected(app_err_code::other);
+  }
+  switch (err.error_code) {
+    // key not found. can only happen in object - add new key-value
+    case res_err_code::key_not_found:
+      DCHECK(err.context->isObject());
+      err.context->insert(tokens.back(), std::move(value));
+      return unit;
+    // special '-' index in array - do append operation
+    case res_err_code::append_requested:
+      DCHECK(err.context->isArray());
+      err.context->push_back(std::move(value));
+      return unit;
+    // index equal to the array size also appends (per spec, par. 4.1)
+    case res_err_code::index_out_of_bounds:
+      DCHECK(err.context->isArray());
+      if (tryTo<size_t>(tokens.back()).value_or(SIZE_MAX) ==
+          err.context->size()) {
+        err.context->push_back(std::move(value));
+        return unit;
+      }
+      return makeUnexpected(app_err_code::other);
+    default:
+      return makeUnexpected(app_err_code::other);
+  }
+}
+
+} // namespace json_patch_detail
+
+inline Expected<Unit, json_patch::patch_application_error> json_patch::apply(
+    dynamic& obj) const {
+  using namespace json_patch_detail;
+  using op_code = patch_operation_code;
+  using error_code = patch_application_error_code;
+  using error = patch_application_error;
+
+  pointer_resolver resolver{obj};
+  for (auto&& it : enumerate(ops_)) {
+    auto const index = it.index;
+    auto const& op = *it;
+
+    switch (op.op_code) {
+      case op_code::test: {
+        auto const resolved = resolver.resolve(op.path);
+        if (!resolved.hasValue()) {
+          return makeUnexpected(error{error_code::path_not_found, index});
+        }
+        if (*resolved->value != *op.value) {
+          return makeUnexpected(error{error_code::test_failed, index});
+        }
+        break;
+      }
+      case op_code::remove: {
+        auto resolved = resolver.resolve(op.path);
+        auto ret = do_remove(resolved);
+        if (ret.hasError()) {
+          return makeUnexpected(error{ret.error(), index});
+        }
+        break;
+      }
+      case op_code::add: {
+        DCHECK(op.value.has_value());
+        auto resolved = resolver.resolve(op.path);
+        auto ret = do_add(resolved, *op.value, op.path.tokens());
+        if (ret.hasError()) {
+          return makeUnexpected(error{ret.error(), index});
+        }
+        break;
+      }
+      case op_code::replace: {
+        DCHECK(op.value.has_value());
+        auto const resolved = resolver.resolve(op.path);
+        if (!resolved.hasValue()) {
+          return makeUnexpected(error{error_code::path_not_found, index});
+        }
+        *resolved->value = *op.value;
+        break;
+      }
+      case op_code::move: {
+        DCHECK(op.from.has_value());
+        auto resolved_from = resolver.resolve(*op.from);
+        if (!resolved_from.hasValue()) {
+          return makeUnexpected(error{error_code::from_not_found, index});
+        }
+        if (*op.from == op.path) {
+          break;
+        }
+        auto value = std::move(*resolved_from->value);
+        auto ret = do_remove(resolved_from);
+        if (ret.hasError()) {
+          return makeUnexpected(error{ret.error(), index});
+        }
+        // after removal, path may have changed - resolve again
+        auto resolved = resolver.resolve(op.path);
+        ret = do_add(resolved, std::move(value), op.path.tokens());
+        if (ret.hasError()) {
+          return makeUnexpected(error{ret.error(), index});
+        }
+        break;
+      }
+      case op_code::copy: {
+        DCHECK(op.from.has_value());
+        auto const resolved_from = resolver.resolve(*op.from);
+        if (!resolved_from.hasValue()) {
+          return makeUnexpected(error{error_code::from_not_found, index});
+        }
+        dynamic value = *resolved_from->value;
+        auto resolved = resolver.resolve(op.path);
+        auto ret = do_add(resolved, std::move(value), op.path.tokens());
+        if (ret.hasError()) {
+          return makeUnexpected(error{ret.error(), index});
+        }
+        break;
+      }
+      case op_code::invalid: {
+        DCHECK(false);
+        return makeUnexpected(error{error_code::other, index});
+      }
+    }
+  }
+  return unit;
+}
+
+namespace json_patch_detail {
+
+// Give up on aligning an array and treat it as wholly rewritten once the
+// edit distance (or the O((N + M) * D) work to find it) exceeds this.
+inline constexpr size_t kMaxEditDistance = 1024;
+inline constexpr size_t kMaxEditWork = size_t(1) << 24;
+
+/*
+ * Myers' O((N + M) * D) longest common subsequence over element hashes.
+ * Appends the matched (from, to) index pairs in increasing order to `out`,
+ * or returns false if the edit distance exceeds `maxD`.
+ */
+inline bool hashLcs(
+    std::vector<size_t> const& a,
+    std::vector<size_t> const& b,
+    size_t maxD,
+    std::vector<std::pair<size_t, size_t>>& out) {
+  auto const n = static_cast<ptrdiff_t>(a.size());
+  auto const m = static_cast<ptrdiff_t>(b.size());
+  // trace[d][k + d] is the furthest x reached on diagonal k with d edits
+  std::vector<std::vector<ptrdiff_t>> trace;
+  for (ptrdiff_t d = 0; d <= static_cast<ptrdiff_t>(maxD); ++d) {
+    std::vector<ptrdiff_t> v(2 * d + 1);
+    auto const* prev = d ? trace.back().data() + (d - 1) : nullptr;
+    for (ptrdiff_t k = -d; k <= d; k += 2) {
+      ptrdiff_t x;
+      if (d == 0) {
+        x = 0;
+      } else if (k == -d || (k != d && prev[k - 1] < prev[k + 1])) {
+        x = prev[k + 1];
+      } else {
+        x = prev[k - 1] + 1;
+      }
+      ptrdiff_t y = x - k;
+      while (x < n && y < m && a[x] == b[y]) {
+        ++x;
+        ++y;
+      }
+      v[k + d] = x;
+      if (x < n || y < m) {
+        continue;
+      }
+      trace.push_back(std::move(v));
+      // walk the edit path back, collecting the diagonal runs
+      auto const start = out.size();
+      for (; d > 0; --d) {
+        auto const* p = trace[d - 1].data() + (d - 1);
+        k = x - y;
+        bool const down = k == -d || (k != d && p[k - 1] < p[k + 1]);
+        auto const prevK = down ? k + 1 : k - 1;
+        auto const prevX = p[prevK];
+        auto const prevY = prevX - prevK;
+        auto const snakeX = down ? prevX : prevX + 1;
+        while (x > snakeX) {
+          out.emplace_back(--x, --y);
+        }
+        x = prevX;
+        y = prevY;
+      }
+      while (x > 0) {
+        out.emplace_back(--x, --y);
+      }
+      std::reverse(out.begin() + start, out.end());
+      return true;
+    }
+    trace.push_back(std::move(v));
+  }
+  return false;
+}
+
+// Counts live slots before a position; slots are revived and cleared as
+// the edit script is replayed against the array.
+class slot_counter {
+ public:
+  explicit slot_counter(std::vector<uint8_t> const& live)
+      : tree_(live.size() + 1) {
+    for (size_t i = 1; i <= live.size(); ++i) {
+      tree_[i] += live[i - 1];
+      auto const parent = i + lowestBit(i);
+      if (parent < tree_.size()) {
+        tree_[parent] += tree_[i];
+      }
+    }
+  }
+
+  size_t before(size_t slot) const {
+    size_t sum = 0;
+    for (; slot; slot &= slot - 1) {
+      sum += tree_[slot];
+    }
+    return sum;
+  }
+
+  void add(size_t slot, int delta) {
+    for (++slot; slot < tree_.size(); slot += lowestBit(slot)) {
+      tree_[slot] += delta;
+    }
+  }
+
+ private:
+  static size_t lowestBit(size_t i) { return i & (~i + 1); }
+
+  std::vector<int32_t> tree_;
+};
+
+class diff_builder {
+ public:
+  using op_code = json_patch::patch_operation_code;
+
+  explicit diff_builder(std::vector<json_patch::patch_operation>& ops)
+      : ops_(ops) {}
+
+  void diffValue(dynamic const& from, dynamic const& to) {
+    if (from.type() != to.type()) {
+      // differently-typed numbers may still compare equal
+      if (from != to) {
+        emit(op_code::replace, path_, none, to);
+      }
+      return;
+    }
+    switch (from.type()) {
+      case dynamic::OBJECT:
+        // comparing first is much cheaper than walking an unchanged
+        // subtree key by key
+        if (from != to) {
+          diffObject(from, to);
+        }
+        break;
+      case dynamic::ARRAY:
+        diffArray(from, to);
+        break;
+      default:
+        if (from != to) {
+          emit(op_code::replace, path_, none, to);
+        }
+        break;
+    }
+  }
+
+ private:
+  // Appends an escaped reference token to the current path and returns the
+  // length to truncate back to.
+  size_t pushKey(StringPiece key) {
+    auto const mark = path_.size();
+    path_ += '/';
+    for (auto const c : key) {
+      switch (c) {
+        case '~':
+          path_ += "~0";
+          break;
+        case '/':
+          path_ += "~1";
+          break;
+        default:
+          path_ += c;
+          break;
+      }
+    }
+    return mark;
+  }
+
+  size_t pushIndex(size_t index) {
+    auto const mark = path_.size();
+    path_ += '/';
+    toAppend(index, &path_);
+    return mark;
+  }
+
+  void emit(
+      op_code code,
+      StringPiece path,
+      Optional<json_pointer> from,
+      Optional<dynamic> value) {
+    json_patch::patch_operation op;
+    op.op_code = code;
+    op.path = json_pointer::parse(path);
+    op.from = std::move(from);
+    op.value = std::move(value);
+    ops_.push_back(std::move(op));
+  }
+
+  void diffObject(dynamic const& from, dynamic const& to) {
+    // json_pointer can only address string keys
+    auto const stringKeys = [](dynamic const& obj) {
+      for (auto const& key : obj.keys()) {
+        if (!key.isString()) {
+          return false;
+        }
+      }
+      return true;
+    };
+    if (!stringKeys(from) || !stringKeys(to)) {
+      if (from != to) {
+        emit(op_code::replace, path_, none, to);
+      }
+      return;
+    }
+
+    std::vector<std::pair<dynamic const, dynamic> const*> removed;
+    std::vector<std::pair<dynamic const, dynamic> const*> added;
+    for (auto const& item : from.items()) {
+      auto const* other = to.get_ptr(item.first);
+      if (!other) {
+        removed.push_back(&item);
+        continue;
+      }
+      auto const mark = pushKey(item.first.getString());
+      diffValue(item.second, *other);
+      path_.resize(mark);
+    }
+    for (auto const& item : to.items()) {
+      if (!from.get_ptr(item.first)) {
+        added.push_back(&item);
+      }
+    }
+
+    // a value that only changed keys becomes a move
+    if (!removed.empty() && !added.empty()) {
+      F14FastMap<size_t, std::vector<size_t>> byHash;
+      for (auto const i : enumerate(removed)) {
+        byHash[(*i)->second.hash()].push_back(i.index);
+      }
+      for (auto& item : added) {
+        auto const found = byHash.find(item->second.hash());
+        if (found == byHash.end()) {
+          continue;
+        }
+        auto& candidates = found->second;
+        for (auto& candidate : candidates) {
+          auto& source = removed[candidate];
+          if (source && source->second == item->second) {
+            auto mark = pushKey(source->first.getString());
+            auto fromPtr = json_pointer::parse(path_);
+            path_.resize(mark);
+            mark = pushKey(item->first.getString());
+            emit(op_code::move, path_, std::move(fromPtr), none);
+            path_.resize(mark);
+            source = nullptr;
+            item = nullptr;
+            break;
+          }
+        }
+      }
+    }
+
+    for (auto const* item : removed) {
+      if (item) {
+        auto const mark = pushKey(item->first.getString());
+        emit(op_code::remove, path_, none, none);
+        path_.resize(mark);
+      }
+    }
+    for (auto const* item : added) {
+      if (item) {
+        auto const mark = pushKey(item->first.getString());
+        emit(op_code::add, path_, none, item->second);
+        path_.resize(mark);
+      }
+    }
+  }
+
+  /*
+   * The edit script for the unaligned middle of an array. Every element of
+   * `from` and every element of `to` not merged into one of them gets a
+   * slot, in script order; an element's index in the array at any point of
+   * the replay is the number of live slots before its own.
+   */
+  struct array_edit {
+    enum class kind : uint8_t { keep, remove, insert, source, target };
+    kind what;
+    // index into `from` for keep/remove/source, into `to` for insert/target;
+    // keep also diffs from[index] against to[other]
+    size_t index;
+    // keep: index into `to`; target: slot of the move source
+    size_t other;
+  };
+
+  void diffArray(dynamic const& from, dynamic const& to) {
+    size_t const n = from.size();
+    size_t const m = to.size();
+    size_t prefix = 0;
+    while (prefix < n && prefix < m && from[prefix] == to[prefix]) {
+      ++prefix;
+    }
+    size_t suffix = 0;
+    while (suffix < n - prefix && suffix < m - prefix &&
+           from[n - 1 - suffix] == to[m - 1 - suffix]) {
+      ++suffix;
+    }
+    size_t const fromCount = n - prefix - suffix;
+    size_t const toCount = m - prefix - suffix;
+    if (fromCount == 0 && toCount == 0) {
+      return;
+    }
+
+    std::vector<size_t> fromHashes(fromCount);
+    std::vector<size_t> toHashes(toCount);
+    for (size_t i = 0; i < fromCount; ++i) {
+      fromHashes[i] = from[prefix + i].hash();
+    }
+    for (size_t j = 0; j < toCount; ++j) {
+      toHashes[j] = to[prefix + j].hash();
+    }
+
+    std::vector<std::pair<size_t, size_t>> matches;
+    auto const total = fromCount + toCount;
+    auto const maxD = std::min({total, kMaxEditDistance, kMaxEditWork / total});
+    if (!hashLcs(fromHashes, toHashes, maxD, matches)) {
+      matches.clear();
+    }
+
+    // pair unmatched removals with equal unmatched insertions as moves
+    std::vector<size_t> moveSource(toCount, SIZE_MAX);
+    std::vector<uint8_t> isSource(fromCount, 0);
+    {
+      std::vector<uint8_t> matchedFrom(fromCount, 0);
+      std::vector<uint8_t> matchedTo(toCount, 0);
+      for (auto const& [i, j] : matches) {
+        matchedFrom[i] = matchedTo[j] = 1;
+      }
+      F14FastMap<size_t, std::vector<size_t>> byHash;
+      for (size_t i = 0; i < fromCount; ++i) {
+        if (!matchedFrom[i]) {
+          byHash[fromHashes[i]].push_back(i);
+        }
+      }
+      if (!byHash.empty()) {
+        for (size_t j = 0; j < toCount; ++j) {
+          if (matchedTo[j]) {
+            continue;
+          }
+          auto const found = byHash.find(toHashes[j]);
+          if (found == byHash.end()) {
+            continue;
+          }
+          for (auto const i : found->second) {
+            if (!isSource[i] && from[prefix + i] == to[prefix + j]) {
+              isSource[i] = 1;
+              moveSource[j] = i;
+              break;
+            }
+          }
+        }
+      }
+    }
+
+    // build the script: each gap between matches lists its removals before
+    // its insertions; a gap without moves diffs removals against insertions
+    // position by position instead
+    std::vector<array_edit> script;
+    script.reserve(fromCount + toCount);
+    std::vector<size_t> slotOf(fromCount);
+    size_t i = 0;
+    size_t j = 0;
+    auto const gap = [&](size_t iEnd, size_t jEnd) {
+      bool moves = false;
+      for (auto k = i; k < iEnd && !moves; ++k) {
+        moves = isSource[k];
+      }
+      for (auto k = j; k < jEnd && !moves; ++k) {
+        moves = moveSource[k] != SIZE_MAX;
+      }
+      if (!moves) {
+        for (; i < iEnd && j < jEnd; ++i, ++j) {
+          slotOf[i] = script.size();
+          script.push_back({array_edit::kind::keep, i, j});
+        }
+      }
+      for (; i < iEnd; ++i) {
+        slotOf[i] = script.size();
+        script.push_back(
+            {isSource[i] ? array_edit::kind::source : array_edit::kind::remove,
+             i,
+             0});
+      }
+      for (; j < jEnd; ++j) {
+        script.push_back(
+            {moveSource[j] != SIZE_MAX ? array_edit::kind::target
+                                       : array_edit::kind::insert,
+             j,
+             0});
+      }
+    };
+    for (auto const& [mi, mj] : matches) {
+      gap(mi, mj);
+      slotOf[i] = script.size();
+      script.push_back({array_edit::kind::keep, i, j});
+      ++i;
+      ++j;
+    }
+    gap(fromCount, toCount);
+    for (auto& edit : script) {
+      if (edit.what == array_edit::kind::target) {
+        edit.other = slotOf[moveSource[edit.index]];
+      }
+    }
+
+    // replay the script, emitting operations at the live indices
+    std::vector<uint8_t> live(script.size());
+    for (size_t slot = 0; slot < script.size(); ++slot) {
+      auto const what = script[slot].what;
+      live[slot] = what != array_edit::kind::insert &&
+          what != array_edit::kind::target;
+    }
+    slot_counter slots{live};
+    for (size_t slot = 0; slot < script.size(); ++slot) {
+      auto const& edit = script[slot];
+      switch (edit.what) {
+        case array_edit::kind::keep: {
+          auto const mark = pushIndex(prefix + slots.before(slot));
+          diffValue(from[prefix + edit.index], to[prefix + edit.other]);
+          path_.resize(mark);
+          break;
+        }
+        case array_edit::kind::remove: {
+          auto const mark = pushIndex(prefix + slots.before(slot));
+          emit(op_code::remove, path_, none, none);
+          path_.resize(mark);
+          slots.add(slot, -1);
+          break;
+        }
+        case array_edit::kind::source:
+          break;
+        case array_edit::kind::insert: {
+          auto const mark = pushIndex(prefix + slots.before(slot));
+          emit(op_code::add, path_, none, to[prefix + edit.index]);
+          path_.resize(mark);
+          slots.add(slot, 1);
+          break;
+        }
+        case array_edit::kind::target: {
+          auto const fromIndex = prefix + slots.before(edit.other);
+          slots.add(edit.other, -1);
+          auto const toIndex = prefix + slots.before(slot);
+          slots.add(slot, 1);
+          if (fromIndex != toIndex) {
+            auto mark = pushIndex(fromIndex);
+            auto fromPtr = json_pointer::parse(path_);
+            path_.resize(mark);
+            mark = pushIndex(toIndex);
+            emit(op_code::move, path_, std::move(fromPtr), none);
+            path_.resize(mark);
+          }
+          break;
+        }
+      }
+    }
+  }
+
+  std::vector<json_patch::patch_operation>& ops_;
+  std::string path_;
+};
+
+} // namespace json_patch_detail
+
+// static
+inline json_patch json_patch::diff(dynamic const& from, dynamic const& to) {
+  using json_patch_detail::diff_builder;
+  json_patch patch;
+  diff_builder{patch.ops_}.diffValue(from, to);
+  return patch;
+}
+
 } // namespace folly
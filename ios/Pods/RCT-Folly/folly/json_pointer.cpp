@@ -16,7 +16,11 @@
 
 #include <folly/json_pointer.h>
 
+#include <algorithm>
+
+#include <folly/Conv.h>
 #include <folly/String.h>
+#include <folly/dynamic.h>
 
 namespace folly {
 
@@ -111,4 +115,124 @@ bool json_pointer::unescape(std::string& str) {
   return true;
 }
 
+compiled_json_pointer::compiled_json_pointer(json_pointer const& ptr) {
+  for (auto const& token : ptr.tokens()) {
+    auto const begin = text_.size();
+    text_.insert(text_.end(), token.begin(), token.end());
+    add_token(begin);
+  }
+}
+
+// static, public
+Expected<compiled_json_pointer, json_pointer::parse_error>
+compiled_json_pointer::try_parse(StringPiece const str) {
+  using parse_error = json_pointer::parse_error;
+
+  compiled_json_pointer ret;
+  // pointer describes complete document
+  if (str.empty()) {
+    return ret;
+  }
+  if (str.front() != '/') {
+    return makeUnexpected(parse_error::invalid_first_character);
+  }
+
+  // unescape in a single pass; tokens only ever shrink
+  ret.text_.reserve(str.size());
+  auto pos = str.begin() + 1;
+  auto const end = str.end();
+  while (true) {
+    auto const begin = ret.text_.size();
+    while (pos != end && *pos != '/') {
+      if (*pos != '~') {
+        ret.text_.push_back(*pos++);
+        continue;
+      }
+      if (pos + 1 == end || (pos[1] != '0' && pos[1] != '1')) {
+        return makeUnexpected(parse_error::invalid_escape_sequence);
+      }
+      ret.text_.push_back(pos[1] == '0' ? '~' : '/');
+      pos += 2;
+    }
+    ret.add_token(begin);
+    if (pos == end) {
+      return ret;
+    }
+    ++pos;
+  }
+}
+
+// static, public
+compiled_json_pointer compiled_json_pointer::parse(StringPiece const str) {
+  auto res = try_parse(str);
+  if (res.hasValue()) {
+    return std::move(res.value());
+  }
+  switch (res.error()) {
+    case json_pointer::parse_error::invalid_first_character:
+      throw json_pointer::parse_exception(
+          "non-empty JSON pointer string does not start with '/'");
+    case json_pointer::parse_error::invalid_escape_sequence:
+      throw json_pointer::parse_exception(
+          "Invalid escape sequence in JSON pointer string");
+    default:
+      assume_unreachable();
+  }
+}
+
+dynamic const* compiled_json_pointer::get_ptr(dynamic const& root) const {
+  dynamic const* curr = &root;
+  for (auto const& t : tokens_) {
+    if (curr->isArray()) {
+      // npos is never in range
+      if (t.index >= curr->size()) {
+        return nullptr;
+      }
+      curr = &curr->begin()[t.index];
+    } else if (curr->isObject()) {
+      curr = curr->get_ptr(StringPiece(text_.data() + t.begin, t.size));
+      if (!curr) {
+        return nullptr;
+      }
+    } else {
+      return nullptr;
+    }
+  }
+  return curr;
+}
+
+dynamic* compiled_json_pointer::get_ptr(dynamic& root) const {
+  return const_cast<dynamic*>(get_ptr(static_cast<dynamic const&>(root)));
+}
+
+bool operator==(
+    compiled_json_pointer const& lhs, compiled_json_pointer const& rhs) {
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs.size(); ++i) {
+    if (lhs[i].name != rhs[i].name) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// private
+void compiled_json_pointer::add_token(size_t const begin) {
+  auto const name =
+      StringPiece(text_.data() + begin, text_.data() + text_.size());
+  size_t index = npos;
+  // "0" or digits without a leading zero, as in RFC 6901 section 4
+  bool const digits = !name.empty() &&
+      std::all_of(name.begin(), name.end(), [](char c) {
+                        return c >= '0' && c <= '9';
+                      });
+  if (digits && (name.size() == 1 || name.front() != '0')) {
+    // numbers that overflow can never be in range either
+    index = tryTo<size_t>(name).value_or(npos);
+  }
+  tokens_.push_back({uint32_t(begin), uint32_t(name.size()), index});
+}
+
 } // namespace folly
@@ -21,9 +21,12 @@
 
 #include <folly/Expected.h>
 #include <folly/Range.h>
+#include <folly/small_vector.h>
 
 namespace folly {
 
+class dynamic;
+
 /*
  * json_pointer
  *
@@ -84,4 +87,72 @@ class json_pointer {
   std::vector<std::string> tokens_;
 };
 
+/*
+ * compiled_json_pointer
+ *
+ * A json_pointer prepared for repeated evaluation. The unescaped tokens
+ * share one inline buffer and tokens that are valid array indices have
+ * them parsed once, so compiling a typical pointer does not allocate and
+ * resolving it neither allocates nor converts strings to numbers.
+ */
+class compiled_json_pointer {
+ public:
+  // Index of a token that cannot address an array element: "-", numbers
+  // with leading zeros, and anything that is not a number.
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  struct token {
+    // unescaped reference token, valid as long as the pointer is unchanged
+    StringPiece name;
+    // array index named by the token, or npos
+    size_t index;
+  };
+
+  compiled_json_pointer() = default;
+  explicit compiled_json_pointer(json_pointer const& ptr);
+
+  /*
+   * Same syntax and errors as json_pointer::try_parse and parse.
+   */
+  static Expected<compiled_json_pointer, json_pointer::parse_error> try_parse(
+      StringPiece str);
+
+  static compiled_json_pointer parse(StringPiece str);
+
+  size_t size() const { return tokens_.size(); }
+  bool empty() const { return tokens_.empty(); }
+  token operator[](size_t i) const {
+    auto const& t = tokens_[i];
+    return {StringPiece(text_.data() + t.begin, t.size), t.index};
+  }
+
+  /*
+   * Resolve the pointer against `root` with the rules of
+   * dynamic::try_get_ptr. Returns nullptr when it does not resolve, in every
+   * case where dynamic::get_ptr(json_pointer) returns nullptr or throws.
+   */
+  dynamic const* get_ptr(dynamic const& root) const;
+  dynamic* get_ptr(dynamic& root) const;
+
+  friend bool operator==(
+      compiled_json_pointer const& lhs, compiled_json_pointer const& rhs);
+  friend bool operator!=(
+      compiled_json_pointer const& lhs, compiled_json_pointer const& rhs) {
+    return !(lhs == rhs);
+  }
+
+ private:
+  struct token_ref {
+    uint32_t begin;
+    uint32_t size;
+    size_t index;
+  };
+
+  // Register text_[begin, end) as the next token.
+  void add_token(size_t begin);
+
+  small_vector<char, 48> text_;
+  small_vector<token_ref, 4> tokens_;
+};
+
 } // namespace folly
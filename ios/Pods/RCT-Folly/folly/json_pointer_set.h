@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <folly/Optional.h>
+#include <folly/Range.h>
+#include <folly/dynamic.h>
+#include <folly/json.h>
+#include <folly/json_pointer.h>
+#include <folly/small_vector.h>
+
+namespace folly {
+
+/*
+ * json_pointer_set
+ *
+ * Resolves many json pointers in a single traversal of a document. The
+ * pointers are merged into a trie, so a prefix shared by several of them is
+ * walked once, and every container on the way is visited at most once no
+ * matter how many pointers go through it.
+ *
+ *   json_pointer_set fields;
+ *   auto const id = fields.insert("/offer/id");
+ *   auto const price = fields.insert("/offer/price/amount");
+ *
+ *   auto values = fields.resolve(response); // dynamic
+ *   if (values[price]) { ... *values[price] ... }
+ *
+ * Raw json text is handled through json::lazy_document: it validates the
+ * text in one pass and the walk over its tape then jumps over every subtree
+ * no pointer selects, without decoding anything.
+ *
+ *   json::lazy_document doc(body);
+ *   auto cursors = fields.resolve(doc);
+ *
+ * Results come back indexed by the positions insert() returned, which are
+ * consecutive from zero in insertion order. Pointers follow the resolution
+ * rules of compiled_json_pointer::get_ptr; one that does not resolve
+ * yields nullptr (or none).
+ */
+class json_pointer_set {
+ public:
+  using cursor = json::lazy_document::cursor;
+
+  json_pointer_set() = default;
+
+  /*
+   * Add a pointer to the set, returning the position of its result.
+   * Inserting the same pointer twice gives two positions with the same
+   * result. The string overload throws json_pointer::parse_exception.
+   */
+  size_t insert(compiled_json_pointer const& ptr);
+  size_t insert(StringPiece ptr) {
+    return insert(compiled_json_pointer::parse(ptr));
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  /*
+   * Resolve every pointer in the set. `out` is resized to size().
+   */
+  void resolve(dynamic const& root, std::vector<dynamic const*>& out) const;
+  void resolve(
+      json::lazy_document const& doc, std::vector<Optional<cursor>>& out) const;
+
+  std::vector<dynamic const*> resolve(dynamic const& root) const {
+    std::vector<dynamic const*> out;
+    resolve(root, out);
+    return out;
+  }
+  std::vector<Optional<cursor>> resolve(json::lazy_document const& doc) const {
+    std::vector<Optional<cursor>> out;
+    resolve(doc, out);
+    return out;
+  }
+
+ private:
+  struct edge {
+    std::string name;
+    uint32_t child;
+  };
+
+  struct node {
+    // sorted by name
+    std::vector<edge> edges;
+    // (array index, position in edges) for edges that name an index, sorted
+    std::vector<std::pair<size_t, uint32_t>> indices;
+    // positions in the results this node resolves
+    small_vector<uint32_t, 1> results;
+  };
+
+  void walk(uint32_t n, dynamic const& value, dynamic const** out) const;
+  void walk(uint32_t n, cursor value, Optional<cursor>* out) const;
+
+  // Text of an object member's key, unescaped into `scratch` if needed.
+  static StringPiece keyName(cursor key, std::string& scratch) {
+    if (key.isString()) {
+      auto const raw = key.raw();
+      if (raw.size() >= 2 && raw.front() == '"' &&
+          raw.find('\\') == StringPiece::npos) {
+        return raw.subpiece(1, raw.size() - 2);
+      }
+    }
+    // escaped strings, and integer keys with convert_int_keys
+    scratch = key.asString();
+    return scratch;
+  }
+
+  std::vector<node> nodes_{1};
+  size_t size_{0};
+};
+
+inline size_t json_pointer_set::insert(compiled_json_pointer const& ptr) {
+  uint32_t n = 0;
+  for (size_t i = 0; i < ptr.size(); ++i) {
+    auto const token = ptr[i];
+    auto& edges = nodes_[n].edges;
+    auto it = std::lower_bound(
+        edges.begin(), edges.end(), token.name, [](edge const& e, auto name) {
+          return StringPiece(e.name) < name;
+        });
+    if (it != edges.end() && it->name == token.name) {
+      n = it->child;
+      continue;
+    }
+    auto const child = uint32_t(nodes_.size());
+    auto const pos = uint32_t(it - edges.begin());
+    edges.insert(it, edge{token.name.str(), child});
+    auto& indices = nodes_[n].indices;
+    for (auto& entry : indices) {
+      entry.second += entry.second >= pos;
+    }
+    if (token.index != compiled_json_pointer::npos) {
+      indices.insert(
+          std::upper_bound(
+              indices.begin(),
+              indices.end(),
+              std::make_pair(token.index, pos)),
+          std::make_pair(token.index, pos));
+    }
+    nodes_.emplace_back();
+    n = child;
+  }
+  nodes_[n].results.push_back(uint32_t(size_));
+  return size_++;
+}
+
+inline void json_pointer_set::resolve(
+    dynamic const& root, std::vector<dynamic const*>& out) const {
+  out.assign(size_, nullptr);
+  walk(0, root, out.data());
+}
+
+inline void json_pointer_set::resolve(
+    json::lazy_document const& doc, std::vector<Optional<cursor>>& out) const {
+  out.assign(size_, none);
+  walk(0, doc.root(), out.data());
+}
+
+inline void json_pointer_set::walk(
+    uint32_t const n, dynamic const& value, dynamic const** out) const {
+  auto const& nd = nodes_[n];
+  for (auto const r : nd.results) {
+    out[r] = &value;
+  }
+  if (value.isObject()) {
+    for (auto const& e : nd.edges) {
+      if (auto const* child = value.get_ptr(StringPiece(e.name))) {
+        walk(e.child, *child, out);
+      }
+    }
+  } else if (value.isArray()) {
+    for (auto const& [index, pos] : nd.indices) {
+      if (index >= value.size()) {
+        break;
+      }
+      walk(nd.edges[pos].child, value.begin()[index], out);
+    }
+  }
+}
+
+inline void json_pointer_set::walk(
+    uint32_t const n, cursor const value, Optional<cursor>* out) const {
+  auto const& nd = nodes_[n];
+  for (auto const r : nd.results) {
+    out[r] = value;
+  }
+  if (nd.edges.empty()) {
+    return;
+  }
+  if (value.isObject()) {
+    // one scan of the members; with duplicate keys the last one wins, as
+    // it does in parseJson
+    small_vector<Optional<cursor>, 4> found(nd.edges.size());
+    std::string scratch;
+    for (auto const& [key, member] : value.items()) {
+      auto const name = keyName(key, scratch);
+      auto const it = std::lower_bound(
+          nd.edges.begin(), nd.edges.end(), name, [](edge const& e, auto k) {
+            return StringPiece(e.name) < k;
+          });
+      if (it != nd.edges.end() && it->name == name) {
+        found[it - nd.edges.begin()] = member;
+      }
+    }
+    for (size_t i = 0; i < found.size(); ++i) {
+      if (found[i]) {
+        walk(nd.edges[i].child, *found[i], out);
+      }
+    }
+  } else if (value.isArray()) {
+    auto it = nd.indices.begin();
+    size_t index = 0;
+    for (auto const element : value) {
+      if (it == nd.indices.end()) {
+        break;
+      }
+      for (; it != nd.indices.end() && it->first == index; ++it) {
+        walk(nd.edges[it->second].child, element, out);
+      }
+      ++index;
+    }
+  }
+}
+
+} // namespace folly
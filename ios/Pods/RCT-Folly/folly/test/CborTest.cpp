@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Like JsonBenchmark.cpp, this is not part of the RCT-Folly pod; it builds
+ * against this tree's folly sources and gtest.
+ */
+
+#include <folly/cbor.h>
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <folly/json.h>
+#include <folly/portability/GTest.h>
+
+using namespace folly;
+
+namespace {
+
+cbor::format const kFormats[] = {cbor::format::cbor, cbor::format::msgpack};
+
+ByteRange bytes(std::string const& s) {
+  return ByteRange(StringPiece(s));
+}
+
+// The bytes that `hex` spells, ignoring spaces.
+std::string unhex(StringPiece hex) {
+  std::string out;
+  for (size_t i = 0; i < hex.size(); ++i) {
+    if (hex[i] != ' ') {
+      out += char(std::stoi(hex.subpiece(i, 2).str(), nullptr, 16));
+      ++i;
+    }
+  }
+  return out;
+}
+
+// Prints what dynamic's operator== can't compare: NaN, the sign of zero
+// and keys that are not strings.
+std::string print(dynamic const& value) {
+  json::serialization_opts opts;
+  opts.allow_non_string_keys = true;
+  opts.allow_nan_inf = true;
+  opts.sort_keys = true;
+  opts.double_mode = double_conversion::DoubleToStringConverter::SHORTEST;
+  auto out = json::serialize(value, opts);
+  if (value.isDouble() && std::signbit(value.getDouble())) {
+    out += " (negative)";
+  }
+  return out;
+}
+
+// Whether decode and document both reject `data` with a decode_error.
+bool rejected(std::string const& data, cbor::format fmt) {
+  size_t errors = 0;
+  try {
+    cbor::decode(bytes(data), fmt);
+  } catch (cbor::decode_error const&) {
+    ++errors;
+  }
+  try {
+    cbor::document doc(bytes(data), fmt);
+  } catch (cbor::decode_error const&) {
+    ++errors;
+  }
+  EXPECT_NE(1, errors) << "decode and document disagree";
+  return errors == 2;
+}
+
+// Whether parseJson accepts `depth` nested arrays.
+bool parseJsonAccepts(size_t depth) {
+  try {
+    parseJson(std::string(depth, '[') + std::string(depth, ']'));
+  } catch (json::parse_error const&) {
+    return false;
+  }
+  return true;
+}
+
+dynamic richValue() {
+  dynamic value = parseJson(R"({
+    "null": null, "bools": [true, false],
+    "ints": [0, 23, 24, 255, 256, 65535, 65536, 4294967295, 4294967296,
+             -1, -24, -25, -256, -257, -65537, -4294967297],
+    "doubles": [0.5, -0.0, 1e300, 5e-324, 1.1],
+    "strings": ["", "x", "é😀", "a\u0000b"],
+    "nested": [[], {}, [[{"k": [1]}]]]
+  })");
+  value["ints"].push_back(std::numeric_limits<int64_t>::min());
+  value["ints"].push_back(std::numeric_limits<int64_t>::max());
+  value["doubles"].push_back(std::numeric_limits<double>::infinity());
+  value["doubles"].push_back(std::numeric_limits<double>::quiet_NaN());
+  value["strings"].push_back(std::string(70000, 'x'));
+  value["strings"].push_back(std::string("\xff\x00\x80", 3));
+  value["keys"] = dynamic::object(1, "int")(-2.5, "double")(true, "bool");
+  return value;
+}
+
+} // namespace
+
+TEST(Cbor, roundTripsParsedJson) {
+  char const* const documents[] = {
+      "null",
+      "[1, -2.5, \"x\", true, false, null]",
+      R"({"a": {"b": [1, {"c": [[], [2]]}]}, "d": "\t"})",
+      R"([9223372036854775807, -9223372036854775808, 1e-300])",
+  };
+  for (auto const text : documents) {
+    auto const value = parseJson(text);
+    for (auto fmt : kFormats) {
+      auto const encoded = cbor::encode(value, fmt);
+      EXPECT_EQ(value, cbor::decode(bytes(encoded), fmt)) << text;
+      EXPECT_EQ(value, cbor::document(bytes(encoded), fmt).toDynamic())
+          << text;
+    }
+  }
+}
+
+TEST(Cbor, roundTripsEdgeValues) {
+  auto const value = richValue();
+  for (auto fmt : kFormats) {
+    auto const encoded = cbor::encode(value, fmt);
+    EXPECT_EQ(print(value), print(cbor::decode(bytes(encoded), fmt)));
+    EXPECT_EQ(
+        print(value),
+        print(cbor::document(bytes(encoded), fmt).toDynamic()));
+    // Appending encodes after what is already there.
+    std::string appended = "prefix";
+    cbor::encode(value, appended, fmt);
+    EXPECT_EQ("prefix" + encoded, appended);
+  }
+  auto const negativeZero = cbor::decode(bytes(cbor::encode(-0.0)));
+  EXPECT_TRUE(negativeZero.isDouble());
+  EXPECT_TRUE(std::signbit(negativeZero.getDouble()));
+  EXPECT_TRUE(cbor::decode(bytes(cbor::encode(int64_t(1)))).isInt());
+  EXPECT_TRUE(cbor::decode(bytes(cbor::encode(1.0))).isDouble());
+}
+
+TEST(Cbor, decodesRfc8949Examples) {
+  struct {
+    char const* hex;
+    char const* json;
+  } const cases[] = {
+      {"00", "0"},
+      {"17", "23"},
+      {"18 18", "24"},
+      {"19 03e8", "1000"},
+      {"1b 000000e8d4a51000", "1000000000000"},
+      {"20", "-1"},
+      {"38 63", "-100"},
+      {"f9 0000", "0.0"},
+      {"f9 3c00", "1.0"},
+      {"f9 7bff", "65504.0"},
+      {"fa 47c35000", "100000.0"},
+      {"fb 7e37e43c8800759c", "1e+300"},
+      {"f9 0001", "5.960464477539063e-08"},
+      {"f9 c400", "-4.0"},
+      {"f9 7c00", "Infinity"},
+      {"f4", "false"},
+      {"f5", "true"},
+      {"f6", "null"},
+      {"f7", "null"},
+      {"c0 74 323031332d30332d32315432303a30343a30305a",
+       "\"2013-03-21T20:04:00Z\""},
+      {"c1 1a 514b67b0", "1363896240"},
+      {"44 01020304", "\"\\u0001\\u0002\\u0003\\u0004\""},
+      {"64 49455446", "\"IETF\""},
+      {"83 010203", "[1,2,3]"},
+      {"83 01 820203 820405", "[1,[2,3],[4,5]]"},
+      {"9f 01 820203 9f0405ff ff", "[1,[2,3],[4,5]]"},
+      {"9f ff", "[]"},
+      {"a2 6161 01 6162 820203", "{\"a\":1,\"b\":[2,3]}"},
+      {"bf 6161 01 6162 9f0203ff ff", "{\"a\":1,\"b\":[2,3]}"},
+  };
+  for (auto const& c : cases) {
+    EXPECT_EQ(
+        print(parseJson(c.json)), print(cbor::decode(bytes(unhex(c.hex)))))
+        << c.hex;
+  }
+  // Integer keys stay integers.
+  EXPECT_EQ(
+      print(dynamic::object(1, 2)(3, 4)),
+      print(cbor::decode(bytes(unhex("a2 01 02 03 04")))));
+}
+
+TEST(Cbor, decodesMessagePackExamples) {
+  struct {
+    char const* hex;
+    char const* json;
+  } const cases[] = {
+      {"c0", "null"},
+      {"c2", "false"},
+      {"c3", "true"},
+      {"7f", "127"},
+      {"e0", "-32"},
+      {"cc 80", "128"},
+      {"cd 0100", "256"},
+      {"ce 00010000", "65536"},
+      {"cf 0000000100000000", "4294967296"},
+      {"d0 df", "-33"},
+      {"d1 ff00", "-256"},
+      {"d3 8000000000000000", "-9223372036854775808"},
+      {"ca 3f800000", "1.0"},
+      {"cb 3ff0000000000000", "1.0"},
+      {"a3 616263", "\"abc\""},
+      {"d9 03 616263", "\"abc\""},
+      {"c4 03 616263", "\"abc\""},
+      {"93 01 c0 c3", "[1,null,true]"},
+      {"dc 0002 01 02", "[1,2]"},
+      {"81 a161 01", "{\"a\":1}"},
+      {"de 0001 a161 01", "{\"a\":1}"},
+  };
+  for (auto const& c : cases) {
+    EXPECT_EQ(
+        print(parseJson(c.json)),
+        print(cbor::decode(bytes(unhex(c.hex)), cbor::format::msgpack)))
+        << c.hex;
+  }
+}
+
+TEST(Cbor, rejectsTruncatedInput) {
+  auto const value = richValue();
+  for (auto fmt : kFormats) {
+    auto const encoded = cbor::encode(value, fmt);
+    // Every prefix but the whole encoding is cut short somewhere.
+    for (size_t size = 0; size < encoded.size();
+         size += size < 1000 ? 1 : 997) {
+      EXPECT_TRUE(rejected(encoded.substr(0, size), fmt)) << size;
+    }
+    EXPECT_TRUE(rejected(encoded + '\0', fmt));
+  }
+}
+
+TEST(Cbor, rejectsInvalidInput) {
+  char const* const cborCases[] = {
+      // Integers outside the int64 range.
+      "3b ffffffffffffffff",
+      "1b ffffffffffffffff",
+      // An indefinite-length string.
+      "5f 420102 43030405 ff",
+      // Reserved additional information and a stray break.
+      "1c",
+      "ff",
+      // A reserved simple value.
+      "f8 ff",
+      // Too few elements, or a break closing a definite-length map.
+      "82 01",
+      "a1 01 02 ff",
+      // An array as a map key.
+      "a1 81 01 02",
+      // Trailing bytes.
+      "00 00",
+  };
+  for (auto const hex : cborCases) {
+    EXPECT_TRUE(rejected(unhex(hex), cbor::format::cbor)) << hex;
+  }
+  char const* const msgpackCases[] = {
+      // Never used.
+      "c1",
+      // Extension types.
+      "d4 01 00",
+      "c7 01 01 00",
+      // Outside the int64 range.
+      "cf ffffffffffffffff",
+      // An array as a map key.
+      "81 91 01 01",
+      "92 01",
+  };
+  for (auto const hex : msgpackCases) {
+    EXPECT_TRUE(rejected(unhex(hex), cbor::format::msgpack)) << hex;
+  }
+}
+
+TEST(Cbor, limitsNestingLikeParseJson) {
+  // The deepest array parseJson accepts with its default options.
+  size_t depth = 1;
+  while (parseJsonAccepts(depth + 1)) {
+    ++depth;
+  }
+  for (auto fmt : kFormats) {
+    auto const open = fmt == cbor::format::cbor ? "\x81" : "\x91";
+    std::string deepest;
+    for (size_t i = 0; i < depth; ++i) {
+      deepest += open;
+    }
+    deepest += fmt == cbor::format::cbor ? "\x80" : "\x90";
+    EXPECT_FALSE(rejected(deepest.substr(1), fmt));
+    EXPECT_TRUE(rejected(deepest, fmt));
+  }
+}
+
+TEST(Cbor, documentReadsInPlace) {
+  dynamic const value = dynamic::object("a", 1)(
+      "b", dynamic::array(1, "x", 2.5))("c", "a string")("d", dynamic::object);
+  for (auto fmt : kFormats) {
+    auto encoded = cbor::encode(value, fmt);
+    cbor::document doc(bytes(encoded), fmt);
+    EXPECT_EQ(1, doc["a"].getInt());
+    EXPECT_EQ(3, doc["b"].size());
+    EXPECT_EQ("x", doc["b"][1].getString());
+    EXPECT_EQ(2.5, doc["b"][2].getDouble());
+    EXPECT_EQ(2.5, doc["b"][2].asDouble());
+    EXPECT_EQ("1", doc["a"].asString());
+    EXPECT_TRUE(doc["d"].empty());
+    auto const string = doc["c"].getString();
+    EXPECT_GE(string.begin(), encoded.data());
+    EXPECT_LE(string.end(), encoded.data() + encoded.size());
+    size_t elements = 0;
+    for (auto element : doc["b"]) {
+      EXPECT_EQ(value["b"][elements++], element.toDynamic());
+    }
+    EXPECT_EQ(3, elements);
+    for (auto item : doc.root().items()) {
+      EXPECT_EQ(value[item.first.getString()], item.second.toDynamic());
+    }
+    EXPECT_EQ(0, doc.root().count("z"));
+    EXPECT_FALSE(doc.root().find("z").hasValue());
+    EXPECT_THROW(doc["z"], std::out_of_range);
+    EXPECT_THROW(doc["b"][3], std::out_of_range);
+    EXPECT_THROW(doc["a"].getString(), TypeError);
+    EXPECT_THROW(doc["b"]["a"], TypeError);
+    EXPECT_THROW(doc[size_t(0)], TypeError);
+  }
+  // With duplicate keys the last one wins, as in decode().
+  auto const duplicates = unhex("a2 6161 01 6161 02");
+  EXPECT_EQ(2, cbor::document(bytes(duplicates))["a"].getInt());
+  EXPECT_EQ(dynamic(dynamic::object("a", 2)), cbor::decode(bytes(duplicates)));
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Like JsonBenchmark.cpp, this is not part of the RCT-Folly pod; it builds
+ * against this tree's folly sources, double-conversion and gtest.
+ */
+
+#include <folly/Conv.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <double-conversion/double-conversion.h>
+
+#include <folly/lang/Bits.h>
+#include <folly/portability/GTest.h>
+
+using namespace folly;
+
+namespace {
+
+// str_to_floating<double> before the Eisel-Lemire fast path, which it
+// still falls back to: double-conversion with the same flags.
+double slowToDouble(std::string const& s, int& length) {
+  using namespace double_conversion;
+  static StringToDoubleConverter const conv(
+      StringToDoubleConverter::ALLOW_TRAILING_JUNK |
+          StringToDoubleConverter::ALLOW_LEADING_SPACES,
+      0.0,
+      std::numeric_limits<double>::quiet_NaN(),
+      nullptr,
+      nullptr);
+  return conv.StringToDouble(s.data(), int(s.size()), &length);
+}
+
+// Checks to<double> against the slow path and against strtod, bit for bit
+// (so that the sign of zero counts), and that the same characters are
+// consumed.
+void expectSameAsSlowPath(std::string const& s) {
+  SCOPED_TRACE(s);
+  int length = 0;
+  double const slow = slowToDouble(s, length);
+  ASSERT_EQ(s.size(), size_t(length));
+
+  StringPiece src(s);
+  auto const fast = tryTo<double>(&src);
+  ASSERT_TRUE(fast.hasValue());
+  EXPECT_TRUE(src.empty());
+  EXPECT_EQ(bit_cast<uint64_t>(slow), bit_cast<uint64_t>(*fast));
+  EXPECT_EQ(bit_cast<uint64_t>(std::strtod(s.c_str(), nullptr)),
+            bit_cast<uint64_t>(*fast));
+}
+
+// splitmix64, so the inputs are the same everywhere
+struct prng {
+  uint64_t state;
+
+  uint64_t next() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+  uint64_t below(uint64_t n) { return next() % n; }
+};
+
+} // namespace
+
+TEST(Conv, stringToDoubleHalfwayCases) {
+  for (auto s : {
+           // 2^53 + 1 and 2^53 + 3, halfway between doubles: ties to even
+           "9007199254740993",
+           "9007199254740995",
+           "9007199254740993.0000000000000000001",
+           // 1 + 2^-53 exactly, and just either side of it
+           "1.00000000000000011102230246251565404236316680908203125",
+           "1.00000000000000011102230246251565404236316680908203124",
+           "1.00000000000000011102230246251565404236316680908203126",
+           // the exact value of 0.1, and 0.1 itself
+           "0.1000000000000000055511151231257827021181583404541015625",
+           "0.1",
+           "7.2057594037927933e16",
+           "2.2250738585072012e-308",
+       }) {
+    expectSameAsSlowPath(s);
+  }
+}
+
+TEST(Conv, stringToDoubleSubnormals) {
+  for (auto s : {
+           "4.9406564584124654e-324", // the smallest subnormal
+           "2.4703282292062327e-324", // just under half of it: 0
+           "2.4703282292062328e-324", // just over half of it
+           "2.2250738585072009e-308", // the largest subnormal
+           "2.2250738585072011e-308",
+           "2.2250738585072014e-308", // the smallest normal
+           "1e-310",
+           "-1e-320",
+           "1e-324",
+           "1e-342",
+           "1e-343",
+           "1e-400",
+           "-1e-400",
+       }) {
+    expectSameAsSlowPath(s);
+  }
+}
+
+TEST(Conv, stringToDoubleLongMantissas) {
+  for (auto s : {
+           "1234567890123456789", // 19 digits, exact in w
+           "12345678901234567890", // 20: truncated
+           "12345678901234567891",
+           "123456789012345678901234567890",
+           "0.0000000000000000000000000000001234567890123456789012",
+           "18446744073709551615", // 2^64 - 1
+           "18446744073709551616",
+           "9999999999999999999",
+           "99999999999999999999e-20",
+           "1.7976931348623157e308", // the largest double
+           "1.79769313486231570814527423731704356798070e308",
+           "1.7976931348623158e308", // still rounds down to it
+           "1.7976931348623159e308", // infinity
+       }) {
+    expectSameAsSlowPath(s);
+  }
+}
+
+TEST(Conv, stringToDoubleExponentLimits) {
+  for (auto s : {
+           "1e22", // the largest exact power of ten
+           "1e23",
+           "1e-22",
+           "1e-23",
+           "9007199254740992e22", // 2^53 * 10^22, Clinger's limit
+           "9007199254740993e22",
+           "1e308",
+           "1e309",
+           "-1e309",
+           "0e999999",
+           "-0",
+           "-0.0e-5",
+           "1e99999999999",
+           "1e-99999999999",
+           "0.000000000000000000000000000000000000000000001e353",
+       }) {
+    expectSameAsSlowPath(s);
+  }
+}
+
+TEST(Conv, stringToDoubleRandomNearHalfway) {
+  // Digit strings of 15 to 40 digits with runs of 9s, 0s and a trailing 5,
+  // the patterns that sit next to a rounding boundary, over the whole
+  // exponent range.
+  prng r{42};
+  for (int i = 0; i < 100000; ++i) {
+    std::string s;
+    if (r.below(4) == 0) {
+      s += '-';
+    }
+    auto const digits = 15 + r.below(26);
+    s += char('1' + r.below(9));
+    for (uint64_t d = 1; d < digits; ++d) {
+      switch (r.below(4)) {
+        case 0:
+          s += '9';
+          break;
+        case 1:
+          s += '0';
+          break;
+        default:
+          s += char('0' + r.below(10));
+      }
+    }
+    if (r.below(2)) {
+      s.back() = '5';
+    }
+    if (r.below(2)) {
+      s.insert(1 + r.below(digits - 1), 1, '.');
+    }
+    s += 'e';
+    s += std::to_string(int(r.below(700)) - 360);
+    expectSameAsSlowPath(s);
+    if (HasFatalFailure()) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Like JsonBenchmark.cpp, this is not part of the RCT-Folly pod; it builds
+ * against this tree's folly sources and gtest.
+ */
+
+#include <folly/frozen_dynamic.h>
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <folly/container/F14Map.h>
+#include <folly/json.h>
+#include <folly/portability/GTest.h>
+
+using namespace folly;
+
+namespace {
+
+// Prints what dynamic's operator== can't compare: NaN, the sign of zero,
+// ints against doubles and keys that are not strings.
+std::string print(dynamic const& value) {
+  json::serialization_opts opts;
+  opts.allow_non_string_keys = true;
+  opts.allow_nan_inf = true;
+  opts.sort_keys = true;
+  auto out = json::serialize(value, opts);
+  if (value.isDouble()) {
+    out += std::signbit(value.getDouble()) ? " (negative double)" : " (double)";
+  }
+  return out;
+}
+
+std::vector<dynamic> values() {
+  std::vector<dynamic> ret = {
+      nullptr,
+      true,
+      false,
+      0,
+      1,
+      -1,
+      std::numeric_limits<int64_t>::min(),
+      1.0,
+      0.0,
+      -0.0,
+      std::numeric_limits<double>::quiet_NaN(),
+      std::numeric_limits<double>::infinity(),
+      "",
+      "a",
+      "é",
+      dynamic::array,
+      dynamic::object,
+      dynamic::array(1, 1.0, "1", nullptr, dynamic::array()),
+      dynamic::object("a", 1)(1, "a")(2.5, dynamic::object("x", nullptr)),
+  };
+  ret.push_back(parseJson(R"({
+    "offers": [{"id": 1, "tags": ["a", "b"]}, {"id": 2, "tags": []}],
+    "meta": {"count": 2, "next": null}
+  })"));
+  return ret;
+}
+
+} // namespace
+
+TEST(FrozenDynamic, hashIsDynamicHash) {
+  for (auto const& value : values()) {
+    frozen_dynamic const frozen(value);
+    EXPECT_EQ(value.hash(), frozen.hash()) << print(value);
+    EXPECT_EQ(value.type(), frozen.type()) << print(value);
+    EXPECT_EQ(print(value), print(frozen.toDynamic()));
+  }
+  EXPECT_EQ(dynamic().hash(), frozen_dynamic().hash());
+}
+
+TEST(FrozenDynamic, equalValuesShareANode) {
+  auto const all = values();
+  for (size_t i = 0; i < all.size(); ++i) {
+    for (size_t j = 0; j < all.size(); ++j) {
+      // print() tells apart exactly the values frozen_dynamic does.
+      EXPECT_EQ(
+          print(all[i]) == print(all[j]),
+          frozen_dynamic(all[i]) == frozen_dynamic(all[j]))
+          << print(all[i]) << " vs " << print(all[j]);
+    }
+  }
+  // Stricter than dynamic's operator==.
+  EXPECT_EQ(dynamic(1), dynamic(1.0));
+  EXPECT_NE(frozen_dynamic(dynamic(1)), frozen_dynamic(dynamic(1.0)));
+  EXPECT_NE(frozen_dynamic(dynamic(0.0)), frozen_dynamic(dynamic(-0.0)));
+  auto const nan = dynamic(std::numeric_limits<double>::quiet_NaN());
+  EXPECT_EQ(frozen_dynamic(nan), frozen_dynamic(nan));
+  // Insertion order does not matter; nested values are shared.
+  dynamic a = dynamic::object;
+  dynamic b = dynamic::object;
+  for (int i = 0; i < 20; ++i) {
+    a[to<std::string>(i)] = dynamic::array(i);
+    b[to<std::string>(19 - i)] = dynamic::array(19 - i);
+  }
+  frozen_dynamic const fa(a);
+  EXPECT_EQ(fa, frozen_dynamic(b));
+  EXPECT_EQ(&*fa["7"].begin(), &*frozen_dynamic(b)["7"].begin());
+  EXPECT_EQ(frozen_dynamic(dynamic::array(7)), fa["7"]);
+}
+
+TEST(FrozenDynamic, accessorsFollowDynamic) {
+  dynamic const value = dynamic::object("a", 1)(
+      "b", dynamic::array(true, "x", 2.5))(3, "three");
+  frozen_dynamic const frozen(value);
+  EXPECT_EQ(3, frozen.size());
+  EXPECT_EQ(1, frozen["a"].getInt());
+  EXPECT_TRUE(frozen["b"][0].getBool());
+  EXPECT_EQ("x", frozen["b"][1].getString());
+  EXPECT_EQ(2.5, frozen["b"][2].getDouble());
+  EXPECT_EQ(1, frozen.count("a"));
+  EXPECT_EQ(0, frozen.count("3"));
+  EXPECT_EQ(nullptr, frozen.get_ptr("z"));
+  size_t members = 0;
+  for (auto const& item : frozen.items()) {
+    EXPECT_EQ(value[item.first.toDynamic()], item.second.toDynamic());
+    ++members;
+  }
+  EXPECT_EQ(3, members);
+  EXPECT_EQ(3, frozen["b"].end() - frozen["b"].begin());
+  EXPECT_THROW(frozen["z"], std::out_of_range);
+  EXPECT_THROW(frozen["b"][3], std::out_of_range);
+  EXPECT_THROW(frozen["a"].getString(), TypeError);
+  EXPECT_THROW(frozen["a"].size(), TypeError);
+  EXPECT_THROW(frozen["b"]["a"], TypeError);
+  EXPECT_THROW(frozen[size_t(0)], TypeError);
+  EXPECT_TRUE(frozen_dynamic().isNull());
+  EXPECT_TRUE(frozen_dynamic(nullptr).isNull());
+}
+
+TEST(FrozenDynamic, internsAndReleases) {
+  auto const before = frozen_dynamic::internedCount();
+  {
+    // "a" is both a key and a string value: 5 nodes, the null is none.
+    frozen_dynamic const frozen(parseJson(
+        R"({"a": [1, 1, "a", null], "b": [1, 1, "a", null]})"));
+    EXPECT_EQ(before + 5, frozen_dynamic::internedCount());
+    auto copy = frozen;
+    frozen_dynamic const again(frozen.toDynamic());
+    EXPECT_EQ(frozen, again);
+    EXPECT_EQ(before + 5, frozen_dynamic::internedCount());
+    auto const element = frozen["b"];
+    copy = frozen_dynamic();
+    EXPECT_EQ(before + 5, frozen_dynamic::internedCount());
+  }
+  EXPECT_EQ(before, frozen_dynamic::internedCount());
+  {
+    frozen_dynamic element;
+    {
+      frozen_dynamic const frozen(parseJson(R"({"a": [1, "x"]})"));
+      element = frozen["a"];
+    }
+    // The array, 1 and "x" remain.
+    EXPECT_EQ(before + 3, frozen_dynamic::internedCount());
+    EXPECT_EQ(frozen_dynamic(parseJson(R"([1, "x"])")), element);
+  }
+  EXPECT_EQ(before, frozen_dynamic::internedCount());
+}
+
+TEST(FrozenDynamic, internsAndReleasesConcurrently) {
+  auto const all = values();
+  auto const before = frozen_dynamic::internedCount();
+  std::atomic<size_t> mismatches{0};
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      for (size_t i = 0; i < 20000; ++i) {
+        // Threads drop the last reference to values others are interning.
+        auto const& value = all[(i * 7 + t) % all.size()];
+        frozen_dynamic const a(value);
+        frozen_dynamic const b = a;
+        frozen_dynamic const c(value);
+        if (a != c || b.hash() != value.hash()) {
+          ++mismatches;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0, mismatches.load());
+  EXPECT_EQ(before, frozen_dynamic::internedCount());
+}
+
+TEST(FrozenDynamic, keysHashMaps) {
+  F14FastMap<frozen_dynamic, int> cache;
+  auto const all = values();
+  for (size_t i = 0; i < all.size(); ++i) {
+    cache[frozen_dynamic(all[i])] = int(i);
+  }
+  EXPECT_EQ(all.size(), cache.size());
+  for (size_t i = 0; i < all.size(); ++i) {
+    EXPECT_EQ(int(i), cache.at(frozen_dynamic(all[i]))) << print(all[i]);
+  }
+}
@@ -0,0 +1,823 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmarks for parsing, serializing and working with folly::dynamic.
+ *
+ * Every benchmark runs over a fixed corpus generated below from a seeded
+ * generator, so numbers are comparable across runs and machines. Besides
+ * time per iteration, each benchmark reports:
+ *
+ *   MB/s     json text processed per second (size of the source document)
+ *   allocs   calls to operator new for one pass over the document
+ *   alloc_kb bytes requested from operator new for one pass
+ *
+ * and the process's peak RSS is printed once all benchmarks have run.
+ * Allocations are counted by the replacement operator new in this file,
+ * only during an extra untimed pass after a warm-up pass, so counting does
+ * not affect timings.
+ *
+ * This is not part of the RCT-Folly pod. It links against this tree's
+ * folly sources and folly/Benchmark.cpp from the matching folly release.
+ * To compare two builds, save a baseline with --bm_json_verbose=base.json
+ * and rerun with --bm_relative_to=base.json.
+ */
+
+#include <folly/Benchmark.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <folly/Conv.h>
+#include <folly/DynamicConverter.h>
+#include <folly/Optional.h>
+#include <folly/Unicode.h>
+#include <folly/cbor.h>
+#include <folly/dynamic.h>
+#include <folly/json.h>
+#include <folly/json_fields.h>
+#include <folly/json_patch.h>
+#include <folly/json_pointer.h>
+#include <folly/json_pointer_set.h>
+#include <folly/portability/GFlags.h>
+
+using namespace folly;
+
+namespace {
+
+struct alloc_stats {
+  bool counting{false};
+  uint64_t count{0};
+  uint64_t bytes{0};
+};
+
+alloc_stats allocStats;
+
+void* countedAlloc(std::size_t size, std::size_t align = 0) noexcept {
+  if (allocStats.counting) {
+    ++allocStats.count;
+    allocStats.bytes += size;
+  }
+  if (align <= alignof(std::max_align_t)) {
+    return std::malloc(size ? size : 1);
+  }
+  void* p = nullptr;
+  return posix_memalign(&p, align, size ? size : 1) == 0 ? p : nullptr;
+}
+
+void* countedNew(std::size_t size, std::size_t align = 0) {
+  if (void* p = countedAlloc(size, align)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+} // namespace
+
+// Every replaceable form, so that no allocation bypasses the count and
+// sized deallocation (-fsized-deallocation) frees what malloc returned.
+void* operator new(std::size_t size) {
+  return countedNew(size);
+}
+void* operator new[](std::size_t size) {
+  return countedNew(size);
+}
+void* operator new(std::size_t size, std::align_val_t align) {
+  return countedNew(size, std::size_t(align));
+}
+void* operator new[](std::size_t size, std::align_val_t align) {
+  return countedNew(size, std::size_t(align));
+}
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept {
+  return countedAlloc(size);
+}
+void* operator new[](std::size_t size, std::nothrow_t const&) noexcept {
+  return countedAlloc(size);
+}
+void* operator new(
+    std::size_t size, std::align_val_t align, std::nothrow_t const&) noexcept {
+  return countedAlloc(size, std::size_t(align));
+}
+void* operator new[](
+    std::size_t size, std::align_val_t align, std::nothrow_t const&) noexcept {
+  return countedAlloc(size, std::size_t(align));
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p, std::size_t) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, std::nothrow_t const&) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p, std::nothrow_t const&) noexcept {
+  std::free(p);
+}
+void operator delete(
+    void* p, std::align_val_t, std::nothrow_t const&) noexcept {
+  std::free(p);
+}
+void operator delete[](
+    void* p, std::align_val_t, std::nothrow_t const&) noexcept {
+  std::free(p);
+}
+
+namespace {
+
+/*
+ * Corpus
+ */
+
+// splitmix64; std distributions differ between standard libraries
+struct prng {
+  uint64_t state;
+
+  uint64_t next() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+  uint64_t below(uint64_t n) { return next() % n; }
+  double unit() { return double(next() >> 11) * 0x1.0p-53; }
+};
+
+std::string word(prng& r) {
+  static char const* const kWords[] = {
+      "coffee",  "loyalty", "reward", "points", "voucher", "discount",
+      "store",   "member",  "gold",   "silver", "weekend", "bonus",
+      "receipt", "online",  "basket", "fresh",  "bakery",  "station",
+  };
+  return kWords[r.below(sizeof(kWords) / sizeof(kWords[0]))];
+}
+
+std::string sentence(prng& r, size_t words) {
+  std::string s;
+  for (size_t i = 0; i < words; ++i) {
+    if (i) {
+      s += ' ';
+    }
+    s += word(r);
+  }
+  return s;
+}
+
+dynamic makeOffer(prng& r, int64_t id) {
+  dynamic tags = dynamic::array;
+  for (auto n = r.below(4); n; --n) {
+    tags.push_back(word(r));
+  }
+  dynamic counts = dynamic::object;
+  for (auto n = r.below(4); n; --n) {
+    counts[word(r)] = int64_t(r.below(1000));
+  }
+  return dynamic::object("id", id)("title", sentence(r, 2 + r.below(5)))(
+      "tags", std::move(tags))(
+      "price",
+      r.below(5) ? dynamic(double(r.below(100000)) / 100) : dynamic())(
+      "counts", std::move(counts))(
+      "card",
+      dynamic::object("brand", r.below(2) ? "visa" : "mastercard")(
+          "last4", int64_t(r.below(10000))))(
+      "merchant", dynamic::object("name", sentence(r, 2))("open", true));
+}
+
+// a typical small REST response
+dynamic makeRestSmall() {
+  prng r{1};
+  dynamic items = dynamic::array;
+  for (int64_t i = 0; i < 4; ++i) {
+    items.push_back(makeOffer(r, i));
+  }
+  return dynamic::object("status", "ok")("page", 1)("per_page", 4)(
+      "user",
+      dynamic::object("id", 48213)("name", "Jan Kowalski")(
+          "email", "jan@example.com")("verified", true))(
+      "items", std::move(items));
+}
+
+dynamic makeArrayLarge() {
+  prng r{2};
+  dynamic offers = dynamic::array;
+  for (int64_t i = 0; i < 4000; ++i) {
+    offers.push_back(makeOffer(r, i));
+  }
+  return offers;
+}
+
+// chains of alternating objects and arrays, within the default
+// recursion_limit of 100
+dynamic makeNestedDeep() {
+  prng r{3};
+  dynamic chains = dynamic::array;
+  for (int i = 0; i < 200; ++i) {
+    dynamic value = int64_t(r.below(100));
+    for (int depth = 0; depth < 90; ++depth) {
+      value = depth % 2 ? dynamic::array(std::move(value), depth)
+                        : dynamic::object(word(r), std::move(value));
+    }
+    chains.push_back(std::move(value));
+  }
+  return chains;
+}
+
+dynamic makeNumbers() {
+  prng r{4};
+  dynamic ints = dynamic::array;
+  dynamic doubles = dynamic::array;
+  for (int i = 0; i < 20000; ++i) {
+    ints.push_back(int64_t(r.next() >> (r.below(63) + 1)) - (1 << 20));
+    doubles.push_back((r.unit() - 0.5) * double(1ull << r.below(60)));
+  }
+  return dynamic::object("ints", std::move(ints))(
+      "doubles", std::move(doubles));
+}
+
+dynamic makeStringsEscaped() {
+  prng r{5};
+  static char const* const kSpecial[] = {
+      "\"", "\\", "\n", "\t", "\r", "/", "<", ">", "&", "'", "\x01", "\x1f"};
+  dynamic strings = dynamic::array;
+  for (int i = 0; i < 5000; ++i) {
+    std::string s;
+    for (auto n = 2 + r.below(8); n; --n) {
+      s += word(r);
+      s += kSpecial[r.below(sizeof(kSpecial) / sizeof(kSpecial[0]))];
+    }
+    strings.push_back(std::move(s));
+  }
+  return strings;
+}
+
+dynamic makeNonAscii() {
+  prng r{6};
+  static char const* const kWords[] = {
+      "zażółć", "gęślą", "jaźń", "kawiarnia", "punkty",
+      "Привет", "скидка", "καφές",
+      "ポイント", "会员",
+      "\xf0\x9f\x8e\x81", // U+1F381
+      "\xf0\x9f\x9b\x92", // U+1F6D2
+  };
+  dynamic strings = dynamic::array;
+  for (int i = 0; i < 5000; ++i) {
+    std::string s;
+    for (auto n = 2 + r.below(8); n; --n) {
+      if (!s.empty()) {
+        s += ' ';
+      }
+      s += kWords[r.below(sizeof(kWords) / sizeof(kWords[0]))];
+    }
+    strings.push_back(std::move(s));
+  }
+  return strings;
+}
+
+struct document {
+  std::string name;
+  dynamic value;
+  std::string json;
+};
+
+std::vector<document> const& corpus() {
+  static auto const docs = [] {
+    std::vector<document> out;
+    auto add = [&](std::string name, dynamic value) {
+      auto json = toJson(value);
+      out.push_back({std::move(name), std::move(value), std::move(json)});
+    };
+    add("rest_small", makeRestSmall());
+    add("array_large", makeArrayLarge());
+    add("nested_deep", makeNestedDeep());
+    add("numbers", makeNumbers());
+    add("strings_escaped", makeStringsEscaped());
+    add("non_ascii", makeNonAscii());
+    return out;
+  }();
+  return docs;
+}
+
+document const& doc(StringPiece name) {
+  for (auto const& d : corpus()) {
+    if (d.name == name) {
+      return d;
+    }
+  }
+  std::abort();
+}
+
+/*
+ * Offer records, for convertTo and json::decode
+ */
+
+struct offer_card {
+  std::string brand;
+  int64_t last4{};
+};
+FOLLY_JSON_FIELDS(offer_card, brand, last4)
+
+struct offer {
+  int64_t id{};
+  std::string title;
+  std::vector<std::string> tags;
+  Optional<double> price;
+  std::map<std::string, int64_t> counts;
+  offer_card card;
+};
+FOLLY_JSON_FIELDS(offer, id, title, tags, price, counts, card)
+
+} // namespace
+
+namespace folly {
+
+template <>
+struct DynamicConverter<offer_card> {
+  static offer_card convert(dynamic const& d) {
+    return {d["brand"].getString(), d["last4"].asInt()};
+  }
+};
+
+template <>
+struct DynamicConverter<offer> {
+  static offer convert(dynamic const& d) {
+    offer o;
+    o.id = d["id"].asInt();
+    o.title = d["title"].getString();
+    o.tags = convertTo<std::vector<std::string>>(d["tags"]);
+    if (!d["price"].isNull()) {
+      o.price = d["price"].asDouble();
+    }
+    o.counts = convertTo<std::map<std::string, int64_t>>(d["counts"]);
+    o.card = convertTo<offer_card>(d["card"]);
+    return o;
+  }
+};
+
+template <>
+struct DynamicConstructor<offer_card, void> {
+  static dynamic construct(offer_card const& c) {
+    return dynamic::object("brand", c.brand)("last4", c.last4);
+  }
+};
+
+template <>
+struct DynamicConstructor<offer, void> {
+  static dynamic construct(offer const& o) {
+    return dynamic::object("id", o.id)("title", o.title)(
+        "tags", toDynamic(o.tags))(
+        "price", o.price ? dynamic(*o.price) : dynamic())(
+        "counts", toDynamic(o.counts))("card", toDynamic(o.card));
+  }
+};
+
+} // namespace folly
+
+namespace {
+
+/*
+ * Registration
+ */
+
+/*
+ * Register `fn`, a callable performing one pass of the benchmark, under
+ * `name`. `bytes` is the size of the json text one pass processes, or 0 to
+ * not report MB/s. `setup`, if given, runs untimed before every pass.
+ */
+template <typename Fn, typename Setup>
+void addDocBenchmark(std::string name, size_t bytes, Fn fn, Setup setup) {
+  addBenchmark(
+      __FILE__,
+      name,
+      [=](UserCounters& counters, unsigned iters) {
+        using clock = std::chrono::high_resolution_clock;
+        {
+          BenchmarkSuspender suspender;
+          // warm up first, so buffers reused across passes are counted
+          // at their steady state
+          setup();
+          doNotOptimizeAway(fn());
+          setup();
+          allocStats = {true, 0, 0};
+          doNotOptimizeAway(fn());
+          allocStats.counting = false;
+          counters["allocs"] = int64_t(allocStats.count);
+          counters["alloc_kb"] = int64_t(allocStats.bytes / 1024);
+        }
+        auto const suspended = BenchmarkSuspender::timeSpent;
+        auto const start = clock::now();
+        for (unsigned i = 0; i < iters; ++i) {
+          setup();
+          doNotOptimizeAway(fn());
+        }
+        auto const elapsed = (clock::now() - start) -
+            (BenchmarkSuspender::timeSpent - suspended);
+        auto const seconds = std::chrono::duration<double>(elapsed).count();
+        if (bytes && seconds > 0) {
+          counters["MB/s"] = UserMetric(
+              int64_t(double(bytes) * iters / seconds / 1e6),
+              UserMetric::Type::METRIC);
+        }
+        return iters;
+      });
+}
+
+template <typename Fn>
+void addDocBenchmark(std::string name, size_t bytes, Fn fn) {
+  addDocBenchmark(std::move(name), bytes, std::move(fn), [] {});
+}
+
+void drawLine() {
+  addBenchmark(__FILE__, "-", []() -> unsigned { return 0; });
+}
+
+void addParseBenchmarks() {
+  static json::serialization_opts const indexed = [] {
+    json::serialization_opts opts;
+    opts.parse_with_structural_index = true;
+    return opts;
+  }();
+  for (auto const& d : corpus()) {
+    addDocBenchmark("parseJson/" + d.name, d.json.size(), [&d] {
+      return parseJson(d.json);
+    });
+    addDocBenchmark(
+        "parseJson_indexed/" + d.name, d.json.size(), [&d] {
+          return parseJson(d.json, indexed);
+        });
+  }
+  drawLine();
+}
+
+void addSerializeBenchmarks() {
+  for (auto const& d : corpus()) {
+    addDocBenchmark("toJson/" + d.name, d.json.size(), [&d] {
+      return toJson(d.value);
+    });
+  }
+  drawLine();
+}
+
+// every string in the two string-heavy documents, escaped into one buffer
+void addEscapeBenchmarks() {
+  static std::vector<std::string> const strings = [] {
+    std::vector<std::string> out;
+    for (auto const* name : {"strings_escaped", "non_ascii"}) {
+      for (auto const& s : doc(name).value) {
+        out.push_back(s.getString());
+      }
+    }
+    return out;
+  }();
+  size_t bytes = 0;
+  for (auto const& s : strings) {
+    bytes += s.size();
+  }
+
+  // serialization_opts is move-only, so each benchmark owns its copy
+  auto add = [&](std::string name, auto configure) {
+    auto opts = std::make_shared<json::serialization_opts>();
+    configure(*opts);
+    addDocBenchmark("escapeString/" + name, bytes, [opts] {
+      static std::string out;
+      out.clear();
+      for (auto const& s : strings) {
+        json::escapeString(s, out, *opts);
+      }
+      return out.size();
+    });
+  };
+  add("plain", [](auto&) {});
+  add("html_safe", [](auto& opts) {
+    opts.extra_ascii_to_escape_bitmap =
+        json::buildExtraAsciiToEscapeBitmap("<>&'");
+  });
+  add("validate_utf8", [](auto& opts) { opts.validate_utf8 = true; });
+  add("encode_non_ascii", [](auto& opts) { opts.encode_non_ascii = true; });
+  drawLine();
+}
+
+/*
+ * Unicode
+ */
+
+// About 1 MB of one script's text, in words of 1 to 8 characters
+std::string makeScript(uint64_t seed, std::vector<char32_t> const& letters) {
+  prng r{seed};
+  std::string out;
+  while (out.size() < (1 << 20)) {
+    for (auto n = 1 + r.below(8); n; --n) {
+      appendCodePointToUtf8(letters[r.below(letters.size())], out);
+    }
+    out += ' ';
+  }
+  return out;
+}
+
+std::vector<char32_t> codePoints(char32_t first, char32_t last) {
+  std::vector<char32_t> out;
+  for (auto c = first; c <= last; ++c) {
+    out.push_back(c);
+  }
+  return out;
+}
+
+void addUnicodeBenchmarks() {
+  struct script {
+    std::string name;
+    std::string utf8;
+    std::u16string utf16;
+  };
+  static std::vector<script> const scripts = [] {
+    // a-z, six times over, and the lower case letters of Latin-1: about
+    // one letter in six takes two bytes
+    auto latin = codePoints(0xe0, 0xff);
+    for (int i = 0; i < 6; ++i) {
+      auto const az = codePoints('a', 'z');
+      latin.insert(latin.end(), az.begin(), az.end());
+    }
+    std::vector<script> out;
+    auto add = [&](std::string name, std::string utf8) {
+      auto utf16 = utf8ToUtf16(utf8);
+      out.push_back({std::move(name), std::move(utf8), std::move(utf16)});
+    };
+    add("ascii", makeScript(8, codePoints('a', 'z')));
+    add("latin", makeScript(9, latin));
+    add("cjk", makeScript(10, codePoints(0x4e00, 0x9fff)));
+    add("emoji", makeScript(11, codePoints(0x1f300, 0x1f5ff)));
+    return out;
+  }();
+
+  for (auto const& s : scripts) {
+    addDocBenchmark("utf8ToCodePoint/" + s.name, s.utf8.size(), [&s] {
+      auto p = reinterpret_cast<unsigned char const*>(s.utf8.data());
+      auto const e = p + s.utf8.size();
+      size_t n = 0;
+      while (p != e) {
+        utf8ToCodePoint(p, e, false);
+        ++n;
+      }
+      return n;
+    });
+    addDocBenchmark("utf8Validate/" + s.name, s.utf8.size(), [&s] {
+      return utf8Validate(s.utf8);
+    });
+    addDocBenchmark("utf8CountCodePoints/" + s.name, s.utf8.size(), [&s] {
+      return utf8CountCodePoints(s.utf8);
+    });
+    addDocBenchmark("utf8ToUtf16/" + s.name, s.utf8.size(), [&s] {
+      static std::u16string out;
+      out.resize(s.utf8.size());
+      return utf8ToUtf16(s.utf8, out.data());
+    });
+    addDocBenchmark("utf16ToUtf8/" + s.name, s.utf8.size(), [&s] {
+      static std::string out;
+      out.resize(3 * s.utf16.size());
+      return utf16ToUtf8(std::u16string_view(s.utf16), out.data());
+    });
+  }
+  drawLine();
+}
+
+void addDynamicBenchmarks() {
+  for (auto const& d : corpus()) {
+    addDocBenchmark("dynamic_copy/" + d.name, d.json.size(), [&d] {
+      return dynamic(d.value);
+    });
+  }
+  addDocBenchmark("dynamic_build/array_large", 0, [] {
+    prng r{2};
+    dynamic offers = dynamic::array;
+    for (int64_t i = 0; i < 4000; ++i) {
+      offers.push_back(makeOffer(r, i));
+    }
+    return offers;
+  });
+  drawLine();
+}
+
+void addConvertBenchmarks() {
+  auto const& numbers = doc("numbers");
+  addDocBenchmark("convertTo/numbers", numbers.json.size(), [&numbers] {
+    return std::make_pair(
+        convertTo<std::vector<int64_t>>(numbers.value["ints"]),
+        convertTo<std::vector<double>>(numbers.value["doubles"]));
+  });
+
+  auto const& offers = doc("array_large");
+  addDocBenchmark(
+      "parseJson_convertTo/array_large", offers.json.size(), [&offers] {
+        return convertTo<std::vector<offer>>(parseJson(offers.json));
+      });
+  addDocBenchmark(
+      "json_decode/array_large", offers.json.size(), [&offers] {
+        return json::decode<std::vector<offer>>(offers.json);
+      });
+
+  static auto const records =
+      convertTo<std::vector<offer>>(offers.value);
+  addDocBenchmark(
+      "toDynamic_toJson/array_large", offers.json.size(), [] {
+        return toJson(toDynamic(records));
+      });
+  addDocBenchmark("json_encode/array_large", offers.json.size(), [] {
+    return json::encode(records);
+  });
+  drawLine();
+}
+
+void addPointerBenchmarks() {
+  static std::vector<std::string> paths;
+  for (size_t i = 0; i < 4000; i += 97) {
+    auto const base = "/" + to<std::string>(i);
+    paths.push_back(base + "/id");
+    paths.push_back(base + "/card/last4");
+    paths.push_back(base + "/price");
+  }
+  static std::vector<json_pointer> const pointers = [] {
+    std::vector<json_pointer> out;
+    for (auto const& p : paths) {
+      out.push_back(json_pointer::parse(p));
+    }
+    return out;
+  }();
+  static std::vector<compiled_json_pointer> const compiled = [] {
+    std::vector<compiled_json_pointer> out;
+    for (auto const& p : paths) {
+      out.push_back(compiled_json_pointer::parse(p));
+    }
+    return out;
+  }();
+  static json_pointer_set const set = [] {
+    json_pointer_set out;
+    for (auto const& p : paths) {
+      out.insert(p);
+    }
+    return out;
+  }();
+
+  auto const& offers = doc("array_large").value;
+  addDocBenchmark("json_pointer/get_ptr", 0, [&offers] {
+    size_t found = 0;
+    for (auto const& p : pointers) {
+      found += offers.get_ptr(p) != nullptr;
+    }
+    return found;
+  });
+  addDocBenchmark("compiled_json_pointer/get_ptr", 0, [&offers] {
+    size_t found = 0;
+    for (auto const& p : compiled) {
+      found += p.get_ptr(offers) != nullptr;
+    }
+    return found;
+  });
+  addDocBenchmark("json_pointer_set/resolve", 0, [&offers] {
+    static std::vector<dynamic const*> out;
+    set.resolve(offers, out);
+    return out.size();
+  });
+  drawLine();
+}
+
+// edits a tenth of the offers: renames, price changes, a few removals
+// and insertions
+dynamic editOffers(dynamic offers) {
+  prng r{7};
+  for (size_t i = 0; i < offers.size(); i += 10) {
+    auto& o = offers[i];
+    o["title"] = sentence(r, 3);
+    o["price"] = double(r.below(100000)) / 100;
+    if (r.below(4) == 0) {
+      o.erase("merchant");
+    }
+  }
+  for (size_t i = 0; i < 20; ++i) {
+    auto const at = r.below(offers.size());
+    offers.erase(offers.begin() + at);
+    offers.insert(offers.begin() + r.below(offers.size()), makeOffer(r, -1));
+  }
+  return offers;
+}
+
+void addPatchBenchmarks() {
+  auto const& from = doc("array_large").value;
+  static dynamic const to = editOffers(from);
+  static json_patch const patch = json_patch::diff(from, to);
+
+  addDocBenchmark("json_patch/diff", 0, [&from] {
+    return json_patch::diff(from, to);
+  });
+
+  static dynamic target;
+  addDocBenchmark(
+      "json_patch/apply",
+      0,
+      [] { return patch.apply(target).hasValue(); },
+      [&from] { target = from; });
+  drawLine();
+}
+
+void addBinaryBenchmarks() {
+  for (auto const fmt : {cbor::format::cbor, cbor::format::msgpack}) {
+    auto const label =
+        std::string(fmt == cbor::format::cbor ? "cbor" : "msgpack");
+    for (auto const& d : corpus()) {
+      addDocBenchmark(label + "_encode/" + d.name, d.json.size(), [&d, fmt] {
+        static std::string out;
+        out.clear();
+        cbor::encode(d.value, out, fmt);
+        return out.size();
+      });
+      auto const encoded = std::make_shared<std::string>(
+          cbor::encode(d.value, fmt));
+      addDocBenchmark(
+          label + "_decode/" + d.name, d.json.size(), [encoded, fmt] {
+            return cbor::decode(ByteRange(StringPiece(*encoded)), fmt);
+          });
+    }
+  }
+}
+
+void printPeakRss() {
+  struct rusage usage {};
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return;
+  }
+#ifdef __APPLE__
+  auto const kb = int64_t(usage.ru_maxrss) / 1024;
+#else
+  auto const kb = int64_t(usage.ru_maxrss);
+#endif
+  std::printf("peak RSS: %" PRId64 " kB\n", kb);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+#if FOLLY_HAVE_LIBGFLAGS
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+#else
+  (void)argc;
+  (void)argv;
+#endif
+
+  for (auto const& d : corpus()) {
+    std::printf("%-16s %10zu bytes\n", d.name.c_str(), d.json.size());
+  }
+  addParseBenchmarks();
+  addSerializeBenchmarks();
+  addEscapeBenchmarks();
+  addUnicodeBenchmarks();
+  addDynamicBenchmarks();
+  addConvertBenchmarks();
+  addPointerBenchmarks();
+  addPatchBenchmarks();
+  addBinaryBenchmarks();
+
+  runBenchmarks();
+  printPeakRss();
+  return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Like JsonBenchmark.cpp, this is not part of the RCT-Folly pod; it builds
+ * against this tree's folly sources and gtest.
+ */
+
+#include <folly/json_fields.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <folly/DynamicConverter.h>
+#include <folly/Optional.h>
+#include <folly/portability/GTest.h>
+
+using namespace folly;
+
+namespace {
+
+struct point {
+  int64_t x{};
+  int64_t y{};
+};
+FOLLY_JSON_FIELDS(point, x, y)
+
+// What a conversion returned, or the type of what it threw.
+template <typename T>
+struct outcome {
+  Optional<T> value;
+  std::string thrown;
+
+  template <typename F>
+  static outcome of(F&& f) {
+    outcome ret;
+    try {
+      ret.value = f();
+    } catch (json::parse_error const&) {
+      ret.thrown = "parse_error";
+    } catch (TypeError const&) {
+      ret.thrown = "TypeError";
+    } catch (ConversionError const&) {
+      ret.thrown = "ConversionError";
+    }
+    return ret;
+  }
+};
+
+template <typename T>
+void expectSameAsConvertTo(
+    StringPiece text, json::serialization_opts const& opts = {}) {
+  SCOPED_TRACE(text);
+  auto const expected =
+      outcome<T>::of([&] { return convertTo<T>(parseJson(text, opts)); });
+  auto const actual =
+      outcome<T>::of([&] { return json::decode<T>(text, opts); });
+  EXPECT_EQ(expected.thrown, actual.thrown);
+  // compared as json, so that NaNs are equal
+  json::serialization_opts nan;
+  nan.allow_nan_inf = true;
+  EXPECT_EQ(
+      json::encode(expected.value, nan), json::encode(actual.value, nan));
+}
+
+} // namespace
+
+TEST(JsonFields, numbersAsParseJsonReadsThem) {
+  for (auto text :
+       {"01", "-01", "007", "1.", "-1.", "1.e2", "1e", "1e+", "0.5", "-0",
+        "-", "-x", "1x", "Infinity", "-Infinity", "NaN", "Inf", "-NaN"}) {
+    expectSameAsConvertTo<double>(text);
+    expectSameAsConvertTo<int64_t>(text);
+  }
+}
+
+TEST(JsonFields, integersAreReadAsInt64) {
+  for (auto text :
+       {"-0", "-0.0", "0", "255", "256", "-1", "1.0", "1.5", "1e2",
+        "9223372036854775807", "9223372036854775808",
+        "18446744073709551615", "-9223372036854775808"}) {
+    expectSameAsConvertTo<uint8_t>(text);
+    expectSameAsConvertTo<uint32_t>(text);
+    expectSameAsConvertTo<uint64_t>(text);
+    expectSameAsConvertTo<int64_t>(text);
+    expectSameAsConvertTo<double>(text);
+  }
+  json::serialization_opts fallback;
+  fallback.double_fallback = true;
+  for (auto text : {"9223372036854775808", "-9223372036854775809",
+                    "100000000000000000000", "9223372036854775807"}) {
+    expectSameAsConvertTo<int64_t>(text, fallback);
+    expectSameAsConvertTo<double>(text, fallback);
+  }
+}
+
+TEST(JsonFields, boolsAndNumbersConvert) {
+  for (auto text : {"true", "false", "0", "1", "2", "-1", "0.0", "0.5"}) {
+    expectSameAsConvertTo<bool>(text);
+    expectSameAsConvertTo<int64_t>(text);
+    expectSameAsConvertTo<double>(text);
+    expectSameAsConvertTo<Optional<double>>(text);
+  }
+  expectSameAsConvertTo<std::vector<bool>>("[true,1,0,false]");
+  expectSameAsConvertTo<std::vector<bool>>("[2.5]");
+  expectSameAsConvertTo<Optional<double>>("null");
+}
+
+TEST(JsonFields, stringsDoNotConvert) {
+  // the documented difference: convertTo<T> reads numbers out of strings
+  // and writes numbers and bools into them
+  EXPECT_EQ(12, convertTo<int64_t>(parseJson("\"12\"")));
+  EXPECT_THROW(json::decode<int64_t>("\"12\""), TypeError);
+  EXPECT_EQ("12", convertTo<std::string>(parseJson("12")));
+  EXPECT_THROW(json::decode<std::string>("12"), TypeError);
+  EXPECT_THROW(json::decode<bool>("\"true\""), TypeError);
+  EXPECT_THROW(json::decode<std::string>("true"), TypeError);
+  // mismatches that convertTo rejects too
+  expectSameAsConvertTo<int64_t>("null");
+  expectSameAsConvertTo<int64_t>("[1]");
+  expectSameAsConvertTo<std::string>("null");
+}
+
+TEST(JsonFields, skippedValuesAreCheckedAsParseJsonChecksThem) {
+  std::string const nul("\"a\0b\"", 5);
+  for (auto const& value : std::vector<std::string>{
+           "\"\\ud800\"", "\"\\udc00\"", "\"\\ud800\\u0041\"", "\"\\ud800x\"",
+           "\"\\ud83d\\ude00\"", "\"\\q\"", "\"\\u12\"", nul, "01", "1.",
+           "-", "1e", "99999999999999999999", "NaN", "Nope"}) {
+    auto const text = to<std::string>("{\"x\":1,\"skipped\":", value, "}");
+    SCOPED_TRACE(text);
+    auto const parsed =
+        outcome<dynamic>::of([&] { return parseJson(text); });
+    auto const decoded =
+        outcome<point>::of([&] { return json::decode<point>(text); });
+    EXPECT_EQ(parsed.thrown, decoded.thrown);
+  }
+  // and the same strings when they are read
+  for (auto value : {"\"\\ud800\"", "\"\\udc00\"", "\"\\ud800\\u0041\""}) {
+    expectSameAsConvertTo<std::string>(value);
+  }
+  expectSameAsConvertTo<std::string>(nul);
+  expectSameAsConvertTo<std::string>("\"a\\u0000b\"");
+}
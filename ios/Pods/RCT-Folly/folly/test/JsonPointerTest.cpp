@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Like JsonBenchmark.cpp, this is not part of the RCT-Folly pod; it builds
+ * against this tree's folly sources and gtest.
+ */
+
+#include <folly/json_pointer.h>
+
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <folly/json.h>
+#include <folly/json_pointer_set.h>
+#include <folly/portability/GTest.h>
+
+using namespace folly;
+
+namespace {
+
+// Keys that need escaping or look like array indexes.
+constexpr auto kDocument = R"({
+  "": "empty key",
+  "a/b": 1,
+  "m~n": 2,
+  "~1": 3,
+  "0": "zero key",
+  "01": "leading zero key",
+  "-": "dash key",
+  "é": 4,
+  "arr": [10, [20, 21], {"k": 30}],
+  "obj": {"0": "object zero", "": {"": "nested empty"}},
+  "s": "scalar"
+})";
+
+char const* const kPointers[] = {
+    "",
+    "/",
+    // Twice, for json_pointer_set.
+    "//",
+    "//",
+    "/a~1b",
+    "/m~0n",
+    "/~01",
+    "/~10",
+    "/0",
+    "/01",
+    "/-",
+    "/é",
+    "/arr",
+    "/arr/0",
+    "/arr/1/1",
+    "/arr/2/k",
+    "/arr/-",
+    "/arr/01",
+    "/arr/3",
+    "/arr/1/-",
+    "/arr/18446744073709551616",
+    "/arr/x",
+    "/obj/0",
+    "/obj/",
+    "/obj//",
+    "/s/0",
+    "/s/x",
+    "/missing",
+    "/missing/a",
+};
+
+// What dynamic::get_ptr returns for `ptr`, with nullptr where it throws.
+dynamic const* expectedPtr(dynamic const& root, StringPiece ptr) {
+  try {
+    return root.get_ptr(json_pointer::parse(ptr));
+  } catch (std::exception const&) {
+    return nullptr;
+  }
+}
+
+} // namespace
+
+TEST(CompiledJsonPointer, resolvesLikeGetPtr) {
+  auto doc = parseJson(kDocument);
+  auto const& root = doc;
+  size_t found = 0;
+  for (auto const ptr : kPointers) {
+    auto const compiled = compiled_json_pointer::parse(ptr);
+    auto const expected = expectedPtr(root, ptr);
+    EXPECT_EQ(expected, compiled.get_ptr(root)) << ptr;
+    EXPECT_EQ(expected, compiled.get_ptr(doc)) << ptr;
+    found += expected != nullptr;
+  }
+  // "/arr/-", "/arr/01", paths through scalars and the like do not resolve.
+  EXPECT_EQ(16, found);
+  EXPECT_EQ(&root, compiled_json_pointer::parse("").get_ptr(root));
+  EXPECT_EQ("empty key", *compiled_json_pointer::parse("/").get_ptr(root));
+  EXPECT_EQ(3, *compiled_json_pointer::parse("/~01").get_ptr(root));
+}
+
+TEST(CompiledJsonPointer, parsesLikeJsonPointer) {
+  for (auto const ptr : kPointers) {
+    auto const compiled = compiled_json_pointer::parse(ptr);
+    auto const plain = json_pointer::parse(ptr);
+    EXPECT_EQ(compiled_json_pointer(plain), compiled) << ptr;
+    ASSERT_EQ(plain.tokens().size(), compiled.size()) << ptr;
+    for (size_t i = 0; i < compiled.size(); ++i) {
+      EXPECT_EQ(plain.tokens()[i], compiled[i].name) << ptr;
+    }
+  }
+  EXPECT_NE(
+      compiled_json_pointer::parse("/a/b"),
+      compiled_json_pointer::parse("/a~1b"));
+  for (auto const bad : {"a", "/a~2", "/a~", "~0"}) {
+    auto const compiled = compiled_json_pointer::try_parse(bad);
+    auto const plain = json_pointer::try_parse(bad);
+    ASSERT_TRUE(compiled.hasError()) << bad;
+    ASSERT_TRUE(plain.hasError()) << bad;
+    EXPECT_EQ(plain.error(), compiled.error()) << bad;
+    EXPECT_THROW(
+        compiled_json_pointer::parse(bad), json_pointer::parse_exception);
+  }
+}
+
+TEST(CompiledJsonPointer, parsesArrayIndexesOnce) {
+  auto const ptr = compiled_json_pointer::parse(
+      "/0/7/10/01/-/x/18446744073709551615/18446744073709551616");
+  size_t const expected[] = {
+      0,
+      7,
+      10,
+      compiled_json_pointer::npos,
+      compiled_json_pointer::npos,
+      compiled_json_pointer::npos,
+      compiled_json_pointer::npos,
+      compiled_json_pointer::npos,
+  };
+  ASSERT_EQ(8, ptr.size());
+  for (size_t i = 0; i < ptr.size(); ++i) {
+    EXPECT_EQ(expected[i], ptr[i].index) << ptr[i].name;
+  }
+}
+
+TEST(JsonPointerSet, resolvesLikeGetPtr) {
+  auto const doc = parseJson(kDocument);
+  json::lazy_document lazy(kDocument);
+  json_pointer_set set;
+  for (auto const ptr : kPointers) {
+    auto const position = set.size();
+    EXPECT_EQ(position, set.insert(ptr));
+  }
+  EXPECT_EQ(std::size(kPointers), set.size());
+  auto const results = set.resolve(doc);
+  auto const cursors = set.resolve(lazy);
+  ASSERT_EQ(set.size(), results.size());
+  ASSERT_EQ(set.size(), cursors.size());
+  for (size_t i = 0; i < set.size(); ++i) {
+    auto const expected = expectedPtr(doc, kPointers[i]);
+    EXPECT_EQ(expected, results[i]) << kPointers[i];
+    ASSERT_EQ(expected != nullptr, cursors[i].hasValue()) << kPointers[i];
+    if (expected) {
+      EXPECT_EQ(*expected, cursors[i]->toDynamic()) << kPointers[i];
+    }
+  }
+}
+
+TEST(JsonPointerSet, readsLazyDocumentsLikeParseJson) {
+  // Escaped keys and duplicate keys, of which parseJson keeps the last.
+  auto const text = R"({"a": 1, "a\/b": {"x": [0, 1, 2]}, "a": 2, "a": 3})";
+  json_pointer_set set;
+  set.insert("/a");
+  set.insert("/a~1b/x/2");
+  set.insert("/a~1b/x/-");
+  set.insert("/a");
+  json::lazy_document lazy(text);
+  auto const cursors = set.resolve(lazy);
+  EXPECT_EQ(3, cursors[0]->asInt());
+  EXPECT_EQ(2, cursors[1]->asInt());
+  EXPECT_FALSE(cursors[2].hasValue());
+  EXPECT_EQ(3, cursors[3]->asInt());
+  EXPECT_EQ(parseJson(text)["a"], cursors[0]->toDynamic());
+
+  // Integer keys are found by their text with convert_int_keys.
+  json::serialization_opts opts;
+  opts.allow_non_string_keys = true;
+  opts.convert_int_keys = true;
+  json::lazy_document converted(R"({1: "one", "2": "two"})", opts);
+  json_pointer_set numbers;
+  numbers.insert("/1");
+  numbers.insert("/2");
+  auto const values = numbers.resolve(converted);
+  EXPECT_EQ("one", values[0]->asString());
+  EXPECT_EQ("two", values[1]->asString());
+}
+
+TEST(JsonPointerSet, reusesTheResultVector) {
+  json_pointer_set set;
+  set.insert("/a");
+  set.insert("/b/0");
+  std::vector<dynamic const*> out(5, nullptr);
+  auto const first = parseJson(R"({"a": 1, "b": [2]})");
+  set.resolve(first, out);
+  ASSERT_EQ(2, out.size());
+  EXPECT_EQ(&first["a"], out[0]);
+  EXPECT_EQ(&first["b"][0], out[1]);
+  auto const second = parseJson(R"({"b": 1})");
+  set.resolve(second, out);
+  EXPECT_EQ(nullptr, out[0]);
+  EXPECT_EQ(nullptr, out[1]);
+  EXPECT_TRUE(json_pointer_set().resolve(first).empty());
+}
@@ -0,0 +1,929 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Like JsonBenchmark.cpp, this is not part of the RCT-Folly pod; it builds
+ * against this tree's folly sources and gtest.
+ */
+
+#include <folly/json.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <typeinfo>
+#include <vector>
+
+#include <folly/FileUtil.h>
+#include <folly/json_patch.h>
+#include <folly/memory/Arena.h>
+
+#include <folly/portability/GTest.h>
+#include <folly/portability/Unistd.h>
+
+using namespace folly;
+
+namespace {
+
+// The message parseJson throws for `text`, or "" if it parses.
+std::string parseJsonError(
+    StringPiece text, json::serialization_opts const& opts) {
+  try {
+    parseJson(text, opts);
+  } catch (json::parse_error const& e) {
+    return e.what();
+  }
+  return "";
+}
+
+// The same for a streaming_parser fed `chunk` bytes at a time.
+std::string streamingError(
+    StringPiece text, json::serialization_opts const& opts, size_t chunk) {
+  try {
+    json::dynamic_builder builder(opts);
+    json::streaming_parser parser(builder, opts);
+    for (size_t i = 0; i < text.size(); i += chunk) {
+      parser.feed(text.subpiece(i, chunk));
+    }
+    parser.finish();
+  } catch (json::parse_error const& e) {
+    return e.what();
+  }
+  return "";
+}
+
+// The type and message of the exception `fn` throws, or "" if none.
+template <typename F>
+std::string exceptionOf(F fn) {
+  try {
+    fn();
+  } catch (std::exception const& e) {
+    return to<std::string>(typeid(e).name(), ": ", e.what());
+  }
+  return "";
+}
+
+// What `fn` returns, or the exception it throws as above.
+template <typename F>
+std::string outputOf(F fn) {
+  std::string out;
+  auto const error = exceptionOf([&] { out = fn(); });
+  return error.empty() ? out : error;
+}
+
+// The line number in a parse_error message.
+std::string errorLine(std::string const& what) {
+  auto const begin = what.find("line ");
+  return what.substr(begin, what.find_first_of(" :", begin + 5) - begin);
+}
+
+json_patch parsePatch(StringPiece text) {
+  auto patch = json_patch::try_parse(parseJson(text));
+  CHECK(patch.hasValue()) << text;
+  return std::move(patch).value();
+}
+
+// Applies the patch in `patch` to `doc` and returns the result, or the
+// index of the failing operation and its error code as "<index>:<code>".
+// Keys are sorted in the result.
+std::string applyPatch(StringPiece doc, StringPiece patch) {
+  auto obj = parseJson(doc);
+  auto const ret = parsePatch(patch).apply(obj);
+  if (ret.hasError()) {
+    return to<std::string>(
+        ret.error().index, ":", static_cast<int>(ret.error().error_code));
+  }
+  json::serialization_opts opts;
+  opts.sort_keys = true;
+  return json::serialize(obj, opts);
+}
+
+// Valid documents that exercise escapes, numbers at their limits, nesting
+// and duplicate keys.
+char const* const kDocuments[] = {
+    "null",
+    "true",
+    "-0",
+    "9223372036854775807",
+    "-9223372036854775808",
+    "1.5e-300",
+    R"("")",
+    R"("a\"b\\c\/\n\u00e9\ud83d\ude00")",
+    "[]",
+    "{}",
+    R"([1, -2.5, "x", true, false, null, [], {}])",
+    R"({"a": {"b": [1, {"c": [[], [2]]}]}, "d": "\t"})",
+    R"({"k": 1, "k": [2], "e\u0301": 3})",
+    R"([[[[[[[[[[1]]]]]]]]]])",
+    " \n\t{ \"sp\" : [ 1 , 2 ] } \r\n",
+};
+
+// Checks every accessor of `value` against the dynamic parseJson returns.
+void checkLazy(json::lazy_document::cursor value, dynamic const& expected) {
+  ASSERT_EQ(expected.type(), value.type());
+  EXPECT_EQ(expected, value.toDynamic());
+  EXPECT_EQ(expected, parseJson(value.raw()));
+  switch (expected.type()) {
+    case dynamic::ARRAY: {
+      ASSERT_EQ(expected.size(), value.size());
+      size_t i = 0;
+      for (auto element : value) {
+        checkLazy(element, expected[i]);
+        checkLazy(value[i], expected[i]);
+        ++i;
+      }
+      EXPECT_EQ(expected.size(), i);
+      EXPECT_THROW(value[expected.size()], std::out_of_range);
+      EXPECT_THROW(value["a"], TypeError);
+      break;
+    }
+    case dynamic::OBJECT: {
+      for (auto const& item : expected.items()) {
+        auto const found = value.find(item.first.getString());
+        ASSERT_TRUE(found.hasValue()) << item.first;
+        checkLazy(*found, item.second);
+      }
+      size_t items = 0;
+      for (auto item : value.items()) {
+        EXPECT_TRUE(item.first.isString());
+        ++items;
+      }
+      EXPECT_EQ(value.size(), items);
+      EXPECT_FALSE(value.find("missing").hasValue());
+      EXPECT_THROW(value["missing"], std::out_of_range);
+      EXPECT_THROW(value[size_t(0)], TypeError);
+      break;
+    }
+    case dynamic::STRING:
+      EXPECT_EQ(expected.getString(), value.asString());
+      EXPECT_EQ(expected.size(), value.size());
+      break;
+    case dynamic::INT64:
+      EXPECT_EQ(expected.getInt(), value.asInt());
+      EXPECT_EQ(expected.asString(), value.asString());
+      break;
+    case dynamic::DOUBLE:
+      EXPECT_EQ(expected.getDouble(), value.asDouble());
+      break;
+    case dynamic::BOOL:
+      EXPECT_EQ(expected.getBool(), value.asBool());
+      break;
+    default:
+      EXPECT_TRUE(value.isNull());
+      break;
+  }
+}
+
+// The same for a tree parsed into an arena.
+void checkArena(json::arena_dynamic const& value, dynamic const& expected) {
+  ASSERT_EQ(expected.type(), value.type());
+  EXPECT_EQ(expected, value.toDynamic());
+  switch (expected.type()) {
+    case dynamic::ARRAY: {
+      ASSERT_EQ(expected.size(), value.size());
+      size_t i = 0;
+      for (auto const& element : value) {
+        checkArena(element, expected[i]);
+        checkArena(value[i], expected[i]);
+        ++i;
+      }
+      EXPECT_THROW(value[expected.size()], std::out_of_range);
+      EXPECT_THROW(value["a"], TypeError);
+      break;
+    }
+    case dynamic::OBJECT: {
+      ASSERT_EQ(expected.size(), value.size());
+      for (auto const& item : expected.items()) {
+        auto const found = value.get_ptr(item.first.getString());
+        ASSERT_NE(nullptr, found) << item.first;
+        checkArena(*found, item.second);
+      }
+      for (auto const& item : value.items()) {
+        EXPECT_EQ(expected[item.first.getString()], item.second.toDynamic());
+      }
+      EXPECT_EQ(nullptr, value.get_ptr("missing"));
+      EXPECT_THROW(value["missing"], std::out_of_range);
+      EXPECT_THROW(value[size_t(0)], TypeError);
+      break;
+    }
+    case dynamic::STRING:
+      EXPECT_EQ(expected.getString(), value.getString());
+      EXPECT_EQ(expected.size(), value.size());
+      EXPECT_THROW(value.getInt(), TypeError);
+      break;
+    case dynamic::INT64:
+      EXPECT_EQ(expected.getInt(), value.getInt());
+      EXPECT_EQ(expected.asString(), value.asString());
+      EXPECT_THROW(value.getString(), TypeError);
+      break;
+    case dynamic::DOUBLE:
+      EXPECT_EQ(expected.getDouble(), value.getDouble());
+      EXPECT_EQ(
+          exceptionOf([&] { expected.asInt(); }),
+          exceptionOf([&] { value.asInt(); }));
+      break;
+    case dynamic::BOOL:
+      EXPECT_EQ(expected.getBool(), value.getBool());
+      break;
+    default:
+      EXPECT_TRUE(value.isNull());
+      break;
+  }
+}
+
+// Element i of the arrays the parallel parser splits. Its strings hold
+// the characters the split looks for.
+std::string arrayElement(size_t i) {
+  return to<std::string>(
+      R"({"id": )", i, R"(, "s": "a,b]}[{\",", "l": [)", i, ", [-", i, "]]}");
+}
+
+// A top-level array of `count` elements over several lines, large enough
+// to be split once `count` passes a few thousand.
+std::string largeArray(size_t count) {
+  std::string text = "[\n";
+  for (size_t i = 0; i < count; ++i) {
+    text += arrayElement(i);
+    text += i + 1 < count ? ",\n" : "\n";
+  }
+  return text + "]";
+}
+
+// Checks that `location` is where `prefix` begins in `text`, on the line
+// and column it gives.
+void checkLocation(
+    StringPiece text, json::parse_location location, StringPiece prefix) {
+  ASSERT_LT(location.offset, text.size());
+  EXPECT_TRUE(text.subpiece(location.offset).startsWith(prefix))
+      << text.subpiece(location.offset, 20) << " vs " << prefix;
+  auto const before = text.subpiece(0, location.offset);
+  EXPECT_EQ(std::count(before.begin(), before.end(), '\n'), location.line);
+  auto const lineStart = before.rfind('\n');
+  EXPECT_EQ(
+      lineStart == StringPiece::npos ? location.offset
+                                     : location.offset - lineStart - 1,
+      location.column);
+}
+
+// Checks the table's entries for `value` and everything inside it, and
+// returns how many values that was.
+size_t checkMetadata(
+    StringPiece text,
+    json::metadata_table const& table,
+    dynamic const& value,
+    dynamic const* key) {
+  auto const entry = table.find(&value);
+  if (!entry) {
+    ADD_FAILURE() << "no entry for " << toJson(value);
+    return 0;
+  }
+  auto const valueText = value.isString() ? "\"" : value.isArray() ? "["
+      : value.isObject()                         ? "{"
+                                                 : toJson(value);
+  checkLocation(text, entry->value_range.begin, valueText);
+  if (key) {
+    checkLocation(text, entry->key_range.begin, toJson(*key));
+  } else {
+    EXPECT_EQ(0, entry->key_range.begin.offset);
+  }
+  size_t values = 1;
+  if (value.isArray()) {
+    for (auto const& element : value) {
+      values += checkMetadata(text, table, element, nullptr);
+    }
+  } else if (value.isObject()) {
+    for (auto const& item : value.items()) {
+      values += checkMetadata(text, table, item.second, &item.first);
+    }
+  }
+  return values;
+}
+
+std::string const kPathNotFound = to<std::string>(static_cast<int>(
+    json_patch::patch_application_error_code::path_not_found));
+std::string const kTestFailed = to<std::string>(static_cast<int>(
+    json_patch::patch_application_error_code::test_failed));
+std::string const kOther = to<std::string>(
+    static_cast<int>(json_patch::patch_application_error_code::other));
+
+} // namespace
+
+TEST(JsonStreaming, errorsAfterIntegersOnParseJsonLine) {
+  // parseNumber skips the whitespace after an integer before its caller
+  // checks the key or the value, so the error is on the following line.
+  json::serialization_opts validate;
+  validate.validate_keys = true;
+  json::serialization_opts plain;
+
+  struct {
+    char const* text;
+    json::serialization_opts const& opts;
+    char const* line;
+  } const cases[] = {
+      {"{\"a\":1,\"a\":2\n}", validate, "line 1"},
+      {"{\n1\n:2}", plain, "line 2"},
+      {"{\"a\":1,\"a\":2.5\n}", validate, "line 0"},
+      {"{\n\"a\"\n:1,\ntrue\n:2}", plain, "line 3"},
+  };
+  for (auto const& c : cases) {
+    auto const expected = parseJsonError(c.text, c.opts);
+    ASSERT_NE("", expected) << c.text;
+    EXPECT_EQ(c.line, errorLine(expected)) << c.text;
+    EXPECT_EQ(expected, streamingError(c.text, c.opts, 1024)) << c.text;
+    EXPECT_EQ(c.line, errorLine(streamingError(c.text, c.opts, 1)))
+        << c.text;
+  }
+}
+
+TEST(JsonLazyDocument, matchesParseJson) {
+  for (auto const text : kDocuments) {
+    SCOPED_TRACE(text);
+    json::lazy_document doc(text);
+    auto const expected = parseJson(text);
+    EXPECT_EQ(expected, doc.toDynamic());
+    checkLazy(doc.root(), expected);
+  }
+}
+
+TEST(JsonLazyDocument, keepsTheLastDuplicateKey) {
+  json::lazy_document doc(R"({"a": 1, "b": 2, "a": [3]})");
+  // size() counts members as written.
+  EXPECT_EQ(3, doc.root().size());
+  EXPECT_EQ("[3]", doc["a"].raw());
+  EXPECT_EQ(3, doc["a"][0].asInt());
+}
+
+TEST(JsonLazyDocument, throwsWhatParseJsonThrows) {
+  json::serialization_opts validate;
+  validate.validate_keys = true;
+  json::serialization_opts limited;
+  limited.recursion_limit = 2;
+  json::serialization_opts plain;
+
+  struct {
+    char const* text;
+    json::serialization_opts const& opts;
+  } const cases[] = {
+      {"", plain},
+      {"[1, 2", plain},
+      {"[1, 2,]", plain},
+      {R"({"a" 1})", plain},
+      {R"("\x")", plain},
+      {R"("\ud800")", plain},
+      {"-", plain},
+      {"1 2", plain},
+      {"nul", plain},
+      {"99999999999999999999", plain},
+      {R"({"a": 1, "a": 2})", validate},
+      {"[[[1]]]", limited},
+  };
+  for (auto const& c : cases) {
+    auto const expected = exceptionOf([&] { parseJson(c.text, c.opts); });
+    ASSERT_NE("", expected) << c.text;
+    EXPECT_EQ(
+        expected,
+        exceptionOf([&] { json::lazy_document doc(c.text, c.opts); }))
+        << c.text;
+  }
+}
+
+TEST(JsonLazyDocument, followsParseOptions) {
+  json::serialization_opts opts;
+  opts.allow_trailing_comma = true;
+  opts.allow_non_string_keys = true;
+  opts.convert_int_keys = true;
+  opts.parse_numbers_as_strings = true;
+  auto const text = R"({1: 2.50, "x": [-0, 1e3,],})";
+  json::lazy_document doc(text, opts);
+  EXPECT_EQ(parseJson(text, opts), doc.toDynamic());
+  EXPECT_EQ("2.50", doc["1"].asString());
+  EXPECT_TRUE(doc["x"][1].isString());
+  EXPECT_EQ(2, doc["x"].size());
+}
+
+TEST(JsonArenaDynamic, matchesParseJson) {
+  for (auto const text : kDocuments) {
+    SCOPED_TRACE(text);
+    SysArena arena;
+    checkArena(parseJson(text, arena), parseJson(text));
+  }
+}
+
+TEST(JsonArenaDynamic, indexesLargeObjects) {
+  // Objects past kMaxLinearMembers are looked up through a hash index.
+  for (size_t members : {7, 8, 9, 100}) {
+    std::string text = "{";
+    for (size_t i = 0; i < members; ++i) {
+      text += to<std::string>(i ? "," : "", "\"k", i, "\":", i);
+    }
+    // A duplicate of the first key, which replaces its value.
+    text += R"(,"k0":"last"})";
+    SCOPED_TRACE(text);
+    SysArena arena;
+    auto const& doc = parseJson(text, arena);
+    EXPECT_EQ(members, doc.size());
+    EXPECT_EQ("last", doc["k0"].getString());
+    checkArena(doc, parseJson(text));
+  }
+}
+
+TEST(JsonArenaDynamic, outlivesTheInput) {
+  SysArena arena;
+  auto text = std::make_unique<std::string>(
+      R"({"s": "a long string that is not stored inline", "e": "\u00e9"})");
+  auto const& doc = parseJson(*text, arena);
+  text.reset();
+  EXPECT_EQ("a long string that is not stored inline", doc["s"].getString());
+  EXPECT_EQ("\u00e9", doc["e"].getString());
+}
+
+TEST(JsonArenaDynamic, throwsWhatParseJsonThrows) {
+  for (auto const text :
+       {"", "[1, 2", R"({"a" 1})", R"("\ud800")", "99999999999999999999"}) {
+    SysArena arena;
+    EXPECT_EQ(
+        exceptionOf([&] { parseJson(text); }),
+        exceptionOf([&] { parseJson(text, arena); }))
+        << text;
+  }
+}
+
+TEST(JsonMetadata, locatesEveryValue) {
+  char const* const documents[] = {
+      "{\n  \"a\": 1,\n  \"b\": [true, null,\n    {\"c\": \"x\"}],\n"
+      "  \"d\": {}\n}",
+      "  [1, -2.5,\r\n\"s\", [[]], {\"k\": [3]}]",
+      "{\"\u00e9\": {\"\u00e9\": \"\u00e9\"}, \"n\":\n\n\n7}",
+  };
+  json::metadata_table table;
+  for (auto const text : documents) {
+    SCOPED_TRACE(text);
+    table.clear();
+    auto const value = parseJsonWithMetadata(text, table);
+    EXPECT_EQ(parseJson(text), value);
+    auto const root = std::string(text).find_first_not_of(" \r\n\t");
+    EXPECT_EQ(root, table[0].value_range.begin.offset);
+    // The root itself has no entry by address.
+    EXPECT_EQ(nullptr, table.find(&value));
+    size_t values = 1;
+    if (value.isArray()) {
+      for (auto const& element : value) {
+        values += checkMetadata(text, table, element, nullptr);
+      }
+    } else {
+      for (auto const& item : value.items()) {
+        values += checkMetadata(text, table, item.second, &item.first);
+      }
+    }
+    EXPECT_EQ(values, table.size());
+    for (size_t i = 1; i < table.size(); ++i) {
+      EXPECT_LT(
+          table[i - 1].value_range.begin.offset,
+          table[i].value_range.begin.offset);
+    }
+  }
+}
+
+TEST(JsonMetadata, reusesTheTable) {
+  json::metadata_table table;
+  auto const first = parseJsonWithMetadata("[1, [2, 3], {\"a\": 4}]", table);
+  EXPECT_EQ(7, table.size());
+  table.clear();
+  EXPECT_TRUE(table.empty());
+  auto const text = "{\"a\":\n  [1]}";
+  auto const second = parseJsonWithMetadata(text, table);
+  EXPECT_EQ(3, table.size());
+  EXPECT_EQ(nullptr, table.find(&first[1]));
+  dynamic const other = 1;
+  EXPECT_EQ(nullptr, table.find(&other));
+  auto const& key = second.items().begin()->first;
+  EXPECT_EQ(2, checkMetadata(text, table, second["a"], &key));
+  EXPECT_EQ(1, table.find(&second["a"][0])->value_range.begin.line);
+}
+
+TEST(JsonMetadata, throwsWhatParseJsonThrows) {
+  json::serialization_opts validate;
+  validate.validate_keys = true;
+  for (auto const text : {"[1,\n2", "{\"a\": 1,\n\"a\": 2}", "[1] x"}) {
+    json::metadata_table table;
+    json::metadata_map map;
+    auto const expected = exceptionOf([&] { parseJson(text, validate); });
+    ASSERT_NE("", expected);
+    EXPECT_EQ(expected, exceptionOf([&] {
+                parseJsonWithMetadata(text, validate, table);
+              }));
+    EXPECT_EQ(expected, exceptionOf([&] {
+                parseJsonWithMetadata(text, validate, &map);
+              }));
+  }
+}
+
+TEST(JsonParallel, matchesParseJson) {
+  json::serialization_opts trailingComma;
+  trailingComma.allow_trailing_comma = true;
+  json::serialization_opts plain;
+
+  auto const text = largeArray(20000);
+  struct {
+    std::string text;
+    json::serialization_opts const& opts;
+  } const cases[] = {
+      {text, plain},
+      {text + " \n", plain},
+      {std::string(text).insert(1, "[], {}, "), plain},
+      {std::string(text).insert(text.size() - 1, ","), trailingComma},
+      {largeArray(3), plain},
+      {"[]", plain},
+      {"{\"a\": [1, 2]}", plain},
+      {"17", plain},
+  };
+  for (auto const& c : cases) {
+    auto const expected = parseJson(c.text, c.opts);
+    for (size_t threads : {1, 2, 3, 8, 0}) {
+      EXPECT_EQ(expected, parseJsonParallel(c.text, c.opts, threads))
+          << c.text.substr(0, 100) << " on " << threads << " threads";
+    }
+  }
+}
+
+TEST(JsonParallel, throwsWhatParseJsonThrows) {
+  json::serialization_opts validate;
+  validate.validate_keys = true;
+  json::serialization_opts plain;
+
+  auto const text = largeArray(20000);
+  // Element i's text starts at this offset.
+  auto const at = [&](size_t i) { return text.find(arrayElement(i)); };
+
+  struct {
+    std::string text;
+    json::serialization_opts const& opts;
+  } const cases[] = {
+      {std::string(text).replace(at(10), 1, "["), plain},
+      {std::string(text).replace(at(10000), 1, "["), plain},
+      {std::string(text).replace(at(19999) + 1, 4, "\"id\": 0, \"id\""),
+       validate},
+      {std::string(text).insert(at(15000), "99999999999999999999, "), plain},
+      {std::string(text).insert(text.size() - 1, ","), plain},
+      {text + " x", plain},
+      {text.substr(0, text.size() - 1), plain},
+      {std::string(text).replace(at(12000), 1, "\n\n["), plain},
+  };
+  for (auto const& c : cases) {
+    auto const expected = exceptionOf([&] { parseJson(c.text, c.opts); });
+    ASSERT_NE("", expected);
+    for (size_t threads : {1, 4}) {
+      EXPECT_EQ(
+          expected,
+          exceptionOf([&] { parseJsonParallel(c.text, c.opts, threads); }))
+          << " on " << threads << " threads";
+    }
+  }
+}
+
+TEST(JsonParallel, parsesNdjsonLines) {
+  std::string text;
+  dynamic expected = dynamic::array;
+  for (size_t i = 0; i < 30000; ++i) {
+    if (i % 1000 == 7) {
+      text += i % 2 ? "\n" : "  \r\n";
+      continue;
+    }
+    auto const line = i % 3 ? arrayElement(i) : to<std::string>(i);
+    expected.push_back(parseJson(line));
+    text += line + "\n";
+  }
+  text.pop_back();
+  for (size_t threads : {1, 2, 8, 0}) {
+    EXPECT_EQ(
+        expected, parseNdjson(text, json::serialization_opts(), threads))
+        << threads << " threads";
+  }
+}
+
+TEST(JsonParallel, numbersNdjsonErrorsWithinTheInput) {
+  std::string text;
+  for (size_t i = 0; i < 30000; ++i) {
+    text += arrayElement(i) + "\n";
+  }
+  for (size_t line : {0, 12345, 29999}) {
+    std::string bad = text;
+    size_t begin = 0;
+    for (size_t i = 0; i < line; ++i) {
+      begin = bad.find('\n', begin) + 1;
+    }
+    bad.insert(begin + 1, "]");
+    for (size_t threads : {1, 4}) {
+      try {
+        parseNdjson(bad, json::serialization_opts(), threads);
+        ADD_FAILURE() << line;
+      } catch (json::parse_error const& e) {
+        EXPECT_EQ(to<std::string>("line ", line), errorLine(e.what()));
+      }
+    }
+  }
+}
+
+TEST(JsonSerialize, sinksReceiveWhatSerializeReturns) {
+  dynamic values = dynamic::array;
+  for (auto const text : kDocuments) {
+    values.push_back(parseJson(text));
+  }
+  values.push_back(std::string(10000, 'x'));
+  values.push_back(dynamic::object(1, "int key")("\u00e9\x01<", 2.5));
+  values.push_back(dynamic::array(std::numeric_limits<double>::infinity()));
+  values.push_back(int64_t(1) << 60);
+
+  json::serialization_opts options[7];
+  options[1].pretty_formatting = true;
+  options[2].sort_keys = true;
+  options[2].allow_non_string_keys = true;
+  options[3].encode_non_ascii = true;
+  options[3].allow_non_string_keys = true;
+  options[4].javascript_safe = true;
+  options[4].convert_int_keys = true;
+  options[5].pretty_formatting = true;
+  options[5].pretty_formatting_indent_width = 4;
+  options[5].allow_non_string_keys = true;
+  options[5].allow_nan_inf = true;
+  options[6].reserve_exact_size = true;
+  options[6].allow_non_string_keys = true;
+
+  json::serialization_opts lenient;
+  lenient.allow_non_string_keys = true;
+  lenient.allow_nan_inf = true;
+  for (auto const& value : values) {
+    SCOPED_TRACE(json::serialize(value, lenient).substr(0, 100));
+    for (auto const& opts : options) {
+      // Errors must be the same too.
+      auto const fails =
+          !exceptionOf([&] { json::serialize(value, opts); }).empty();
+      auto const expected =
+          outputOf([&] { return json::serialize(value, opts); });
+      EXPECT_EQ(
+          fails ? expected : to<std::string>(expected.size()),
+          outputOf([&] {
+            return to<std::string>(json::serializedSize(value, opts));
+          }));
+      for (size_t bufferSize : {0, 1, 7, 4096}) {
+        EXPECT_EQ(expected, outputOf([&] {
+                    std::string out;
+                    json::callback_sink sink(
+                        [&](StringPiece piece) { out += piece; });
+                    json::serialize(value, opts, sink, bufferSize);
+                    return out;
+                  }));
+      }
+      EXPECT_EQ(expected, outputOf([&] {
+                  std::ostringstream out;
+                  json::ostream_sink sink(out);
+                  json::serialize(value, opts, sink);
+                  return out.str();
+                }));
+    }
+  }
+}
+
+TEST(JsonSerialize, sinkPiecesAreBounded) {
+  dynamic value = dynamic::array;
+  for (int i = 0; i < 1000; ++i) {
+    value.push_back(dynamic::object("key", i)("s", "short string"));
+  }
+  value.push_back(std::string(5000, 'x'));
+  std::vector<size_t> pieces;
+  std::string out;
+  json::callback_sink sink([&](StringPiece piece) {
+    pieces.push_back(piece.size());
+    out += piece;
+  });
+  json::serialize(value, json::serialization_opts(), sink, 64);
+  EXPECT_EQ(toJson(value), out);
+  // The long string is passed on whole; everything else in pieces of
+  // about the buffer size.
+  EXPECT_EQ(1, std::count_if(pieces.begin(), pieces.end(), [](size_t n) {
+              return n > 64 + 16;
+            }));
+  EXPECT_GT(pieces.size(), out.size() / 128);
+}
+
+TEST(JsonSerialize, fdSinkWritesTheFile) {
+  dynamic value = dynamic::array;
+  for (int i = 0; i < 10000; ++i) {
+    value.push_back(dynamic::object("key", i));
+  }
+  std::unique_ptr<FILE, int (*)(FILE*)> file(std::tmpfile(), std::fclose);
+  ASSERT_NE(nullptr, file);
+  json::fd_sink sink(fileno(file.get()));
+  json::serialize(value, json::serialization_opts(), sink);
+  std::string written;
+  ASSERT_EQ(0, lseek(fileno(file.get()), 0, SEEK_SET));
+  ASSERT_TRUE(readFile(fileno(file.get()), written));
+  EXPECT_EQ(toJson(value), written);
+
+  json::fd_sink closed(-1);
+  EXPECT_THROW(
+      json::serialize(value, json::serialization_opts(), closed),
+      std::system_error);
+}
+
+TEST(JsonPatch, appliesRfc6902Examples) {
+  // RFC 6902, appendix A.
+  struct {
+    char const* doc;
+    char const* patch;
+    std::string expected;
+  } const cases[] = {
+      // A.1, A.2: adding an object member and an array element.
+      {R"({"foo":"bar"})",
+       R"([{"op":"add","path":"/baz","value":"qux"}])",
+       R"({"baz":"qux","foo":"bar"})"},
+      {R"({"foo":["bar","baz"]})",
+       R"([{"op":"add","path":"/foo/1","value":"qux"}])",
+       R"({"foo":["bar","qux","baz"]})"},
+      // A.3, A.4: removing an object member and an array element.
+      {R"({"baz":"qux","foo":"bar"})",
+       R"([{"op":"remove","path":"/baz"}])",
+       R"({"foo":"bar"})"},
+      {R"({"foo":["bar","qux","baz"]})",
+       R"([{"op":"remove","path":"/foo/1"}])",
+       R"({"foo":["bar","baz"]})"},
+      // A.5: replacing a value.
+      {R"({"baz":"qux","foo":"bar"})",
+       R"([{"op":"replace","path":"/baz","value":"boo"}])",
+       R"({"baz":"boo","foo":"bar"})"},
+      // A.6, A.7: moving a value and an array element.
+      {R"({"foo":{"bar":"baz","waldo":"fred"},"qux":{"corge":"grault"}})",
+       R"([{"op":"move","from":"/foo/waldo","path":"/qux/thud"}])",
+       R"({"foo":{"bar":"baz"},"qux":{"corge":"grault","thud":"fred"}})"},
+      {R"({"foo":["all","grass","cows","eat"]})",
+       R"([{"op":"move","from":"/foo/1","path":"/foo/3"}])",
+       R"({"foo":["all","cows","eat","grass"]})"},
+      // A.8, A.9: testing a value.
+      {R"({"baz":"qux","foo":["a",2,"c"]})",
+       R"([{"op":"test","path":"/baz","value":"qux"},
+           {"op":"test","path":"/foo/1","value":2}])",
+       R"({"baz":"qux","foo":["a",2,"c"]})"},
+      {R"({"baz":"qux"})",
+       R"([{"op":"test","path":"/baz","value":"bar"}])",
+       "0:" + kTestFailed},
+      // A.10: adding a nested member object.
+      {R"({"foo":"bar"})",
+       R"([{"op":"add","path":"/child","value":{"grandchild":{}}}])",
+       R"({"child":{"grandchild":{}},"foo":"bar"})"},
+      // A.12: adding to a nonexistent target.
+      {R"({"foo":"bar"})",
+       R"([{"op":"add","path":"/baz/bat","value":"qux"}])",
+       "0:" + kOther},
+      // A.14: ~ escape ordering.
+      {R"({"/":9,"~1":10})",
+       R"([{"op":"test","path":"/~01","value":10}])",
+       R"({"/":9,"~1":10})"},
+      // A.15: comparing strings and numbers.
+      {R"({"/":9,"~1":10})",
+       R"([{"op":"test","path":"/~01","value":"10"}])",
+       "0:" + kTestFailed},
+      // A.16: adding an array value.
+      {R"({"foo":["bar"]})",
+       R"([{"op":"add","path":"/foo/-","value":["abc","def"]}])",
+       R"({"foo":["bar",["abc","def"]]})"},
+  };
+  for (auto const& c : cases) {
+    EXPECT_EQ(c.expected, applyPatch(c.doc, c.patch)) << c.patch;
+  }
+}
+
+TEST(JsonPatch, appliesArrayIndexesAndRoot) {
+  // "-" and the index equal to the size both append; beyond that fails.
+  EXPECT_EQ(
+      "[1,2,3,4]",
+      applyPatch(
+          "[1,2]",
+          R"([{"op":"add","path":"/-","value":3},
+              {"op":"add","path":"/3","value":4}])"));
+  EXPECT_EQ(
+      "0:" + kOther,
+      applyPatch("[1,2]", R"([{"op":"add","path":"/3","value":3}])"));
+  EXPECT_EQ(
+      "0:" + kPathNotFound,
+      applyPatch("[1,2]", R"([{"op":"remove","path":"/-"}])"));
+  EXPECT_EQ(
+      "0:" + kPathNotFound,
+      applyPatch("[1,2]", R"([{"op":"replace","path":"/01","value":0}])"));
+  // The empty path is the whole document.
+  EXPECT_EQ(
+      R"({"x":[1]})",
+      applyPatch(
+          "[1,2]",
+          R"([{"op":"replace","path":"","value":{"x":[1]}},
+              {"op":"test","path":"","value":{"x":[1]}}])"));
+  EXPECT_EQ(
+      "0:" + kOther, applyPatch("[1,2]", R"([{"op":"remove","path":""}])"));
+  // A move into its own child is rejected when parsing.
+  auto const overlap = json_patch::try_parse(
+      parseJson(R"([{"op":"move","from":"/a","path":"/a/b"}])"));
+  ASSERT_TRUE(overlap.hasError());
+  EXPECT_EQ(
+      json_patch::parse_error_code::overlapping_pointers,
+      overlap.error().error_code);
+}
+
+TEST(JsonPatch, appliesOperationsThatChangeCachedParents) {
+  // apply() keeps the containers resolved for one operation's path for the
+  // next one; each of these changes a container the next operation walks.
+  struct {
+    char const* patch;
+    char const* expected;
+  } const cases[] = {
+      {R"([{"op":"replace","path":"/a","value":{"b":{"c":1}}},
+           {"op":"add","path":"/a/b/d","value":2}])",
+       R"({"a":{"b":{"c":1,"d":2}},"l":[[0],[1],[2]]})"},
+      {R"([{"op":"remove","path":"/l/0"},
+           {"op":"test","path":"/l/0/0","value":1},
+           {"op":"add","path":"/l/0/-","value":5}])",
+       R"({"a":{"x":1},"l":[[1,5],[2]]})"},
+      {R"([{"op":"add","path":"/a/k1","value":1},
+           {"op":"add","path":"/a/k2","value":2},
+           {"op":"add","path":"/a/k3","value":3},
+           {"op":"add","path":"/a/k4","value":{}},
+           {"op":"add","path":"/a/k4/z","value":4},
+           {"op":"test","path":"/a/x","value":1}])",
+       R"({"a":{"k1":1,"k2":2,"k3":3,"k4":{"z":4},"x":1},"l":[[0],[1],[2]]})"},
+      {R"([{"op":"move","from":"/l/2","path":"/l/0/1"},
+           {"op":"copy","from":"/l/0","path":"/l/-"},
+           {"op":"replace","path":"/l/2/1/0","value":7}])",
+       R"({"a":{"x":1},"l":[[0,[2]],[1],[0,[7]]]})"},
+      {R"([{"op":"move","from":"/a","path":"/l/1/0"},
+           {"op":"add","path":"/l/1/0/y","value":2}])",
+       R"({"l":[[0],[{"x":1,"y":2},1],[2]]})"},
+  };
+  for (auto const& c : cases) {
+    EXPECT_EQ(
+        c.expected, applyPatch(R"({"a":{"x":1},"l":[[0],[1],[2]]})", c.patch))
+        << c.patch;
+  }
+}
+
+TEST(JsonPatch, diffAppliesToTheTarget) {
+  struct {
+    char const* from;
+    char const* to;
+  } const cases[] = {
+      {"null", "null"},
+      {"1", "[1]"},
+      {"[]", "[1,2,3]"},
+      {"[1,2,3]", "[]"},
+      {"[1,2,3,4,5]", "[1,2,9,4,5]"},
+      {"[1,2,3,4,5]", "[0,1,2,3,4,5,6]"},
+      {"[1,2,3,4,{\"k\":[1,2,3]}]", "[{\"k\":[1,2,3]},1,2,3,4]"},
+      {"[{\"k\":[1,2,3]},1,2,3,4]", "[1,2,3,4,{\"k\":[1,2,3]}]"},
+      {"[[1],[2],[3]]", "[[3],[1],[2,2]]"},
+      {"[1,1,1,2,2]", "[2,1,2,1]"},
+      {R"({"a":1,"b":2})", R"({"b":3,"c":1})"},
+      {R"({"a":[1,{"x":1},3],"b":{"big":[1,2,3]}})",
+       R"({"a":[1,{"x":2},3,4],"c":{"big":[1,2,3]}})"},
+      {R"({"a/b":{"~":1},"~0":[]})", R"({"a/b":{"~":2},"~1":[1]})"},
+      {R"({"a":{"b":{"c":[1,2]}}})", R"({"a":{"b":{"c":"x"}}})"},
+      {R"({"a":1.5,"b":true})", R"({"a":1,"b":"true"})"},
+  };
+  for (auto const& c : cases) {
+    auto const from = parseJson(c.from);
+    auto const to = parseJson(c.to);
+    auto const patch = json_patch::diff(from, to);
+    EXPECT_EQ(from == to, patch.ops().empty()) << c.from << " " << c.to;
+    auto obj = from;
+    EXPECT_TRUE(patch.apply(obj).hasValue()) << c.from << " " << c.to;
+    EXPECT_EQ(to, obj) << c.from << " " << c.to;
+  }
+}
+
+TEST(JsonPatch, diffEmitsMovesForRelocatedValues) {
+  auto const from = parseJson(R"({"a":{"big":[1,2,3]},"l":[[4,5],6,7]})");
+  auto const to = parseJson(R"({"b":{"big":[1,2,3]},"l":[6,7,[4,5]]})");
+  auto const patch = json_patch::diff(from, to);
+  size_t moves = 0;
+  for (auto const& op : patch.ops()) {
+    EXPECT_NE(json_patch::patch_operation_code::add, op.op_code);
+    moves += op.op_code == json_patch::patch_operation_code::move;
+  }
+  EXPECT_EQ(2, moves);
+  auto obj = from;
+  ASSERT_TRUE(patch.apply(obj).hasValue());
+  EXPECT_EQ(to, obj);
+}
@@ -188,8 +188,8 @@
 /* Special configuration for ucontext */
 #undef HAVE_UCONTEXT_H
 #undef PC_FROM_UCONTEXT
-#if defined(__x86_64__)
+#if defined(__APPLE__) && defined(__x86_64__)
 #define PC_FROM_UCONTEXT uc_mcontext->__ss.__rip
-#elif defined(__i386__)
+#elif defined(__APPLE__) && defined(__i386__)
 #define PC_FROM_UCONTEXT uc_mcontext->__ss.__eip
 #endif
@@ -39,10 +39,12 @@
 #include <errno.h>
 #include <string.h>
 #include <time.h>
+#include <atomic>
 #include <iosfwd>
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #if 1
 # include <unistd.h>
 #endif
@@ -191,6 +193,24 @@ typedef unsigned __int64 uint64;
 //
 // Outputs log messages for the first 20 times it is executed.
 //
+// To keep a line that may fire in a flood from flooding the logs, limit
+// its rate or sample it:
+//
+//   LOG_RATE_LIMITED(WARNING, 10, 100) << "Dropped request " << id;
+//   LOG_SAMPLED(INFO, 0.01) << "Served " << url;
+//
+// The first logs a burst of up to 100 messages, then 10 a second; the
+// second logs one message in a hundred, at random.  Messages left out are
+// counted and reported now and then.  See LOG_RATE_LIMITED below.
+//
+// Where formatting the message costs too much, use LOG_FAST, which takes
+// a format with a "{}" for each argument:
+//
+//   LOG_FAST(INFO, "Found {} cookies in {}", num_cookies, jar_name);
+//
+// With --logfast, the arguments are only recorded; a background thread
+// formats the message later.  See LOG_FAST below.
+//
 // Analogous SYSLOG, SYSLOG_IF, and SYSLOG_EVERY_N macros are available.
 // These log to syslog as well as to the normal logs.  If you use these at
 // all, you need to be aware that syslog can drastically reduce performance,
@@ -364,6 +384,16 @@ DECLARE_string(log_dir);
 // Set the log file mode.
 DECLARE_int32(logfile_mode);
 
+// Sets how often log files are synced to disk: at most this many
+// milliseconds after they are written, and after every this many bytes.
+// 0 leaves it to the system.
+DECLARE_int32(logfile_sync_ms);
+DECLARE_int32(logfile_sync_bytes);
+
+// Sets how often, in seconds, the messages left out by LOG_RATE_LIMITED
+// and LOG_SAMPLED are reported.  0 never reports them.
+DECLARE_int32(log_limit_summary_secs);
+
 // Sets the path of the directory into which to put additional links
 // to the log files.
 DECLARE_string(log_link);
@@ -376,6 +406,25 @@ DECLARE_int32(max_log_size);
 // Sets whether to avoid logging to the disk if the disk is full.
 DECLARE_bool(stop_logging_if_full_disk);
 
+// Sets whether log messages are written by a background thread, LOG()
+// only queuing them.
+DECLARE_bool(logasync);
+
+// Sets the number of messages the asynchronous log queue holds.
+DECLARE_int32(logasync_queue_size);
+
+// Sets what LOG() does when the asynchronous log queue is full: "block",
+// "drop" or "sync".  "sync" writes the message on the calling thread, ahead
+// of the messages still in the queue.
+DECLARE_string(logasync_overflow);
+
+// Sets whether LOG_FAST() leaves formatting its messages to a background
+// thread.
+DECLARE_bool(logfast);
+
+// Sets the size in bytes of each thread's LOG_FAST buffer.
+DECLARE_int32(logfast_buffer_size);
+
 #ifdef MUST_UNDEF_GFLAGS_DECLARE_MACROS
 #undef MUST_UNDEF_GFLAGS_DECLARE_MACROS
 #undef DECLARE_VARIABLE
@@ -567,6 +616,29 @@ class LogSink;  // defined below
 #define LOG_STRING(severity, outvec) \
   LOG_TO_STRING_##severity(static_cast<std::vector<std::string>*>(outvec)).stream()
 
+// LOG_FAST(severity, format, args...) logs "format" with each "{}" in it
+// replaced by the next argument, formatted as operator<< would; arguments
+// left over are appended, separated by spaces.  The arguments may be of
+// arithmetic, enum and pointer types, C strings or strings.  "format"
+// must be a string literal.
+//
+// With --logfast the calling thread only copies the arguments, together
+// with the call site and the time, into a buffer of its own.  A background
+// thread formats the messages and sends them wherever LOG() would, sinks
+// included, in timestamp order.  Otherwise, and for FATAL, the message is
+// formatted and sent right away.
+#define LOG_FAST(severity, format, ...)                                 \
+  do {                                                                  \
+    if (google::GLOG_ ## severity >= GOOGLE_STRIP_LOG && \
+        google::GLOG_ ## severity >= FLAGS_minloglevel) { \
+      static const google::FastLogSite                  \
+          google_fast_log_site = {                                      \
+            __FILE__, __LINE__, google::GLOG_ ## severity, \
+            format };                                                   \
+      google::FastLog(google_fast_log_site, ##__VA_ARGS__); \
+    }                                                                   \
+  } while (0)
+
 #define LOG_IF(severity, condition) \
   !(condition) ? (void) 0 : google::LogMessageVoidify() & LOG(severity)
 #define SYSLOG_IF(severity, condition) \
@@ -955,6 +1027,36 @@ bool IsFailureSignalHandlerInstalled();
 #define LOG_IF_EVERY_N(severity, condition, n) \
   SOME_KIND_OF_LOG_IF_EVERY_N(severity, (condition), (n), google::LogMessage::SendToLog)
 
+// LOG_RATE_LIMITED(severity, per_sec, burst) logs from a token bucket
+// that holds up to "burst" messages and refills at "per_sec" messages a
+// second; it starts full.  A "per_sec" of 0 or less never refills it, so
+// the site logs its first "burst" messages only.  LOG_SAMPLED(severity, p)
+// logs each message with probability "p", drawn from a generator of the
+// calling thread's own.  Either way a message left out is not formatted,
+// so it costs a few nanoseconds; it is counted, and every
+// --log_limit_summary_secs a line at each severity lists the call sites
+// that left messages out and how many.  Both are lock-free and safe to use
+// from any thread.
+#define LOG_LIMIT_SITE LOG_EVERY_N_VARNAME(log_limit_site_, __LINE__)
+
+#define SOME_KIND_OF_LOG_LIMITED(severity, allows) \
+  GOOGLE_GLOG_COMPILE_ASSERT(google::GLOG_ ## severity < \
+                             google::NUM_SEVERITIES,     \
+                             INVALID_REQUESTED_LOG_SEVERITY);           \
+  static google::LogLimitSite LOG_LIMIT_SITE(                \
+      __FILE__, __LINE__, google::GLOG_ ## severity);        \
+  if (allows) \
+    google::LogMessage( \
+        __FILE__, __LINE__, google::GLOG_ ## severity).stream()
+
+#define LOG_RATE_LIMITED(severity, per_sec, burst) \
+  SOME_KIND_OF_LOG_LIMITED(severity, google::LogRateLimitAllows( \
+      &LOG_LIMIT_SITE, (per_sec), (burst)))
+
+#define LOG_SAMPLED(severity, p) \
+  SOME_KIND_OF_LOG_LIMITED(severity, google::LogSampleAllows( \
+      &LOG_LIMIT_SITE, (p)))
+
 // We want the special COUNTER value available for LOG_EVERY_X()'ed messages
 enum PRIVATE_Counter {COUNTER};
 
@@ -1121,6 +1223,9 @@ class GOOGLE_GLOG_DLL_DECL LogStreamBuf : public std::streambuf {
   // Legacy public ostrstream method.
   size_t pcount() const { return pptr() - pbase(); }
   char* pbase() const { return std::streambuf::pbase(); }
+
+  // Empties the buffer for reuse.
+  void reset() { setp(pbase(), epptr()); }
 };
 
 }  // namespace base_logging
@@ -1176,6 +1281,24 @@ public:
     char* pbase() const { return streambuf_.pbase(); }
     char* str() const { return pbase(); }
 
+    // Empties the stream and restores the state of a newly constructed
+    // one, for reuse by another message: flags, width, precision, fill,
+    // exception mask and locale.  What iword(), pword() and
+    // register_callback() stored is kept.
+    void reset() {
+      streambuf_.reset();
+      exceptions(std::ios_base::goodbit);
+      clear();
+      flags(std::ios_base::skipws | std::ios_base::dec);
+      width(0);
+      precision(6);
+      fill(' ');
+      if (getloc() != std::locale()) {
+        imbue(std::locale());
+      }
+      ctr_ = 0;
+    }
+
   private:
     LogStream(const LogStream&);
     LogStream& operator=(const LogStream&);
@@ -1255,6 +1378,10 @@ public:
   // Must be called without the log_mutex held.  (L < log_mutex)
   static int64 num_messages(int severity);
 
+  // Number of messages dropped because the asynchronous log queue was
+  // full (--logasync_overflow=drop).
+  static int64 num_dropped_messages();
+
   struct LogMessageData;
 
 private:
@@ -1631,6 +1758,240 @@ class GOOGLE_GLOG_DLL_DECL NullStreamFatal : public NullStream {
   __attribute__ ((noreturn)) ~NullStreamFatal() throw () { _exit(1); }
 };
 
+// Support for LOG_FAST.
+
+// A LOG_FAST call site.
+struct FastLogSite {
+  const char* file;
+  int line;
+  LogSeverity severity;
+  const char* format;
+};
+
+// How LOG_FAST records an argument.
+enum FastLogArgType {
+  FASTLOG_END,      // ends the list of argument types
+  FASTLOG_BOOL,     // one byte, 0 or 1
+  FASTLOG_CHAR,     // one byte
+  FASTLOG_INT,      // int64
+  FASTLOG_UINT,     // uint64
+  FASTLOG_DOUBLE,   // double
+  FASTLOG_POINTER,  // const void*
+  FASTLOG_STRING    // uint32 length, then the chars
+};
+
+// Returns where to write the "size" bytes of arguments of a LOG_FAST
+// message from "site", whose types "types" lists, or NULL if the message
+// must be formatted right away by FastLogNow().  A non-NULL return must be
+// followed by FastLogCommit() on the same thread.
+GOOGLE_GLOG_DLL_DECL char* FastLogBegin(const FastLogSite& site,
+                                        const unsigned char* types,
+                                        size_t size);
+GOOGLE_GLOG_DLL_DECL void FastLogCommit();
+
+// Formats the LOG_FAST message with arguments "args" and logs it.
+GOOGLE_GLOG_DLL_DECL void FastLogNow(const FastLogSite& site,
+                                     const unsigned char* types,
+                                     const char* args);
+
+// FastLogArg<T> records arguments of type T: it has their kType, and
+// Size() and Encode() them.  It is left undefined for the types LOG_FAST
+// does not take.
+template <typename T, typename Enable = void>
+struct FastLogArg;
+
+template <typename T>
+inline char* FastLogCopy(char* out, const T& value) {
+  memcpy(out, &value, sizeof(value));
+  return out + sizeof(value);
+}
+
+template <typename T>
+struct FastLogArg<T, typename std::enable_if<
+                         std::is_integral<T>::value>::type> {
+  static const unsigned char kType =
+      std::is_signed<T>::value ? FASTLOG_INT : FASTLOG_UINT;
+  static size_t Size(T) { return sizeof(int64); }
+  static char* Encode(char* out, T value) {
+    if (std::is_signed<T>::value) {
+      return FastLogCopy(out, static_cast<int64>(value));
+    }
+    return FastLogCopy(out, static_cast<uint64>(value));
+  }
+};
+
+template <typename T>
+struct FastLogArg<T, typename std::enable_if<
+                         std::is_enum<T>::value>::type> {
+  static const unsigned char kType = FASTLOG_INT;
+  static size_t Size(T) { return sizeof(int64); }
+  static char* Encode(char* out, T value) {
+    return FastLogCopy(out, static_cast<int64>(value));
+  }
+};
+
+template <typename T>
+struct FastLogArg<T, typename std::enable_if<
+                         std::is_floating_point<T>::value>::type> {
+  static const unsigned char kType = FASTLOG_DOUBLE;
+  static size_t Size(T) { return sizeof(double); }
+  static char* Encode(char* out, T value) {
+    return FastLogCopy(out, static_cast<double>(value));
+  }
+};
+
+template <typename T>
+struct FastLogArg<T*> {
+  static const unsigned char kType = FASTLOG_POINTER;
+  static size_t Size(const void*) { return sizeof(const void*); }
+  static char* Encode(char* out, const void* value) {
+    return FastLogCopy(out, value);
+  }
+};
+
+template <>
+struct FastLogArg<bool> {
+  static const unsigned char kType = FASTLOG_BOOL;
+  static size_t Size(bool) { return 1; }
+  static char* Encode(char* out, bool value) {
+    *out = value ? 1 : 0;
+    return out + 1;
+  }
+};
+
+struct FastLogCharArg {
+  static const unsigned char kType = FASTLOG_CHAR;
+  static size_t Size(char) { return 1; }
+  static char* Encode(char* out, char value) {
+    *out = value;
+    return out + 1;
+  }
+};
+
+template <> struct FastLogArg<char> : FastLogCharArg {};
+template <> struct FastLogArg<signed char> : FastLogCharArg {};
+template <> struct FastLogArg<unsigned char> : FastLogCharArg {};
+
+// NULL is recorded as "(null)".
+struct FastLogCStringArg {
+  static const unsigned char kType = FASTLOG_STRING;
+  static size_t Size(const void* value) {
+    return sizeof(uint32) + Length(value);
+  }
+  static char* Encode(char* out, const void* value) {
+    const uint32 len = static_cast<uint32>(Length(value));
+    out = FastLogCopy(out, len);
+    memcpy(out, value != NULL ? value : "(null)", len);
+    return out + len;
+  }
+  static size_t Length(const void* value) {
+    return value != NULL ? strlen(static_cast<const char*>(value)) : 6;
+  }
+};
+
+template <> struct FastLogArg<char*> : FastLogCStringArg {};
+template <> struct FastLogArg<const char*> : FastLogCStringArg {};
+template <> struct FastLogArg<signed char*> : FastLogCStringArg {};
+template <> struct FastLogArg<const signed char*> : FastLogCStringArg {};
+template <> struct FastLogArg<unsigned char*> : FastLogCStringArg {};
+template <> struct FastLogArg<const unsigned char*> : FastLogCStringArg {};
+
+template <>
+struct FastLogArg<std::string> {
+  static const unsigned char kType = FASTLOG_STRING;
+  static size_t Size(const std::string& value) {
+    return sizeof(uint32) + value.size();
+  }
+  static char* Encode(char* out, const std::string& value) {
+    out = FastLogCopy(out, static_cast<uint32>(value.size()));
+    memcpy(out, value.data(), value.size());
+    return out + value.size();
+  }
+};
+
+// The FASTLOG_END terminated list of the types of arguments "Args".
+template <typename... Args>
+struct FastLogArgTypes {
+  static const unsigned char kTypes[sizeof...(Args) + 1];
+};
+
+template <typename... Args>
+const unsigned char FastLogArgTypes<Args...>::kTypes[sizeof...(Args) + 1] =
+    { FastLogArg<Args>::kType..., FASTLOG_END };
+
+inline size_t FastLogArgsSize() { return 0; }
+
+template <typename T, typename... Rest>
+inline size_t FastLogArgsSize(const T& arg, const Rest&... rest) {
+  return FastLogArg<typename std::decay<T>::type>::Size(arg) +
+         FastLogArgsSize(rest...);
+}
+
+inline char* FastLogEncode(char* out) { return out; }
+
+template <typename T, typename... Rest>
+inline char* FastLogEncode(char* out, const T& arg, const Rest&... rest) {
+  out = FastLogArg<typename std::decay<T>::type>::Encode(out, arg);
+  return FastLogEncode(out, rest...);
+}
+
+// The body of LOG_FAST.
+template <typename... Args>
+void FastLog(const FastLogSite& site, const Args&... args) {
+  const unsigned char* types =
+      FastLogArgTypes<typename std::decay<Args>::type...>::kTypes;
+  const size_t size = FastLogArgsSize(args...);
+  char* out = FastLogBegin(site, types, size);
+  if (out != NULL) {
+    FastLogEncode(out, args...);
+    FastLogCommit();
+  } else if (size <= 256) {
+    char buffer[256];
+    FastLogEncode(buffer, args...);
+    FastLogNow(site, types, buffer);
+  } else {
+    std::vector<char> buffer(size);
+    FastLogEncode(&buffer[0], args...);
+    FastLogNow(site, types, &buffer[0]);
+  }
+}
+
+// Support for LOG_RATE_LIMITED and LOG_SAMPLED.
+
+// A LOG_RATE_LIMITED or LOG_SAMPLED call site.
+struct LogLimitSite {
+  constexpr LogLimitSite(const char* file_, int line_,
+                         LogSeverity severity_)
+      : file(file_), line(line_), severity(severity_), empty_time(-1e300),
+        burst_taken(0), suppressed(0), listed(false), next(NULL) {}
+
+  const char* file;
+  int line;
+  LogSeverity severity;
+  // When the token bucket was last empty, in seconds; it holds
+  // (now - empty_time) * per_sec tokens, up to burst.  Long ago at
+  // first, so that it starts full.
+  std::atomic<double> empty_time;
+  // The messages logged from a bucket that never refills, which stands
+  // in for "empty_time" when per_sec is 0 or less.
+  std::atomic<int64> burst_taken;
+  // Messages left out since they were last reported.
+  std::atomic<int64> suppressed;
+  // Whether the site is on the list of those that left messages out, and
+  // the next one there.
+  std::atomic<bool> listed;
+  std::atomic<LogLimitSite*> next;
+};
+
+// Returns whether LOG_RATE_LIMITED at "site" logs its message, taking a
+// token if so and counting the message as left out if not.
+GOOGLE_GLOG_DLL_DECL bool LogRateLimitAllows(LogLimitSite* site,
+                                             double per_sec, double burst);
+
+// Returns whether LOG_SAMPLED at "site" logs its message, counting the
+// message as left out if not.
+GOOGLE_GLOG_DLL_DECL bool LogSampleAllows(LogLimitSite* site, double p);
+
 // Install a signal handler that will dump signal information and a stack
 // trace when the program crashes on certain signals.  We'll install the
 // signal handler for the following signals.
@@ -73,20 +73,25 @@
 #endif
 
 #if defined(__GNUC__)
-// We emit an anonymous static int* variable at every VLOG_IS_ON(n) site.
-// (Normally) the first time every VLOG_IS_ON(n) site is hit,
+// We emit an anonymous static VLogSite variable at every VLOG_IS_ON(n) site.
+// The first time every VLOG_IS_ON(n) site is hit, and again whenever the
+// set of --vmodule patterns has changed since,
 // we determine what variable will dynamically control logging at this site:
 // it's either FLAGS_v or an appropriate internal variable
 // matching the current source file that represents results of
 // parsing of --vmodule flag and/or SetVLOGLevel calls.
-#define VLOG_IS_ON(verboselevel)                                \
-  __extension__  \
-  ({ static google::int32* vlocal__ = &google::kLogSiteUninitialized;           \
-     google::int32 verbose_level__ = (verboselevel);                    \
-     (*vlocal__ >= verbose_level__) &&                          \
-     ((vlocal__ != &google::kLogSiteUninitialized) ||                   \
-      (google::InitVLOG3__(&vlocal__, &FLAGS_v,                         \
-                   __FILE__, verbose_level__))); })
+// Otherwise the check is two loads of generation numbers and one of
+// the level; it never takes a lock.
+#define VLOG_IS_ON(verboselevel)                               \
+  __extension__                                                \
+  ({ static google::VLogSite vsite__;                          \
+     google::int32 verbose_level__ = (verboselevel);           \
+     (vsite__.generation.load(std::memory_order_acquire) ==    \
+      google::vlog_generation.load(std::memory_order_relaxed)) \
+         ? (*vsite__.level.load(std::memory_order_relaxed) >=  \
+            verbose_level__)                                   \
+         : google::InitVLOG3__(&vsite__, &FLAGS_v,             \
+                               __FILE__, verbose_level__); })
 #else
 // GNU extensions not available, so we do not support --vmodule.
 // Dynamic value of FLAGS_v always controls the logging level.
@@ -96,32 +101,36 @@
 // Set VLOG(_IS_ON) level for module_pattern to log_level.
 // This lets us dynamically control what is normally set by the --vmodule flag.
 // Returns the level that previously applied to module_pattern.
-// NOTE: To change the log level for VLOG(_IS_ON) sites
-//	 that have already executed after/during InitGoogleLogging,
-//	 one needs to supply the exact --vmodule pattern that applied to them.
-//       (If no --vmodule pattern applied to them
-//       the value of FLAGS_v will continue to control them.)
+// Patterns are matched in the order they were added, newest first, so a new
+// pattern also takes over VLOG(_IS_ON) sites that have already executed,
+// unless an older --vmodule pattern comes first for them.
 extern GOOGLE_GLOG_DLL_DECL int SetVLOGLevel(const char* module_pattern,
                                              int log_level);
 
 // Various declarations needed for VLOG_IS_ON above: =========================
 
-// Special value used to indicate that a VLOG_IS_ON site has not been
-// initialized.  We make this a large value, so the common-case check
-// of "*vlocal__ >= verbose_level__" in VLOG_IS_ON definition
-// passes in such cases and InitVLOG3__ is then triggered.
-extern google::int32 kLogSiteUninitialized;
+// The logging info cached at a VLOG_IS_ON site: the variable that controls
+// its verbosity level, valid while "generation" equals vlog_generation.
+// A zero generation means the site has not been initialized.
+struct VLogSite {
+  std::atomic<google::int32*> level;
+  std::atomic<google::uint32> generation;
+};
+
+// Changes whenever the set of --vmodule patterns does, and so which
+// variable controls a VLOG_IS_ON site; always odd.
+extern GOOGLE_GLOG_DLL_DECL std::atomic<google::uint32> vlog_generation;
 
 // Helper routine which determines the logging info for a particalur VLOG site.
-//   site_flag     is the address of the site-local pointer to the controlling
-//                 verbosity level
-//   site_default  is the default to use for *site_flag
+//   site          is the site-local cache of the controlling verbosity level
+//   site_default  is the default to use for the site's level
 //   fname         is the current source file name
 //   verbose_level is the argument to VLOG_IS_ON
 // We will return the return value for VLOG_IS_ON
-// and if possible set *site_flag appropriately.
+// and if possible set *site appropriately.
+// This never blocks on a thread changing the --vmodule patterns.
 extern GOOGLE_GLOG_DLL_DECL bool InitVLOG3__(
-    google::int32** site_flag,
+    google::VLogSite* site,
     google::int32* site_default,
     const char* fname,
     google::int32 verbose_level);
@@ -93,11 +93,13 @@ static const char TEST_SRC_DIR[] = ".";
 DEFINE_string(test_tmpdir, GetTempDir(), "Dir we use for temp files");
 DEFINE_string(test_srcdir, TEST_SRC_DIR,
               "Source-dir root, needed to find glog_unittest_flagfile");
-DEFINE_bool(run_benchmark, false, "If true, run benchmarks");
+GLOG_DEFINE_bool(run_benchmark, false, "If true, run benchmarks");
 #ifdef NDEBUG
-DEFINE_int32(benchmark_iters, 100000000, "Number of iterations per benchmark");
+GLOG_DEFINE_int32(benchmark_iters, 100000000,
+                  "Number of iterations per benchmark");
 #else
-DEFINE_int32(benchmark_iters, 100000, "Number of iterations per benchmark");
+GLOG_DEFINE_int32(benchmark_iters, 100000,
+                  "Number of iterations per benchmark");
 #endif
 
 #ifdef HAVE_LIB_GTEST
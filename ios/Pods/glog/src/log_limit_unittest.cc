@@ -0,0 +1,112 @@
+// Copyright (c) 2009, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Tests of LOG_RATE_LIMITED: how many of a flood of messages it lets
+// through.
+
+#include "config_for_unittests.h"
+#include "utilities.h"
+
+#include <string.h>
+
+#include "glog/logging.h"
+#include "googletest.h"
+
+using namespace std;
+using namespace GOOGLE_NAMESPACE;
+
+// Counts the messages that reach it, other than the reports of those left
+// out.
+class CountingSink : public LogSink {
+ public:
+  CountingSink() : count_(0) { AddLogSink(this); }
+  ~CountingSink() { RemoveLogSink(this); }
+
+  virtual void send(LogSeverity, const char*, const char*, int,
+                    const struct ::tm*, const char* message,
+                    size_t message_len) {
+    if (message_len >= 7 && memcmp(message, "limited", 7) == 0) {
+      ++count_;
+    }
+  }
+
+  int count() const { return count_; }
+
+ private:
+  int count_;
+};
+
+TEST(LogRateLimited, LogsTheBurstThenTheRate) {
+  CountingSink sink;
+  for (int i = 0; i < 100; ++i) {
+    // An hour a token: none refills while the test runs.
+    LOG_RATE_LIMITED(INFO, 1.0 / 3600, 5) << "limited " << i;
+  }
+  EXPECT_EQ(5, sink.count());
+}
+
+TEST(LogRateLimited, ZeroRateLogsTheBurstOnce) {
+  CountingSink sink;
+  for (int i = 0; i < 100; ++i) {
+    LOG_RATE_LIMITED(INFO, 0, 3) << "limited " << i;
+  }
+  EXPECT_EQ(3, sink.count());
+}
+
+TEST(LogRateLimited, NegativeRateLogsTheBurstOnce) {
+  CountingSink sink;
+  for (int i = 0; i < 100; ++i) {
+    LOG_RATE_LIMITED(INFO, -1, 2) << "limited " << i;
+  }
+  EXPECT_EQ(2, sink.count());
+}
+
+TEST(LogRateLimited, TinyRateLogsTheBurstOnce) {
+  CountingSink sink;
+  for (int i = 0; i < 100; ++i) {
+    LOG_RATE_LIMITED(INFO, 1e-310, 4) << "limited " << i;
+  }
+  EXPECT_EQ(4, sink.count());
+}
+
+TEST(LogRateLimited, ZeroBurstNeverLogs) {
+  CountingSink sink;
+  for (int i = 0; i < 100; ++i) {
+    LOG_RATE_LIMITED(INFO, 0, 0) << "limited " << i;
+  }
+  EXPECT_EQ(0, sink.count());
+}
+
+int main(int argc, char** argv) {
+  FLAGS_logtostderr = true;
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,422 @@
+// Copyright (c) 2009, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests of the log files themselves: what reaches them around exit(), and
+// what is left beside them.
+// Each test logs from a forked child, so that it has its own files and
+// exit hooks.  With --run_benchmark, also measures how fast log files are
+// written, and how long the calls that roll them over take.
+
+#include "config_for_unittests.h"
+#include "utilities.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "glog/logging.h"
+#include "googletest.h"
+
+using namespace std;
+using namespace GOOGLE_NAMESPACE;
+
+// A fresh directory for the files of one test.
+static string MakeLogDir(const char* name) {
+  ostringstream dir;
+  dir << FLAGS_test_tmpdir << "/logfile_unittest." << name << '.'
+      << getpid();
+  mkdir(dir.str().c_str(), 0755);
+  return dir.str();
+}
+
+// The contents of the INFO log that a child wrote in "dir", found
+// through its symlink.
+static string ReadInfoLog(const string& dir) {
+  const string program =
+      GOOGLE_NAMESPACE::glog_internal_namespace_::ProgramInvocationShortName();
+  const string path = dir + "/" + program + ".INFO";
+  FILE* file = fopen(path.c_str(), "r");
+  CHECK(file != NULL) << path;
+  const string contents = ReadEntireFile(file);
+  fclose(file);
+  return contents;
+}
+
+// The contents of all the INFO logs in "dir", of every process that wrote
+// one there.
+static string ReadAllInfoLogs(const string& dir) {
+  string contents;
+  DIR* d = opendir(dir.c_str());
+  CHECK(d != NULL) << dir;
+  while (const struct dirent* entry = readdir(d)) {
+    const string path = dir + "/" + entry->d_name;
+    struct stat st;
+    if (strstr(entry->d_name, ".log.INFO.") == NULL ||
+        lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    FILE* file = fopen(path.c_str(), "r");
+    CHECK(file != NULL) << path;
+    contents += ReadEntireFile(file);
+    fclose(file);
+  }
+  closedir(d);
+  return contents;
+}
+
+// Runs "child" in a forked process that logs to "dir" and then calls
+// exit(0), and waits for it.
+static void RunChild(const string& dir, void (*child)()) {
+  fflush(NULL);
+  const pid_t pid = fork();
+  CHECK(pid != -1);
+  if (pid == 0) {
+    FLAGS_log_dir = dir;
+    child();
+    exit(0);
+  }
+  int status = 0;
+  CHECK_EQ(waitpid(pid, &status, 0), pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+struct LogsWhenDestroyed {
+  ~LogsWhenDestroyed() { LOG(INFO) << "from a static destructor"; }
+};
+
+static void LogFromAtExit() {
+  LOG(INFO) << "from an atexit handler";
+}
+
+static void LogAroundExitHook() {
+  // Both are registered before the first log file registers its exit
+  // hook, so they run after it.
+  atexit(&LogFromAtExit);
+  static LogsWhenDestroyed logs_when_destroyed;
+  (void)logs_when_destroyed;
+  LOG(INFO) << "before exit";
+}
+
+static void LogAroundExitHookAsync() {
+  // The writer thread's own exit hook, registered by the first message,
+  // runs after the log files' one as well.
+  FLAGS_logasync = true;
+  LogAroundExitHook();
+}
+
+// Runs "child" in a process forked from the calling one, which has
+// already started its background threads, waits for it and returns its
+// pid.  The child gets 10 seconds to finish.
+static pid_t RunForkedChild(void (*child)()) {
+  fflush(NULL);
+  const pid_t pid = fork();
+  CHECK(pid != -1);
+  if (pid == 0) {
+    alarm(10);
+    child();
+    exit(0);
+  }
+  int status = 0;
+  CHECK_EQ(waitpid(pid, &status, 0), pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  return pid;
+}
+
+static void LogAndFlushThenExit() {
+  LOG(INFO) << "from a forked child, flushed";
+  FlushLogFiles(GLOG_INFO);
+  _exit(0);  // no exit hooks: only the flush writes the message out
+}
+
+static void LogThenExit() {
+  LOG(INFO) << "from a forked child, at exit";
+}
+
+static void LogAsyncAroundFork() {
+  FLAGS_logasync = true;
+  LOG(INFO) << "before fork";
+  FlushLogFiles(GLOG_INFO);
+  RunForkedChild(&LogAndFlushThenExit);
+  RunForkedChild(&LogThenExit);
+  LOG(INFO) << "after fork";
+}
+
+// More lines than a --logfast buffer of the default size holds.
+static const int kFastLines = 6000;
+
+static void LogFastAndFlushThenExit() {
+  for (int i = 0; i < kFastLines; ++i) {
+    LOG_FAST(INFO, "fast line {}", i);
+  }
+  FlushLogFiles(GLOG_INFO);
+  _exit(0);
+}
+
+static void LogFastThenExit() {
+  LOG_FAST(INFO, "fast at exit");
+}
+
+// Checks that "log" has a line ending in "text", logged by the main
+// thread of "pid".
+static void CheckLoggedBy(const string& log, const string& text,
+                          pid_t pid) {
+  const size_t end = log.find(text + "\n");
+  EXPECT_TRUE(end != string::npos);
+  istringstream line(log.substr(log.rfind('\n', end) + 1));
+  string date, time;
+  pid_t tid = 0;
+  line >> date >> time >> tid;
+  EXPECT_EQ(pid, tid);
+}
+
+static void LogFastAroundFork() {
+  FLAGS_logfast = true;
+  LOG_FAST(INFO, "fast before fork");
+  FlushLogFiles(GLOG_INFO);
+  const pid_t flushed = RunForkedChild(&LogFastAndFlushThenExit);
+  const pid_t exited = RunForkedChild(&LogFastThenExit);
+  LOG_FAST(INFO, "fast after fork");
+  FlushLogFiles(GLOG_INFO);
+
+  const string log = ReadAllInfoLogs(FLAGS_log_dir);
+  CheckLoggedBy(log, "fast before fork", getpid());
+  CheckLoggedBy(log, "fast line 0", flushed);
+  ostringstream last;
+  last << "fast line " << kFastLines - 1;
+  CheckLoggedBy(log, last.str(), flushed);
+  CheckLoggedBy(log, "fast at exit", exited);
+  CheckLoggedBy(log, "fast after fork", getpid());
+}
+
+static bool Exists(const string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+static void Touch(const string& path) {
+  FILE* file = fopen(path.c_str(), "w");
+  CHECK(file != NULL) << path;
+  fclose(file);
+}
+
+// A pid that no process has: that of a child that has been reaped.
+static pid_t DeadPid() {
+  const pid_t pid = fork();
+  CHECK(pid != -1);
+  if (pid == 0) {
+    _exit(0);
+  }
+  CHECK_EQ(waitpid(pid, NULL, 0), pid);
+  return pid;
+}
+
+static string sweep_base;
+
+static void LogToSweepBase() {
+  SetLogDestination(GLOG_INFO, sweep_base.c_str());
+  LOG(INFO) << "swept";
+}
+
+static void CheckLoggedAroundExitHook(const string& dir) {
+  const string log = ReadInfoLog(dir);
+  EXPECT_TRUE(log.find("before exit") != string::npos);
+  EXPECT_TRUE(log.find("from an atexit handler") != string::npos);
+  EXPECT_TRUE(log.find("from a static destructor") != string::npos);
+}
+
+TEST(LogFile, MessagesAfterTheExitHookAreWritten) {
+  const string dir = MakeLogDir("exit_hook");
+  RunChild(dir, &LogAroundExitHook);
+  CheckLoggedAroundExitHook(dir);
+}
+
+TEST(LogFile, MessagesAfterTheExitHookAreWrittenWithLogAsync) {
+  const string dir = MakeLogDir("exit_hook_async");
+  RunChild(dir, &LogAroundExitHookAsync);
+  CheckLoggedAroundExitHook(dir);
+}
+
+TEST(LogFile, ForkedChildrenLogWithLogAsync) {
+  const string dir = MakeLogDir("fork_async");
+  RunChild(dir, &LogAsyncAroundFork);
+  const string log = ReadAllInfoLogs(dir);
+  EXPECT_TRUE(log.find("before fork") != string::npos);
+  EXPECT_TRUE(log.find("from a forked child, flushed") != string::npos);
+  EXPECT_TRUE(log.find("from a forked child, at exit") != string::npos);
+  EXPECT_TRUE(log.find("after fork") != string::npos);
+}
+
+TEST(LogFile, ForkedChildrenLogWithLogFast) {
+  // The checks are made in the child, which knows its children's pids.
+  RunChild(MakeLogDir("fork_fast"), &LogFastAroundFork);
+}
+
+TEST(LogFile, PreparedFilesOfDeadProcessesAreRemoved) {
+  const string dir = MakeLogDir("sweep");
+  sweep_base = dir + "/base.";
+  ostringstream dead, alive, other;
+  dead << sweep_base << "next." << DeadPid();
+  alive << sweep_base << "next." << getpid();
+  other << dir << "/other.next." << DeadPid();
+  Touch(dead.str());
+  Touch(alive.str());
+  Touch(other.str());
+  RunChild(dir, &LogToSweepBase);
+  EXPECT_TRUE(!Exists(dead.str()));
+  EXPECT_TRUE(Exists(alive.str()));
+  EXPECT_TRUE(Exists(other.str()));
+}
+
+// The size of the one log file in "dir".
+static off_t SizeOfLogFile(const string& dir) {
+  off_t size = -1;
+  DIR* d = opendir(dir.c_str());
+  CHECK(d != NULL) << dir;
+  while (const struct dirent* entry = readdir(d)) {
+    const string path = dir + "/" + entry->d_name;
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      CHECK_EQ(size, -1) << "more than one file in " << dir;
+      size = st.st_size;
+    }
+  }
+  closedir(d);
+  return size;
+}
+
+static const string& BenchmarkText() {
+  static const string text(150, 'x');
+  return text;
+}
+
+// Logs a line of the same length every time.
+static void LogBenchmarkLine() {
+  LOG(INFO) << BenchmarkText();
+}
+
+// The value at "fraction" of the way through "values", which it reorders.
+static double Percentile(vector<double>* values, double fraction) {
+  vector<double>::iterator at =
+      values->begin() + static_cast<size_t>(fraction * (values->size() - 1));
+  nth_element(values->begin(), at, values->end());
+  return *at;
+}
+
+// Each iteration logs a 200-byte line to log files of 1 MB, and prints
+// the write rate and the latency of the calls: all of them, and those
+// that rolled a file over.  The files are named to the second, so each
+// rollover waits for the next second first; clock() doesn't count the
+// wait, but --benchmark_iters=100000 takes about 20 seconds.
+static void BM_WriteLogFiles(int iters) {
+  typedef std::chrono::steady_clock Clock;
+  const string dir = MakeLogDir("benchmark");
+  SetLogDestination(GLOG_INFO, (dir + "/benchmark.").c_str());
+  const int32 max_log_size = FLAGS_max_log_size;
+  FLAGS_max_log_size = 1;
+
+  // The header and line lengths tell which call will roll the file over.
+  LogBenchmarkLine();
+  FlushLogFiles(GLOG_INFO);
+  const off_t one_line = SizeOfLogFile(dir);
+  LogBenchmarkLine();
+  FlushLogFiles(GLOG_INFO);
+  const off_t line = SizeOfLogFile(dir) - one_line;
+  const off_t header = one_line - line;
+  off_t length = header + 2 * line;
+  time_t created = time(NULL);
+
+  vector<double> ns(iters);
+  vector<double> rollover_ns;
+  double total_ns = 0;
+  for (int i = 0; i < iters; ++i) {
+    const bool rollover = length >= (1 << 20);
+    if (rollover) {
+      length = header;
+      // Short sleeps at the end, which keep the caches warm.
+      struct timeval now;
+      while (gettimeofday(&now, NULL) == 0 && now.tv_sec <= created) {
+        const long left =
+            (created + 1 - now.tv_sec) * 1000000L - now.tv_usec;
+        usleep(left > 20000 ? left - 10000 : 1000);
+      }
+    }
+    const Clock::time_point start = Clock::now();
+    LogBenchmarkLine();
+    ns[i] = std::chrono::duration<double, std::nano>(Clock::now() - start)
+                .count();
+    total_ns += ns[i];
+    length += line;
+    if (rollover) {
+      created = time(NULL);
+      rollover_ns.push_back(ns[i]);
+    }
+  }
+  FlushLogFiles(GLOG_INFO);
+  FLAGS_max_log_size = max_log_size;
+
+  printf("BM_WriteLogFiles: %.0f MB/s; per call %.2f us at the median, "
+         "%.2f us at p99, %.2f us at p99.9\n",
+         line * 1e3 * iters / total_ns, Percentile(&ns, 0.5) / 1e3,
+         Percentile(&ns, 0.99) / 1e3, Percentile(&ns, 0.999) / 1e3);
+  if (!rollover_ns.empty()) {
+    printf("BM_WriteLogFiles: %d rollovers, %.0f us at the median, "
+           "%.0f us at worst\n",
+           static_cast<int>(rollover_ns.size()),
+           Percentile(&rollover_ns, 0.5) / 1e3,
+           Percentile(&rollover_ns, 1) / 1e3);
+  }
+}
+BENCHMARK(BM_WriteLogFiles)
+
+int main(int argc, char** argv) {
+  FLAGS_logtostderr = false;
+  FLAGS_alsologtostderr = false;
+  FLAGS_stderrthreshold = GLOG_FATAL;
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+#ifdef HAVE_LIB_GFLAGS
+  ParseCommandLineFlags(&argc, &argv, true);
+#endif
+  const int result = RUN_ALL_TESTS();
+  RunSpecifiedBenchmarks();
+  return result;
+}
@@ -33,7 +33,10 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <iomanip>
+#include <ctype.h>
+#include <stddef.h>
 #include <string>
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>  // For _exit.
@@ -57,6 +60,17 @@
 #endif
 #include <vector>
 #include <errno.h>                   // for errno
+#ifdef HAVE_PTHREAD
+# include <dirent.h>
+# include <pthread.h>
+# include <sched.h>
+# include <signal.h>  // For kill.
+#endif
+#include <set>
+#ifdef HAVE_UNISTD_H
+# include <sys/uio.h>  // For writev.
+#endif
+#include <deque>
 #include <sstream>
 #include "base/commandlineflags.h"        // to get the program name
 #include "glog/logging.h"
@@ -166,6 +180,15 @@ static const char* DefaultLogDir() {
 }
 
 GLOG_DEFINE_int32(logfile_mode, 0664, "Log file mode/permissions.");
+GLOG_DEFINE_int32(logfile_sync_ms, 0,
+                  "Sync log files to disk at most this many milliseconds "
+                  "after they are written (0 means leave it to the system)");
+GLOG_DEFINE_int32(logfile_sync_bytes, 0,
+                  "Sync log files to disk after every this many bytes "
+                  "written (0 means leave it to the system)");
+GLOG_DEFINE_int32(log_limit_summary_secs, 60,
+                  "Report the messages LOG_RATE_LIMITED and LOG_SAMPLED left "
+                  "out every this many seconds (0 means never)");
 
 GLOG_DEFINE_string(log_dir, DefaultLogDir(),
                    "If specified, logfiles are written into this directory instead "
@@ -183,6 +206,24 @@ GLOG_DEFINE_bool(stop_logging_if_full_disk, false,
 GLOG_DEFINE_string(log_backtrace_at, "",
                    "Emit a backtrace when logging at file:linenum.");
 
+GLOG_DEFINE_bool(logasync, BoolFromEnv("GOOGLE_LOGASYNC", false),
+                 "write log messages from a background thread; LOG() only "
+                 "queues the message");
+GLOG_DEFINE_int32(logasync_queue_size, 8192,
+                  "number of messages the --logasync queue holds (rounded up "
+                  "to a power of two)");
+GLOG_DEFINE_string(logasync_overflow, "block",
+                   "what LOG() does when the --logasync queue is full: "
+                   "\"block\" until there is room, \"drop\" the message, or "
+                   "\"sync\" write it on the calling thread, ahead of the "
+                   "messages still queued");
+GLOG_DEFINE_bool(logfast, BoolFromEnv("GOOGLE_LOGFAST", false),
+                 "LOG_FAST() only records its arguments; a background "
+                 "thread formats and writes the messages");
+GLOG_DEFINE_int32(logfast_buffer_size, 65536,
+                  "bytes of LOG_FAST records each thread buffers (rounded "
+                  "up to a power of two)");
+
 // TODO(hamaji): consider windows
 #define PATH_SEPARATOR '/'
 
@@ -351,6 +392,7 @@ struct LogMessage::LogMessageData  {
   };
   time_t timestamp_;            // Time of creation of LogMessage
   struct ::tm tm_time_;         // Time of creation of LogMessage
+  char time_text_[16];          // "mmdd hh:mm:ss." of tm_time_, or empty
   size_t num_prefix_chars_;     // # of chars of prefix in this message
   size_t num_chars_to_log_;     // # of chars of msg to send to log
   size_t num_chars_to_syslog_;  // # of chars of msg to send to syslog
@@ -358,6 +400,7 @@ struct LogMessage::LogMessageData  {
   const char* fullname_;        // fullname of file that called LOG
   bool has_been_flushed_;       // false => data has not been flushed
   bool first_fatal_;            // true => this was first fatal msg
+  bool in_use_;                 // true => cached data in use by a message
 
  private:
   LogMessageData(const LogMessageData&);
@@ -377,6 +420,13 @@ int64 LogMessage::num_messages_[NUM_SEVERITIES] = {0, 0, 0, 0};
 // Globally disable log writing (if disk is full)
 static bool stop_writing = false;
 
+// Set when the exit hook, LogDestination::FlushLogFilesAtExit(), runs.
+// Nothing flushes the log files or runs LogFileWorker jobs after it, so
+// messages logged later, from static destructors, later atexit handlers
+// or the shutdown of LOG_FAST and --logasync, are written out right away,
+// and file work is done on the spot.
+static std::atomic<bool> log_files_exiting(false);
+
 const char*const LogSeverityNames[NUM_SEVERITIES] = {
   "INFO", "WARNING", "ERROR", "FATAL"
 };
@@ -394,11 +444,15 @@ static bool SendEmailInternal(const char*dest, const char *subject,
 base::Logger::~Logger() {
 }
 
+class LogFileWorker;
+
 namespace {
 
 // Encapsulates all file-system related state
 class LogFileObject : public base::Logger {
  public:
+  friend class GOOGLE_NAMESPACE::LogFileWorker;
+
   LogFileObject(LogSeverity severity, const char* base_filename);
   ~LogFileObject();
 
@@ -422,37 +476,110 @@ class LogFileObject : public base::Logger {
     return file_length_;
   }
 
-  // Internal flush routine.  Exposed so that FlushLogFilesUnsafe()
-  // can avoid grabbing a lock.  Usually Flush() calls it after
-  // acquiring lock_.
+  // Internal flush routine.  Flush() calls it after acquiring lock_.
+  // It doesn't sync the file under --logfile_sync_ms or
+  // --logfile_sync_bytes, which Flush() does.
   void FlushUnlocked();
 
+  // For FlushLogFilesUnsafe(), which the failure signal handler calls:
+  // writes out the buffer and then the message, if any, to the file that
+  // is already open.  Nothing is created, rolled over or handed to the
+  // LogFileWorker.  Does nothing and returns false if lock_ is held,
+  // since the buffer may be half written.
+  bool WriteUnsafe(const char* message, size_t message_len);
+
+  // Removes the file prepared for the next rollover, if any.
+  void DiscardPrepared() {
+    MutexLock l(&lock_);
+    DiscardPreparedLogfile();
+  }
+
  private:
   static const uint32 kRolloverAttemptFrequency = 0x20;
 
+  // Messages are collected in a buffer of this size and written out with
+  // one writev(), together with the message that doesn't fit, if any.
+  static const uint32 kBufferSize = 128 * 1024;
+  static const size_t kBufferAlignment = 4096;  // a page, usually
+
   Mutex lock_;
   bool base_filename_selected_;
   string base_filename_;
   string symlink_basename_;
   string filename_extension_;     // option users can specify (eg to add port#)
-  FILE* file_;
+  int fd_;                        // -1 if there is no file
+  char* buffer_;                  // kBufferSize bytes, page aligned
+  uint32 buffer_used_;
   LogSeverity severity_;
   uint32 bytes_since_flush_;
+  uint32 bytes_since_sync_;       // written out since the last sync
   uint32 file_length_;
   unsigned int rollover_attempt_;
   int64 next_flush_time_;         // cycle count at which to flush log
+  int64 next_sync_time_;          // cycle count at which to sync, if due
+
+  // The file that the next rollover switches to, opened ahead of time
+  // under the name prepared_path_ by the LogFileWorker: a descriptor,
+  // -1 while none is ready or -2 if opening it failed.  prepared_path_
+  // is empty if none has been asked for.
+  std::atomic<int> prepared_fd_;
+  string prepared_path_;
+  int32 prepared_pid_;
 
   // Actually create a logfile using the value of base_filename_ and the
   // supplied argument time_pid_string
   // REQUIRES: lock_ is held
   bool CreateLogfile(const string& time_pid_string);
+
+  // Write() after acquiring lock_.
+  void WriteUnlocked(bool force_flush, time_t timestamp,
+                     const char* message, int message_len);
+
+  // Returns the name under which the next file is prepared.
+  string PreparedPath() const;
+
+  // Has the next file prepared in the background, if it isn't already.
+  // REQUIRES: lock_ is held
+  void PrepareNextLogfile();
+
+  // Renames the prepared file to "filename" and returns its descriptor,
+  // or returns -1 if there is none to use.
+  // REQUIRES: lock_ is held
+  int AdoptPreparedLogfile(const char* filename);
+
+  // Closes and removes the prepared file, waiting for it if need be.
+  // REQUIRES: lock_ is held
+  void DiscardPreparedLogfile();
+
+  // Buffers "message", writing it out if the buffer is full.  Returns
+  // false, with errno set, if writing failed.
+  // REQUIRES: lock_ is held
+  bool Append(const char* message, size_t message_len);
+
+  // Writes out the buffer followed by "message".
+  // REQUIRES: lock_ is held
+  bool WriteOut(const char* message, size_t message_len);
+
+  // Writes out the buffer and closes the file, in the background where
+  // possible.
+  // REQUIRES: lock_ is held
+  void CloseFile();
+
+  // Syncs the file in the background if --logfile_sync_ms or
+  // --logfile_sync_bytes call for it.
+  // REQUIRES: lock_ is held
+  void SyncIfDue();
 };
 
 }  // namespace
 
+struct AsyncLogRecord;
+
 class LogDestination {
  public:
   friend class LogMessage;
+  friend class AsyncLogger;
+  friend class FastLogger;
   friend void ReprintFatalMessage();
   friend base::Logger* base::GetLogger(LogSeverity);
   friend void base::SetLogger(LogSeverity, base::Logger*);
@@ -472,6 +599,10 @@ class LogDestination {
   static void FlushLogFiles(int min_severity);
   static void FlushLogFilesUnsafe(int min_severity);
 
+  // Writes out the log files when the program exits, as stdio does for
+  // FILE*s, and removes the files prepared for their rollovers.
+  static void FlushLogFilesAtExit();
+
   // we set the maximum size of our packet to be 1400, the logic being
   // to prevent fragmentation.
   // Really this number is arbitrary.
@@ -518,8 +649,29 @@ class LogDestination {
                          const char* message,
                          size_t message_len);
 
+  // Take a complete log message, prefix and trailing newline included, and
+  // send it to the log files, stderr, email and the registered sinks.
+  static void LogToAll(LogSeverity severity,
+                       const char *full_filename,
+                       const char *base_filename,
+                       int line,
+                       const struct ::tm* tm_time,
+                       time_t timestamp,
+                       const char* message,
+                       size_t len,
+                       size_t prefix_len);
+
+  // Send messages queued by the asynchronous logger, or formatted by the
+  // LOG_FAST one, as SendToLog() would have.  L < log_mutex.
+  static void LogAsyncRecords(AsyncLogRecord* const* records, size_t n);
+
+  // Write queued messages to the log files and stderr without locking.
+  // Used for catastrophic failures, like FlushLogFilesUnsafe().
+  static void LogAsyncRecordsUnsafe(AsyncLogRecord* const* records,
+                                    size_t n);
+
   // Wait for all registered sinks via WaitTillSent
-  // including the optional one in "data".
+  // including the optional one in "data", which may be NULL.
   static void WaitForSinks(LogMessage::LogMessageData* data);
 
   static LogDestination* log_destination(LogSeverity severity);
@@ -580,7 +732,7 @@ inline void LogDestination::FlushLogFilesUnsafe(int min_severity) {
     if (log != NULL) {
       // Flush the base fileobject_ logger directly instead of going
       // through any wrappers to reduce chance of deadlock.
-      log->fileobject_.FlushUnlocked();
+      log->fileobject_.WriteUnsafe(NULL, 0);
     }
   }
 }
@@ -793,6 +945,32 @@ inline void LogDestination::LogToSinks(LogSeverity severity,
   }
 }
 
+inline void LogDestination::LogToAll(LogSeverity severity,
+                                     const char *full_filename,
+                                     const char *base_filename,
+                                     int line,
+                                     const struct ::tm* tm_time,
+                                     time_t timestamp,
+                                     const char* message,
+                                     size_t len,
+                                     size_t prefix_len) {
+  // global flag: never log to file if set.  Also -- don't log to a
+  // file if we haven't parsed the command line flags to get the
+  // program name.
+  if (FLAGS_logtostderr || !IsGoogleLoggingInitialized()) {
+    ColoredWriteToStderr(severity, message, len);
+  } else {
+    // log this message to all log files of severity <= severity
+    LogToAllLogfiles(severity, timestamp, message, len);
+    MaybeLogToStderr(severity, message, len);
+    MaybeLogToEmail(severity, message, len);
+  }
+  // this could be protected by a flag if necessary.
+  // NOTE: -1 removes trailing \n
+  LogToSinks(severity, full_filename, base_filename, line, tm_time,
+             message + prefix_len, len - prefix_len - 1);
+}
+
 inline void LogDestination::WaitForSinks(LogMessage::LogMessageData* data) {
   ReaderMutexLock l(&sink_mutex_);
   if (sinks_) {
@@ -800,9 +978,9 @@ inline void LogDestination::WaitForSinks(LogMessage::LogMessageData* data) {
       (*sinks_)[i]->WaitTillSent();
     }
   }
-  const bool send_to_sink =
-      (data->send_method_ == &LogMessage::SendToSink) ||
-      (data->send_method_ == &LogMessage::SendToSinkAndLog);
+  const bool send_to_sink = data != NULL &&
+      ((data->send_method_ == &LogMessage::SendToSink) ||
+       (data->send_method_ == &LogMessage::SendToSinkAndLog));
   if (send_to_sink && data->sink_ != NULL) {
     data->sink_->WaitTillSent();
   }
@@ -828,243 +1006,2312 @@ void LogDestination::DeleteLogDestinations() {
   sinks_ = NULL;
 }
 
-namespace {
+// Writes the decimal text of 'value' to 'out', padded on the left with
+// 'fill' to 'width' chars, as "setw(width) << value" does with the stream's
+// fill set to 'fill'.  Returns the char past the text.
+static char* FormatDecimal(char* out, unsigned int value,
+                           int width, char fill) {
+  char digits[16];
+  char* end = digits + sizeof(digits);
+  char* p = end;
+  do {
+    *--p = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  while (end - p < width) {
+    *--p = fill;
+  }
+  memcpy(out, p, end - p);
+  return out + (end - p);
+}
 
-LogFileObject::LogFileObject(LogSeverity severity,
-                             const char* base_filename)
-  : base_filename_selected_(base_filename != NULL),
-    base_filename_((base_filename != NULL) ? base_filename : ""),
-    symlink_basename_(glog_internal_namespace_::ProgramInvocationShortName()),
-    filename_extension_(),
-    file_(NULL),
-    severity_(severity),
-    bytes_since_flush_(0),
-    file_length_(0),
-    rollover_attempt_(kRolloverAttemptFrequency-1),
-    next_flush_time_(0) {
-  assert(severity >= 0);
-  assert(severity < NUM_SEVERITIES);
+// Writes "mmdd hh:mm:ss." for 'tm_time' to 'out' (15 chars with the NUL)
+// and returns true, or returns false if a field takes more than two digits.
+static bool FormatTimeText(const struct ::tm& tm_time, char* out) {
+  const int fields[5] = { 1 + tm_time.tm_mon, tm_time.tm_mday,
+                          tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec };
+  static const char kSeparators[5] = { '\0', ' ', ':', ':', '.' };
+  for (int i = 0; i < 5; ++i) {
+    if (fields[i] < 0 || fields[i] > 99) {
+      return false;
+    }
+  }
+  for (int i = 0; i < 5; ++i) {
+    *out++ = static_cast<char>('0' + fields[i] / 10);
+    *out++ = static_cast<char>('0' + fields[i] % 10);
+    if (i > 0) {
+      *out++ = kSeparators[i];
+    }
+  }
+  *out = '\0';
+  return true;
 }
 
-LogFileObject::~LogFileObject() {
-  MutexLock l(&lock_);
-  if (file_ != NULL) {
-    fclose(file_);
-    file_ = NULL;
+// Writes the prefix of a log line to "stream", whose fill must be '0'.
+// "time_text" is FormatTimeText() of "tm_time", or empty.  The fields are
+// written out directly rather than through setw() and friends, which cost
+// more than the rest of a short message does.
+static void WriteLogPrefix(ostream& stream, LogSeverity severity,
+                           const struct ::tm& tm_time, const char* time_text,
+                           int usecs, unsigned int tid,
+                           const char* basename, int line) {
+  if (time_text[0] == '\0' || usecs < 0 || line < 0) {
+    stream << LogSeverityNames[severity][0]
+           << setw(2) << 1+tm_time.tm_mon
+           << setw(2) << tm_time.tm_mday
+           << ' '
+           << setw(2) << tm_time.tm_hour  << ':'
+           << setw(2) << tm_time.tm_min   << ':'
+           << setw(2) << tm_time.tm_sec   << "."
+           << setw(6) << usecs
+           << ' '
+           << setfill(' ') << setw(5) << tid << setfill('0')
+           << ' '
+           << basename << ':' << line << "] ";
+    return;
   }
+  char prefix[64];
+  char* p = prefix;
+  *p++ = LogSeverityNames[severity][0];
+  memcpy(p, time_text, 14);
+  p += 14;
+  p = FormatDecimal(p, usecs, 6, '0');
+  *p++ = ' ';
+  p = FormatDecimal(p, tid, 5, ' ');
+  *p++ = ' ';
+  stream.write(prefix, p - prefix);
+  stream.write(basename, strlen(basename));
+  p = prefix;
+  *p++ = ':';
+  p = FormatDecimal(p, line, 0, '0');
+  *p++ = ']';
+  *p++ = ' ';
+  stream.write(prefix, p - prefix);
 }
 
-void LogFileObject::SetBasename(const char* basename) {
-  MutexLock l(&lock_);
-  base_filename_selected_ = true;
-  if (base_filename_ != basename) {
-    // Get rid of old log file since we are changing names
-    if (file_ != NULL) {
-      fclose(file_);
-      file_ = NULL;
-      rollover_attempt_ = kRolloverAttemptFrequency-1;
+// Asynchronous logging (--logasync).
+//
+// LOG() copies the finished message into an AsyncLogRecord and pushes it
+// onto a bounded lock-free queue; a writer thread pops records in batches
+// and sends each one where SendToLog() would have, taking log_mutex once
+// per batch.  Only messages bound for SendToLog() are queued.  FATAL
+// messages, those for LOG_TO_SINK, LOG_STRING and SYSLOG, and those logged
+// on the writer thread itself (by a sink, say) first wait for the queue to
+// drain and are then sent on the calling thread, so they stay in order.
+//
+// When the queue is full, --logasync_overflow decides: "block" waits for
+// room, "drop" discards the message and counts it (the writer reports the
+// count in a WARNING), and "sync" sends it on the calling thread, possibly
+// ahead of messages still in the queue.
+//
+// A forked child inherits the queue but not the writer.  It leaves the
+// parent's records to the parent and starts a writer of its own for its
+// first message.
+
+struct AsyncLogRecord {
+  LogSeverity severity;
+  int line;
+  time_t timestamp;
+  struct ::tm tm_time;
+  size_t num_prefix_chars;
+  size_t num_chars;          // # of chars of text, trailing \n included
+  size_t basename_offset;    // of the basename within the file name
+  // The message text, followed by the NUL-terminated source file name.
+  char text[1];
+
+  const char* fullname() const { return text + num_chars; }
+  const char* basename() const { return fullname() + basename_offset; }
+};
+
+class AsyncLogger {
+ public:
+  // Queues the message in "data" if asynchronous logging applies to it.
+  // Returns false if the caller must send it itself; every message queued
+  // before it has then been sent already, unless the queue was full and
+  // --logasync_overflow is "sync".  L < log_mutex.
+  static bool Send(LogMessage::LogMessageData* data);
+
+  // Waits until every message queued so far has been sent.  L < log_mutex.
+  static void Drain();
+
+  // Writes out the queued messages on the calling thread without taking
+  // any locks.  Used for catastrophic failures.
+  static void DrainUnsafe();
+
+  // Sends the queued messages and stops the writer thread.  A later
+  // message starts it again.  L < log_mutex.
+  static void Stop();
+
+  static int64 num_dropped();
+
+#ifdef HAVE_PTHREAD
+ private:
+  static bool Start();
+  static bool OnWriterThread();
+  static void Notify();
+  static bool PushBlocking(AsyncLogRecord* record);
+  static void SendQueued();
+  static void* WriterMain(void*);
+  static void AtExit();
+#endif
+};
+
+void LogDestination::LogAsyncRecords(AsyncLogRecord* const* records,
+                                     size_t n) {
+  {
+    MutexLock l(&log_mutex);
+    for (size_t i = 0; i < n; ++i) {
+      const AsyncLogRecord* r = records[i];
+      LogToAll(r->severity, r->fullname(), r->basename(), r->line,
+               &r->tm_time, r->timestamp, r->text, r->num_chars,
+               r->num_prefix_chars);
+      ++LogMessage::num_messages_[r->severity];
     }
-    base_filename_ = basename;
   }
+  WaitForSinks(NULL);
 }
 
-void LogFileObject::SetExtension(const char* ext) {
-  MutexLock l(&lock_);
-  if (filename_extension_ != ext) {
-    // Get rid of old log file since we are changing names
-    if (file_ != NULL) {
-      fclose(file_);
-      file_ = NULL;
-      rollover_attempt_ = kRolloverAttemptFrequency-1;
+void LogDestination::LogAsyncRecordsUnsafe(AsyncLogRecord* const* records,
+                                           size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    const AsyncLogRecord* r = records[i];
+    if (FLAGS_logtostderr) {
+      WriteToStderr(r->text, r->num_chars);
+      continue;
+    }
+    for (int j = r->severity; j >= 0; --j) {
+      LogDestination* log = log_destinations_[j];
+      if (log != NULL) {
+        log->fileobject_.WriteUnsafe(r->text, r->num_chars);
+      }
+    }
+    if (r->severity >= FLAGS_stderrthreshold || FLAGS_alsologtostderr) {
+      WriteToStderr(r->text, r->num_chars);
     }
-    filename_extension_ = ext;
   }
 }
 
-void LogFileObject::SetSymlinkBasename(const char* symlink_basename) {
-  MutexLock l(&lock_);
-  symlink_basename_ = symlink_basename;
-}
+#ifdef HAVE_PTHREAD
 
-void LogFileObject::Flush() {
-  MutexLock l(&lock_);
-  FlushUnlocked();
+namespace {
+
+// getpid() is a system call, too slow to make for every message, so the
+// checks for a forked child compare against this copy, which an atfork
+// handler refreshes in the child.
+std::atomic<pid_t> cached_pid(0);
+pthread_once_t cached_pid_once = PTHREAD_ONCE_INIT;
+
+void RefreshCachedPid() {
+  cached_pid.store(getpid(), std::memory_order_relaxed);
 }
 
-void LogFileObject::FlushUnlocked(){
-  if (file_ != NULL) {
-    fflush(file_);
-    bytes_since_flush_ = 0;
-  }
-  // Figure out when we are due for another flush.
-  const int64 next = (FLAGS_logbufsecs
-                      * static_cast<int64>(1000000));  // in usec
-  next_flush_time_ = CycleClock_Now() + UsecToCycles(next);
+void InitCachedPid() {
+  RefreshCachedPid();
+  pthread_atfork(NULL, NULL, &RefreshCachedPid);
 }
 
-bool LogFileObject::CreateLogfile(const string& time_pid_string) {
-  string string_filename = base_filename_+filename_extension_+
-                           time_pid_string;
-  const char* filename = string_filename.c_str();
-  int fd = open(filename, O_WRONLY | O_CREAT | O_EXCL, FLAGS_logfile_mode);
-  if (fd == -1) return false;
-#ifdef HAVE_FCNTL
-  // Mark the file close-on-exec. We don't really care if this fails
-  fcntl(fd, F_SETFD, FD_CLOEXEC);
-#endif
+pid_t CachedPid() {
+  pthread_once(&cached_pid_once, &InitCachedPid);
+  return cached_pid.load(std::memory_order_relaxed);
+}
 
-  file_ = fdopen(fd, "a");  // Make a FILE*.
-  if (file_ == NULL) {  // Man, we're screwed!
-    close(fd);
-    unlink(filename);  // Erase the half-baked evidence: an unusable log file
+// "owner_pid" is the process that started a background thread, 0 if none
+// did, or minus the pid of a forked child that is resetting what it
+// inherited.  A child has no such thread, and may find the mutexes that
+// went with it locked forever.  Returns whether the state is this
+// process's own, calling "reset" first if this is a child that has not yet
+// done so.  Returns false while another thread of the child resets it.
+bool ClaimStateAfterFork(std::atomic<pid_t>* owner_pid, void (*reset)()) {
+  const pid_t self = CachedPid();
+  pid_t owner = owner_pid->load(std::memory_order_acquire);
+  if (owner == 0 || owner == self) {
+    return true;
+  }
+  if (owner == -self ||
+      !owner_pid->compare_exchange_strong(owner, -self,
+                                          std::memory_order_acquire)) {
     return false;
   }
+  reset();
+  owner_pid->store(0, std::memory_order_release);
+  return true;
+}
 
-  // We try to create a symlink called <program_name>.<severity>,
-  // which is easier to use.  (Every time we create a new logfile,
-  // we destroy the old symlink and create a new one, so it always
-  // points to the latest logfile.)  If it fails, we're sad but it's
-  // no error.
-  if (!symlink_basename_.empty()) {
-    // take directory from filename
-    const char* slash = strrchr(filename, PATH_SEPARATOR);
-    const string linkname =
-      symlink_basename_ + '.' + LogSeverityNames[severity_];
-    string linkpath;
-    if ( slash ) linkpath = string(filename, slash-filename+1);  // get dirname
-    linkpath += linkname;
-    unlink(linkpath.c_str());                    // delete old one if it exists
+// A bounded multi-producer, multi-consumer queue (Dmitry Vyukov's): each
+// cell carries a sequence number telling producers and consumers whose
+// turn it is, so pushes and pops only contend on their own position.
+class AsyncLogQueue {
+ public:
+  explicit AsyncLogQueue(size_t capacity)  // a power of two
+    : cells_(new Cell[capacity]), mask_(capacity - 1),
+      enqueue_pos_(0), dequeue_pos_(0) {
+    for (size_t i = 0; i < capacity; ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
 
-#if defined(OS_WINDOWS)
-    // TODO(hamaji): Create lnk file on Windows?
-#elif defined(HAVE_UNISTD_H)
-    // We must have unistd.h.
-    // Make the symlink be relative (in the same dir) so that if the
-    // entire log directory gets relocated the link is still valid.
-    const char *linkdest = slash ? (slash + 1) : filename;
-    if (symlink(linkdest, linkpath.c_str()) != 0) {
-      // silently ignore failures
+  bool TryPush(AsyncLogRecord* record) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell* cell = &cells_[pos & mask_];
+      const size_t seq = cell->seq.load(std::memory_order_acquire);
+      const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          cell->record = record;
+          cell->seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // full
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
     }
+  }
 
-    // Make an additional link to the log file in a place specified by
-    // FLAGS_log_link, if indicated
-    if (!FLAGS_log_link.empty()) {
-      linkpath = FLAGS_log_link + "/" + linkname;
-      unlink(linkpath.c_str());                  // delete old one if it exists
-      if (symlink(filename, linkpath.c_str()) != 0) {
-        // silently ignore failures
+  AsyncLogRecord* TryPop() {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell* cell = &cells_[pos & mask_];
+      const size_t seq = cell->seq.load(std::memory_order_acquire);
+      const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          AsyncLogRecord* record = cell->record;
+          cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+          return record;
+        }
+      } else if (diff < 0) {
+        return NULL;  // empty
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
       }
     }
-#endif
   }
 
-  return true;  // Everything worked
+  bool Empty() const {
+    const size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    return cells_[pos & mask_].seq.load(std::memory_order_acquire) !=
+           pos + 1;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    AsyncLogRecord* record;
+  };
+
+  Cell* const cells_;
+  const size_t mask_;
+  // On separate cache lines, so producers and the writer do not contend.
+  alignas(64) std::atomic<size_t> enqueue_pos_;
+  alignas(64) std::atomic<size_t> dequeue_pos_;
+};
+
+enum AsyncOverflow {
+  ASYNC_OVERFLOW_BLOCK,
+  ASYNC_OVERFLOW_DROP,
+  ASYNC_OVERFLOW_SYNC
+};
+
+// The maximum number of records the writer sends per batch.
+const size_t kAsyncBatchSize = 64;
+
+// The number of times the writer yields, finding the queue empty, before
+// it goes to sleep.
+const int kAsyncIdleYields = 16;
+
+// Created by the first Start() and never freed, so that DrainUnsafe() can
+// always use it.
+AsyncLogQueue* async_queue = NULL;
+AsyncOverflow async_overflow = ASYNC_OVERFLOW_BLOCK;
+
+// Everybody who sleeps (the writer when the queue is empty, producers when
+// it is full, Drain() callers) waits on async_cond under async_mutex, after
+// registering in async_sleepers.  Whoever changes the state they wait for
+// calls Notify(), which only touches the mutex if somebody sleeps.
+pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t async_cond = PTHREAD_COND_INITIALIZER;
+std::atomic<int> async_sleepers(0);
+
+pthread_t async_writer;
+std::atomic<bool> async_running(false);
+bool async_stopping = false;  // under async_mutex
+bool async_exiting = false;   // under async_mutex; no restart after exit()
+
+// The process the writer was started in; see ClaimStateAfterFork().
+// Everything else above is only used once this is 0 or our pid.
+std::atomic<pid_t> async_pid(0);
+
+// Each message counts in async_queued before it is pushed, and in
+// async_sent once it has been sent or, if it was not pushed after all,
+// given up, so that Drain() never waits on a message queued after its
+// caller's.
+std::atomic<int64> async_queued(0);
+std::atomic<int64> async_sent(0);
+std::atomic<int64> async_dropped(0);  // records dropped on overflow
+
+// Returns whether this process has a running writer.  The Start() that
+// set async_running filled in cached_pid.
+bool HaveAsyncWriter() {
+  return async_running.load(std::memory_order_acquire) &&
+         async_pid.load(std::memory_order_acquire) ==
+             cached_pid.load(std::memory_order_relaxed);
 }
 
-void LogFileObject::Write(bool force_flush,
-                          time_t timestamp,
-                          const char* message,
-                          int message_len) {
-  MutexLock l(&lock_);
+// In a forked child, forgets the parent's writer and queue.  The queued
+// records are the parent's, which writes them; the queue is left behind
+// rather than freed, as another thread of ours may still be looking at it.
+void ResetAsyncState() {
+  pthread_mutex_init(&async_mutex, NULL);
+  pthread_cond_init(&async_cond, NULL);
+  async_sleepers.store(0);
+  async_queue = NULL;
+  async_running.store(false);
+  async_stopping = false;
+  async_queued.store(0);
+  async_sent.store(0);
+  async_dropped.store(0);
+}
 
-  // We don't log if the base_name_ is "" (which means "don't write")
-  if (base_filename_selected_ && base_filename_.empty()) {
-    return;
-  }
+bool ClaimAsyncState() {
+  return ClaimStateAfterFork(&async_pid, &ResetAsyncState);
+}
 
-  if (static_cast<int>(file_length_ >> 20) >= MaxLogSize() ||
-      PidHasChanged()) {
-    if (file_ != NULL) fclose(file_);
-    file_ = NULL;
-    file_length_ = bytes_since_flush_ = 0;
-    rollover_attempt_ = kRolloverAttemptFrequency-1;
+AsyncLogRecord* NewAsyncLogRecord(LogSeverity severity,
+                                  const char* fullname, const char* basename,
+                                  int line, const struct ::tm& tm_time,
+                                  time_t timestamp, const char* text,
+                                  size_t num_chars, size_t num_prefix_chars) {
+  const size_t name_len = strlen(fullname) + 1;
+  AsyncLogRecord* r = static_cast<AsyncLogRecord*>(
+      malloc(offsetof(AsyncLogRecord, text) + num_chars + name_len));
+  if (r == NULL) {
+    return NULL;
   }
+  r->severity = severity;
+  r->line = line;
+  r->timestamp = timestamp;
+  r->tm_time = tm_time;
+  r->num_prefix_chars = num_prefix_chars;
+  r->num_chars = num_chars;
+  r->basename_offset = basename - fullname;
+  memcpy(r->text, text, num_chars);
+  memcpy(r->text + r->num_chars, fullname, name_len);
+  return r;
+}
 
-  // If there's no destination file, make one before outputting
-  if (file_ == NULL) {
-    // Try to rollover the log file every 32 log messages.  The only time
-    // this could matter would be when we have trouble creating the log
-    // file.  If that happens, we'll lose lots of log messages, of course!
-    if (++rollover_attempt_ != kRolloverAttemptFrequency) return;
-    rollover_attempt_ = 0;
+AsyncLogRecord* NewAsyncLogRecord(const LogMessage::LogMessageData* data) {
+  return NewAsyncLogRecord(data->severity_, data->fullname_, data->basename_,
+                           data->line_, data->tm_time_, data->timestamp_,
+                           data->message_text_, data->num_chars_to_log_,
+                           data->num_prefix_chars_);
+}
 
-    struct ::tm tm_time;
-    localtime_r(&timestamp, &tm_time);
+// Pops up to kAsyncBatchSize records into "batch".
+size_t PopAsyncBatch(AsyncLogRecord** batch) {
+  size_t n = 0;
+  while (n < kAsyncBatchSize &&
+         (batch[n] = async_queue->TryPop()) != NULL) {
+    ++n;
+  }
+  return n;
+}
 
-    // The logfile's filename will have the date/time & pid in it
-    ostringstream time_pid_stream;
-    time_pid_stream.fill('0');
-    time_pid_stream << 1900+tm_time.tm_year
-                    << setw(2) << 1+tm_time.tm_mon
-                    << setw(2) << tm_time.tm_mday
-                    << '-'
-                    << setw(2) << tm_time.tm_hour
-                    << setw(2) << tm_time.tm_min
-                    << setw(2) << tm_time.tm_sec
-                    << '.'
-                    << GetMainThreadPid();
-    const string& time_pid_string = time_pid_stream.str();
+// Logged from the writer thread, which sends it right away.
+void ReportAsyncDrops(int64 count) {
+  LOG(WARNING) << "Dropped " << count
+               << " log messages: the --logasync queue was full";
+}
 
-    if (base_filename_selected_) {
-      if (!CreateLogfile(time_pid_string)) {
-        perror("Could not create log file");
-        fprintf(stderr, "COULD NOT CREATE LOGFILE '%s'!\n",
-                time_pid_string.c_str());
-        return;
-      }
-    } else {
-      // If no base filename for logs of this severity has been set, use a
-      // default base filename of
-      // "<program name>.<hostname>.<user name>.log.<severity level>.".  So
-      // logfiles will have names like
-      // webserver.examplehost.root.log.INFO.19990817-150000.4354, where
-      // 19990817 is a date (1999 August 17), 150000 is a time (15:00:00),
-      // and 4354 is the pid of the logging process.  The date & time reflect
-      // when the file was created for output.
-      //
-      // Where does the file get put?  Successively try the directories
-      // "/tmp", and "."
-      string stripped_filename(
-          glog_internal_namespace_::ProgramInvocationShortName());
-      string hostname;
-      GetHostName(&hostname);
+}  // namespace
 
-      string uidname = MyUserName();
-      // We should not call CHECK() here because this function can be
-      // called after holding on to log_mutex. We don't want to
-      // attempt to hold on to the same mutex, and get into a
-      // deadlock. Simply use a name like invalid-user.
-      if (uidname.empty()) uidname = "invalid-user";
+void AsyncLogger::Notify() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (async_sleepers.load(std::memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&async_mutex);
+    pthread_cond_broadcast(&async_cond);
+    pthread_mutex_unlock(&async_mutex);
+  }
+}
 
-      stripped_filename = stripped_filename+'.'+hostname+'.'
-                          +uidname+".log."
-                          +LogSeverityNames[severity_]+'.';
-      // We're going to (potentially) try to put logs in several different dirs
-      const vector<string> & log_dirs = GetLoggingDirectories();
+bool AsyncLogger::OnWriterThread() {
+  return HaveAsyncWriter() && pthread_equal(pthread_self(), async_writer);
+}
 
-      // Go through the list of dirs, and try to create the log file in each
-      // until we succeed or run out of options
-      bool success = false;
-      for (vector<string>::const_iterator dir = log_dirs.begin();
-           dir != log_dirs.end();
-           ++dir) {
-        base_filename_ = *dir + "/" + stripped_filename;
-        if ( CreateLogfile(time_pid_string) ) {
-          success = true;
-          break;
-        }
+bool AsyncLogger::Start() {
+  static bool atexit_registered = false;
+  if (!ClaimAsyncState()) {
+    return false;
+  }
+  pthread_mutex_lock(&async_mutex);
+  if (!async_running.load(std::memory_order_relaxed) && !async_exiting) {
+    if (async_queue == NULL) {
+      size_t capacity = 2;
+      while (capacity < static_cast<size_t>(FLAGS_logasync_queue_size)) {
+        capacity <<= 1;
       }
-      // If we never succeeded, we have to give up
-      if ( success == false ) {
-        perror("Could not create logging file");
-        fprintf(stderr, "COULD NOT CREATE A LOGGINGFILE %s!",
-                time_pid_string.c_str());
-        return;
+      async_queue = new AsyncLogQueue(capacity);
+    }
+    if (FLAGS_logasync_overflow == "drop") {
+      async_overflow = ASYNC_OVERFLOW_DROP;
+    } else if (FLAGS_logasync_overflow == "sync") {
+      async_overflow = ASYNC_OVERFLOW_SYNC;
+    } else {
+      async_overflow = ASYNC_OVERFLOW_BLOCK;
+    }
+    if (pthread_create(&async_writer, NULL, &AsyncLogger::WriterMain,
+                       NULL) == 0) {
+      async_pid.store(CachedPid(), std::memory_order_release);
+      async_running.store(true, std::memory_order_release);
+      if (!atexit_registered) {
+        atexit(&AsyncLogger::AtExit);
+        atexit_registered = true;
       }
     }
+  }
+  const bool running = async_running.load(std::memory_order_relaxed);
+  pthread_mutex_unlock(&async_mutex);
+  return running;
+}
 
-    // Write a header message into the log file
-    ostringstream file_header_stream;
+bool AsyncLogger::PushBlocking(AsyncLogRecord* record) {
+  bool pushed;
+  pthread_mutex_lock(&async_mutex);
+  async_sleepers.fetch_add(1);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  while (!(pushed = async_queue->TryPush(record)) && !async_stopping &&
+         async_running.load(std::memory_order_relaxed)) {
+    pthread_cond_wait(&async_cond, &async_mutex);
+  }
+  async_sleepers.fetch_sub(1);
+  pthread_mutex_unlock(&async_mutex);
+  return pushed;
+}
+
+bool AsyncLogger::Send(LogMessage::LogMessageData* data) {
+  if (!FLAGS_logasync) {
+    // Someone may have just turned --logasync off.
+    Drain();
+    return false;
+  }
+  if (data->send_method_ != &LogMessage::SendToLog ||
+      data->severity_ == GLOG_FATAL || !IsGoogleLoggingInitialized() ||
+      OnWriterThread()) {
+    Drain();
+    return false;
+  }
+  if (!HaveAsyncWriter() && !Start()) {
+    return false;
+  }
+
+  AsyncLogRecord* record = NewAsyncLogRecord(data);
+  if (record == NULL) {
+    Drain();
+    return false;
+  }
+  async_queued.fetch_add(1);
+  if (!async_queue->TryPush(record) &&
+      (async_overflow != ASYNC_OVERFLOW_BLOCK || !PushBlocking(record))) {
+    // Not queued after all: give its place up, so that Drain() does not
+    // wait for it.
+    free(record);
+    async_sent.fetch_add(1);
+    Notify();
+    if (async_overflow == ASYNC_OVERFLOW_DROP) {
+      async_dropped.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    if (async_overflow == ASYNC_OVERFLOW_BLOCK) {
+      Drain();  // the writer stopped
+    }
+    return false;
+  }
+  Notify();
+  if (!async_running.load(std::memory_order_acquire)) {
+    // The writer stopped before it could see this record.
+    SendQueued();
+  }
+  return true;
+}
+
+void AsyncLogger::Drain() {
+  if (!HaveAsyncWriter() || OnWriterThread()) {
+    return;
+  }
+  const int64 target = async_queued.load();
+  pthread_mutex_lock(&async_mutex);
+  async_sleepers.fetch_add(1);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  while (async_sent.load() < target &&
+         async_running.load(std::memory_order_relaxed)) {
+    pthread_cond_wait(&async_cond, &async_mutex);
+  }
+  async_sleepers.fetch_sub(1);
+  pthread_mutex_unlock(&async_mutex);
+}
+
+void AsyncLogger::DrainUnsafe() {
+  if (async_queue == NULL ||
+      async_pid.load(std::memory_order_acquire) != getpid()) {
+    return;  // none, or the parent's
+  }
+  // No free(): we may be in a signal handler.
+  AsyncLogRecord* record;
+  while ((record = async_queue->TryPop()) != NULL) {
+    LogDestination::LogAsyncRecordsUnsafe(&record, 1);
+  }
+}
+
+void AsyncLogger::SendQueued() {
+  if (async_queue == NULL) {
+    return;
+  }
+  AsyncLogRecord* batch[kAsyncBatchSize];
+  size_t n;
+  while ((n = PopAsyncBatch(batch)) > 0) {
+    LogDestination::LogAsyncRecords(batch, n);
+    for (size_t i = 0; i < n; ++i) {
+      free(batch[i]);
+    }
+    async_sent.fetch_add(n);
+  }
+  Notify();
+}
+
+void AsyncLogger::Stop() {
+  if (!HaveAsyncWriter()) {
+    return;  // and in a forked child, the writer is the parent's
+  }
+  pthread_mutex_lock(&async_mutex);
+  if (!async_running.load(std::memory_order_relaxed) || async_stopping) {
+    pthread_mutex_unlock(&async_mutex);
+    return;
+  }
+  async_stopping = true;
+  pthread_cond_broadcast(&async_cond);
+  pthread_mutex_unlock(&async_mutex);
+
+  pthread_join(async_writer, NULL);
+
+  pthread_mutex_lock(&async_mutex);
+  async_running.store(false, std::memory_order_release);
+  async_stopping = false;
+  pthread_cond_broadcast(&async_cond);
+  pthread_mutex_unlock(&async_mutex);
+
+  // Records pushed while the writer was finishing.
+  SendQueued();
+}
+
+void AsyncLogger::AtExit() {
+  if (!ClaimAsyncState()) {
+    return;
+  }
+  pthread_mutex_lock(&async_mutex);
+  async_exiting = true;
+  pthread_mutex_unlock(&async_mutex);
+  Stop();
+}
+
+int64 AsyncLogger::num_dropped() {
+  return async_dropped.load(std::memory_order_relaxed);
+}
+
+void* AsyncLogger::WriterMain(void*) {
+  AsyncLogRecord* batch[kAsyncBatchSize];
+  int64 reported_drops = 0;
+  int64 next_report_time = 0;
+  for (;;) {
+    const size_t n = PopAsyncBatch(batch);
+    if (n > 0) {
+      Notify();  // there is room in the queue now
+      LogDestination::LogAsyncRecords(batch, n);
+      for (size_t i = 0; i < n; ++i) {
+        free(batch[i]);
+      }
+      async_sent.fetch_add(n);
+      Notify();
+
+      // Report drops at most once a second.
+      const int64 dropped = async_dropped.load(std::memory_order_relaxed);
+      if (dropped != reported_drops && CycleClock_Now() >= next_report_time) {
+        ReportAsyncDrops(dropped - reported_drops);
+        reported_drops = dropped;
+        next_report_time = CycleClock_Now() + UsecToCycles(1000000);
+      }
+      continue;
+    }
+
+    // Give producers a chance before paying for a wakeup per message.
+    bool idle = true;
+    for (int i = 0; i < kAsyncIdleYields && idle; ++i) {
+      sched_yield();
+      idle = async_queue->Empty();
+    }
+    if (!idle) {
+      continue;
+    }
+
+    pthread_mutex_lock(&async_mutex);
+    if (async_stopping) {
+      pthread_mutex_unlock(&async_mutex);
+      const int64 dropped = async_dropped.load(std::memory_order_relaxed);
+      if (dropped != reported_drops) {
+        ReportAsyncDrops(dropped - reported_drops);
+      }
+      break;
+    }
+    async_sleepers.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (async_queue->Empty()) {
+      pthread_cond_wait(&async_cond, &async_mutex);
+    }
+    async_sleepers.fetch_sub(1);
+    pthread_mutex_unlock(&async_mutex);
+  }
+  return NULL;
+}
+
+#else  // !HAVE_PTHREAD
+
+// Without threads, --logasync has no effect.
+bool AsyncLogger::Send(LogMessage::LogMessageData*) { return false; }
+void AsyncLogger::Drain() {}
+void AsyncLogger::DrainUnsafe() {}
+void AsyncLogger::Stop() {}
+int64 AsyncLogger::num_dropped() { return 0; }
+
+#endif  // HAVE_PTHREAD
+
+// Deferred formatting (LOG_FAST, --logfast).
+//
+// LOG_FAST() appends a record -- its call site, the types of its
+// arguments, a timestamp and the arguments' bytes -- to a ring buffer of
+// the calling thread, which only that thread writes.  The formatter, a
+// background thread or whoever calls Drain(), takes the records of all the
+// buffers in timestamp order, formats them and sends them as the
+// asynchronous logger sends its records.  A thread whose buffer is full
+// waits for the formatter.  FATAL messages, records too big for a buffer,
+// messages logged by the formatting thread itself (from a sink, say) and
+// those logged before InitGoogleLogging() are formatted on the spot by
+// FastLogNow().  A forked child inherits the buffers but not the
+// formatter; it leaves their records to the parent and starts over with
+// buffers and a formatter of its own.
+
+struct FastLogBuffer;
+
+class FastLogger {
+ public:
+  // Returns where the caller writes the arguments of a record for "site",
+  // or NULL if the message must be formatted right away.
+  static char* Begin(const FastLogSite& site, const unsigned char* types,
+                     size_t size);
+
+  // Publishes the record of the last Begin() of this thread.
+  static void Commit();
+
+  // Formats and sends every record committed so far.  L < log_mutex.
+  static void Drain();
+
+  // Writes out the committed records on the calling thread for
+  // FlushLogFilesUnsafe(), unless another thread holds fast_format_mutex.
+  // Not async-signal-safe, since formatting calls localtime_r() and writes
+  // to an ostream: the failure signal handler calls it as a last resort.
+  static void DrainUnsafe();
+
+  // Sends the committed records and stops the formatter thread.  A later
+  // LOG_FAST() starts it again.  L < log_mutex.
+  static void Stop();
+
+#ifdef HAVE_PTHREAD
+ private:
+  static bool Start();
+  static FastLogBuffer* CurrentBuffer();
+  static bool OnFormattingThread();
+  static bool WaitForRoom(FastLogBuffer* buffer, uint64 tail);
+  static void Notify();
+  static size_t FormatQueued();
+  static size_t FormatAll(bool unsafe);
+  static void* FormatterMain(void*);
+  static void AtExit();
+#endif
+};
+
+// Writes the LOG_FAST argument of type "type" at "arg" to "stream" and
+// returns where the next argument starts.
+static const char* FormatFastLogArg(ostream& stream, unsigned char type,
+                                    const char* arg) {
+  switch (type) {
+    case FASTLOG_BOOL:
+      stream << (*arg != 0);
+      return arg + 1;
+    case FASTLOG_CHAR:
+      stream << *arg;
+      return arg + 1;
+    case FASTLOG_INT: {
+      int64 value;
+      memcpy(&value, arg, sizeof(value));
+      stream << value;
+      return arg + sizeof(value);
+    }
+    case FASTLOG_UINT: {
+      uint64 value;
+      memcpy(&value, arg, sizeof(value));
+      stream << value;
+      return arg + sizeof(value);
+    }
+    case FASTLOG_DOUBLE: {
+      double value;
+      memcpy(&value, arg, sizeof(value));
+      stream << value;
+      return arg + sizeof(value);
+    }
+    case FASTLOG_POINTER: {
+      const void* value;
+      memcpy(&value, arg, sizeof(value));
+      stream << value;
+      return arg + sizeof(value);
+    }
+    case FASTLOG_STRING: {
+      uint32 len;
+      memcpy(&len, arg, sizeof(len));
+      stream.write(arg + sizeof(len), len);
+      return arg + sizeof(len) + len;
+    }
+  }
+  return arg;
+}
+
+// Writes "format" to "stream" with each "{}" replaced by the next of the
+// LOG_FAST arguments in "args", whose types "types" lists, and then the
+// arguments left over, each after a space.
+static void FormatFastLogArgs(ostream& stream, const char* format,
+                              const unsigned char* types, const char* args) {
+  for (;;) {
+    const char* next = strstr(format, "{}");
+    if (next == NULL || *types == FASTLOG_END) {
+      stream << format;
+      break;
+    }
+    stream.write(format, next - format);
+    format = next + 2;
+    args = FormatFastLogArg(stream, *types++, args);
+  }
+  for (; *types != FASTLOG_END; ++types) {
+    stream << ' ';
+    args = FormatFastLogArg(stream, *types, args);
+  }
+}
+
+char* FastLogBegin(const FastLogSite& site, const unsigned char* types,
+                   size_t size) {
+  return FastLogger::Begin(site, types, size);
+}
+
+void FastLogCommit() {
+  FastLogger::Commit();
+}
+
+void FastLogNow(const FastLogSite& site, const unsigned char* types,
+                const char* args) {
+  LogMessage message(site.file, site.line, site.severity);
+  FormatFastLogArgs(message.stream(), site.format, types, args);
+}
+
+#ifdef HAVE_PTHREAD
+
+// The header of a record in a FastLogBuffer; the arguments follow it.
+struct FastLogRecord {
+  const FastLogSite* site;      // NULL for padding up to the buffer's end
+  const unsigned char* types;
+  int64 time;                   // CycleClock_Now() at the LOG_FAST()
+  size_t size;                  // of the record, header included
+};
+
+// A single-producer, single-consumer ring of FastLogRecords.  Positions
+// count bytes since the buffer was created.  A record never wraps around
+// the end of the ring; padding fills the space it does not fit in.
+struct FastLogBuffer {
+  FastLogBuffer(size_t capacity, unsigned int tid, pid_t pid)
+    : data(new char[capacity]), capacity(capacity), tid(tid), pid(pid),
+      next(NULL),
+      orphaned(false), reserved(0), cached_tail(0), format_end(0),
+      head(0), tail(0) {
+  }
+  ~FastLogBuffer() { delete[] data; }
+
+  char* const data;
+  const size_t capacity;        // a power of two
+  const unsigned int tid;       // of the thread writing the buffer
+  const pid_t pid;              // of its process, not of a forked child
+  FastLogBuffer* next;          // in fast_buffers
+  std::atomic<bool> orphaned;   // the thread has exited
+
+  // Used by the writing thread only.
+  uint64 reserved;              // the end of the record being written
+  uint64 cached_tail;           // tail, as last seen
+
+  // Used by the formatter only: the head as of the start of this pass.
+  uint64 format_end;
+
+  // On separate cache lines, so the writer and the formatter do not
+  // contend.
+  alignas(64) std::atomic<uint64> head;  // committed up to here
+  alignas(64) std::atomic<uint64> tail;  // formatted up to here
+};
+
+namespace {
+
+// Records start at multiples of this.
+const size_t kFastLogAlign = 8;
+
+// The formatter thread sleeps this long after a pass that found records,
+// and twice as long after each pass that found none, up to the maximum.
+const int64 kFastLogMinWaitUsecs = 1000;
+const int64 kFastLogMaxWaitUsecs = 100000;
+
+// Formats records into complete log lines.
+class FastLogFormatter {
+ public:
+  FastLogFormatter()
+    : stream_(text_, LogMessage::kMaxLogMessageLen, 0), timestamp_(0),
+      num_prefix_chars_(0) {
+    time_text_[0] = '\0';
+  }
+
+  // Formats "r", a record of the thread "tid", and returns the length of
+  // the text, trailing newline included.
+  size_t Format(const FastLogRecord* r, unsigned int tid);
+
+  const char* text() const { return text_; }
+  time_t timestamp() const { return timestamp_; }
+  const struct ::tm& tm_time() const { return tm_time_; }
+  size_t num_prefix_chars() const { return num_prefix_chars_; }
+
+ private:
+  char text_[LogMessage::kMaxLogMessageLen + 1];
+  LogMessage::LogStream stream_;
+  time_t timestamp_;
+  struct ::tm tm_time_;
+  char time_text_[16];          // FormatTimeText() of tm_time_, or empty
+  size_t num_prefix_chars_;
+};
+
+size_t FastLogFormatter::Format(const FastLogRecord* r, unsigned int tid) {
+  const FastLogSite* site = r->site;
+  const time_t timestamp = static_cast<time_t>(r->time / 1000000);
+  if (timestamp != timestamp_ || time_text_[0] == '\0') {
+    timestamp_ = timestamp;
+    localtime_r(&timestamp_, &tm_time_);
+    if (!FormatTimeText(tm_time_, time_text_)) {
+      time_text_[0] = '\0';
+    }
+  }
+
+  stream_.reset();
+  stream_.fill('0');
+  if (FLAGS_log_prefix) {
+    WriteLogPrefix(stream_, site->severity, tm_time_, time_text_,
+                   static_cast<int>(r->time % 1000000), tid,
+                   const_basename(site->file), site->line);
+  }
+  num_prefix_chars_ = stream_.pcount();
+  FormatFastLogArgs(stream_, site->format, r->types,
+                    reinterpret_cast<const char*>(r + 1));
+  size_t n = stream_.pcount();
+  if (n == 0 || text_[n - 1] != '\n') {
+    text_[n++] = '\n';  // there is room: stream_ stops one char short
+  }
+  return n;
+}
+
+pthread_key_t fast_buffer_key;
+pthread_once_t fast_buffer_once = PTHREAD_ONCE_INIT;
+
+// The buffers of all threads, newest first.  fast_buffers_mutex serializes
+// changes to the list; only FormatAll() removes buffers, so the formatter
+// may walk it without the mutex.
+std::atomic<FastLogBuffer*> fast_buffers(NULL);
+pthread_mutex_t fast_buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Held while formatting, by the formatter thread or a Drain() caller.
+pthread_mutex_t fast_format_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::atomic<pthread_t> fast_format_owner;
+std::atomic<bool> fast_format_owned(false);
+
+// Created with the first buffer and never freed, for DrainUnsafe().
+FastLogFormatter* fast_formatter = NULL;         // under fast_format_mutex
+FastLogFormatter* fast_unsafe_formatter = NULL;
+AsyncLogRecord* fast_unsafe_record = NULL;
+
+// The formatter thread sleeps, and writers wait for room, on fast_cond
+// under fast_mutex.
+pthread_mutex_t fast_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t fast_cond = PTHREAD_COND_INITIALIZER;
+std::atomic<int> fast_sleepers(0);
+
+pthread_t fast_thread;
+std::atomic<bool> fast_running(false);
+bool fast_stopping = false;  // under fast_mutex
+bool fast_exiting = false;   // under fast_mutex; no restart after exit()
+
+// The process the formatter was started in; see ClaimStateAfterFork().
+// Everything else above is only used once this is 0 or our pid.
+std::atomic<pid_t> fast_pid(0);
+
+// Returns whether this process has a running formatter.  The Start() that
+// set fast_running filled in cached_pid.
+bool HaveFastFormatter() {
+  return fast_running.load(std::memory_order_acquire) &&
+         fast_pid.load(std::memory_order_acquire) ==
+             cached_pid.load(std::memory_order_relaxed);
+}
+
+// In a forked child, forgets the parent's formatter and buffers.  The
+// records in them are the parent's, which formats them; the buffers are
+// left behind rather than freed, as another thread of ours may still be
+// looking at them.  A thread's buffer from before the fork is replaced by
+// CurrentBuffer(), so that its records carry the child's thread id.
+void ResetFastState() {
+  pthread_mutex_init(&fast_buffers_mutex, NULL);
+  pthread_mutex_init(&fast_format_mutex, NULL);
+  pthread_mutex_init(&fast_mutex, NULL);
+  pthread_cond_init(&fast_cond, NULL);
+  fast_buffers.store(NULL);
+  fast_format_owned.store(false);
+  fast_sleepers.store(0);
+  fast_running.store(false);
+  fast_stopping = false;
+}
+
+bool ClaimFastState() {
+  return ClaimStateAfterFork(&fast_pid, &ResetFastState);
+}
+
+void OrphanFastLogBuffer(void* buffer) {
+  static_cast<FastLogBuffer*>(buffer)->orphaned.store(
+      true, std::memory_order_release);
+}
+
+void CreateFastBufferKey() {
+  pthread_key_create(&fast_buffer_key, &OrphanFastLogBuffer);
+}
+
+// Returns the next record of "b" to format in this pass, skipping
+// padding, or NULL if there is none.
+const FastLogRecord* NextFastLogRecord(FastLogBuffer* b) {
+  uint64 tail = b->tail.load(std::memory_order_relaxed);
+  while (tail < b->format_end) {
+    const size_t pos = tail & (b->capacity - 1);
+    const FastLogRecord* r =
+        reinterpret_cast<const FastLogRecord*>(b->data + pos);
+    if (b->capacity - pos < sizeof(FastLogRecord)) {
+      tail += b->capacity - pos;
+    } else if (r->site == NULL) {
+      tail += r->size;
+    } else {
+      b->tail.store(tail, std::memory_order_release);
+      return r;
+    }
+  }
+  b->tail.store(tail, std::memory_order_release);
+  return NULL;
+}
+
+}  // namespace
+
+char* FastLogger::Begin(const FastLogSite& site, const unsigned char* types,
+                        size_t size) {
+  if (!FLAGS_logfast || site.severity >= GLOG_FATAL ||
+      !IsGoogleLoggingInitialized()) {
+    return NULL;
+  }
+  if (!HaveFastFormatter() && !Start()) {
+    return NULL;
+  }
+  FastLogBuffer* b = CurrentBuffer();
+  if (b == NULL) {
+    return NULL;
+  }
+  const size_t need = (sizeof(FastLogRecord) + size + kFastLogAlign - 1) &
+                      ~(kFastLogAlign - 1);
+  if (need > b->capacity / 2) {
+    return NULL;
+  }
+
+  const uint64 head = b->head.load(std::memory_order_relaxed);
+  const size_t pos = head & (b->capacity - 1);
+  const size_t pad = b->capacity - pos < need ? b->capacity - pos : 0;
+  const uint64 end = head + pad + need;
+  if (end - b->cached_tail > b->capacity) {
+    b->cached_tail = b->tail.load(std::memory_order_acquire);
+    if (end - b->cached_tail > b->capacity &&
+        !WaitForRoom(b, end - b->capacity)) {
+      return NULL;
+    }
+  }
+  if (pad >= sizeof(FastLogRecord)) {
+    FastLogRecord* padding = reinterpret_cast<FastLogRecord*>(b->data + pos);
+    padding->site = NULL;
+    padding->size = pad;
+  }
+  FastLogRecord* r = reinterpret_cast<FastLogRecord*>(
+      b->data + ((head + pad) & (b->capacity - 1)));
+  r->site = &site;
+  r->types = types;
+  r->time = CycleClock_Now();
+  r->size = need;
+  b->reserved = end;
+  return reinterpret_cast<char*>(r + 1);
+}
+
+void FastLogger::Commit() {
+  FastLogBuffer* b =
+      static_cast<FastLogBuffer*>(pthread_getspecific(fast_buffer_key));
+  b->head.store(b->reserved, std::memory_order_release);
+  // Wake the formatter early if the buffer fills up.
+  if (b->reserved - b->cached_tail > b->capacity / 2) {
+    b->cached_tail = b->tail.load(std::memory_order_acquire);
+    if (b->reserved - b->cached_tail > b->capacity / 2) {
+      Notify();
+    }
+  }
+  if (!fast_running.load(std::memory_order_acquire)) {
+    // The formatter stopped before it could see this record.
+    Drain();
+  }
+}
+
+FastLogBuffer* FastLogger::CurrentBuffer() {
+  pthread_once(&fast_buffer_once, &CreateFastBufferKey);
+  FastLogBuffer* b =
+      static_cast<FastLogBuffer*>(pthread_getspecific(fast_buffer_key));
+  if (b != NULL && b->pid == cached_pid.load(std::memory_order_relaxed)) {
+    return b;
+  }
+  size_t capacity = 4096;
+  while (capacity < static_cast<size_t>(FLAGS_logfast_buffer_size)) {
+    capacity <<= 1;
+  }
+  b = new FastLogBuffer(capacity, static_cast<unsigned int>(GetTID()),
+                        CachedPid());
+  if (pthread_setspecific(fast_buffer_key, b) != 0) {
+    delete b;
+    return NULL;
+  }
+  pthread_mutex_lock(&fast_buffers_mutex);
+  b->next = fast_buffers.load(std::memory_order_relaxed);
+  fast_buffers.store(b, std::memory_order_release);
+  pthread_mutex_unlock(&fast_buffers_mutex);
+  return b;
+}
+
+bool FastLogger::OnFormattingThread() {
+  return fast_format_owned.load(std::memory_order_acquire) &&
+         pthread_equal(pthread_self(),
+                       fast_format_owner.load(std::memory_order_relaxed));
+}
+
+bool FastLogger::WaitForRoom(FastLogBuffer* b, uint64 tail) {
+  if (OnFormattingThread()) {
+    return false;  // nobody else would make room
+  }
+  pthread_mutex_lock(&fast_mutex);
+  fast_sleepers.fetch_add(1);
+  pthread_cond_broadcast(&fast_cond);  // wake the formatter
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  while ((b->cached_tail = b->tail.load(std::memory_order_acquire)) < tail &&
+         fast_running.load(std::memory_order_relaxed)) {
+    pthread_cond_wait(&fast_cond, &fast_mutex);
+  }
+  fast_sleepers.fetch_sub(1);
+  pthread_mutex_unlock(&fast_mutex);
+  return b->cached_tail >= tail;
+}
+
+void FastLogger::Notify() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (fast_sleepers.load(std::memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&fast_mutex);
+    pthread_cond_broadcast(&fast_cond);
+    pthread_mutex_unlock(&fast_mutex);
+  }
+}
+
+bool FastLogger::Start() {
+  static bool atexit_registered = false;
+  if (!ClaimFastState()) {
+    return false;
+  }
+  pthread_mutex_lock(&fast_mutex);
+  if (!fast_running.load(std::memory_order_relaxed) && !fast_exiting) {
+    if (fast_formatter == NULL) {
+      fast_formatter = new FastLogFormatter;
+      fast_unsafe_formatter = new FastLogFormatter;
+      fast_unsafe_record = static_cast<AsyncLogRecord*>(
+          malloc(offsetof(AsyncLogRecord, text) +
+                 LogMessage::kMaxLogMessageLen + 2));
+    }
+    if (fast_unsafe_record != NULL &&
+        pthread_create(&fast_thread, NULL, &FastLogger::FormatterMain,
+                       NULL) == 0) {
+      fast_pid.store(CachedPid(), std::memory_order_release);
+      fast_running.store(true, std::memory_order_release);
+      if (!atexit_registered) {
+        atexit(&FastLogger::AtExit);
+        atexit_registered = true;
+      }
+    }
+  }
+  const bool running = fast_running.load(std::memory_order_relaxed);
+  pthread_mutex_unlock(&fast_mutex);
+  return running;
+}
+
+size_t FastLogger::FormatQueued() {
+  pthread_mutex_lock(&fast_format_mutex);
+  fast_format_owner.store(pthread_self(), std::memory_order_relaxed);
+  fast_format_owned.store(true, std::memory_order_release);
+  const size_t n = FormatAll(false);
+  fast_format_owned.store(false, std::memory_order_release);
+  pthread_mutex_unlock(&fast_format_mutex);
+  Notify();  // there is room in the buffers now
+  return n;
+}
+
+size_t FastLogger::FormatAll(bool unsafe) {
+  FastLogBuffer* const first = fast_buffers.load(std::memory_order_acquire);
+  for (FastLogBuffer* b = first; b != NULL; b = b->next) {
+    b->format_end = b->head.load(std::memory_order_acquire);
+  }
+
+  FastLogFormatter* formatter =
+      unsafe ? fast_unsafe_formatter : fast_formatter;
+  AsyncLogRecord* batch[kAsyncBatchSize];
+  size_t n = 0;
+  size_t count = 0;
+  for (;;) {
+    // The buffer whose next record is the oldest.
+    FastLogBuffer* oldest = NULL;
+    const FastLogRecord* r = NULL;
+    for (FastLogBuffer* b = first; b != NULL; b = b->next) {
+      const FastLogRecord* next = NextFastLogRecord(b);
+      if (next != NULL && (r == NULL || next->time < r->time)) {
+        oldest = b;
+        r = next;
+      }
+    }
+    if (r == NULL) {
+      break;
+    }
+
+    const size_t len = formatter->Format(r, oldest->tid);
+    const FastLogSite* site = r->site;
+    if (unsafe) {
+      // No malloc(): we may be in a signal handler.  The file name is
+      // not needed without sinks.
+      AsyncLogRecord* record = fast_unsafe_record;
+      record->severity = site->severity;
+      record->line = site->line;
+      record->timestamp = formatter->timestamp();
+      record->tm_time = formatter->tm_time();
+      record->num_prefix_chars = formatter->num_prefix_chars();
+      record->num_chars = len;
+      record->basename_offset = 0;
+      memcpy(record->text, formatter->text(), len);
+      record->text[len] = '\0';
+      LogDestination::LogAsyncRecordsUnsafe(&record, 1);
+    } else {
+      batch[n] = NewAsyncLogRecord(
+          site->severity, site->file, const_basename(site->file), site->line,
+          formatter->tm_time(), formatter->timestamp(), formatter->text(),
+          len, formatter->num_prefix_chars());
+      if (batch[n] != NULL) {
+        ++n;
+      }
+    }
+    oldest->tail.store(oldest->tail.load(std::memory_order_relaxed) +
+                       r->size, std::memory_order_release);
+    ++count;
+
+    if (n == kAsyncBatchSize) {
+      LogDestination::LogAsyncRecords(batch, n);
+      for (size_t i = 0; i < n; ++i) {
+        free(batch[i]);
+      }
+      n = 0;
+    }
+  }
+  if (n > 0) {
+    LogDestination::LogAsyncRecords(batch, n);
+    for (size_t i = 0; i < n; ++i) {
+      free(batch[i]);
+    }
+  }
+
+  if (!unsafe) {
+    // Free the buffers of threads that have exited, once they are empty.
+    pthread_mutex_lock(&fast_buffers_mutex);
+    FastLogBuffer* prev = NULL;
+    FastLogBuffer* b = fast_buffers.load(std::memory_order_relaxed);
+    while (b != NULL) {
+      FastLogBuffer* next = b->next;
+      if (b->orphaned.load(std::memory_order_acquire) &&
+          b->tail.load(std::memory_order_relaxed) ==
+              b->head.load(std::memory_order_acquire)) {
+        if (prev == NULL) {
+          fast_buffers.store(next, std::memory_order_release);
+        } else {
+          prev->next = next;
+        }
+        delete b;
+      } else {
+        prev = b;
+      }
+      b = next;
+    }
+    pthread_mutex_unlock(&fast_buffers_mutex);
+  }
+  return count;
+}
+
+void FastLogger::Drain() {
+  if (!ClaimFastState() ||
+      fast_buffers.load(std::memory_order_acquire) == NULL ||
+      OnFormattingThread()) {
+    return;
+  }
+  FormatQueued();
+}
+
+void FastLogger::DrainUnsafe() {
+  if (fast_buffers.load(std::memory_order_acquire) == NULL ||
+      fast_unsafe_record == NULL ||
+      fast_pid.load(std::memory_order_acquire) != getpid()) {
+    return;  // nothing, or the parent's
+  }
+  // Whoever holds the lock may be halfway through a record, or freeing
+  // the buffer of a thread that has exited; its records are lost then.
+  if (pthread_mutex_trylock(&fast_format_mutex) != 0) {
+    return;
+  }
+  FormatAll(true);
+  pthread_mutex_unlock(&fast_format_mutex);
+}
+
+void FastLogger::Stop() {
+  if (!HaveFastFormatter()) {
+    return;  // and in a forked child, the formatter is the parent's
+  }
+  pthread_mutex_lock(&fast_mutex);
+  if (!fast_running.load(std::memory_order_relaxed) || fast_stopping) {
+    pthread_mutex_unlock(&fast_mutex);
+    return;
+  }
+  fast_stopping = true;
+  pthread_cond_broadcast(&fast_cond);
+  pthread_mutex_unlock(&fast_mutex);
+
+  pthread_join(fast_thread, NULL);
+
+  pthread_mutex_lock(&fast_mutex);
+  fast_running.store(false, std::memory_order_release);
+  fast_stopping = false;
+  pthread_cond_broadcast(&fast_cond);
+  pthread_mutex_unlock(&fast_mutex);
+
+  // Records committed while the formatter was finishing.
+  Drain();
+}
+
+void FastLogger::AtExit() {
+  if (!ClaimFastState()) {
+    return;
+  }
+  pthread_mutex_lock(&fast_mutex);
+  fast_exiting = true;
+  pthread_mutex_unlock(&fast_mutex);
+  Stop();
+}
+
+void* FastLogger::FormatterMain(void*) {
+  int64 wait = kFastLogMinWaitUsecs;
+  for (;;) {
+    if (FormatQueued() > 0) {
+      wait = kFastLogMinWaitUsecs;
+    } else if (wait < kFastLogMaxWaitUsecs) {
+      wait *= 2;
+    }
+
+    pthread_mutex_lock(&fast_mutex);
+    if (fast_stopping) {
+      pthread_mutex_unlock(&fast_mutex);
+      break;
+    }
+    const int64 until = CycleClock_Now() + UsecToCycles(wait);
+    struct timespec deadline;
+    deadline.tv_sec = static_cast<time_t>(until / 1000000);
+    deadline.tv_nsec = static_cast<long>(until % 1000000) * 1000;
+    fast_sleepers.fetch_add(1);
+    pthread_cond_timedwait(&fast_cond, &fast_mutex, &deadline);
+    fast_sleepers.fetch_sub(1);
+    pthread_mutex_unlock(&fast_mutex);
+  }
+  FormatQueued();
+  return NULL;
+}
+
+#else  // !HAVE_PTHREAD
+
+// Without threads, LOG_FAST formats on the spot.
+char* FastLogger::Begin(const FastLogSite&, const unsigned char*, size_t) {
+  return NULL;
+}
+void FastLogger::Commit() {}
+void FastLogger::Drain() {}
+void FastLogger::DrainUnsafe() {}
+void FastLogger::Stop() {}
+
+#endif  // HAVE_PTHREAD
+
+// Support for LOG_RATE_LIMITED and LOG_SAMPLED.
+
+// The sites that have left messages out, linked through their "next",
+// and when in WallTime_Now() time to report them next.
+static std::atomic<LogLimitSite*> log_limit_sites(NULL);
+static std::atomic<WallTime> log_limit_next_report(0);
+
+// Logs, at each severity, how many messages each site left out since the
+// last time.
+static void ReportLogLimitSites(int64 secs) {
+  std::ostringstream lists[NUM_SEVERITIES];
+  int64 totals[NUM_SEVERITIES] = { 0 };
+  for (LogLimitSite* site = log_limit_sites.load(std::memory_order_acquire);
+       site != NULL; site = site->next.load(std::memory_order_relaxed)) {
+    const int64 suppressed =
+        site->suppressed.exchange(0, std::memory_order_relaxed);
+    if (suppressed > 0) {
+      // Not at FATAL, which would not be a report but a crash.
+      const LogSeverity severity = std::min<LogSeverity>(site->severity,
+                                                         GLOG_ERROR);
+      lists[severity] << ' ' << const_basename(site->file) << ':'
+                      << site->line << '=' << suppressed;
+      totals[severity] += suppressed;
+    }
+  }
+  for (int i = 0; i < NUM_SEVERITIES; ++i) {
+    if (totals[i] > 0) {
+      LogMessage(__FILE__, __LINE__, i).stream()
+          << "Left out " << totals[i] << " rate-limited or sampled "
+          << "messages in the last " << secs << "s:" << lists[i].str();
+    }
+  }
+}
+
+// Reports the sites that left messages out if it is time to.
+static void MaybeReportLogLimitSites(WallTime now) {
+  WallTime next = log_limit_next_report.load(std::memory_order_relaxed);
+  if (now < next) {
+    return;
+  }
+  const int64 secs = FLAGS_log_limit_summary_secs;
+  if (secs <= 0) {
+    return;
+  }
+  // Whoever moves the time on reports.
+  if (log_limit_next_report.compare_exchange_strong(
+          next, now + secs)) {
+    if (next != 0) {
+      ReportLogLimitSites(secs);
+    }
+  }
+}
+
+// Counts a message that "site" left out.  The clock is read for one in
+// 1024 of them, so that a site that leaves every message out still gets
+// them reported.
+static void SuppressLogMessage(LogLimitSite* site) {
+  const int64 suppressed =
+      site->suppressed.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (suppressed % 1024 == 0) {
+    MaybeReportLogLimitSites(WallTime_Now());
+  }
+  if (!site->listed.load(std::memory_order_relaxed) &&
+      !site->listed.exchange(true)) {
+    LogLimitSite* head = log_limit_sites.load(std::memory_order_relaxed);
+    do {
+      site->next.store(head, std::memory_order_relaxed);
+    } while (!log_limit_sites.compare_exchange_weak(
+                 head, site, std::memory_order_release,
+                 std::memory_order_relaxed));
+  }
+}
+
+// Returns the time for token buckets, in seconds.  It is read for every
+// LOG_RATE_LIMITED, so where there is a coarse monotonic clock, which
+// costs a fraction of a precise one, it is used.
+static double LogLimitClock() {
+#if defined(OS_LINUX) && defined(CLOCK_MONOTONIC_COARSE)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec + ts.tv_nsec * 0.000000001;
+#elif defined(OS_MACOSX) && defined(CLOCK_MONOTONIC_RAW_APPROX)
+  return clock_gettime_nsec_np(CLOCK_MONOTONIC_RAW_APPROX) * 0.000000001;
+#else
+  return WallTime_Now();
+#endif
+}
+
+bool LogRateLimitAllows(LogLimitSite* site, double per_sec, double burst) {
+  if (!(per_sec >= 1e-20)) {
+    // The bucket never refills (or, this slowly, not within the life of
+    // the process), so it holds the burst it started with.  Only calls
+    // that raced for the last token count past "burst".
+    if (site->burst_taken.load(std::memory_order_relaxed) < burst &&
+        site->burst_taken.fetch_add(1, std::memory_order_relaxed) < burst) {
+      MaybeReportLogLimitSites(WallTime_Now());
+      return true;
+    }
+    SuppressLogMessage(site);
+    return false;
+  }
+  const double now = LogLimitClock();
+  // As in folly's TokenBucket, a single time stands for the tokens: they
+  // are what has refilled since the bucket was empty.
+  double empty_time = site->empty_time.load(std::memory_order_relaxed);
+  for (;;) {
+    double tokens = (now - empty_time) * per_sec;
+    if (tokens > burst || now < empty_time - 1) {
+      // Full, or the clock went back, as WallTime_Now() can.  Just
+      // behind is only another thread having taken a token since "now"
+      // was read.
+      tokens = burst;
+    }
+    if (!(tokens >= 1)) {
+      SuppressLogMessage(site);
+      return false;
+    }
+    // per_sec is at least 1e-20, so the division stays finite.
+    if (site->empty_time.compare_exchange_weak(
+            empty_time, now - (tokens - 1) / per_sec,
+            std::memory_order_relaxed)) {
+      MaybeReportLogLimitSites(WallTime_Now());
+      return true;
+    }
+  }
+}
+
+#ifdef HAVE_PTHREAD
+// Each thread keeps the state of its LOG_SAMPLED random numbers.
+static pthread_key_t log_random_key;
+static pthread_once_t log_random_once = PTHREAD_ONCE_INIT;
+
+static void DeleteLogRandomState(void* state) {
+  delete static_cast<uint64*>(state);
+}
+
+static void CreateLogRandomKey() {
+  pthread_key_create(&log_random_key, &DeleteLogRandomState);
+}
+#endif
+
+// Returns the next of the calling thread's xorshift64* random numbers.
+static uint64 NextLogRandom() {
+#ifdef HAVE_PTHREAD
+  pthread_once(&log_random_once, &CreateLogRandomKey);
+  uint64* state = static_cast<uint64*>(pthread_getspecific(log_random_key));
+  if (state == NULL) {
+    state = new uint64(0);
+    if (pthread_setspecific(log_random_key, state) != 0) {
+      static uint64 shared_state = 0;  // racy, but only random anyway
+      delete state;
+      state = &shared_state;
+    }
+  }
+#else
+  static uint64 random_state = 0;
+  uint64* state = &random_state;
+#endif
+  uint64 x = *state;
+  if (x == 0) {
+    // Seed with splitmix64 of the time and where the state lives, which
+    // differs between threads.
+    x = static_cast<uint64>(CycleClock_Now()) ^
+        reinterpret_cast<uintptr_t>(state);
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    if (x == 0) {
+      x = 1;
+    }
+  }
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545f4914f6cdd1dULL;
+}
+
+bool LogSampleAllows(LogLimitSite* site, double p) {
+  const uint64 r = NextLogRandom();
+  // The top 53 bits, as a double in [0, 1).
+  if (static_cast<double>(r >> 11) * (1.0 / 9007199254740992.0) < p) {
+    MaybeReportLogLimitSites(WallTime_Now());
+    return true;
+  }
+  SuppressLogMessage(site);
+  return false;
+}
+
+// Syncs the data of "fd" to disk.
+static void SyncLogFile(int fd) {
+#ifdef OS_LINUX
+  fdatasync(fd);
+#else
+  fsync(fd);
+#endif
+}
+
+// Points the symlinks called "linkname", in the directory of "filename"
+// and in --log_link, to "filename".
+static void UpdateLogSymlinks(const string& string_filename,
+                              const string& linkname) {
+  const char* filename = string_filename.c_str();
+  // take directory from filename
+  const char* slash = strrchr(filename, PATH_SEPARATOR);
+  string linkpath;
+  if ( slash ) linkpath = string(filename, slash-filename+1);  // get dirname
+  linkpath += linkname;
+  unlink(linkpath.c_str());                    // delete old one if it exists
+
+#if defined(OS_WINDOWS)
+  // TODO(hamaji): Create lnk file on Windows?
+#elif defined(HAVE_UNISTD_H)
+  // We must have unistd.h.
+  // Make the symlink be relative (in the same dir) so that if the
+  // entire log directory gets relocated the link is still valid.
+  const char *linkdest = slash ? (slash + 1) : filename;
+  if (symlink(linkdest, linkpath.c_str()) != 0) {
+    // silently ignore failures
+  }
+
+  // Make an additional link to the log file in a place specified by
+  // FLAGS_log_link, if indicated
+  if (!FLAGS_log_link.empty()) {
+    linkpath = FLAGS_log_link + "/" + linkname;
+    unlink(linkpath.c_str());                  // delete old one if it exists
+    if (symlink(filename, linkpath.c_str()) != 0) {
+      // silently ignore failures
+    }
+  }
+#endif
+}
+
+#ifdef HAVE_PTHREAD
+
+// Background work on log files that would otherwise stall the thread that
+// logs: opening the file that the next rollover switches to, closing the
+// file rolled over from, pointing the symlinks at the new one, syncing
+// files under --logfile_sync_ms and --logfile_sync_bytes, and removing the
+// prepared files that crashed processes left behind.  Jobs run in
+// order on one thread, started by the first of them and never stopped.  A
+// forked child has no worker, and none is used after the exit hook, so
+// there its callers do the work themselves.
+class LogFileWorker {
+ public:
+  // Opens "path" for "file" and stores the result in file->prepared_fd_.
+  // Returns false if the caller must do without.
+  static bool Prepare(LogFileObject* file, const string& path);
+
+  // Waits until no Prepare() for "file" is queued or running.
+  static void Cancel(LogFileObject* file);
+
+  // Syncs "fd" if "sync" is true, then closes it.  Returns false if the
+  // caller must do it.
+  static bool Release(int fd, bool sync);
+
+  // Calls UpdateLogSymlinks(filename, linkname) if the worker is already
+  // running.  Returns false if the caller must do it.
+  static bool Link(const string& filename, const string& linkname);
+
+  // Removes the files prepared under "prefix" (see PreparedPath()) by
+  // processes that no longer exist, the first time it is asked to for
+  // "prefix".
+  static void Sweep(const string& prefix);
+
+  // Waits until every job queued so far is done.
+  static void Drain();
+
+ private:
+  struct Job {
+    LogFileObject* file;  // to prepare a file for, or NULL
+    string path;          // to open, or to link to if "file" is NULL
+    string linkname;
+    int fd;               // to release, if "path" is empty
+    bool sync;
+    bool sweep;           // "path" is a prefix to sweep
+  };
+  typedef std::deque<Job> Queue;
+
+  static Queue* queue_;
+  static bool Push(const Job& job);
+  static void* WorkerMain(void*);
+};
+
+namespace {
+
+// Guards LogFileWorker::queue_ and the following; log_worker_cond is
+// signalled when a job is queued or finished.
+pthread_mutex_t log_worker_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t log_worker_cond = PTHREAD_COND_INITIALIZER;
+LogFileObject* log_worker_current = NULL;  // being prepared for
+bool log_worker_busy = false;
+
+// The process the worker runs in, or 0 before it is started.  Checked
+// without the mutex, which a forked child may find locked forever.
+std::atomic<pid_t> log_worker_pid(0);
+
+// Returns whether this process has a running worker.
+bool HaveLogWorker() {
+  return log_worker_pid.load(std::memory_order_acquire) == getpid();
+}
+
+}  // namespace
+
+LogFileWorker::Queue* LogFileWorker::queue_ = NULL;
+
+bool LogFileWorker::Push(const Job& job) {
+  const pid_t started = log_worker_pid.load(std::memory_order_acquire);
+  if ((started != 0 && started != getpid()) ||
+      log_files_exiting.load(std::memory_order_acquire)) {
+    return false;
+  }
+  pthread_mutex_lock(&log_worker_mutex);
+  if (log_worker_pid.load(std::memory_order_relaxed) == 0) {
+    pthread_t worker;
+    queue_ = new Queue;
+    if (pthread_create(&worker, NULL, &LogFileWorker::WorkerMain,
+                       NULL) == 0) {
+      pthread_detach(worker);
+      log_worker_pid.store(getpid(), std::memory_order_release);
+    } else {
+      delete queue_;
+      queue_ = NULL;
+    }
+  }
+  const bool pushed = HaveLogWorker();
+  if (pushed) {
+    queue_->push_back(job);
+    pthread_cond_broadcast(&log_worker_cond);
+  }
+  pthread_mutex_unlock(&log_worker_mutex);
+  return pushed;
+}
+
+bool LogFileWorker::Prepare(LogFileObject* file, const string& path) {
+  Job job = { file, path, string(), -1, false, false };
+  return Push(job);
+}
+
+bool LogFileWorker::Release(int fd, bool sync) {
+  Job job = { NULL, string(), string(), fd, sync, false };
+  return Push(job);
+}
+
+bool LogFileWorker::Link(const string& filename, const string& linkname) {
+  if (!HaveLogWorker()) {
+    return false;
+  }
+  Job job = { NULL, filename, linkname, -1, false, false };
+  return Push(job);
+}
+
+void LogFileWorker::Sweep(const string& prefix) {
+  Job job = { NULL, prefix, string(), -1, false, true };
+  Push(job);  // if there is no worker, the next process sweeps
+}
+
+// Removes "<prefix>next.<pid>" files whose process is gone.  A pid that has
+// been reused keeps its file, which is left for a later sweep.
+static void RemoveStalePreparedLogfiles(const string& prefix) {
+  const size_t slash = prefix.rfind('/');
+  const string dir = slash == string::npos ? string(".") :
+                     slash == 0 ? string("/") : prefix.substr(0, slash);
+  const string name = (slash == string::npos ? prefix :
+                       prefix.substr(slash + 1)) + "next.";
+  DIR* d = opendir(dir.c_str());
+  if (d == NULL) {
+    return;
+  }
+  while (const struct dirent* entry = readdir(d)) {
+    if (strncmp(entry->d_name, name.data(), name.size()) != 0) {
+      continue;
+    }
+    const char* digits = entry->d_name + name.size();
+    char* end = NULL;
+    errno = 0;
+    const long pid = strtol(digits, &end, 10);
+    if (!isdigit(*digits) || *end != '\0' || errno != 0 || pid <= 0 ||
+        pid == GetMainThreadPid()) {
+      continue;
+    }
+    // EPERM means the process exists, under another user.
+    if (kill(static_cast<pid_t>(pid), 0) != 0 && errno == ESRCH) {
+      unlink((dir + "/" + entry->d_name).c_str());
+    }
+  }
+  closedir(d);
+}
+
+void LogFileWorker::Cancel(LogFileObject* file) {
+  if (!HaveLogWorker()) {
+    return;
+  }
+  pthread_mutex_lock(&log_worker_mutex);
+  {
+    Queue& queue = *queue_;
+    for (size_t i = 0; i < queue.size(); ) {
+      if (queue[i].file == file) {
+        queue.erase(queue.begin() + i);
+      } else {
+        ++i;
+      }
+    }
+    while (log_worker_current == file) {
+      pthread_cond_wait(&log_worker_cond, &log_worker_mutex);
+    }
+  }
+  pthread_mutex_unlock(&log_worker_mutex);
+}
+
+void* LogFileWorker::WorkerMain(void*) {
+  pthread_mutex_lock(&log_worker_mutex);
+  while (true) {
+    while (queue_->empty()) {
+      pthread_cond_wait(&log_worker_cond, &log_worker_mutex);
+    }
+    const Job job = queue_->front();
+    queue_->pop_front();
+    log_worker_current = job.file;
+    log_worker_busy = true;
+    pthread_mutex_unlock(&log_worker_mutex);
+
+    int fd = -1;
+    if (job.sweep) {
+      // Only this thread touches the set.
+      static std::set<string>* swept = new std::set<string>;
+      if (swept->insert(job.path).second) {
+        RemoveStalePreparedLogfiles(job.path);
+      }
+    } else if (job.file != NULL) {
+      fd = open(job.path.c_str(), O_WRONLY | O_CREAT | O_EXCL,
+                FLAGS_logfile_mode);
+#ifdef HAVE_FCNTL
+      if (fd != -1) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+      }
+#endif
+    } else if (!job.path.empty()) {
+      UpdateLogSymlinks(job.path, job.linkname);
+    } else {
+      if (job.sync) {
+        SyncLogFile(job.fd);
+      }
+      close(job.fd);
+    }
+
+    pthread_mutex_lock(&log_worker_mutex);
+    if (job.file != NULL) {
+      // Cancel() waits for this, so the file is still there.
+      job.file->prepared_fd_.store(fd == -1 ? -2 : fd);
+    }
+    log_worker_current = NULL;
+    log_worker_busy = false;
+    pthread_cond_broadcast(&log_worker_cond);
+  }
+  return NULL;
+}
+
+void LogFileWorker::Drain() {
+  if (!HaveLogWorker()) {
+    return;
+  }
+  pthread_mutex_lock(&log_worker_mutex);
+  while (!queue_->empty() || log_worker_busy) {
+    pthread_cond_wait(&log_worker_cond, &log_worker_mutex);
+  }
+  pthread_mutex_unlock(&log_worker_mutex);
+}
+
+#else  // !HAVE_PTHREAD
+
+// Without threads, everything happens on the spot.
+class LogFileWorker {
+ public:
+  static bool Prepare(LogFileObject*, const string&) { return false; }
+  static void Cancel(LogFileObject*) {}
+  static bool Release(int, bool) { return false; }
+  static bool Link(const string&, const string&) { return false; }
+  static void Sweep(const string&) {}
+  static void Drain() {}
+};
+
+#endif  // HAVE_PTHREAD
+
+void LogDestination::FlushLogFilesAtExit() {
+  log_files_exiting.store(true, std::memory_order_release);
+  FastLogger::Drain();
+  AsyncLogger::Drain();
+  {
+    MutexLock l(&log_mutex);
+    for (int i = 0; i < NUM_SEVERITIES; ++i) {
+      LogDestination* log = log_destinations_[i];
+      if (log != NULL) {
+        log->fileobject_.Flush();
+        log->fileobject_.DiscardPrepared();
+      }
+    }
+  }
+  LogFileWorker::Drain();  // for the syncs and symlinks
+}
+
+namespace {
+
+LogFileObject::LogFileObject(LogSeverity severity,
+                             const char* base_filename)
+  : base_filename_selected_(base_filename != NULL),
+    base_filename_((base_filename != NULL) ? base_filename : ""),
+    symlink_basename_(glog_internal_namespace_::ProgramInvocationShortName()),
+    filename_extension_(),
+    fd_(-1),
+    buffer_(NULL),
+    buffer_used_(0),
+    severity_(severity),
+    bytes_since_flush_(0),
+    bytes_since_sync_(0),
+    file_length_(0),
+    rollover_attempt_(kRolloverAttemptFrequency-1),
+    next_flush_time_(0),
+    next_sync_time_(0),
+    prepared_fd_(-1),
+    prepared_pid_(0) {
+  assert(severity >= 0);
+  assert(severity < NUM_SEVERITIES);
+}
+
+LogFileObject::~LogFileObject() {
+  MutexLock l(&lock_);
+  CloseFile();
+  DiscardPreparedLogfile();
+  free(buffer_);
+}
+
+void LogFileObject::SetBasename(const char* basename) {
+  MutexLock l(&lock_);
+  base_filename_selected_ = true;
+  if (base_filename_ != basename) {
+    // Get rid of old log file since we are changing names
+    if (fd_ != -1) {
+      CloseFile();
+      rollover_attempt_ = kRolloverAttemptFrequency-1;
+    }
+    DiscardPreparedLogfile();
+    base_filename_ = basename;
+  }
+}
+
+void LogFileObject::SetExtension(const char* ext) {
+  MutexLock l(&lock_);
+  if (filename_extension_ != ext) {
+    // Get rid of old log file since we are changing names
+    if (fd_ != -1) {
+      CloseFile();
+      rollover_attempt_ = kRolloverAttemptFrequency-1;
+    }
+    DiscardPreparedLogfile();
+    filename_extension_ = ext;
+  }
+}
+
+void LogFileObject::SetSymlinkBasename(const char* symlink_basename) {
+  MutexLock l(&lock_);
+  symlink_basename_ = symlink_basename;
+}
+
+void LogFileObject::Flush() {
+  MutexLock l(&lock_);
+  FlushUnlocked();
+  SyncIfDue();
+}
+
+void LogFileObject::FlushUnlocked(){
+  if (fd_ != -1) {
+    WriteOut(NULL, 0);
+    bytes_since_flush_ = 0;
+  }
+  // Figure out when we are due for another flush.
+  int64 next = (FLAGS_logbufsecs
+                * static_cast<int64>(1000000));  // in usec
+  if (FLAGS_logfile_sync_ms > 0) {
+    next = min(next, FLAGS_logfile_sync_ms * static_cast<int64>(1000));
+  }
+  next_flush_time_ = CycleClock_Now() + UsecToCycles(next);
+}
+
+bool LogFileObject::Append(const char* message, size_t message_len) {
+  if (log_files_exiting.load(std::memory_order_relaxed)) {
+    return WriteOut(message, message_len);
+  }
+  if (buffer_ == NULL) {
+    void* buffer;
+    if (posix_memalign(&buffer, kBufferAlignment, kBufferSize) == 0) {
+      buffer_ = static_cast<char*>(buffer);
+    } else {
+      return WriteOut(message, message_len);  // unbuffered, then
+    }
+  }
+  if (message_len <= kBufferSize - buffer_used_) {
+    memcpy(buffer_ + buffer_used_, message, message_len);
+    buffer_used_ += message_len;
+    return true;
+  }
+  return WriteOut(message, message_len);
+}
+
+bool LogFileObject::WriteOut(const char* message, size_t message_len) {
+  const size_t total = buffer_used_ + message_len;
+  if (total == 0) {
+    return true;
+  }
+  if (bytes_since_sync_ == 0) {
+    next_sync_time_ = CycleClock_Now() +
+        UsecToCycles(FLAGS_logfile_sync_ms * static_cast<int64>(1000));
+  }
+  bytes_since_sync_ += total;
+
+  bool ok = true;
+#ifdef HAVE_UNISTD_H
+  struct iovec iov[2];
+  int n = 0;
+  if (buffer_used_ > 0) {
+    iov[n].iov_base = buffer_;
+    iov[n].iov_len = buffer_used_;
+    ++n;
+  }
+  if (message_len > 0) {
+    iov[n].iov_base = const_cast<char*>(message);
+    iov[n].iov_len = message_len;
+    ++n;
+  }
+  struct iovec* next = iov;
+  while (n > 0) {
+    ssize_t written = writev(fd_, next, n);
+    if (written <= 0) {
+      if (written < 0 && errno == EINTR) continue;
+      ok = false;
+      break;
+    }
+    while (n > 0 && static_cast<size_t>(written) >= next->iov_len) {
+      written -= next->iov_len;
+      ++next;
+      --n;
+    }
+    if (n > 0) {
+      next->iov_base = static_cast<char*>(next->iov_base) + written;
+      next->iov_len -= written;
+    }
+  }
+#else
+  const char* parts[2] = { buffer_, message };
+  const size_t lengths[2] = { buffer_used_, message_len };
+  for (int i = 0; i < 2 && ok; ++i) {
+    for (size_t done = 0; done < lengths[i]; ) {
+      const int written = write(fd_, parts[i] + done, lengths[i] - done);
+      if (written <= 0) {
+        ok = false;
+        break;
+      }
+      done += written;
+    }
+  }
+#endif
+  buffer_used_ = 0;
+  return ok;
+}
+
+void LogFileObject::CloseFile() {
+  if (fd_ == -1) {
+    return;
+  }
+  WriteOut(NULL, 0);
+  const bool sync = bytes_since_sync_ > 0 &&
+      (FLAGS_logfile_sync_ms > 0 || FLAGS_logfile_sync_bytes > 0);
+  if (!LogFileWorker::Release(fd_, sync)) {
+    if (sync) {
+      SyncLogFile(fd_);
+    }
+    close(fd_);
+  }
+  fd_ = -1;
+  bytes_since_sync_ = 0;
+}
+
+void LogFileObject::SyncIfDue() {
+  if (fd_ == -1 || bytes_since_sync_ == 0) {
+    return;
+  }
+  if (!(FLAGS_logfile_sync_bytes > 0 &&
+        bytes_since_sync_ >= static_cast<uint32>(FLAGS_logfile_sync_bytes)) &&
+      !(FLAGS_logfile_sync_ms > 0 && CycleClock_Now() >= next_sync_time_)) {
+    return;
+  }
+  bytes_since_sync_ = 0;
+  // The worker syncs a duplicate, which stays valid whatever happens to
+  // fd_ in the meantime.
+  const int fd = dup(fd_);
+  if (fd == -1) {
+    SyncLogFile(fd_);
+  } else if (!LogFileWorker::Release(fd, true)) {
+    SyncLogFile(fd);
+    close(fd);
+  }
+}
+
+string LogFileObject::PreparedPath() const {
+  ostringstream path;
+  path << base_filename_ << filename_extension_ << "next."
+       << GetMainThreadPid();
+  return path.str();
+}
+
+void LogFileObject::PrepareNextLogfile() {
+  if (!prepared_path_.empty()) {
+    return;
+  }
+  prepared_path_ = PreparedPath();
+  prepared_pid_ = GetMainThreadPid();
+  prepared_fd_.store(-1);
+  if (!LogFileWorker::Prepare(this, prepared_path_)) {
+    prepared_path_.clear();
+  }
+}
+
+int LogFileObject::AdoptPreparedLogfile(const char* filename) {
+  if (prepared_path_.empty()) {
+    return -1;
+  }
+  if (prepared_pid_ != GetMainThreadPid() ||
+      prepared_path_ != PreparedPath()) {
+    // Prepared by the parent of a forked process, or for a directory the
+    // files don't go to anymore.
+    DiscardPreparedLogfile();
+    return -1;
+  }
+  const int fd = prepared_fd_.exchange(-1);
+  if (fd == -1) {
+    return -1;  // not ready yet; it will be for the next rollover
+  }
+  if (fd == -2) {
+    prepared_path_.clear();  // failed; try again for the next rollover
+    return -1;
+  }
+  // Unlike rename(), link() doesn't replace an existing file, which is
+  // what O_EXCL guards against when creating one.
+  if (link(prepared_path_.c_str(), filename) != 0) {
+    const bool exists = errno == EEXIST;
+    prepared_fd_.store(fd);
+    if (!exists) {
+      DiscardPreparedLogfile();
+    }
+    return -1;
+  }
+  unlink(prepared_path_.c_str());
+  prepared_path_.clear();
+  return fd;
+}
+
+void LogFileObject::DiscardPreparedLogfile() {
+  if (prepared_path_.empty()) {
+    return;
+  }
+  LogFileWorker::Cancel(this);
+  const int fd = prepared_fd_.exchange(-1);
+  if (fd >= 0) {
+    close(fd);
+    // The parent of a forked process still owns its prepared file.
+    if (prepared_pid_ == GetMainThreadPid()) {
+      unlink(prepared_path_.c_str());
+    }
+  }
+  prepared_path_.clear();
+}
+
+bool LogFileObject::CreateLogfile(const string& time_pid_string) {
+  string string_filename = base_filename_+filename_extension_+
+                           time_pid_string;
+  const char* filename = string_filename.c_str();
+  int fd = AdoptPreparedLogfile(filename);
+  if (fd == -1) {
+    fd = open(filename, O_WRONLY | O_CREAT | O_EXCL, FLAGS_logfile_mode);
+    if (fd == -1) return false;
+#ifdef HAVE_FCNTL
+    // Mark the file close-on-exec. We don't really care if this fails
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+  }
+
+  fd_ = fd;
+  LogFileWorker::Sweep(base_filename_ + filename_extension_);
+
+  // Buffered messages are written out at exit, as they were by stdio
+  // before log files had buffers of their own.
+  static const bool flush_at_exit =
+      atexit(&LogDestination::FlushLogFilesAtExit) == 0;
+  (void)flush_at_exit;
+
+  // We try to create a symlink called <program_name>.<severity>,
+  // which is easier to use.  (Every time we create a new logfile,
+  // we destroy the old symlink and create a new one, so it always
+  // points to the latest logfile.)  If it fails, we're sad but it's
+  // no error.  Jobs run in order, so the worker leaves the symlinks
+  // pointing to the latest file too.
+  if (!symlink_basename_.empty()) {
+    const string linkname =
+      symlink_basename_ + '.' + LogSeverityNames[severity_];
+    if (!LogFileWorker::Link(string_filename, linkname)) {
+      UpdateLogSymlinks(string_filename, linkname);
+    }
+  }
+
+  return true;  // Everything worked
+}
+
+void LogFileObject::Write(bool force_flush,
+                          time_t timestamp,
+                          const char* message,
+                          int message_len) {
+  MutexLock l(&lock_);
+  WriteUnlocked(force_flush, timestamp, message, message_len);
+}
+
+bool LogFileObject::WriteUnsafe(const char* message, size_t message_len) {
+  if (!lock_.TryLock()) {
+    return false;
+  }
+  if (fd_ != -1 && !stop_writing) {
+    WriteOut(message, message_len);
+    file_length_ += message_len;
+  }
+  lock_.Unlock();
+  return true;
+}
+
+void LogFileObject::WriteUnlocked(bool force_flush,
+                                  time_t timestamp,
+                                  const char* message,
+                                  int message_len) {
+  // We don't log if the base_name_ is "" (which means "don't write")
+  if (base_filename_selected_ && base_filename_.empty()) {
+    return;
+  }
+
+  if (static_cast<int>(file_length_ >> 20) >= MaxLogSize() ||
+      PidHasChanged()) {
+    CloseFile();
+    file_length_ = bytes_since_flush_ = 0;
+    rollover_attempt_ = kRolloverAttemptFrequency-1;
+  }
+
+  // If there's no destination file, make one before outputting
+  if (fd_ == -1) {
+    // Try to rollover the log file every 32 log messages.  The only time
+    // this could matter would be when we have trouble creating the log
+    // file.  If that happens, we'll lose lots of log messages, of course!
+    if (++rollover_attempt_ != kRolloverAttemptFrequency) return;
+    rollover_attempt_ = 0;
+
+    struct ::tm tm_time;
+    localtime_r(&timestamp, &tm_time);
+
+    // The logfile's filename will have the date/time & pid in it
+    ostringstream time_pid_stream;
+    time_pid_stream.fill('0');
+    time_pid_stream << 1900+tm_time.tm_year
+                    << setw(2) << 1+tm_time.tm_mon
+                    << setw(2) << tm_time.tm_mday
+                    << '-'
+                    << setw(2) << tm_time.tm_hour
+                    << setw(2) << tm_time.tm_min
+                    << setw(2) << tm_time.tm_sec
+                    << '.'
+                    << GetMainThreadPid();
+    const string& time_pid_string = time_pid_stream.str();
+
+    if (base_filename_selected_) {
+      if (!CreateLogfile(time_pid_string)) {
+        perror("Could not create log file");
+        fprintf(stderr, "COULD NOT CREATE LOGFILE '%s'!\n",
+                time_pid_string.c_str());
+        return;
+      }
+    } else {
+      // If no base filename for logs of this severity has been set, use a
+      // default base filename of
+      // "<program name>.<hostname>.<user name>.log.<severity level>.".  So
+      // logfiles will have names like
+      // webserver.examplehost.root.log.INFO.19990817-150000.4354, where
+      // 19990817 is a date (1999 August 17), 150000 is a time (15:00:00),
+      // and 4354 is the pid of the logging process.  The date & time reflect
+      // when the file was created for output.
+      //
+      // Where does the file get put?  Successively try the directories
+      // "/tmp", and "."
+      string stripped_filename(
+          glog_internal_namespace_::ProgramInvocationShortName());
+      string hostname;
+      GetHostName(&hostname);
+
+      string uidname = MyUserName();
+      // We should not call CHECK() here because this function can be
+      // called after holding on to log_mutex. We don't want to
+      // attempt to hold on to the same mutex, and get into a
+      // deadlock. Simply use a name like invalid-user.
+      if (uidname.empty()) uidname = "invalid-user";
+
+      stripped_filename = stripped_filename+'.'+hostname+'.'
+                          +uidname+".log."
+                          +LogSeverityNames[severity_]+'.';
+      // We're going to (potentially) try to put logs in several different dirs
+      const vector<string> & log_dirs = GetLoggingDirectories();
+
+      // Go through the list of dirs, and try to create the log file in each
+      // until we succeed or run out of options
+      bool success = false;
+      for (vector<string>::const_iterator dir = log_dirs.begin();
+           dir != log_dirs.end();
+           ++dir) {
+        base_filename_ = *dir + "/" + stripped_filename;
+        if ( CreateLogfile(time_pid_string) ) {
+          success = true;
+          break;
+        }
+      }
+      // If we never succeeded, we have to give up
+      if ( success == false ) {
+        perror("Could not create logging file");
+        fprintf(stderr, "COULD NOT CREATE A LOGGINGFILE %s!",
+                time_pid_string.c_str());
+        return;
+      }
+    }
+
+    // Write a header message into the log file
+    ostringstream file_header_stream;
     file_header_stream.fill('0');
     file_header_stream << "Log file created at: "
                        << 1900+tm_time.tm_year << '/'
@@ -1081,22 +3328,19 @@ void LogFileObject::Write(bool force_flush,
     const string& file_header_string = file_header_stream.str();
 
     const int header_len = file_header_string.size();
-    fwrite(file_header_string.data(), 1, header_len, file_);
+    Append(file_header_string.data(), header_len);
     file_length_ += header_len;
     bytes_since_flush_ += header_len;
   }
 
   // Write to LOG file
   if ( !stop_writing ) {
-    // fwrite() doesn't return an error when the disk is full, for
-    // messages that are less than 4096 bytes. When the disk is full,
-    // it returns the message length for messages that are less than
-    // 4096 bytes. fwrite() returns 4096 for message lengths that are
-    // greater than 4096, thereby indicating an error.
+    // A full disk shows when the buffer is written out, which is for
+    // this message or a later one.
     errno = 0;
-    fwrite(message, 1, message_len, file_);
+    const bool written = Append(message, message_len);
     if ( FLAGS_stop_logging_if_full_disk &&
-         errno == ENOSPC ) {  // disk full, stop writing to disk
+         !written && errno == ENOSPC ) {  // disk full, stop writing to disk
       stop_writing = true;  // until the disk is
       return;
     } else {
@@ -1120,11 +3364,18 @@ void LogFileObject::Write(bool force_flush,
       if (file_length_ >= logging::kPageSize) {
         // don't evict the most recent page
         uint32 len = file_length_ & ~(logging::kPageSize - 1);
-        posix_fadvise(fileno(file_), 0, len, POSIX_FADV_DONTNEED);
+        posix_fadvise(fd_, 0, len, POSIX_FADV_DONTNEED);
       }
     }
 #endif
   }
+  SyncIfDue();
+
+  // Have the next file ready by the time this one is full, so that the
+  // rollover doesn't wait for it.
+  if (file_length_ >= static_cast<uint32>(MaxLogSize()) << 19) {
+    PrepareNextLogfile();
+  }
 }
 
 }  // namespace
@@ -1143,7 +3394,52 @@ static LogMessage::LogMessageData fatal_msg_data_exclusive;
 static LogMessage::LogMessageData fatal_msg_data_shared;
 
 LogMessage::LogMessageData::LogMessageData()
-  : stream_(message_text_, LogMessage::kMaxLogMessageLen, 0) {
+  : stream_(message_text_, LogMessage::kMaxLogMessageLen, 0),
+    timestamp_(0),
+    in_use_(false) {
+  time_text_[0] = '\0';
+}
+
+#ifdef HAVE_PTHREAD
+// Each thread keeps the LogMessageData of its messages for reuse, which
+// saves allocating 30K and constructing a stream per message.
+static pthread_key_t cached_data_key;
+static pthread_once_t cached_data_once = PTHREAD_ONCE_INIT;
+
+static void DeleteCachedData(void* data) {
+  delete static_cast<LogMessage::LogMessageData*>(data);
+}
+
+static void CreateCachedDataKey() {
+  pthread_key_create(&cached_data_key, &DeleteCachedData);
+}
+#endif
+
+// Returns the calling thread's cached LogMessageData, ready for a new
+// message, or NULL if there is none to use.  The cached data is in use
+// when a message is logged while another one is being built, by an
+// operator<< that logs, say; that message gets a data of its own.
+static LogMessage::LogMessageData* AcquireCachedData() {
+#ifdef HAVE_PTHREAD
+  pthread_once(&cached_data_once, &CreateCachedDataKey);
+  LogMessage::LogMessageData* data = static_cast<LogMessage::LogMessageData*>(
+      pthread_getspecific(cached_data_key));
+  if (data == NULL) {
+    data = new LogMessage::LogMessageData();
+    if (pthread_setspecific(cached_data_key, data) != 0) {
+      delete data;
+      return NULL;
+    }
+  } else if (data->in_use_) {
+    return NULL;
+  } else {
+    data->stream_.reset();
+  }
+  data->in_use_ = true;
+  return data;
+#else
+  return NULL;
+#endif
 }
 
 LogMessage::LogMessage(const char* file, int line, LogSeverity severity,
@@ -1198,8 +3494,11 @@ void LogMessage::Init(const char* file,
                       void (LogMessage::*send_method)()) {
   allocated_ = NULL;
   if (severity != GLOG_FATAL || !exit_on_dfatal) {
-    allocated_ = new LogMessageData();
-    data_ = allocated_;
+    data_ = AcquireCachedData();
+    if (data_ == NULL) {
+      allocated_ = new LogMessageData();
+      data_ = allocated_;
+    }
     data_->first_fatal_ = false;
   } else {
     MutexLock l(&fatal_msg_lock);
@@ -1221,8 +3520,16 @@ void LogMessage::Init(const char* file,
   data_->sink_ = NULL;
   data_->outvec_ = NULL;
   WallTime now = WallTime_Now();
-  data_->timestamp_ = static_cast<time_t>(now);
-  localtime_r(&data_->timestamp_, &data_->tm_time_);
+  time_t timestamp = static_cast<time_t>(now);
+  // A thread logging many lines a second keeps its data, and with it the
+  // broken-down time and date text of the last second it logged in.
+  if (timestamp != data_->timestamp_ || data_->time_text_[0] == '\0') {
+    data_->timestamp_ = timestamp;
+    localtime_r(&data_->timestamp_, &data_->tm_time_);
+    if (!FormatTimeText(data_->tm_time_, data_->time_text_)) {
+      data_->time_text_[0] = '\0';  // not cached; WriteLogPrefix() copes
+    }
+  }
   int usecs = static_cast<int>((now - data_->timestamp_) * 1000000);
   RawLog__SetLastTime(data_->tm_time_, usecs);
 
@@ -1237,19 +3544,9 @@ void LogMessage::Init(const char* file,
   //    (log level, GMT month, date, time, thread_id, file basename, line)
   // We exclude the thread_id for the default thread.
   if (FLAGS_log_prefix && (line != kNoLogPrefix)) {
-    stream() << LogSeverityNames[severity][0]
-             << setw(2) << 1+data_->tm_time_.tm_mon
-             << setw(2) << data_->tm_time_.tm_mday
-             << ' '
-             << setw(2) << data_->tm_time_.tm_hour  << ':'
-             << setw(2) << data_->tm_time_.tm_min   << ':'
-             << setw(2) << data_->tm_time_.tm_sec   << "."
-             << setw(6) << usecs
-             << ' '
-             << setfill(' ') << setw(5)
-             << static_cast<unsigned int>(GetTID()) << setfill('0')
-             << ' '
-             << data_->basename_ << ':' << data_->line_ << "] ";
+    WriteLogPrefix(stream(), severity, data_->tm_time_, data_->time_text_,
+                   usecs, static_cast<unsigned int>(GetTID()),
+                   data_->basename_, line);
   }
   data_->num_prefix_chars_ = data_->stream_.pcount();
 
@@ -1268,7 +3565,11 @@ void LogMessage::Init(const char* file,
 
 LogMessage::~LogMessage() {
   Flush();
-  delete allocated_;
+  if (allocated_ != NULL) {
+    delete allocated_;
+  } else {
+    data_->in_use_ = false;  // back in the cache
+  }
 }
 
 int LogMessage::preserved_errno() const {
@@ -1304,14 +3605,22 @@ void LogMessage::Flush() {
     data_->message_text_[data_->num_chars_to_log_++] = '\n';
   }
 
-  // Prevent any subtle race conditions by wrapping a mutex lock around
-  // the actual logging action per se.
-  {
-    MutexLock l(&log_mutex);
-    (this->*(data_->send_method_))();
-    ++num_messages_[static_cast<int>(data_->severity_)];
+  // LOG_FAST messages logged before a FATAL one go out first.
+  if (data_->severity_ == GLOG_FATAL) {
+    FastLogger::Drain();
+  }
+
+  // With --logasync, the message is queued for the writer thread instead.
+  if (!AsyncLogger::Send(data_)) {
+    // Prevent any subtle race conditions by wrapping a mutex lock around
+    // the actual logging action per se.
+    {
+      MutexLock l(&log_mutex);
+      (this->*(data_->send_method_))();
+      ++num_messages_[static_cast<int>(data_->severity_)];
+    }
+    LogDestination::WaitForSinks(data_);
   }
-  LogDestination::WaitForSinks(data_);
 
   if (append_newline) {
     // Fix the ostrstream back how it was before we screwed with it.
@@ -1368,39 +3677,11 @@ void LogMessage::SendToLog() EXCLUSIVE_LOCKS_REQUIRED(log_mutex) {
     already_warned_before_initgoogle = true;
   }
 
-  // global flag: never log to file if set.  Also -- don't log to a
-  // file if we haven't parsed the command line flags to get the
-  // program name.
-  if (FLAGS_logtostderr || !IsGoogleLoggingInitialized()) {
-    ColoredWriteToStderr(data_->severity_,
-                         data_->message_text_, data_->num_chars_to_log_);
-
-    // this could be protected by a flag if necessary.
-    LogDestination::LogToSinks(data_->severity_,
-                               data_->fullname_, data_->basename_,
-                               data_->line_, &data_->tm_time_,
-                               data_->message_text_ + data_->num_prefix_chars_,
-                               (data_->num_chars_to_log_ -
-                                data_->num_prefix_chars_ - 1));
-  } else {
-
-    // log this message to all log files of severity <= severity_
-    LogDestination::LogToAllLogfiles(data_->severity_, data_->timestamp_,
-                                     data_->message_text_,
-                                     data_->num_chars_to_log_);
-
-    LogDestination::MaybeLogToStderr(data_->severity_, data_->message_text_,
-                                     data_->num_chars_to_log_);
-    LogDestination::MaybeLogToEmail(data_->severity_, data_->message_text_,
-                                    data_->num_chars_to_log_);
-    LogDestination::LogToSinks(data_->severity_,
-                               data_->fullname_, data_->basename_,
-                               data_->line_, &data_->tm_time_,
-                               data_->message_text_ + data_->num_prefix_chars_,
-                               (data_->num_chars_to_log_
-                                - data_->num_prefix_chars_ - 1));
-    // NOTE: -1 removes trailing \n
-  }
+  LogDestination::LogToAll(data_->severity_,
+                           data_->fullname_, data_->basename_,
+                           data_->line_, &data_->tm_time_, data_->timestamp_,
+                           data_->message_text_, data_->num_chars_to_log_,
+                           data_->num_prefix_chars_);
 
   // If we log a FATAL message, flush all the log destinations, then toss
   // a signal for others to catch. We leave the logs in a state that
@@ -1572,6 +3853,10 @@ int64 LogMessage::num_messages(int severity) {
   return num_messages_[severity];
 }
 
+int64 LogMessage::num_dropped_messages() {
+  return AsyncLogger::num_dropped();
+}
+
 // Output the COUNTER value. This is only valid if ostream is a
 // LogStream.
 ostream& operator<<(ostream &os, const PRIVATE_Counter&) {
@@ -1600,10 +3885,14 @@ ErrnoLogMessage::~ErrnoLogMessage() {
 }
 
 void FlushLogFiles(LogSeverity min_severity) {
+  FastLogger::Drain();
+  AsyncLogger::Drain();
   LogDestination::FlushLogFiles(min_severity);
 }
 
 void FlushLogFilesUnsafe(LogSeverity min_severity) {
+  FastLogger::DrainUnsafe();
+  AsyncLogger::DrainUnsafe();
   LogDestination::FlushLogFilesUnsafe(min_severity);
 }
 
@@ -2079,6 +4368,8 @@ void InitGoogleLogging(const char* argv0) {
 }
 
 void ShutdownGoogleLogging() {
+  FastLogger::Stop();
+  AsyncLogger::Stop();
   glog_internal_namespace_::ShutdownGoogleLoggingUtilities();
   LogDestination::DeleteLogDestinations();
   delete logging_directories_list;
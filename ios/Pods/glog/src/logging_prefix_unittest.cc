@@ -0,0 +1,164 @@
+// Copyright (c) 2009, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Golden test of the log line prefix: what LogMessage writes must be, byte
+// for byte, what the setw()/setfill() code it replaced wrote.
+
+#include "config_for_unittests.h"
+#include "utilities.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "glog/logging.h"
+#include "googletest.h"
+
+using namespace std;
+using namespace GOOGLE_NAMESPACE;
+
+// The prefix as LogMessage::Init wrote it before it cached the time text.
+static string OldPrefix(LogSeverity severity, const struct ::tm& tm_time,
+                        int usecs, unsigned int tid,
+                        const char* basename, int line) {
+  ostringstream stream;
+  stream.fill('0');
+  stream << GetLogSeverityName(severity)[0]
+         << setw(2) << 1+tm_time.tm_mon
+         << setw(2) << tm_time.tm_mday
+         << ' '
+         << setw(2) << tm_time.tm_hour  << ':'
+         << setw(2) << tm_time.tm_min   << ':'
+         << setw(2) << tm_time.tm_sec   << "."
+         << setw(6) << usecs
+         << ' '
+         << setfill(' ') << setw(5) << tid << setfill('0')
+         << ' '
+         << basename << ':' << line << "] ";
+  return stream.str();
+}
+
+// A message logged by the test, and the wall time around it.
+struct Logged {
+  LogSeverity severity;
+  const char* basename;
+  int line;
+  struct timeval before;
+  struct timeval after;
+};
+
+static void Log(vector<Logged>* logged, LogSeverity severity,
+                const char* file, const char* basename, int line) {
+  Logged l = { severity, basename, line, {0, 0}, {0, 0} };
+  gettimeofday(&l.before, NULL);
+  LogMessage(file, line, severity).stream() << "message";
+  gettimeofday(&l.after, NULL);
+  logged->push_back(l);
+}
+
+// Checks each captured line against OldPrefix().  The microseconds are
+// read back from the line and checked against the times around the
+// message.  Lines logged across a second boundary are skipped.  Returns
+// how many lines were compared.
+static size_t CheckPrefixes(const vector<Logged>& logged,
+                            const string& captured) {
+  const unsigned int tid = static_cast<unsigned int>(
+      GOOGLE_NAMESPACE::glog_internal_namespace_::GetTID());
+  istringstream lines(captured);
+  string text;
+  size_t compared = 0;
+  for (size_t i = 0; i < logged.size(); ++i) {
+    const Logged& l = logged[i];
+    CHECK(getline(lines, text)) << "line " << i << " is missing";
+    EXPECT_TRUE(text.size() > 15 + 6);
+    const int usecs = atoi(text.substr(15, 6).c_str());
+    if (l.before.tv_sec != l.after.tv_sec) {
+      continue;
+    }
+    // Init() truncates a double, so it may read one microsecond early.
+    EXPECT_TRUE(l.before.tv_usec - 1 <= usecs && usecs <= l.after.tv_usec);
+    struct ::tm tm_time;
+    const time_t seconds = l.before.tv_sec;
+    localtime_r(&seconds, &tm_time);
+    EXPECT_EQ(OldPrefix(l.severity, tm_time, usecs, tid, l.basename, l.line)
+                  + "message",
+              text);
+    ++compared;
+  }
+  CHECK(!getline(lines, text)) << "unexpected line: " << text;
+  return compared;
+}
+
+TEST(LogPrefix, MatchesSetwFormatting) {
+  static const int kLines[] = { 0, 1, 9, 10, 99, 100, 12345, 99999, 100000,
+                                2147483647 };
+  static const LogSeverity kSeverities[] = { GLOG_INFO, GLOG_WARNING,
+                                             GLOG_ERROR };
+  vector<Logged> logged;
+  CaptureTestStderr();
+  for (size_t s = 0; s < sizeof(kSeverities) / sizeof(*kSeverities); ++s) {
+    for (size_t i = 0; i < sizeof(kLines) / sizeof(*kLines); ++i) {
+      Log(&logged, kSeverities[s], "prefix.cc", "prefix.cc", kLines[i]);
+      Log(&logged, kSeverities[s], "some/dir/other_file.h", "other_file.h",
+          kLines[i]);
+    }
+  }
+  const size_t compared = CheckPrefixes(logged, GetCapturedTestStderr());
+  EXPECT_TRUE(compared > 0);
+}
+
+TEST(LogPrefix, TimeTextFollowsTheClock) {
+  // The time text is kept from one message to the next within a second;
+  // log across a few second boundaries, so that it is remade.
+  vector<Logged> logged;
+  CaptureTestStderr();
+  const time_t start = time(NULL);
+  while (time(NULL) < start + 3) {
+    Log(&logged, GLOG_INFO, "prefix.cc", "prefix.cc",
+        static_cast<int>(logged.size()));
+    usleep(2000);
+  }
+  const size_t compared = CheckPrefixes(logged, GetCapturedTestStderr());
+  EXPECT_TRUE(compared + 3 >= logged.size());
+}
+
+int main(int argc, char** argv) {
+  FLAGS_logtostderr = true;
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
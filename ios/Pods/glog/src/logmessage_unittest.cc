@@ -0,0 +1,243 @@
+// Copyright (c) 2009, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Tests of the LogMessageData that each thread reuses for its messages.
+// With --run_benchmark, also times LOG(INFO), counting the calls to
+// operator new it makes, and LOG_FAST.
+
+#include "config_for_unittests.h"
+#include "utilities.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <locale>
+#include <string>
+#include <vector>
+
+#include "glog/logging.h"
+#include "googletest.h"
+
+using namespace std;
+using namespace GOOGLE_NAMESPACE;
+
+// Calls to operator new, from any thread, counted by googletest.h's
+// g_new_hook.
+static std::atomic<long> allocations(0);
+
+static void CountAllocation() {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Prints how many calls to operator new each of "iters" messages made.
+static void PrintAllocations(const char* name, long before, int iters) {
+  printf("%s: %.2f calls to operator new per message\n", name,
+         double(allocations.load() - before) / iters);
+}
+
+TEST(LogMessage, ReusedDataAllocatesNothing) {
+  LOG(INFO) << "first message of the thread";
+  const long before = allocations.load();
+  for (int i = 0; i < 100; ++i) {
+    LOG(INFO) << "message " << i;
+  }
+  EXPECT_EQ(0, allocations.load() - before);
+}
+
+// Keeps the text of the messages that reach it.
+class CapturingSink : public LogSink {
+ public:
+  CapturingSink() { AddLogSink(this); }
+  ~CapturingSink() { RemoveLogSink(this); }
+
+  virtual void send(LogSeverity, const char*, const char*, int,
+                    const struct ::tm*, const char* message,
+                    size_t message_len) {
+    messages_.push_back(string(message, message_len));
+  }
+
+  const vector<string>& messages() const { return messages_; }
+
+ private:
+  vector<string> messages_;
+};
+
+TEST(LogMessage, FormattingDoesNotLeakIntoTheNextMessage) {
+  CapturingSink sink;
+  LOG(INFO) << hex << showbase << uppercase << boolalpha << fixed
+            << setprecision(2) << setfill('*') << setw(6) << 255 << ' '
+            << true << ' ' << 3.14159 << setw(10);
+  LOG(INFO) << 255 << ' ' << true << ' ' << 3.14159;
+  EXPECT_EQ(2, sink.messages().size());
+  EXPECT_EQ("**0XFF true 3.14", sink.messages()[0]);
+  EXPECT_EQ("255 1 3.14159", sink.messages()[1]);
+}
+
+// Groups the digits of numbers by three.
+class ThousandsGrouping : public numpunct<char> {
+ protected:
+  virtual char do_thousands_sep() const { return ','; }
+  virtual string do_grouping() const { return "\3"; }
+};
+
+static ostream& GroupThousands(ostream& stream) {
+  stream.imbue(locale(stream.getloc(), new ThousandsGrouping));
+  return stream;
+}
+
+static ostream& ThrowWhenBad(ostream& stream) {
+  stream.exceptions(ios_base::badbit);
+  return stream;
+}
+
+static ostream& SetBad(ostream& stream) {
+  stream.setstate(ios_base::badbit);
+  return stream;
+}
+
+TEST(LogMessage, LocaleAndExceptionMaskDoNotLeakIntoTheNextMessage) {
+  CapturingSink sink;
+  LOG(INFO) << GroupThousands << ThrowWhenBad << 1234567;
+  LOG(INFO) << 1234567;
+  bool threw = false;
+  try {
+    LOG(INFO) << SetBad;
+  } catch (const ios_base::failure&) {
+    threw = true;
+  }
+  EXPECT_FALSE(threw);
+  EXPECT_EQ(3, sink.messages().size());
+  EXPECT_EQ("1,234,567", sink.messages()[0]);
+  EXPECT_EQ("1234567", sink.messages()[1]);
+}
+
+// Logs a message of its own when written to a stream.
+struct LogsWhenWritten {
+  int value;
+};
+
+static ostream& operator<<(ostream& stream, const LogsWhenWritten& v) {
+  LOG(INFO) << "inner " << v.value;
+  return stream << "outer " << v.value;
+}
+
+TEST(LogMessage, MessagesLoggedWhileBuildingOneGetTheirOwnData) {
+  const LogsWhenWritten logs = { 255 };
+  {
+    CapturingSink sink;
+    LOG(INFO) << hex << logs << " done";
+    LOG(INFO) << 255;
+    EXPECT_EQ(3, sink.messages().size());
+    EXPECT_EQ("inner 255", sink.messages()[0]);
+    EXPECT_EQ("outer ff done", sink.messages()[1]);
+    EXPECT_EQ("255", sink.messages()[2]);
+  }
+  // The cached data is free again once the outer message is sent.
+  LOG(INFO) << hex << logs << " done";
+  const long before = allocations.load();
+  LOG(INFO) << 255;
+  EXPECT_EQ(0, allocations.load() - before);
+}
+
+static void BM_LogInfo(int iters) {
+  LOG(INFO) << "first message of the thread";
+  const long before = allocations.load();
+  for (int i = 0; i < iters; ++i) {
+    LOG(INFO) << "request " << i << " served";
+  }
+  PrintAllocations("BM_LogInfo", before, iters);
+}
+BENCHMARK(BM_LogInfo)
+
+// Below --minloglevel, a message is still built, then dropped.
+static void BM_LogInfoSuppressed(int iters) {
+  FLAGS_minloglevel = GLOG_WARNING;
+  const long before = allocations.load();
+  for (int i = 0; i < iters; ++i) {
+    LOG(INFO) << "request " << i << " served";
+  }
+  PrintAllocations("BM_LogInfoSuppressed", before, iters);
+  FLAGS_minloglevel = GLOG_INFO;
+}
+BENCHMARK(BM_LogInfoSuppressed)
+
+// Times each of "iters" LOG_FAST calls on the calling thread and prints
+// the median and the 99th percentile.  The time per iteration that
+// RunSpecifiedBenchmarks prints includes the formatting thread's.
+static void TimeLogFast(const char* name, int iters) {
+  typedef std::chrono::steady_clock Clock;
+  LOG_FAST(INFO, "first message of the thread");
+  vector<double> ns(iters);
+  for (int i = 0; i < iters; ++i) {
+    const Clock::time_point start = Clock::now();
+    LOG_FAST(INFO, "request {} served in {} ms", i, 3.5);
+    ns[i] = std::chrono::duration<double, std::nano>(Clock::now() - start)
+                .count();
+  }
+  FlushLogFiles(GLOG_INFO);
+  const vector<double>::iterator median = ns.begin() + iters / 2;
+  const vector<double>::iterator p99 = ns.end() - 1 - iters / 100;
+  nth_element(ns.begin(), median, ns.end());
+  nth_element(median, p99, ns.end());
+  printf("%s: %.0f ns per call at the median, %.0f ns at p99\n", name,
+         *median, *p99);
+}
+
+static void BM_LogFast(int iters) {
+  FLAGS_logfast = true;
+  TimeLogFast("BM_LogFast", iters);
+  FLAGS_logfast = false;
+}
+BENCHMARK(BM_LogFast)
+
+// Without --logfast, LOG_FAST formats on the calling thread.
+static void BM_LogFastFormattedInline(int iters) {
+  TimeLogFast("BM_LogFastFormattedInline", iters);
+}
+BENCHMARK(BM_LogFastFormattedInline)
+
+int main(int argc, char** argv) {
+  FLAGS_logtostderr = false;
+  FLAGS_alsologtostderr = false;
+  FLAGS_stderrthreshold = GLOG_FATAL;
+  FLAGS_log_dir = FLAGS_test_tmpdir;
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  g_new_hook = &CountAllocation;
+#ifdef HAVE_LIB_GFLAGS
+  ParseCommandLineFlags(&argc, &argv, true);
+#endif
+  const int result = RUN_ALL_TESTS();
+  RunSpecifiedBenchmarks();
+  return result;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Builds and runs the *_unittest.cc files in this directory.  They are not
+# part of the glog pod: each is compiled, with googletest.h, together with
+# the library sources here.
+#
+# usage: ./run_unittests.sh [name_unittest ...]
+#
+# With no names, runs them all.  CXX and CXXFLAGS are used if set.  Set
+# GLOG_run_benchmark=1 to also run the benchmarks that some tests have,
+# for GLOG_benchmark_iters iterations each (100000 by default).
+
+set -e
+
+cd "$(dirname "$0")"
+CXX=${CXX:-c++}
+CXXFLAGS=${CXXFLAGS:--std=c++14 -O2 -g}
+out=${TMPDIR:-/tmp}/glog_unittests
+mkdir -p "$out"
+
+sources="logging.cc raw_logging.cc utilities.cc vlog_is_on.cc symbolize.cc
+         demangle.cc signalhandler.cc"
+tests=${*:-$(ls *_unittest.cc | sed 's/\.cc$//')}
+
+status=0
+for test in $tests; do
+  echo "== $test"
+  $CXX $CXXFLAGS -I. -o "$out/$test" "$test.cc" $sources -lpthread
+  "$out/$test" || status=1
+done
+exit $status
@@ -45,6 +45,11 @@
 // some functions which are not guaranteed to be so, such as memchr()
 // and memmove().  We assume they are async-signal-safe.
 //
+// On ELF systems the symbols of each object file are indexed the first
+// time a pc in it is symbolized (see ElfSymbolIndex).  The index lives in
+// memory from mmap(), which is a plain system call, so the no-heap rule
+// above still holds.
+//
 // Additional header can be specified by the GLOG_BUILD_CONFIG_INCLUDE
 // macro to add platform specific defines (e.g. OS_OPENBSD).
 
@@ -121,10 +126,14 @@ _END_GOOGLE_NAMESPACE_
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+
 #include "symbolize.h"
 #include "config.h"
 #include "glog/raw_logging.h"
@@ -321,6 +330,303 @@ FindSymbol(uint64_t pc, const int fd, char *out, int out_size,
   return false;
 }
 
+// An index of the symbols of an object file.  The file is mapped into
+// memory and the symbols that can contain a pc, from the regular and the
+// dynamic symbol table, are sorted by address, so that a lookup is a
+// binary search rather than read()s of every symbol.  Indexes are built
+// by the first thread to symbolize a pc in the file, live in a fixed
+// table and are never freed.  A file whose index another thread is still
+// building, or which could not be indexed, is searched with FindSymbol().
+namespace {
+
+struct ElfSymbolIndexEntry {
+  uint64_t start;    // st_value
+  uint64_t end;      // st_value + st_size
+  uint64_t max_end;  // the largest "end" of this and all earlier entries
+  uint64_t name;     // file offset of the symbol name
+  uint32_t order;    // position in .symtab, then in .dynsym
+};
+
+inline bool operator<(const ElfSymbolIndexEntry& a,
+                      const ElfSymbolIndexEntry& b) {
+  return a.start != b.start ? a.start < b.start : a.order < b.order;
+}
+
+enum {
+  kIndexEmpty,      // unused slot
+  kIndexClaimed,    // a thread is filling in the file's identity
+  kIndexBuilding,   // the identity is set; the index is being built
+  kIndexReady,
+  kIndexFailed      // the file could not be indexed
+};
+
+struct ElfSymbolIndex {
+  std::atomic<int> state;
+
+  // The identity of the file, set before state becomes kIndexBuilding.
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+
+  // Set before state becomes kIndexReady.
+  const char *image;         // the whole file
+  ElfW(Half) elf_type;
+  bool has_exec_segment;     // of a DSO: the read-execute PT_LOAD segment
+  uint64_t exec_segment_bias;  // and its p_offset - p_vaddr
+  const ElfSymbolIndexEntry *entries;
+  size_t num_entries;
+};
+
+const int kMaxElfSymbolIndexes = 64;
+ElfSymbolIndex g_elf_symbol_indexes[kMaxElfSymbolIndexes];
+std::atomic<bool> g_elf_symbol_index_enabled(true);
+
+// Returns anonymous memory from mmap(), or NULL.
+void *AllocateIndexMemory(size_t size) {
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+// Returns the section header "i" of the ELF image, or NULL.
+const ElfW(Shdr) *SectionHeader(const char *image, size_t size,
+                                const ElfW(Ehdr) *elf_header, size_t i) {
+  if (i >= elf_header->e_shnum) {
+    return NULL;
+  }
+  const uint64_t offset = elf_header->e_shoff + i * sizeof(ElfW(Shdr));
+  if (offset + sizeof(ElfW(Shdr)) > size) {
+    return NULL;
+  }
+  return reinterpret_cast<const ElfW(Shdr) *>(image + offset);
+}
+
+// Returns the first section header of "type", as GetSectionHeaderByType()
+// would find it, or NULL.
+const ElfW(Shdr) *SectionHeaderByType(const char *image, size_t size,
+                                      const ElfW(Ehdr) *elf_header,
+                                      ElfW(Word) type) {
+  for (size_t i = 0; i < elf_header->e_shnum; ++i) {
+    const ElfW(Shdr) *section = SectionHeader(image, size, elf_header, i);
+    if (section == NULL) {
+      return NULL;
+    }
+    if (section->sh_type == type) {
+      return section;
+    }
+  }
+  return NULL;
+}
+
+// Calls "fn" on each symbol of the symbol table "type" that can contain
+// a pc, with its position and the file offset of its name.  Returns
+// false if the table is malformed.
+template <typename Fn>
+bool ForEachIndexableSymbol(const char *image, size_t size,
+                            const ElfW(Ehdr) *elf_header, ElfW(Word) type,
+                            Fn fn) {
+  const ElfW(Shdr) *symtab =
+      SectionHeaderByType(image, size, elf_header, type);
+  if (symtab == NULL) {
+    return true;  // no such table
+  }
+  const ElfW(Shdr) *strtab =
+      SectionHeader(image, size, elf_header, symtab->sh_link);
+  if (strtab == NULL || symtab->sh_entsize != sizeof(ElfW(Sym)) ||
+      symtab->sh_offset > size ||
+      symtab->sh_size > size - symtab->sh_offset) {
+    return false;
+  }
+  const ElfW(Sym) *symbols =
+      reinterpret_cast<const ElfW(Sym) *>(image + symtab->sh_offset);
+  const size_t num_symbols = symtab->sh_size / sizeof(ElfW(Sym));
+  for (size_t i = 0; i < num_symbols; ++i) {
+    const ElfW(Sym) &symbol = symbols[i];
+    // FindSymbol() skips null value and undefined symbols; empty ones
+    // contain no pc.
+    if (symbol.st_value != 0 && symbol.st_shndx != 0 &&
+        symbol.st_size != 0) {
+      fn(symbol, i, strtab->sh_offset + symbol.st_name);
+    }
+  }
+  return true;
+}
+
+// Builds the index of the file "fd", whose identity is already in
+// "index", and returns whether it succeeded.
+bool BuildElfSymbolIndex(const int fd, ElfSymbolIndex *index) {
+  const size_t size = index->size;
+  if (size < sizeof(ElfW(Ehdr))) {
+    return false;
+  }
+  void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  const char *image = static_cast<const char *>(mapping);
+  const ElfW(Ehdr) *elf_header = reinterpret_cast<const ElfW(Ehdr) *>(image);
+  if (memcmp(elf_header->e_ident, ELFMAG, SELFMAG) != 0 ||
+      elf_header->e_shentsize != sizeof(ElfW(Shdr))) {
+    munmap(mapping, size);
+    return false;
+  }
+
+  index->has_exec_segment = false;
+  index->exec_segment_bias = 0;
+  if (elf_header->e_type == ET_DYN) {
+    for (unsigned i = 0; i != elf_header->e_phnum; ++i) {
+      const uint64_t offset = elf_header->e_phoff + i * sizeof(ElfW(Phdr));
+      if (offset + sizeof(ElfW(Phdr)) > size) {
+        break;
+      }
+      const ElfW(Phdr) *phdr =
+          reinterpret_cast<const ElfW(Phdr) *>(image + offset);
+      if (phdr->p_type == PT_LOAD &&
+          (phdr->p_flags & (PF_R | PF_X)) == (PF_R | PF_X)) {
+        index->has_exec_segment = true;
+        index->exec_segment_bias = phdr->p_offset - phdr->p_vaddr;
+        break;
+      }
+    }
+  }
+
+  // Count the symbols, then fill in and sort the entries.
+  size_t num_entries = 0;
+  size_t num_symtab = 0;
+  const ElfW(Shdr) *symtab =
+      SectionHeaderByType(image, size, elf_header, SHT_SYMTAB);
+  if (symtab != NULL && symtab->sh_entsize != 0) {
+    num_symtab = symtab->sh_size / symtab->sh_entsize;
+  }
+  bool ok = true;
+  for (int pass = 0; ok && pass < 2; ++pass) {
+    ok = ForEachIndexableSymbol(
+        image, size, elf_header, pass == 0 ? SHT_SYMTAB : SHT_DYNSYM,
+        [&num_entries](const ElfW(Sym) &, size_t, uint64_t) {
+          ++num_entries;
+        });
+  }
+  ElfSymbolIndexEntry *entries = NULL;
+  if (ok && num_entries > 0) {
+    entries = static_cast<ElfSymbolIndexEntry *>(
+        AllocateIndexMemory(num_entries * sizeof(ElfSymbolIndexEntry)));
+    ok = entries != NULL;
+  }
+  if (!ok) {
+    munmap(mapping, size);
+    return false;
+  }
+  size_t n = 0;
+  for (int pass = 0; pass < 2; ++pass) {
+    const size_t first_order = pass == 0 ? 0 : num_symtab;
+    ForEachIndexableSymbol(
+        image, size, elf_header, pass == 0 ? SHT_SYMTAB : SHT_DYNSYM,
+        [entries, first_order, &n](const ElfW(Sym) &symbol, size_t i,
+                                   uint64_t name) {
+          ElfSymbolIndexEntry &entry = entries[n++];
+          entry.start = symbol.st_value;
+          entry.end = symbol.st_value + symbol.st_size;
+          entry.name = name;
+          entry.order = static_cast<uint32_t>(first_order + i);
+        });
+  }
+  std::sort(entries, entries + num_entries);
+  uint64_t max_end = 0;
+  for (size_t i = 0; i < num_entries; ++i) {
+    max_end = std::max(max_end, entries[i].end);
+    entries[i].max_end = max_end;
+  }
+
+  index->image = image;
+  index->elf_type = elf_header->e_type;
+  index->entries = entries;
+  index->num_entries = num_entries;
+  return true;
+}
+
+// Returns the index of the file "fd", building it if need be, or NULL if
+// there is none to use.
+const ElfSymbolIndex *GetElfSymbolIndex(const int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return NULL;
+  }
+  for (int i = 0; i < kMaxElfSymbolIndexes; ++i) {
+    ElfSymbolIndex *index = &g_elf_symbol_indexes[i];
+    int state = index->state.load(std::memory_order_acquire);
+    if (state == kIndexEmpty &&
+        index->state.compare_exchange_strong(state, kIndexClaimed,
+                                             std::memory_order_acquire)) {
+      index->dev = st.st_dev;
+      index->ino = st.st_ino;
+      index->size = st.st_size;
+      index->mtime = st.st_mtime;
+      index->state.store(kIndexBuilding, std::memory_order_release);
+      const bool built = BuildElfSymbolIndex(fd, index);
+      index->state.store(built ? kIndexReady : kIndexFailed,
+                         std::memory_order_release);
+      return built ? index : NULL;
+    }
+    if (state == kIndexEmpty || state == kIndexClaimed) {
+      continue;  // not this file, as far as we can tell
+    }
+    if (index->dev == st.st_dev && index->ino == st.st_ino &&
+        index->size == st.st_size && index->mtime == st.st_mtime) {
+      return state == kIndexReady ? index : NULL;
+    }
+  }
+  return NULL;  // the table is full
+}
+
+// Looks "pc" up in "index" as FindSymbol() would in the regular and then
+// the dynamic symbol table: among the symbols containing the pc, the
+// first one in table order wins.
+bool FindSymbolInIndex(uint64_t pc, const ElfSymbolIndex *index,
+                       char *out, int out_size, uint64_t symbol_offset) {
+  const uint64_t address = pc - symbol_offset;
+  const ElfSymbolIndexEntry *entries = index->entries;
+
+  // Find the first entry starting past "address"; the entries containing
+  // it come before, no earlier than the last one whose max_end is past it.
+  size_t lo = 0;
+  size_t hi = index->num_entries;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (entries[mid].start <= address) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  const ElfSymbolIndexEntry *found = NULL;
+  for (size_t i = lo; i > 0 && entries[i - 1].max_end > address; --i) {
+    const ElfSymbolIndexEntry &entry = entries[i - 1];
+    if (address < entry.end && (found == NULL || entry.order < found->order)) {
+      found = &entry;
+    }
+  }
+  if (found == NULL || out_size <= 0 ||
+      found->name >= static_cast<uint64_t>(index->size)) {
+    return false;
+  }
+  const char *name = index->image + found->name;
+  const size_t available = std::min<uint64_t>(out_size,
+                                              index->size - found->name);
+  const char *end = static_cast<const char *>(memchr(name, '\0', available));
+  if (end == NULL) {
+    return false;
+  }
+  memcpy(out, name, end - name + 1);
+  return true;
+}
+
+}  // namespace
+
+void SetElfSymbolIndexEnabled(bool enabled) {
+  g_elf_symbol_index_enabled.store(enabled, std::memory_order_relaxed);
+}
+
 // Get the symbol name of "pc" from the file pointed by "fd".  Process
 // both regular and dynamic symbol tables if necessary.  On success,
 // write the symbol name to "out" and return true.  Otherwise, return
@@ -328,6 +634,23 @@ FindSymbol(uint64_t pc, const int fd, char *out, int out_size,
 static bool GetSymbolFromObjectFile(const int fd, uint64_t pc,
                                     char *out, int out_size,
                                     uint64_t map_base_address) {
+  const ElfSymbolIndex *index = NULL;
+  if (g_elf_symbol_index_enabled.load(std::memory_order_relaxed)) {
+    index = GetElfSymbolIndex(fd);
+  }
+  if (index != NULL) {
+    uint64_t symbol_offset = 0;
+    if (index->elf_type == ET_DYN) {  // DSO needs offset adjustment.
+      if (!index->has_exec_segment) {
+        return false;
+      }
+      symbol_offset = map_base_address + index->exec_segment_bias;
+      if (symbol_offset == 0)
+        return false;
+    }
+    return FindSymbolInIndex(pc, index, out, out_size, symbol_offset);
+  }
+
   // Read the ELF header.
   ElfW(Ehdr) elf_header;
   if (!ReadFromOffsetExact(fd, &elf_header, sizeof(elf_header), 0)) {
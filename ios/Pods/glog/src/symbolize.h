@@ -99,6 +99,11 @@ _START_GOOGLE_NAMESPACE_
 bool GetSectionHeaderByName(int fd, const char *name, size_t name_len,
                             ElfW(Shdr) *out);
 
+// Sets whether symbolizing uses the index built for each object file (the
+// default) or reads the symbol tables for every pc, as it used to.  For
+// tests and benchmarks that compare the two.
+void SetElfSymbolIndexEnabled(bool enabled);
+
 _END_GOOGLE_NAMESPACE_
 
 #endif  /* __ELF__ */
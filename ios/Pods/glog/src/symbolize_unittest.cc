@@ -0,0 +1,172 @@
+// Copyright (c) 2009, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Tests of the symbol index that Symbolize() builds for each object file:
+// it must find what the symbol table walk of FindSymbol() finds.  With
+// --run_benchmark, also times symbolizing 10k pcs with and without it.
+
+#include "config_for_unittests.h"
+#include "utilities.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "glog/logging.h"
+#include "googletest.h"
+#include "symbolize.h"
+
+using namespace std;
+using namespace GOOGLE_NAMESPACE;
+
+#if defined(HAVE_SYMBOLIZE) && defined(__ELF__)
+
+extern "C" ATTRIBUTE_NOINLINE void nonstatic_func() {
+  volatile int a = 0;
+  ++a;
+}
+
+static const size_t kNumPcs = 10000;
+
+// "kNumPcs" pcs spread evenly over the executable mappings of object
+// files: the test itself, libc, libstdc++ and the rest.
+static const vector<void*>& Pcs() {
+  static vector<void*>* pcs = NULL;
+  if (pcs != NULL) {
+    return *pcs;
+  }
+  vector<pair<uintptr_t, uintptr_t> > ranges;
+  uintptr_t total = 0;
+  FILE* maps = fopen("/proc/self/maps", "r");
+  CHECK(maps != NULL);
+  char line[1024];
+  while (fgets(line, sizeof(line), maps) != NULL) {
+    unsigned long start, end;
+    char perms[5];
+    int path = 0;
+    if (sscanf(line, "%lx-%lx %4s %*s %*s %*s %n",
+               &start, &end, perms, &path) == 3 &&
+        strcmp(perms, "r-xp") == 0 && line[path] == '/') {
+      ranges.push_back(make_pair(start, end));
+      total += end - start;
+    }
+  }
+  fclose(maps);
+  CHECK(!ranges.empty());
+  pcs = new vector<void*>;
+  const uintptr_t stride = total / kNumPcs;
+  uintptr_t skip = 0;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    uintptr_t pc = ranges[i].first + skip;
+    for (; pc < ranges[i].second && pcs->size() < kNumPcs; pc += stride) {
+      pcs->push_back(reinterpret_cast<void*>(pc));
+    }
+    skip = pc - ranges[i].second;
+  }
+  return *pcs;
+}
+
+// What Symbolize() makes of "pc", or "" if it fails.
+static string SymbolizeToString(void* pc) {
+  char symbol[1024];
+  return Symbolize(pc, symbol, sizeof(symbol)) ? string(symbol) : string();
+}
+
+TEST(Symbolize, IndexFindsNonstaticFunc) {
+  void* pc = reinterpret_cast<char*>(&nonstatic_func) + 1;
+  SetElfSymbolIndexEnabled(false);
+  EXPECT_EQ(string("nonstatic_func"), SymbolizeToString(pc));
+  SetElfSymbolIndexEnabled(true);
+  EXPECT_EQ(string("nonstatic_func"), SymbolizeToString(pc));
+}
+
+TEST(Symbolize, IndexMatchesFindSymbol) {
+  const vector<void*>& pcs = Pcs();
+  vector<string> expected(pcs.size());
+  SetElfSymbolIndexEnabled(false);
+  for (size_t i = 0; i < pcs.size(); ++i) {
+    expected[i] = SymbolizeToString(pcs[i]);
+  }
+  SetElfSymbolIndexEnabled(true);
+  size_t found = 0;
+  for (size_t i = 0; i < pcs.size(); ++i) {
+    EXPECT_EQ(expected[i], SymbolizeToString(pcs[i]));
+    found += !expected[i].empty();
+  }
+  // Stripped libraries only have .dynsym, but many pcs are in a symbol.
+  EXPECT_GT(found, pcs.size() / 10);
+}
+
+// Each iteration symbolizes the next of the 10k pcs; run with
+// --benchmark_iters=10000 to symbolize each once.
+static void SymbolizePcs(int iters) {
+  const vector<void*>& pcs = Pcs();
+  char symbol[1024];
+  for (int i = 0; i < iters; ++i) {
+    Symbolize(pcs[i % pcs.size()], symbol, sizeof(symbol));
+  }
+}
+
+static void BM_Symbolize(int iters) {
+  SetElfSymbolIndexEnabled(true);
+  SymbolizePcs(iters);
+}
+BENCHMARK(BM_Symbolize)
+
+static void BM_SymbolizeWithoutIndex(int iters) {
+  SetElfSymbolIndexEnabled(false);
+  SymbolizePcs(iters);
+  SetElfSymbolIndexEnabled(true);
+}
+BENCHMARK(BM_SymbolizeWithoutIndex)
+
+int main(int argc, char** argv) {
+  FLAGS_logtostderr = true;
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+#ifdef HAVE_LIB_GFLAGS
+  ParseCommandLineFlags(&argc, &argv, true);
+#endif
+  const int result = RUN_ALL_TESTS();
+  RunSpecifiedBenchmarks();
+  return result;
+}
+
+#else
+
+int main() {
+  printf("PASS (no symbolize_unittest support)\n");
+  return 0;
+}
+
+#endif  // HAVE_SYMBOLIZE && __ELF__
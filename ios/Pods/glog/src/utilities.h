@@ -70,6 +70,10 @@
 #define PRIXS __PRIS_PREFIX "X"
 #define PRIoS __PRIS_PREFIX "o"
 
+// For Mutex::TryLock(), which the failure signal handler uses on the log
+// files' locks.  Defined before any other include of base/mutex.h, so that
+// every file sees the same Mutex.
+#define GMUTEX_TRYLOCK
 #include "base/mutex.h"  // This must go first so we get _XOPEN_SOURCE
 
 #include <string>
@@ -37,16 +37,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <atomic>
 #include <cstdio>
+#include <map>
 #include <string>
+#include <thread>
+#include <vector>
 #include "base/commandlineflags.h"
 #include "glog/logging.h"
 #include "glog/raw_logging.h"
 #include "base/googleinit.h"
 
-// glog doesn't have annotation
-#define ANNOTATE_BENIGN_RACE(address, description)
-
 using std::string;
 
 GLOG_DEFINE_int32(v, 0, "Show all VLOG(m) messages for m <= this."
@@ -99,15 +100,12 @@ GOOGLE_GLOG_DLL_DECL bool SafeFNMatch_(const char* pattern,
 
 using glog_internal_namespace_::SafeFNMatch_;
 
-int32 kLogSiteUninitialized = 1000;
-
-// List of per-module log levels from FLAGS_vmodule.
+// List of per-module log levels from FLAGS_vmodule, newest first, with
+// one element per distinct pattern.
 // Once created each element is never deleted/modified
-// except for the vlog_level: other threads will read VModuleInfo blobs
-// w/o locks and we'll store pointers to vlog_level at VLOG locations
+// except for the vlog_level: VModuleMatcher snapshots point to them
+// and we'll store pointers to vlog_level at VLOG locations
 // that will never go away.
-// We can't use an STL struct here as we wouldn't know
-// when it's safe to delete/update it: other threads need to use it w/o locks.
 struct VModuleInfo {
   string module_pattern;
   mutable int32 vlog_level;  // Conceptually this is an AtomicWord, but it's
@@ -116,20 +114,238 @@ struct VModuleInfo {
   const VModuleInfo* next;
 };
 
-// This protects the following global variables.
+// The patterns of the vmodule_list compiled for matching a module name.
+// The first pattern in the list that matches wins.  The literal prefix of
+// each pattern, up to its first wildcard, is a path in a trie of
+// characters: a pattern without wildcards matches a name that ends at the
+// node its path leads to, and the others are tried with SafeFNMatch_ on
+// the rest of a name that gets to their node.
+// A matcher is immutable once built, so threads use it w/o locks.
+class VModuleMatcher {
+ public:
+  explicit VModuleMatcher(const VModuleInfo* list);
+
+  // Returns the first pattern matching name, or NULL.
+  // Does not allocate memory or require any locks.
+  const VModuleInfo* Match(const char* name, size_t name_length) const;
+
+ private:
+  struct Glob {
+    const VModuleInfo* info;
+    uint32 rank;           // position in the vmodule_list
+  };
+  struct Node {
+    char c;                // the last character of the path to this node
+    uint32 first_child;    // children are contiguous and sorted by c
+    uint32 num_children;
+    const VModuleInfo* exact;  // the pattern that is this path, if any
+    uint32 exact_rank;
+    uint32 first_glob;     // globs_ with this path as literal prefix
+    uint32 num_globs;
+  };
+
+  // Returns the child of node with character c, or NULL.
+  const Node* Child(const Node& node, char c) const;
+
+  std::vector<Node> nodes_;  // nodes_[0] is the root
+  std::vector<Glob> globs_;
+};
+
+VModuleMatcher::VModuleMatcher(const VModuleInfo* list) {
+  // Build a trie with std::map children first, then lay it out breadth
+  // first so that the children of each node are contiguous.
+  struct Builder {
+    std::map<char, size_t> children;
+    const VModuleInfo* exact;
+    uint32 exact_rank;
+    std::vector<Glob> globs;
+  };
+  std::vector<Builder> builders(1);
+  builders[0].exact = NULL;
+  uint32 rank = 0;
+  for (const VModuleInfo* info = list; info != NULL; info = info->next) {
+    const string& pattern = info->module_pattern;
+    const size_t prefix_length = pattern.find_first_of("*?");
+    size_t b = 0;
+    for (size_t i = 0; i < pattern.size() && i < prefix_length; ++i) {
+      std::map<char, size_t>::iterator it = builders[b].children.find(
+          pattern[i]);
+      if (it == builders[b].children.end()) {
+        builders.push_back(Builder());
+        builders.back().exact = NULL;
+        it = builders[b].children.insert(
+            std::make_pair(pattern[i], builders.size() - 1)).first;
+      }
+      b = it->second;
+    }
+    if (prefix_length == string::npos) {
+      if (builders[b].exact == NULL) {
+        builders[b].exact = info;
+        builders[b].exact_rank = rank;
+      }
+    } else {
+      Glob glob = { info, rank };
+      builders[b].globs.push_back(glob);
+    }
+    ++rank;
+  }
+
+  std::vector<size_t> order(1, 0);  // builder index of each node
+  std::vector<char> chars(1, '\0');
+  nodes_.resize(builders.size());
+  for (size_t n = 0; n < order.size(); ++n) {
+    const Builder& builder = builders[order[n]];
+    Node& node = nodes_[n];
+    node.c = chars[n];
+    node.first_child = static_cast<uint32>(order.size());
+    node.num_children = static_cast<uint32>(builder.children.size());
+    for (std::map<char, size_t>::const_iterator it = builder.children.begin();
+         it != builder.children.end(); ++it) {
+      order.push_back(it->second);
+      chars.push_back(it->first);
+    }
+    node.exact = builder.exact;
+    node.exact_rank = builder.exact_rank;
+    node.first_glob = static_cast<uint32>(globs_.size());
+    node.num_globs = static_cast<uint32>(builder.globs.size());
+    globs_.insert(globs_.end(), builder.globs.begin(), builder.globs.end());
+  }
+}
+
+const VModuleMatcher::Node* VModuleMatcher::Child(const Node& node,
+                                                  char c) const {
+  const Node* first = &nodes_[node.first_child];
+  const Node* last = first + node.num_children;
+  while (first != last) {
+    const Node* mid = first + (last - first) / 2;
+    if (mid->c < c) {
+      first = mid + 1;
+    } else {
+      last = mid;
+    }
+  }
+  return first != &nodes_[node.first_child] + node.num_children &&
+      first->c == c ? first : NULL;
+}
+
+const VModuleInfo* VModuleMatcher::Match(const char* name,
+                                         size_t name_length) const {
+  const VModuleInfo* found = NULL;
+  uint32 found_rank = 0;
+  const Node* node = &nodes_[0];
+  size_t i = 0;
+  while (true) {
+    for (uint32 g = node->first_glob; g != node->first_glob + node->num_globs;
+         ++g) {
+      const Glob& glob = globs_[g];
+      if (found != NULL && glob.rank >= found_rank) {
+        continue;
+      }
+      // The literal prefix of the pattern has matched the name so far.
+      const string& pattern = glob.info->module_pattern;
+      if (SafeFNMatch_(pattern.data() + i, pattern.size() - i,
+                       name + i, name_length - i)) {
+        found = glob.info;
+        found_rank = glob.rank;
+      }
+    }
+    if (i == name_length) {
+      if (node->exact != NULL &&
+          (found == NULL || node->exact_rank < found_rank)) {
+        found = node->exact;
+      }
+      return found;
+    }
+    node = Child(*node, name[i]);
+    if (node == NULL) {
+      return found;
+    }
+    ++i;
+  }
+}
+
+// This protects the following global variables and the writing of
+// vmodule_matcher.
 static Mutex vmodule_lock;
 // Pointer to head of the VModuleInfo list.
 // It's a map from module pattern to logging level for those module(s).
 static VModuleInfo* vmodule_list = 0;
-// Boolean initialization flag.
-static bool inited_vmodule = false;
+// Boolean initialization flag, also read w/o the lock.
+static std::atomic<bool> inited_vmodule(false);
+
+// The current vmodule_list compiled.  It is replaced, never modified,
+// when the list changes, and readers use it w/o locks.  A replaced
+// matcher is deleted once the readers that may have seen it are done:
+// a reader counts itself in vmodule_readers[epoch % 2] for the current
+// epoch, and the writer waits for the count of the previous epoch to
+// drain after moving to the next one.
+static std::atomic<const VModuleMatcher*> vmodule_matcher(NULL);
+static std::atomic<uint32> vmodule_epoch(0);
+static std::atomic<uint32> vmodule_readers[2];
+
+std::atomic<uint32> vlog_generation(1);
+
+// Generations are odd, so neither the zero of an uninitialized VLogSite
+// nor this marker of one being updated is ever current.
+static const uint32 kVLogSiteBusy = 2;
+
+// Pins the current vmodule_matcher for the lifetime of the object.
+class VModuleReader {
+ public:
+  VModuleReader() {
+    while (true) {
+      epoch_ = vmodule_epoch.load();
+      vmodule_readers[epoch_ % 2].fetch_add(1);
+      if (vmodule_epoch.load() == epoch_) break;
+      vmodule_readers[epoch_ % 2].fetch_sub(1);
+    }
+  }
+  ~VModuleReader() {
+    vmodule_readers[epoch_ % 2].fetch_sub(1, std::memory_order_release);
+  }
+
+  const VModuleMatcher* matcher() const {
+    return vmodule_matcher.load(std::memory_order_acquire);
+  }
+
+ private:
+  uint32 epoch_;
+};
+
+// Compiles the vmodule_list into a new vmodule_matcher, and makes the
+// VLOG sites look their levels up again.
+// L >= vmodule_lock.
+static void PublishVModuleMatcher() {
+  vmodule_lock.AssertHeld();
+  const VModuleMatcher* old = vmodule_matcher.exchange(
+      new VModuleMatcher(vmodule_list));
+  vlog_generation.store(vlog_generation.load(std::memory_order_relaxed) + 2,
+                        std::memory_order_release);
+
+  const uint32 epoch = vmodule_epoch.load(std::memory_order_relaxed);
+  vmodule_epoch.store(epoch + 1);
+  while (vmodule_readers[epoch % 2].load(std::memory_order_acquire) != 0) {
+    std::this_thread::yield();
+  }
+  delete old;
+}
+
+// Returns the element of the vmodule_list with this exact pattern, or NULL.
+// L >= vmodule_lock.
+static VModuleInfo* FindVModuleInfo(const char* module_pattern) {
+  vmodule_lock.AssertHeld();
+  for (VModuleInfo* info = vmodule_list; info != NULL;
+       info = const_cast<VModuleInfo*>(info->next)) {
+    if (info->module_pattern == module_pattern) return info;
+  }
+  return NULL;
+}
 
 // L >= vmodule_lock.
 static void VLOG2Initializer() {
   vmodule_lock.AssertHeld();
   // Can now parse --vmodule flag and initialize mapping of module-specific
   // logging levels.
-  inited_vmodule = false;
   const char* vmodule = FLAGS_vmodule.c_str();
   const char* sep;
   VModuleInfo* head = NULL;
@@ -137,10 +353,23 @@ static void VLOG2Initializer() {
   while ((sep = strchr(vmodule, '=')) != NULL) {
     string pattern(vmodule, sep - vmodule);
     int module_level;
-    if (sscanf(sep, "=%d", &module_level) == 1) {
+    bool seen = false;
+    for (const VModuleInfo* info = head; info != NULL && !seen;
+         info = info->next) {
+      seen = info->module_pattern == pattern;
+    }
+    // The first entry for a pattern wins, as it always did, and the flag
+    // overrides an earlier SetVLOGLevel for it.
+    VModuleInfo* set = seen ? NULL : FindVModuleInfo(pattern.c_str());
+    if (seen || sscanf(sep, "=%d", &module_level) != 1) {
+      // Ignore this entry.
+    } else if (set != NULL) {
+      set->vlog_level = module_level;
+    } else {
       VModuleInfo* info = new VModuleInfo;
       info->module_pattern = pattern;
       info->vlog_level = module_level;
+      info->next = NULL;
       if (head)  tail->next = info;
       else  head = info;
       tail = info;
@@ -154,38 +383,44 @@ static void VLOG2Initializer() {
     tail->next = vmodule_list;
     vmodule_list = head;
   }
-  inited_vmodule = true;
+  PublishVModuleMatcher();
+  inited_vmodule.store(true, std::memory_order_release);
+}
+
+// Parses --vmodule the first time it is called.
+static void InitVModule() {
+  if (!inited_vmodule.load(std::memory_order_acquire)) {
+    MutexLock l(&vmodule_lock);
+    if (!inited_vmodule.load(std::memory_order_relaxed)) {
+      VLOG2Initializer();
+    }
+  }
 }
 
 // This can be called very early, so we use SpinLock and RAW_VLOG here.
 int SetVLOGLevel(const char* module_pattern, int log_level) {
   int result = FLAGS_v;
-  int const pattern_len = strlen(module_pattern);
-  bool found = false;
   {
     MutexLock l(&vmodule_lock);  // protect whole read-modify-write
-    for (const VModuleInfo* info = vmodule_list;
-         info != NULL; info = info->next) {
-      if (info->module_pattern == module_pattern) {
-        if (!found) {
-          result = info->vlog_level;
-          found = true;
-        }
-        info->vlog_level = log_level;
-      } else if (!found  &&
-                 SafeFNMatch_(info->module_pattern.c_str(),
-                              info->module_pattern.size(),
-                              module_pattern, pattern_len)) {
-        result = info->vlog_level;
-        found = true;
-      }
+    // A pattern matches itself, so this finds any exact entry too unless
+    // an earlier pattern matches first.  There is no matcher only while
+    // the list is empty.
+    const VModuleMatcher* matcher = vmodule_matcher.load();
+    const VModuleInfo* first = matcher == NULL ? NULL :
+        matcher->Match(module_pattern, strlen(module_pattern));
+    if (first != NULL) {
+      result = first->vlog_level;
     }
-    if (!found) {
-      VModuleInfo* info = new VModuleInfo;
+    VModuleInfo* info = FindVModuleInfo(module_pattern);
+    if (info != NULL) {
+      info->vlog_level = log_level;
+    } else {
+      info = new VModuleInfo;
       info->module_pattern = module_pattern;
       info->vlog_level = log_level;
       info->next = vmodule_list;
       vmodule_list = info;
+      PublishVModuleMatcher();
     }
   }
   RAW_VLOG(1, "Set VLOG level for \"%s\" to %d", module_pattern, log_level);
@@ -193,19 +428,20 @@ int SetVLOGLevel(const char* module_pattern, int log_level) {
 }
 
 // NOTE: Individual VLOG statements cache the integer log level pointers.
-// NOTE: This function must not allocate memory or require any locks.
-bool InitVLOG3__(int32** site_flag, int32* site_default,
+// NOTE: Apart from parsing --vmodule the first time, this function does
+// not allocate memory or require any locks.
+bool InitVLOG3__(VLogSite* site, int32* site_default,
                  const char* fname, int32 verbose_level) {
-  MutexLock l(&vmodule_lock);
-  bool read_vmodule_flag = inited_vmodule;
-  if (!read_vmodule_flag) {
-    VLOG2Initializer();
-  }
+  InitVModule();
 
   // protect the errno global in case someone writes:
   // VLOG(..) << "The last error was " << strerror(errno)
   int old_errno = errno;
 
+  // Read before the matcher, so that a site is never marked current
+  // with the level of an older matcher.
+  const uint32 generation = vlog_generation.load(std::memory_order_acquire);
+
   // site_default normally points to FLAGS_v
   int32* site_flag_value = site_default;
 
@@ -223,24 +459,29 @@ bool InitVLOG3__(int32** site_flag, int32* site_default,
   // TODO: Trim out _unittest suffix?  Perhaps it is better to have
   // the extra control and just leave it there.
 
-  // find target in vector of modules, replace site_flag_value with
+  // find target in the vmodule patterns, replace site_flag_value with
   // a module-specific verbose level, if any.
-  for (const VModuleInfo* info = vmodule_list;
-       info != NULL; info = info->next) {
-    if (SafeFNMatch_(info->module_pattern.c_str(), info->module_pattern.size(),
-                     base, base_length)) {
+  {
+    VModuleReader reader;
+    const VModuleInfo* info = reader.matcher()->Match(base, base_length);
+    if (info != NULL) {
       site_flag_value = &info->vlog_level;
         // value at info->vlog_level is now what controls
-        // the VLOG at the caller site forever
-      break;
+        // the VLOG at the caller site until the patterns change
     }
   }
 
-  // Cache the vlog value pointer if --vmodule flag has been parsed.
-  ANNOTATE_BENIGN_RACE(site_flag,
-                       "*site_flag may be written by several threads,"
-                       " but the value will be the same");
-  if (read_vmodule_flag) *site_flag = site_flag_value;
+  // Cache the vlog value pointer.  Threads racing to update the same
+  // site take turns through a generation of kVLogSiteBusy, so that the
+  // level and generation a site ends up with come from the same thread;
+  // the losers just don't cache.  Any level a site has is safe to read.
+  uint32 seen = site->generation.load(std::memory_order_relaxed);
+  if (seen != kVLogSiteBusy &&
+      site->generation.compare_exchange_strong(seen, kVLogSiteBusy,
+                                               std::memory_order_acquire)) {
+    site->level.store(site_flag_value, std::memory_order_relaxed);
+    site->generation.store(generation, std::memory_order_release);
+  }
 
   // restore the errno in case something recoverable went wrong during
   // the initialization of the VLOG mechanism (see above note "protect the..")
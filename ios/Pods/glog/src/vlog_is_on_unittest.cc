@@ -0,0 +1,156 @@
+// Copyright (c) 2009, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Tests of how --vmodule and SetVLOGLevel patterns pick the verbosity
+// level of VLOG sites.
+
+#include "config_for_unittests.h"
+#include "utilities.h"
+
+#include <string.h>
+
+#include "glog/logging.h"
+#include "googletest.h"
+
+DECLARE_string(vmodule);
+
+using namespace std;
+using namespace GOOGLE_NAMESPACE;
+
+_START_GOOGLE_NAMESPACE_
+namespace glog_internal_namespace_ {
+bool SafeFNMatch_(const char* pattern, size_t patt_len, const char* str,
+                  size_t str_len);
+}  // namespace glog_internal_namespace_
+_END_GOOGLE_NAMESPACE_
+
+using GOOGLE_NAMESPACE::glog_internal_namespace_::SafeFNMatch_;
+
+// None of these match this file's module, vlog_is_on_unittest.
+static const char kVModule[] =
+    "first=1,fir*=2,*ast=3,first=4,f?rst=5,"
+    "glob_*=6,glob_exact=7,"
+    "ab*=8,abc*=9,"
+    "quirk**=10,"
+    "foo=11";
+
+static bool Matches(const char* pattern, const char* str) {
+  return SafeFNMatch_(pattern, strlen(pattern), str, strlen(str));
+}
+
+static int32 no_pattern = -1;
+
+// The level that the patterns give the VLOG sites of "file", or -1 if none
+// matches it.
+static int ModuleLevel(const char* file) {
+  VLogSite site;
+  site.level.store(NULL);
+  site.generation.store(0);
+  InitVLOG3__(&site, &no_pattern, file, 0);
+  return *site.level.load();
+}
+
+// A VLOG site of this file.
+static bool IsOn(int level) {
+  return VLOG_IS_ON(level);
+}
+
+TEST(VLogIsOn, SafeFNMatch) {
+  EXPECT_TRUE(Matches("", ""));
+  EXPECT_TRUE(Matches("*", ""));
+  EXPECT_TRUE(Matches("a*", "a"));
+  EXPECT_TRUE(Matches("a*", "abc"));
+  EXPECT_TRUE(Matches("*c", "abc"));
+  EXPECT_TRUE(Matches("a?c", "abc"));
+  EXPECT_TRUE(Matches("a**", "ab"));
+  EXPECT_FALSE(Matches("?", ""));
+  EXPECT_FALSE(Matches("a?c", "ac"));
+  EXPECT_FALSE(Matches("a", "ab"));
+  EXPECT_FALSE(Matches("a[b]", "ab"));  // no character classes
+  // Only a single trailing "*" matches nothing at the end of a name.
+  EXPECT_FALSE(Matches("a**", "a"));
+  EXPECT_FALSE(Matches("**", ""));
+}
+
+TEST(VModule, ModulesAreBaseNames) {
+  EXPECT_EQ(11, ModuleLevel("foo.cc"));
+  EXPECT_EQ(11, ModuleLevel("src/dir/foo.cc"));
+  EXPECT_EQ(11, ModuleLevel("foo-inl.h"));
+  EXPECT_EQ(11, ModuleLevel("foo.pb.h"));
+  EXPECT_EQ(11, ModuleLevel("foo"));
+  EXPECT_EQ(-1, ModuleLevel("foo_test.cc"));
+  EXPECT_EQ(-1, ModuleLevel("foo/bar.cc"));
+}
+
+TEST(VModule, FirstMatchWins) {
+  EXPECT_EQ(1, ModuleLevel("first.cc"));  // not the later "first=4"
+  EXPECT_EQ(2, ModuleLevel("firm.cc"));
+  EXPECT_EQ(3, ModuleLevel("last.cc"));
+  EXPECT_EQ(5, ModuleLevel("forst.cc"));
+  EXPECT_EQ(6, ModuleLevel("glob_exact.cc"));
+  EXPECT_EQ(8, ModuleLevel("abcd.cc"));
+  EXPECT_EQ(-1, ModuleLevel("quirk.cc"));
+  EXPECT_EQ(10, ModuleLevel("quirks.cc"));
+  EXPECT_EQ(-1, ModuleLevel("vlog_is_on_unittest.cc"));
+}
+
+TEST(VModule, SetVLOGLevelRetargetsSitesThatRan) {
+  EXPECT_FALSE(IsOn(1));
+  // A new pattern comes first.
+  EXPECT_EQ(0, SetVLOGLevel("vlog_is_on_unittest", 2));
+  EXPECT_TRUE(IsOn(2));
+  EXPECT_FALSE(IsOn(3));
+  // The same pattern keeps its place and changes its level.
+  EXPECT_EQ(2, SetVLOGLevel("vlog_is_on_unittest", 0));
+  EXPECT_FALSE(IsOn(1));
+  EXPECT_EQ(0, SetVLOGLevel("vlog_is_on_*", 3));
+  EXPECT_TRUE(IsOn(3));
+  EXPECT_EQ(3, SetVLOGLevel("vlog_is_on_unittest", 4));
+  EXPECT_FALSE(IsOn(4));
+  FLAGS_v = 4;
+  EXPECT_FALSE(IsOn(4));
+  FLAGS_v = 0;
+  EXPECT_EQ(3, SetVLOGLevel("vlog_is_on_*", 4));
+  EXPECT_TRUE(IsOn(4));
+
+  // Those of --vmodule too, but a pattern that comes earlier still wins.
+  EXPECT_EQ(6, SetVLOGLevel("glob_exact", 12));
+  EXPECT_EQ(6, ModuleLevel("glob_exact.cc"));
+  EXPECT_EQ(1, SetVLOGLevel("first", 13));
+  EXPECT_EQ(13, ModuleLevel("first.cc"));
+}
+
+int main(int argc, char** argv) {
+  FLAGS_vmodule = kVModule;
+  FLAGS_logtostderr = true;
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}